@@ -0,0 +1,303 @@
+/* J. Williams, 2020-2021 */
+
+//This file contains routines for batch fitting: fitting the same fit
+//region and peaks in many spectra and views at once.  A snapshot of the
+//data of each spectrum/view is taken when the batch is started, then each
+//one is fit on its own fit context (see fit_data.c), using the same
+//initial guess routine as single fits, on a pool of worker threads (one
+//fit per thread).  Results are collected on the main thread as each fit
+//finishes, and may be written to a CSV file.
+
+//get the spectra making up a spectrum or view to be batch fit, numbered the
+//same way as in the manage window: entries below rawdata.numSpOpened are
+//spectra, the rest are views
+//spInd and scaleFactor must have space for NSPECT values, sumSp is set if
+//the spectra are summed (see copySpFitData)
+//returns the number of spectra, or 0 if the entry can't be fit (eg. views
+//of overlaid or stacked spectra, or views whose spectra no longer exist)
+int getBatchFitEntrySp(const int entry, int *spInd, double *scaleFactor, int *sumSp){
+  int i,numSp;
+  *sumSp = 0;
+  if((entry >= 0)&&(entry < rawdata.numSpOpened)){
+    spInd[0] = entry;
+    scaleFactor[0] = drawing.scaleFactor[entry];
+    return 1;
+  }
+  int viewNum = entry - rawdata.numSpOpened;
+  if((viewNum < 0)||(viewNum >= rawdata.numViews)){
+    return 0;
+  }
+  switch(rawdata.viewMultiplotMode[viewNum]){
+    case 1:
+      //summed view
+      *sumSp = 1;
+      numSp = 0;
+      for(i=0;i<rawdata.viewNumMultiplotSp[viewNum];i++){
+        spInd[numSp] = getSpIndexFromHandle(rawdata.viewMultiPlots[viewNum][i]);
+        scaleFactor[numSp] = rawdata.viewScaleFactor[viewNum][i];
+        if(spInd[numSp] >= 0){
+          numSp++;
+        }
+      }
+      return numSp;
+    case 0:
+      //single spectrum
+      if(rawdata.viewNumMultiplotSp[viewNum] <= 0){
+        return 0;
+      }
+      spInd[0] = getSpIndexFromHandle(rawdata.viewMultiPlots[viewNum][0]);
+      scaleFactor[0] = rawdata.viewScaleFactor[viewNum][0];
+      return (spInd[0] >= 0) ? 1 : 0;
+    default:
+      //overlaid or stacked spectra
+      return 0;
+  }
+}
+
+//get the area, centroid, and FWHM (vals[0] to vals[2]) of a fitted peak, and
+//their uncertainties (errs[0] to errs[2]), calibrated if a calibration is in
+//use (the same values as shown by print_fit_results)
+void getFitPeakVals(const fit_params *par, const int peakNum, double *vals, double *errs){
+  vals[0] = evalPeakArea(par,peakNum,par->fitType);
+  errs[0] = evalPeakAreaErr(par,peakNum,par->fitType);
+  if(calpar.calMode == 1){
+    vals[1] = getCalVal((double)par->fitParVal[7+(3*peakNum)]);
+    errs[1] = getCalWidth((double)par->fitParErr[7+(3*peakNum)]);
+    vals[2] = 2.35482*getCalWidth((double)par->fitParVal[8+(3*peakNum)]);
+    errs[2] = 2.35482*getCalWidth((double)par->fitParErr[8+(3*peakNum)]);
+  }else{
+    vals[1] = (double)par->fitParVal[7+(3*peakNum)];
+    errs[1] = (double)par->fitParErr[7+(3*peakNum)];
+    vals[2] = 2.35482*(double)par->fitParVal[8+(3*peakNum)];
+    errs[2] = 2.35482*(double)par->fitParErr[8+(3*peakNum)];
+  }
+}
+
+//fit one spectrum/view of a batch fit, on a worker thread
+void batchFitThread(gpointer data, gpointer user_data){
+  batch_fit_job *job = (batch_fit_job*)data;
+  if(g_atomic_int_get(&batchstate.cancel) == 0){
+    setFitInitGuesses(job->ctx);
+    if(performGausFit(job->ctx)){
+      job->result = 1;
+    }else if(g_atomic_int_get(&batchstate.cancel)){
+      job->result = 3;
+    }else{
+      job->result = 2;
+    }
+  }else{
+    job->result = 3;
+  }
+  g_atomic_int_set(&job->done,1);
+  if(batchstate.doneFunc != NULL){
+    g_idle_add(batchstate.doneFunc,NULL); //let the main thread collect the results
+  }
+}
+
+//stop a batch fit, fits which are running stop at their next iteration,
+//and are collected as cancelled along with those which weren't started
+void cancelBatchFit(){
+  g_atomic_int_set(&batchstate.cancel,1);
+}
+
+//stop a batch fit and discard its results, waiting for any fits which are
+//running to stop
+void clearBatchFit(){
+  int i;
+  if(batchstate.job == NULL){
+    return;
+  }
+  cancelBatchFit();
+  if(batchstate.pool != NULL){
+    g_thread_pool_free(batchstate.pool,FALSE,TRUE); //wait for any fits still running
+    batchstate.pool = NULL;
+  }
+  for(i=0;i<batchstate.numJobs;i++){
+    if(batchstate.job[i].ctx != NULL){
+      freeFitContext(batchstate.job[i].ctx);
+    }
+  }
+  free(batchstate.job);
+  batchstate.job = NULL;
+  batchstate.numJobs = 0;
+  batchstate.numCollected = 0;
+}
+
+//check whether a batch fit has fits which haven't been collected yet
+int isBatchFitRunning(){
+  return ((batchstate.job != NULL)&&(batchstate.numCollected < batchstate.numJobs));
+}
+
+//start fitting the region and peaks in par (with data contracted by
+//contractFactor) in each of numEntries spectra/views (numbered as in
+//getBatchFitEntrySp), in parallel on a pool of worker threads
+//doneFunc is called on the main thread (from the GTK main loop) each time
+//a fit has finished, the results should then be collected using
+//collectNextBatchFitJob
+//entries without any spectra to fit aren't run, and are collected with result 4
+//any previous batch fit results are discarded
+//returns 1 on success, 0 on failure (eg. if the region can't be fit)
+int startBatchFit(const fit_params *par, const int contractFactor, const int *entry, const int numEntries, GSourceFunc doneFunc){
+  int i;
+  int numToFit = 0;
+  int spInd[NSPECT];
+  double scaleFactor[NSPECT];
+  if(isBatchFitRunning()||(numEntries <= 0)){
+    return 0;
+  }
+  clearBatchFit();
+  batchstate.job = calloc((size_t)numEntries,sizeof(batch_fit_job));
+  if(batchstate.job == NULL){
+    printf("ERROR: cannot allocate memory to fit %i spectra.\n",numEntries);
+    return 0;
+  }
+  batchstate.numJobs = numEntries;
+  batchstate.numCollected = 0;
+  batchstate.doneFunc = doneFunc;
+  g_atomic_int_set(&batchstate.cancel,0);
+  for(i=0;i<numEntries;i++){
+    batch_fit_job *job = &batchstate.job[i];
+    int sumSp;
+    int numSp = getBatchFitEntrySp(entry[i],spInd,scaleFactor,&sumSp);
+    if(entry[i] < rawdata.numSpOpened){
+      snprintf(job->name,256,"%s",rawdata.histComment[entry[i]]);
+    }else if(entry[i] < rawdata.numSpOpened+rawdata.numViews){
+      snprintf(job->name,256,"%s",rawdata.viewComment[entry[i]-rawdata.numSpOpened]);
+    }
+    if(numSp <= 0){
+      //nothing to fit, collected straight away
+      job->result = 4;
+      g_atomic_int_set(&job->done,1);
+      continue;
+    }
+    job->ctx = allocFitContext(par,contractFactor);
+    if(job->ctx == NULL){
+      clearBatchFit(); //the same region is fit in all spectra, so none can be fit
+      return 0;
+    }
+    job->ctx->cancel = &batchstate.cancel;
+    job->ctx->maxThreads = 1; //fits are run in parallel instead
+    job->ctx->quiet = 1; //results are shown in the batch fit window instead
+    copySpFitData(job->ctx,spInd,scaleFactor,numSp,sumSp);
+    numToFit++;
+  }
+  if((numToFit < numEntries)&&(doneFunc != NULL)){
+    g_idle_add(doneFunc,NULL); //collect the entries which weren't fit
+  }
+  if(numToFit == 0){
+    return 1;
+  }
+  int numThreads = (int)g_get_num_processors();
+  if(numThreads > numToFit){
+    numThreads = numToFit;
+  }
+  batchstate.pool = g_thread_pool_new(batchFitThread,NULL,numThreads,FALSE,NULL);
+  if(batchstate.pool == NULL){
+    //no worker threads, fit the spectra one at a time on this thread instead
+    printf("WARNING: cannot start worker threads, fitting spectra sequentially.\n");
+    for(i=0;i<numEntries;i++){
+      if(batchstate.job[i].ctx != NULL){
+        batchFitThread(&batchstate.job[i],NULL);
+      }
+    }
+    return 1;
+  }
+  for(i=0;i<numEntries;i++){
+    if(batchstate.job[i].ctx != NULL){
+      g_thread_pool_push(batchstate.pool,&batchstate.job[i],NULL);
+    }
+  }
+  return 1;
+}
+
+//collect the results of the next finished fit of a batch fit, on the main
+//thread, once all fits are collected the worker threads are stopped
+//returns the index of the fit, or -1 if no more fits have finished
+int collectNextBatchFitJob(){
+  int i;
+  if(batchstate.job == NULL){
+    return -1;
+  }
+  for(i=0;i<batchstate.numJobs;i++){
+    batch_fit_job *job = &batchstate.job[i];
+    if((job->collected == 0)&&(g_atomic_int_get(&job->done))){
+      if(job->ctx != NULL){
+        memcpy(&job->par,&job->ctx->par,sizeof(fit_params));
+        freeFitContext(job->ctx);
+        job->ctx = NULL;
+      }
+      job->collected = 1;
+      batchstate.numCollected++;
+      if((batchstate.numCollected >= batchstate.numJobs)&&(batchstate.pool != NULL)){
+        g_thread_pool_free(batchstate.pool,FALSE,TRUE); //all fits are done
+        batchstate.pool = NULL;
+      }
+      return i;
+    }
+  }
+  return -1;
+}
+
+//write a CSV field, quoted if needed
+void writeCSVStr(FILE *out, const char *str){
+  if(strpbrk(str,",\"\r\n") == NULL){
+    fprintf(out,"%s",str);
+    return;
+  }
+  fputc('"',out);
+  for(;*str!='\0';str++){
+    if(*str == '"'){
+      fputc('"',out); //escape quotes by doubling them
+    }
+    fputc(*str,out);
+  }
+  fputc('"',out);
+}
+
+//write the collected results of a batch fit to a CSV file, with one line
+//per fitted peak (or one line for spectra/views which weren't fit)
+//returns 1 on success, 0 on failure
+int writeBatchFitCSV(const char *filename){
+  int i,j;
+  FILE *out;
+  const char *resultStr[5] = {"not fit","fit","failed","cancelled","no spectra"};
+  if(batchstate.job == NULL){
+    return 0;
+  }
+  if((out = fopen(filename, "w")) == NULL){
+    printf("ERROR: Cannot open the output file: %s\n", filename);
+    printf("The file may not be accesible.\n");
+    return 0;
+  }
+  if(calpar.calMode == 1){
+    //column names including the calibration units, which may need quoting
+    const char *calColName[4] = {"Centroid","Centroid Err","FWHM","FWHM Err"};
+    char colName[64];
+    fprintf(out,"Name,Peak,Area,Area Err");
+    for(i=0;i<4;i++){
+      snprintf(colName,64,"%s (%s)",calColName[i],calpar.calUnit);
+      fputc(',',out);
+      writeCSVStr(out,colName);
+    }
+    fprintf(out,",Chisq/NDF,Result\n");
+  }else{
+    fprintf(out,"Name,Peak,Area,Area Err,Centroid,Centroid Err,FWHM,FWHM Err,Chisq/NDF,Result\n");
+  }
+  for(i=0;i<batchstate.numJobs;i++){
+    const batch_fit_job *job = &batchstate.job[i];
+    if((job->collected)&&(job->result == 1)){
+      for(j=0;j<job->par.numFitPeaks;j++){
+        double vals[3], errs[3];
+        getFitPeakVals(&job->par,j,vals,errs);
+        writeCSVStr(out,job->name);
+        fprintf(out,",%i,%.10g,%.10g,%.10g,%.10g,%.10g,%.10g,%.10g,%s\n",j+1,vals[0],errs[0],vals[1],errs[1],vals[2],errs[2],job->par.chisq/(1.0*job->par.ndf),resultStr[1]);
+      }
+    }else{
+      writeCSVStr(out,job->name);
+      fprintf(out,",,,,,,,,,%s\n",resultStr[job->collected ? job->result : 0]);
+    }
+  }
+  fclose(out);
+  printf("Wrote batch fit results to file: %s\n",filename);
+  return 1;
+}
@@ -0,0 +1,267 @@
+/* J. Williams, 2020-2021 */
+
+//This file contains storage for channel comments placed by the user on
+//spectra and views.  Comments live in a growable array indexed by comment
+//id (ids are stable until the comment is deleted).  Each spectrum handle
+//and each view has its own list of comment ids sorted by channel, so that
+//finding the comments in a channel range (eg. for drawing or checking
+//what is under the cursor) is a binary search rather than a scan over
+//every comment.
+//
+//Deleting a comment only marks it as unused.  Deleted comments are skipped
+//when reading the sorted lists, and are dropped from their list (and their
+//ids made available for reuse) the next time the list is modified.
+
+//get the sorted list of comments for the given spectrum handle (view=0) or
+//view number (view=1), or NULL if there is no such list
+comment_list *getCommentList(const unsigned char view, const int sp){
+  if(view){
+    if((sp < 0)||(sp >= MAXNVIEWS)){
+      return NULL;
+    }
+    return &comstore.list[NSPECT+sp];
+  }else{
+    if((sp < 0)||(sp >= NSPECT)){
+      return NULL;
+    }
+    return &comstore.list[sp];
+  }
+}
+
+//get the comment with the given id, or NULL if there is no such comment
+chan_comment *getComment(const int id){
+  if((id < 0)||(id >= comstore.numAlloc)){
+    return NULL;
+  }
+  if(comstore.com[id].used == 0){
+    return NULL;
+  }
+  return &comstore.com[id];
+}
+
+//drop deleted comments from a sorted list, making their ids available for reuse
+void compactCommentList(comment_list *list){
+  int i;
+  int numKept = 0;
+  if(list->numDeleted == 0){
+    return;
+  }
+  for(i=0;i<list->num;i++){
+    if(comstore.com[list->ids[i]].used){
+      list->ids[numKept] = list->ids[i];
+      numKept++;
+    }else{
+      comstore.freeIds[comstore.numFree] = list->ids[i];
+      comstore.numFree++;
+    }
+  }
+  list->num = numKept;
+  list->numDeleted = 0;
+}
+
+//get an unused comment id, growing the comment array if needed
+//returns -1 if memory could not be allocated
+int getFreeCommentId(){
+  if(comstore.numFree > 0){
+    comstore.numFree--;
+    return comstore.freeIds[comstore.numFree];
+  }
+  if(comstore.numUsed >= comstore.numAlloc){
+    int newAlloc = comstore.numAlloc*2;
+    if(newAlloc < 64){
+      newAlloc = 64;
+    }
+    chan_comment *newCom = realloc(comstore.com,(size_t)newAlloc*sizeof(chan_comment));
+    if(newCom == NULL){
+      printf("ERROR: cannot allocate memory for comments.\n");
+      return -1;
+    }
+    comstore.com = newCom;
+    int *newFreeIds = realloc(comstore.freeIds,(size_t)newAlloc*sizeof(int));
+    if(newFreeIds == NULL){
+      printf("ERROR: cannot allocate memory for comments.\n");
+      return -1;
+    }
+    comstore.freeIds = newFreeIds;
+    memset(&comstore.com[comstore.numAlloc],0,(size_t)(newAlloc - comstore.numAlloc)*sizeof(chan_comment));
+    comstore.numAlloc = newAlloc;
+  }
+  comstore.numUsed++;
+  return comstore.numUsed - 1;
+}
+
+//get the position of the first comment in a sorted list at or above channel ch
+int getCommentListPos(const comment_list *list, const int ch){
+  int lo = 0;
+  int hi = list->num;
+  while(lo < hi){
+    int mid = lo + (hi - lo)/2;
+    if(comstore.com[list->ids[mid]].ch < ch){
+      lo = mid + 1;
+    }else{
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+//add a comment on the given spectrum handle (view=0) or view number (view=1)
+//returns the id of the new comment, or -1 on failure
+int addComment(const unsigned char view, const int sp, const int ch, const float val, const char *text){
+  comment_list *list = getCommentList(view,sp);
+  if(list == NULL){
+    printf("WARNING: cannot add comment to invalid %s %i.\n",view ? "view" : "spectrum",sp);
+    return -1;
+  }
+  compactCommentList(list);
+  if(list->num >= list->numAlloc){
+    int newAlloc = list->numAlloc*2;
+    if(newAlloc < 8){
+      newAlloc = 8;
+    }
+    int *newIds = realloc(list->ids,(size_t)newAlloc*sizeof(int));
+    if(newIds == NULL){
+      printf("ERROR: cannot allocate memory for comments.\n");
+      return -1;
+    }
+    list->ids = newIds;
+    list->numAlloc = newAlloc;
+  }
+  int id = getFreeCommentId();
+  if(id < 0){
+    return -1;
+  }
+  chan_comment *com = &comstore.com[id];
+  memset(com,0,sizeof(chan_comment));
+  strncpy(com->text,text,sizeof(com->text)-1);
+  com->view = view;
+  com->sp = sp;
+  com->ch = ch;
+  com->val = val;
+  com->used = 1;
+
+  //insert after any existing comments on the same channel
+  int pos = getCommentListPos(list,ch+1);
+  memmove(&list->ids[pos+1],&list->ids[pos],(size_t)(list->num - pos)*sizeof(int));
+  list->ids[pos] = id;
+  list->num++;
+  comstore.numComments++;
+  rawdata.metaGeneration++;
+  return id;
+}
+
+//delete the comment with the given id
+void deleteComment(const int id){
+  chan_comment *com = getComment(id);
+  if(com == NULL){
+    return;
+  }
+  comment_list *list = getCommentList(com->view,com->sp);
+  com->used = 0;
+  comstore.numComments--;
+  rawdata.metaGeneration++;
+  if(list != NULL){
+    list->numDeleted++;
+    if(list->numDeleted > list->num/2){
+      compactCommentList(list); //amortized over the deletions since the last compaction
+    }
+  }
+}
+
+//delete all comments on the given spectrum handle (view=0) or view number (view=1)
+void deleteCommentsOn(const unsigned char view, const int sp){
+  int i;
+  comment_list *list = getCommentList(view,sp);
+  if(list == NULL){
+    return;
+  }
+  for(i=0;i<list->num;i++){
+    if(comstore.com[list->ids[i]].used){
+      comstore.com[list->ids[i]].used = 0;
+      comstore.numComments--;
+    }
+  }
+  list->numDeleted = list->num;
+  compactCommentList(list);
+  rawdata.metaGeneration++;
+}
+
+//delete all comments on a view, and renumber the comments on subsequent
+//views to match the view array being shortened by one
+void deleteViewComments(const int viewInd, const int numViews){
+  int i,j;
+  if((viewInd < 0)||(viewInd >= MAXNVIEWS)){
+    return;
+  }
+  deleteCommentsOn(1,viewInd);
+  comment_list delList = comstore.list[NSPECT+viewInd];
+  for(i=viewInd+1;i<numViews;i++){
+    if(i >= MAXNVIEWS){
+      break;
+    }
+    comment_list *list = &comstore.list[NSPECT+i];
+    for(j=0;j<list->num;j++){
+      comstore.com[list->ids[j]].sp = i-1;
+    }
+    comstore.list[NSPECT+i-1] = *list;
+  }
+  //reuse the (now empty) list storage of the deleted view for the last view
+  if((numViews > viewInd)&&(numViews <= MAXNVIEWS)){
+    comstore.list[NSPECT+numViews-1] = delList;
+  }
+}
+
+//get the range of positions [*start,*end) in the sorted comment list of the
+//given spectrum handle (view=0) or view number (view=1) which covers
+//channels minCh to maxCh (inclusive)
+//deleted comments may be in the range and should be skipped, using getComment
+//returns the list, or NULL if there is no such list
+const comment_list *getCommentsInRange(const unsigned char view, const int sp, const int minCh, const int maxCh, int *start, int *end){
+  const comment_list *list = getCommentList(view,sp);
+  if(list == NULL){
+    *start = 0;
+    *end = 0;
+    return NULL;
+  }
+  *start = getCommentListPos(list,minCh);
+  if(maxCh < minCh){
+    *end = *start;
+  }else{
+    *end = getCommentListPos(list,maxCh+1);
+  }
+  return list;
+}
+
+//remove all comments, keeping allocated memory for reuse
+void clearComments(){
+  int i;
+  for(i=0;i<(NSPECT+MAXNVIEWS);i++){
+    comstore.list[i].num = 0;
+    comstore.list[i].numDeleted = 0;
+  }
+  for(i=0;i<comstore.numUsed;i++){
+    comstore.com[i].used = 0;
+  }
+  comstore.numUsed = 0;
+  comstore.numFree = 0;
+  comstore.numComments = 0;
+}
+
+void freeCommentStore(){
+  int i;
+  for(i=0;i<(NSPECT+MAXNVIEWS);i++){
+    free(comstore.list[i].ids);
+    comstore.list[i].ids = NULL;
+    comstore.list[i].num = 0;
+    comstore.list[i].numAlloc = 0;
+    comstore.list[i].numDeleted = 0;
+  }
+  free(comstore.com);
+  free(comstore.freeIds);
+  comstore.com = NULL;
+  comstore.freeIds = NULL;
+  comstore.numAlloc = 0;
+  comstore.numUsed = 0;
+  comstore.numFree = 0;
+  comstore.numComments = 0;
+}
@@ -0,0 +1,328 @@
+/* J. Williams, 2020-2021 */
+
+//This file contains routines for reading data files sequentially, as a
+//stream, whether or not they are compressed.  Files ending in .gz (gzip)
+//or .zst (zstd, if available when built, see Makefile) are decompressed
+//as they are read, so that eg. file.mca.gz is read in the same way as
+//file.mca without first decompressing it to disk.  Compressed files without
+//a compression suffix are recognized by their magic number.
+//
+//Compressed files are decompressed on a separate thread into a small ring
+//of blocks, so that decompression overlaps with parsing of the data by the
+//file reader (which is itself usually running on a worker thread, see
+//startImportFiles in read_data.c).  Uncompressed files are read directly.
+
+#define DATA_COMPRESSION_NONE 0
+#define DATA_COMPRESSION_GZIP 1
+#define DATA_COMPRESSION_ZSTD 2
+
+//get the compression of a data file from its name (.gz or .zst suffix)
+int getDataFileNameCompression(const char *filename){
+  const char *dot = strrchr(filename,'.');
+  if(dot != NULL){
+    if(strcmp(dot+1,"gz")==0){
+      return DATA_COMPRESSION_GZIP;
+    }else if(strcmp(dot+1,"zst")==0){
+      return DATA_COMPRESSION_ZSTD;
+    }
+  }
+  return DATA_COMPRESSION_NONE;
+}
+
+//get the compression of a data file from its name or, if it has no
+//compression suffix, from the magic number at the start of the file (so that
+//eg. a gzip compressed file named file.mca is still read correctly)
+int getDataFileCompression(const char *filename){
+  int compression = getDataFileNameCompression(filename);
+  if(compression != DATA_COMPRESSION_NONE){
+    return compression;
+  }
+  unsigned char magic[4];
+  int fd = open(filename, O_RDONLY);
+  if(fd < 0){
+    return DATA_COMPRESSION_NONE;
+  }
+  ssize_t numRead = pread(fd,magic,sizeof(magic),0);
+  close(fd);
+  if(numRead == (ssize_t)sizeof(magic)){
+    if((magic[0] == 0x1F)&&(magic[1] == 0x8B)&&(magic[2] == 8)&&((magic[3] & 0xE0) == 0)){
+      return DATA_COMPRESSION_GZIP; //deflate method, no reserved flags set
+    }else if((magic[0] == 0x28)&&(magic[1] == 0xB5)&&(magic[2] == 0x2F)&&(magic[3] == 0xFD)){
+      return DATA_COMPRESSION_ZSTD;
+    }
+  }
+  return DATA_COMPRESSION_NONE;
+}
+
+//get the extension (without the dot) of the data in a file, looking through
+//any compression suffix (eg. "mca" for file.mca.gz), into ext (extLen characters)
+//returns 1 on success, 0 if the file has no extension
+int getDataFileExtension(const char *filename, char *ext, const size_t extLen){
+  const char *base = getFileBasename(filename); //see utils.c
+  size_t len = strlen(base);
+  if(getDataFileNameCompression(base) != DATA_COMPRESSION_NONE){
+    len = (size_t)(strrchr(base,'.') - base); //strip the compression suffix
+  }
+  const char *dot = NULL;
+  size_t i;
+  for(i=0;i<len;i++){
+    if(base[i] == '.'){
+      dot = &base[i];
+    }
+  }
+  if(dot == NULL){
+    return 0;
+  }
+  size_t extChars = len - (size_t)(dot + 1 - base);
+  if(extChars >= extLen){
+    extChars = extLen - 1;
+  }
+  memcpy(ext,dot+1,extChars);
+  ext[extChars] = '\0';
+  return 1;
+}
+
+//decompress up to len bytes of a compressed file into buf, on whichever
+//thread is doing the decompression
+//returns the number of bytes decompressed, less than len only at the end of
+//the file or on failure (ds->err is set)
+size_t decompressDataStream(data_stream *ds, unsigned char *buf, const size_t len){
+  size_t numOut = 0;
+  if(ds->compression == DATA_COMPRESSION_GZIP){
+    while(numOut < len){
+      int numRead = gzread(ds->gz,buf+numOut,(unsigned int)(len-numOut));
+      if(numRead < 0){
+        ds->err = 1;
+        break;
+      }else if(numRead == 0){
+        int errnum;
+        gzerror(ds->gz,&errnum);
+        if(errnum != Z_OK){
+          ds->err = 1; //eg. truncated file
+        }
+        break; //end of file
+      }
+      numOut += (size_t)numRead;
+    }
+  }
+#ifdef JF3_ZSTD
+  else if(ds->compression == DATA_COMPRESSION_ZSTD){
+    ZSTD_outBuffer out = {buf,len,0};
+    int needInput = 0; //zstd may still have output buffered from the last call, so try without reading first
+    while(out.pos < out.size){
+      if(needInput){
+        ssize_t numRead = read(ds->fd,ds->zInBuf,ds->zInBufSize);
+        if(numRead < 0){
+          if(errno == EINTR){
+            continue;
+          }
+          ds->err = 1;
+          break;
+        }else if(numRead == 0){
+          if(ds->zFrameLeft != 0){
+            ds->err = 1; //truncated file
+          }
+          break;
+        }
+        ds->zIn.src = ds->zInBuf;
+        ds->zIn.size = (size_t)numRead;
+        ds->zIn.pos = 0;
+      }
+      size_t prevPos = out.pos;
+      size_t prevInPos = ds->zIn.pos;
+      size_t ret = ZSTD_decompressStream(ds->zds,&out,&ds->zIn);
+      if(ZSTD_isError(ret)){
+        ds->err = 1;
+        break;
+      }
+      if((out.pos != prevPos)||(ds->zIn.pos != prevInPos)){
+        ds->zFrameLeft = ret; //calls which do nothing only return a hint for the next frame
+      }
+      //only read more once all input is used and nothing more can be decompressed from it
+      needInput = ((ds->zIn.pos >= ds->zIn.size)&&(out.pos == prevPos));
+    }
+    numOut = out.pos;
+  }
+#endif
+  return numOut;
+}
+
+//decompress a file into the ring of blocks, ahead of the reader
+gpointer dataStreamThread(gpointer data){
+  data_stream *ds = (data_stream*)data;
+  while(1){
+    g_mutex_lock(&ds->lock);
+    while((ds->numFull == DATA_STREAM_NUM_BLOCKS)&&(ds->cancel == 0)){
+      g_cond_wait(&ds->cond,&ds->lock);
+    }
+    int cancel = ds->cancel;
+    int blockInd = (ds->head + ds->numFull) % DATA_STREAM_NUM_BLOCKS; //empty, so not touched by the reader
+    g_mutex_unlock(&ds->lock);
+    if(cancel){
+      break;
+    }
+    size_t len = decompressDataStream(ds,ds->block[blockInd],DATA_STREAM_BLOCK_SIZE);
+    g_mutex_lock(&ds->lock);
+    ds->blockLen[blockInd] = len;
+    if(len > 0){
+      ds->numFull++;
+    }
+    if((len < DATA_STREAM_BLOCK_SIZE)||(ds->err)){
+      ds->done = 1;
+    }
+    int done = ds->done;
+    g_cond_signal(&ds->cond);
+    g_mutex_unlock(&ds->lock);
+    if(done){
+      break;
+    }
+  }
+  return NULL;
+}
+
+void closeDataStream(data_stream *ds){
+  int i;
+  if(ds->thread != NULL){
+    g_mutex_lock(&ds->lock);
+    ds->cancel = 1;
+    g_cond_signal(&ds->cond);
+    g_mutex_unlock(&ds->lock);
+    g_thread_join(ds->thread);
+    ds->thread = NULL;
+  }
+  if(ds->compression != DATA_COMPRESSION_NONE){
+    g_mutex_clear(&ds->lock);
+    g_cond_clear(&ds->cond);
+  }
+  if(ds->gz != NULL){
+    gzclose(ds->gz); //also closes the file
+  }else if(ds->fd >= 0){
+    close(ds->fd);
+  }
+#ifdef JF3_ZSTD
+  if(ds->zds != NULL){
+    ZSTD_freeDStream(ds->zds);
+  }
+  free(ds->zInBuf);
+#endif
+  for(i=0;i<DATA_STREAM_NUM_BLOCKS;i++){
+    free(ds->block[i]);
+  }
+  memset(ds,0,sizeof(data_stream));
+  ds->fd = -1;
+}
+
+//open a data file for reading as a stream, decompressing it if needed
+//if readAhead is set, compressed files are decompressed ahead of the reader
+//on a separate thread (not worthwhile if only the start of the file is read)
+//returns 1 on success, 0 on failure
+int openDataStreamReadAhead(data_stream *ds, const char *filename, const int readAhead){
+  int i;
+  memset(ds,0,sizeof(data_stream));
+  ds->compression = (unsigned char)getDataFileCompression(filename);
+#ifndef JF3_ZSTD
+  if(ds->compression == DATA_COMPRESSION_ZSTD){
+    printf("ERROR: cannot open file %s, jf3 was built without zstd support.\n",filename);
+    ds->fd = -1;
+    return 0;
+  }
+#endif
+  if((ds->fd = open(filename, O_RDONLY)) < 0){
+    return 0;
+  }
+  if(ds->compression == DATA_COMPRESSION_NONE){
+    posix_fadvise(ds->fd,0,0,POSIX_FADV_SEQUENTIAL);
+    return 1;
+  }
+  g_mutex_init(&ds->lock);
+  g_cond_init(&ds->cond);
+  if(ds->compression == DATA_COMPRESSION_GZIP){
+    ds->gz = gzdopen(ds->fd,"rb");
+    if(ds->gz == NULL){
+      closeDataStream(ds);
+      return 0;
+    }
+    gzbuffer(ds->gz,262144);
+  }
+#ifdef JF3_ZSTD
+  else if(ds->compression == DATA_COMPRESSION_ZSTD){
+    ds->zds = ZSTD_createDStream();
+    ds->zInBufSize = ZSTD_DStreamInSize();
+    ds->zInBuf = malloc(ds->zInBufSize);
+    if((ds->zds == NULL)||(ds->zInBuf == NULL)||(ZSTD_isError(ZSTD_initDStream(ds->zds)))){
+      closeDataStream(ds);
+      return 0;
+    }
+  }
+#endif
+  if(readAhead){
+    for(i=0;i<DATA_STREAM_NUM_BLOCKS;i++){
+      ds->block[i] = malloc(DATA_STREAM_BLOCK_SIZE);
+      if(ds->block[i] == NULL){
+        closeDataStream(ds);
+        return 0;
+      }
+    }
+    ds->thread = g_thread_try_new("decompress_thread", dataStreamThread, ds, NULL);
+  }
+  //if there is no thread, the file is decompressed as it is read instead
+  return 1;
+}
+
+int openDataStream(data_stream *ds, const char *filename){
+  return openDataStreamReadAhead(ds,filename,1);
+}
+
+//read up to len bytes from a data stream into buf
+//returns the number of bytes read, less than len only at the end of the
+//file or on failure (ds->err is set)
+size_t readDataStream(data_stream *ds, void *buf, const size_t len){
+  size_t numOut = 0;
+  if(ds->compression == DATA_COMPRESSION_NONE){
+    while(numOut < len){
+      ssize_t numRead = read(ds->fd,(unsigned char*)buf+numOut,len-numOut);
+      if(numRead < 0){
+        if(errno == EINTR){
+          continue;
+        }
+        ds->err = 1;
+        break;
+      }else if(numRead == 0){
+        break; //end of file
+      }
+      numOut += (size_t)numRead;
+    }
+    return numOut;
+  }
+  if(ds->thread == NULL){
+    return decompressDataStream(ds,buf,len);
+  }
+  while(numOut < len){
+    g_mutex_lock(&ds->lock);
+    while((ds->numFull == 0)&&(ds->done == 0)){
+      g_cond_wait(&ds->cond,&ds->lock);
+    }
+    int numFull = ds->numFull;
+    g_mutex_unlock(&ds->lock);
+    if(numFull == 0){
+      break; //end of file (or decompression failed, ds->err is set)
+    }
+    //the head block is full, so isn't touched by the decompressing thread
+    size_t numCopy = ds->blockLen[ds->head] - ds->pos;
+    if(numCopy > (len - numOut)){
+      numCopy = len - numOut;
+    }
+    memcpy((unsigned char*)buf+numOut,ds->block[ds->head]+ds->pos,numCopy);
+    numOut += numCopy;
+    ds->pos += numCopy;
+    if(ds->pos == ds->blockLen[ds->head]){
+      g_mutex_lock(&ds->lock);
+      ds->head = (ds->head + 1) % DATA_STREAM_NUM_BLOCKS;
+      ds->numFull--;
+      ds->pos = 0;
+      g_cond_signal(&ds->cond);
+      g_mutex_unlock(&ds->lock);
+    }
+  }
+  return numOut;
+}
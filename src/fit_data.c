@@ -3,11 +3,13 @@
 //This file contains routines for fitting displayed spectra.
 //The main fit routine is startGausFit (at the bottom), which
 //in turn calls other subroutines.
+//Each fit runs on its own fit context (see fit_context in jf3.h),
+//which holds a snapshot of the data being fit, so fits don't read
+//the gui state while running.
 
 //external declarations
-extern double evalPeakArea(const int peakNum, const int fitType);
-extern double evalPeakAreaErr(const int peakNum, const int fitType);
-extern double getFitChisq(const int fitType);
+extern double evalPeakArea(const fit_params *par, const int peakNum, const int fitType);
+extern double evalPeakAreaErr(const fit_params *par, const int peakNum, const int fitType);
 
 //update the gui state while/after fitting
 gboolean update_gui_fit_state(){
@@ -21,6 +23,7 @@ gboolean update_gui_fit_state(){
       gtk_widget_set_sensitive(GTK_WIDGET(spectrum_selector),TRUE);
       gtk_widget_set_sensitive(GTK_WIDGET(contract_scale),TRUE);
       gtk_widget_set_sensitive(GTK_WIDGET(fit_fit_button),TRUE);
+      gtk_widget_set_sensitive(GTK_WIDGET(fit_batch_button),TRUE);
       gtk_widget_hide(GTK_WIDGET(fit_spinner));
       gtk_revealer_set_reveal_child(revealer_info_panel, FALSE);
       gtk_widget_queue_draw(GTK_WIDGET(spectrum_drawing_area)); //redraw to show the fit
@@ -28,15 +31,18 @@ gboolean update_gui_fit_state(){
     case 5:
       gtk_label_set_text(revealer_info_label,"Further refining fit...");
       gtk_widget_set_sensitive(GTK_WIDGET(fit_fit_button),FALSE);
+      gtk_widget_set_sensitive(GTK_WIDGET(fit_batch_button),FALSE);
       break;
     case 4:
       gtk_label_set_text(revealer_info_label,"Refining fit...");
       gtk_widget_set_sensitive(GTK_WIDGET(fit_fit_button),FALSE);
+      gtk_widget_set_sensitive(GTK_WIDGET(fit_batch_button),FALSE);
       break;
     case 3:
       gtk_label_set_text(revealer_info_label,"Fitting...");
       gtk_widget_show(GTK_WIDGET(fit_spinner));
       gtk_widget_set_sensitive(GTK_WIDGET(fit_fit_button),FALSE);
+      gtk_widget_set_sensitive(GTK_WIDGET(fit_batch_button),FALSE);
       gtk_widget_set_sensitive(GTK_WIDGET(contract_scale),FALSE);
       gtk_revealer_set_reveal_child(revealer_info_panel, TRUE);
       break;
@@ -50,6 +56,7 @@ gboolean update_gui_fit_state(){
       gtk_widget_set_sensitive(GTK_WIDGET(multiplot_button),FALSE);
       gtk_widget_set_sensitive(GTK_WIDGET(spectrum_selector),FALSE);
       gtk_widget_set_sensitive(GTK_WIDGET(fit_fit_button),FALSE);
+      gtk_widget_set_sensitive(GTK_WIDGET(fit_batch_button),FALSE);
       gtk_label_set_text(revealer_info_label,"Right-click to set fit region lower and upper bounds.");
       gtk_revealer_set_reveal_child(revealer_info_panel, TRUE);
       break;
@@ -62,6 +69,7 @@ gboolean update_gui_fit_state(){
       gtk_widget_set_sensitive(GTK_WIDGET(multiplot_button),TRUE);
       gtk_widget_set_sensitive(GTK_WIDGET(spectrum_selector),TRUE);
       gtk_widget_set_sensitive(GTK_WIDGET(fit_fit_button),TRUE);
+      gtk_widget_set_sensitive(GTK_WIDGET(fit_batch_button),TRUE);
       gtk_widget_hide(GTK_WIDGET(fit_spinner));
       gtk_revealer_set_reveal_child(revealer_info_panel, FALSE);
       gtk_widget_queue_draw(GTK_WIDGET(spectrum_drawing_area)); //redraw to hide any fit
@@ -104,7 +112,7 @@ gboolean print_fit_results(){
     getFormattedValAndUncertainty((double)fitpar.fitParVal[1],(double)fitpar.fitParErr[1],fitParStr[1],50,1,guiglobals.roundErrors);
     getFormattedValAndUncertainty((double)fitpar.fitParVal[2],(double)fitpar.fitParErr[2],fitParStr[2],50,1,guiglobals.roundErrors);
   }
-  length += snprintf(fitResStr+length,(long unsigned int)(strSize-length),"Chisq/NDF: %f\n\nBackground\nA: %s, B: %s, C: %s\n\n",getFitChisq(fitpar.fitType)/(1.0*fitpar.ndf),fitParStr[0],fitParStr[1],fitParStr[2]);
+  length += snprintf(fitResStr+length,(long unsigned int)(strSize-length),"Chisq/NDF: %f\n\nBackground\nA: %s, B: %s, C: %s\n\n",fitpar.chisq/(1.0*fitpar.ndf),fitParStr[0],fitParStr[1],fitParStr[2]);
   if(fitpar.fitType == 1){
     if(calpar.calMode == 1){
       getFormattedValAndUncertainty(getCalVal((double)fitpar.fitParVal[3]),getCalWidth((double)fitpar.fitParErr[3]),fitParStr[0],50,1,guiglobals.roundErrors);
@@ -117,7 +125,7 @@ gboolean print_fit_results(){
   }
   length += snprintf(fitResStr+length,(long unsigned int)(strSize-length),"Peaks");
   for(i=0;i<fitpar.numFitPeaks;i++){
-    getFormattedValAndUncertainty(evalPeakArea(i,fitpar.fitType),evalPeakAreaErr(i,fitpar.fitType),fitParStr[0],50,1,guiglobals.roundErrors);
+    getFormattedValAndUncertainty(evalPeakArea(&fitpar,i,fitpar.fitType),evalPeakAreaErr(&fitpar,i,fitpar.fitType),fitParStr[0],50,1,guiglobals.roundErrors);
     if(calpar.calMode == 1){
       getFormattedValAndUncertainty(getCalVal((double)fitpar.fitParVal[7+(3*i)]),getCalWidth((double)fitpar.fitParErr[7+(3*i)]),fitParStr[1],50,1,guiglobals.roundErrors);
       getFormattedValAndUncertainty(2.35482*getCalWidth((double)fitpar.fitParVal[8+(3*i)]),2.35482*getCalWidth((double)fitpar.fitParErr[8+(3*i)]),fitParStr[2],50,1,guiglobals.roundErrors);
@@ -158,566 +166,583 @@ double getFWHM(double chan, double widthF, double widthG, double widthH){
 }
 
 //get the value of the fitted gaussian term for a given x value
-long double evalGaussTerm(int peakNum, long double xval){
+long double evalGaussTerm(const fit_params *par, const int peakNum, const long double xval){
   long double evalG;
-  if(fitpar.fixRelativeWidths){
-    evalG = expl(-0.5* powl((xval-fitpar.fitParVal[7+(3*peakNum)]),2.0)/(powl(fitpar.fitParVal[8]*fitpar.relWidths[peakNum],2.0)));
+  if(par->fixRelativeWidths){
+    evalG = expl(-0.5* powl((xval-par->fitParVal[7+(3*peakNum)]),2.0)/(powl(par->fitParVal[8]*par->relWidths[peakNum],2.0)));
   }else{
-    evalG = expl(-0.5* powl((xval-fitpar.fitParVal[7+(3*peakNum)]),2.0)/(powl(fitpar.fitParVal[8+(3*peakNum)],2.0)));
+    evalG = expl(-0.5* powl((xval-par->fitParVal[7+(3*peakNum)]),2.0)/(powl(par->fitParVal[8+(3*peakNum)],2.0)));
   }
-  //printf("peakNum: %i, xval: %f, pos: %f, width: %f, eval: %f\n",peakNum,xval,fitpar.fitParVal[7+(3*peakNum)],fitpar.fitParVal[8+(3*peakNum)],evalG);
+  //printf("peakNum: %i, xval: %f, pos: %f, width: %f, eval: %f\n",peakNum,xval,par->fitParVal[7+(3*peakNum)],par->fitParVal[8+(3*peakNum)],evalG);
   return evalG;
 }
 
 //get the value of the fitted skewed gaussian term for a given x value
-long double evalSkewedGaussTerm(const int peakNum, const long double xval){
+long double evalSkewedGaussTerm(const fit_params *par, const int peakNum, const long double xval){
   long double evalG;
-  if(fitpar.fixRelativeWidths){
-    evalG = expl((xval-fitpar.fitParVal[7+(3*peakNum)])/fitpar.fitParVal[4]) * erfcl( (xval-fitpar.fitParVal[7+(3*peakNum)])/(1.41421356*fitpar.fitParVal[8]*fitpar.relWidths[peakNum]) + (fitpar.fitParVal[8]*fitpar.relWidths[peakNum])/(1.41421356*fitpar.fitParVal[4]) ) ;
+  if(par->fixRelativeWidths){
+    evalG = expl((xval-par->fitParVal[7+(3*peakNum)])/par->fitParVal[4]) * erfcl( (xval-par->fitParVal[7+(3*peakNum)])/(1.41421356*par->fitParVal[8]*par->relWidths[peakNum]) + (par->fitParVal[8]*par->relWidths[peakNum])/(1.41421356*par->fitParVal[4]) ) ;
   }else{
-    evalG = expl((xval-fitpar.fitParVal[7+(3*peakNum)])/fitpar.fitParVal[4]) * erfcl( (xval-fitpar.fitParVal[7+(3*peakNum)])/(1.41421356*fitpar.fitParVal[8+(3*peakNum)]) + fitpar.fitParVal[8+(3*peakNum)]/(1.41421356*fitpar.fitParVal[4]) ) ;
+    evalG = expl((xval-par->fitParVal[7+(3*peakNum)])/par->fitParVal[4]) * erfcl( (xval-par->fitParVal[7+(3*peakNum)])/(1.41421356*par->fitParVal[8+(3*peakNum)]) + par->fitParVal[8+(3*peakNum)]/(1.41421356*par->fitParVal[4]) ) ;
   }
-  //printf("peakNum: %i, xval: %f, pos: %f, width: %f, eval: %f\n",peakNum,xval,fitpar.fitParVal[7+(3*peakNum)],fitpar.fitParVal[8+(3*peakNum)],evalG);
+  //printf("peakNum: %i, xval: %f, pos: %f, width: %f, eval: %f\n",peakNum,xval,par->fitParVal[7+(3*peakNum)],par->fitParVal[8+(3*peakNum)],evalG);
   return evalG;
 }
 
-//evaluate the derivative of a gaussian peak term, needed for non-linear fits 
-//derPar: 0=amplitude, 1=centroid, 2=width, 3=R, 4=beta
-long double evalGaussTermDerivative(const int peakNum, const long double xval, const int derPar){
-  long double evalGDer = evalGaussTerm(peakNum,xval);
-  switch (derPar){
-    /*case 4:
-      evalGDer *= 0.0; //no skewness in symmetric Gaussian
-      break;*/
-    case 3:
-      evalGDer *= -1.0*fitpar.fitParVal[6+(3*peakNum)];
-      break;
-    case 2:
-      evalGDer *= fitpar.fitParVal[6+(3*peakNum)]*(1.0 - fitpar.fitParVal[3]);
-      if(fitpar.fixRelativeWidths){
-        evalGDer *= powl((xval-fitpar.fitParVal[7+(3*peakNum)]),2.0)/(powl(fitpar.fitParVal[8],3.0)*powl(fitpar.relWidths[peakNum],2.0));
-      }else{
-        evalGDer *= powl((xval-fitpar.fitParVal[7+(3*peakNum)]),2.0)/powl(fitpar.fitParVal[8+(3*peakNum)],3.0);
-      }
-      break;
-    case 1:
-      evalGDer *= fitpar.fitParVal[6+(3*peakNum)]*(1.0 - fitpar.fitParVal[3]);
-      if(fitpar.fixRelativeWidths){
-        evalGDer *= (xval-fitpar.fitParVal[7+(3*peakNum)])/powl(fitpar.fitParVal[8]*fitpar.relWidths[peakNum],2.0);
-      }else{
-        evalGDer *= (xval-fitpar.fitParVal[7+(3*peakNum)])/powl(fitpar.fitParVal[8+(3*peakNum)],2.0);
-      }
-      break;
-    case 0:
-      evalGDer *= (1.0 - fitpar.fitParVal[3]);
-      break;
-    default:
-      printf("WARNING: invalid Gaussian derivative parameter (%i).\n",derPar);
-      break;
+//evaluate a peak term (the gaussian and, for fitType 1, skewed gaussian), and
+//its derivatives with respect to each of the peak parameters, needed for
+//non-linear fits (the exponentials shared between derivatives are evaluated once)
+//der: 0=amplitude, 1=centroid, 2=width, 3=R, 4=beta
+//returns the value of the peak term
+long double evalPeakTermDerivatives(const fit_params *par, const int peakNum, const long double xval, const int fitType, long double *der){
+  long double amp = par->fitParVal[6+(3*peakNum)];
+  long double dx = xval - par->fitParVal[7+(3*peakNum)];
+  long double r = par->fitParVal[3];
+  long double width;
+  if(par->fixRelativeWidths){
+    width = par->fitParVal[8]*par->relWidths[peakNum];
+  }else{
+    width = par->fitParVal[8+(3*peakNum)];
   }
-  return evalGDer;
-}
 
-//evaluate the derivative of a skewed gaussian peak term, needed for non-linear fits 
-//derPar: 0=amplitude, 1=centroid, 2=width, 3=R, 4=beta
-long double evalSkewedGaussTermDerivative(const int peakNum, const long double xval, const int derPar){
-  long double evalGDer = 1.0;
-  long double evalGDerT2;
-  switch (derPar){
-    case 4:
-      evalGDer = fitpar.fitParVal[6+(3*peakNum)]*fitpar.fitParVal[3]*(xval-fitpar.fitParVal[7+(3*peakNum)])*evalSkewedGaussTerm(peakNum,xval)/(fitpar.fitParVal[4]*fitpar.fitParVal[4]);
-      evalGDerT2 = 2.0*fitpar.fitParVal[6+(3*peakNum)]*fitpar.fitParVal[3]/(2.5066*fitpar.fitParVal[4]*fitpar.fitParVal[4]);
-      if(fitpar.fixRelativeWidths){
-        evalGDerT2 *= expl( ((xval-fitpar.fitParVal[7+(3*peakNum)])/fitpar.fitParVal[4]) - powl( ((xval-fitpar.fitParVal[7+(3*peakNum)])/(1.41421356*fitpar.fitParVal[8]*fitpar.relWidths[peakNum])) + ((fitpar.fitParVal[8]*fitpar.relWidths[peakNum])/(1.41421356*fitpar.fitParVal[4])),2.0) ) ;
-        evalGDerT2 *= fitpar.fitParVal[8]*fitpar.relWidths[peakNum];
-      }else{
-        evalGDerT2 *= expl( ((xval-fitpar.fitParVal[7+(3*peakNum)])/fitpar.fitParVal[4]) - powl( ((xval-fitpar.fitParVal[7+(3*peakNum)])/(1.41421356*fitpar.fitParVal[8+(3*peakNum)])) + ((fitpar.fitParVal[8+(3*peakNum)])/(1.41421356*fitpar.fitParVal[4])),2.0) ) ;
-        evalGDerT2 *= fitpar.fitParVal[8+(3*peakNum)];
-      }
-      evalGDer = evalGDerT2 - evalGDer;
-      break;
-    case 3:
-      evalGDer = fitpar.fitParVal[6+(3*peakNum)]*evalSkewedGaussTerm(peakNum,xval);
-      break;
-    case 2:
-      evalGDer = -2.0*fitpar.fitParVal[6+(3*peakNum)]*fitpar.fitParVal[3]/1.7725;
-      if(fitpar.fixRelativeWidths){
-        evalGDer *= expl( (xval-fitpar.fitParVal[7+(3*peakNum)])/fitpar.fitParVal[4] - powl((xval-fitpar.fitParVal[7+(3*peakNum)])/(1.41421356*fitpar.fitParVal[8]*fitpar.relWidths[peakNum]) + (fitpar.fitParVal[8]*fitpar.relWidths[peakNum])/(1.41421356*fitpar.fitParVal[4]),2.0) ) ;
-        evalGDer *= ( (1.0/(1.41421356*fitpar.fitParVal[4])) - (xval-fitpar.fitParVal[7+(3*peakNum)])/(1.41421356*fitpar.fitParVal[8]*fitpar.relWidths[peakNum]*fitpar.fitParVal[8]*fitpar.relWidths[peakNum]) );
-      }else{
-        evalGDer *= expl( (xval-fitpar.fitParVal[7+(3*peakNum)])/fitpar.fitParVal[4] - powl((xval-fitpar.fitParVal[7+(3*peakNum)])/(1.41421356*fitpar.fitParVal[8+(3*peakNum)]) + (fitpar.fitParVal[8+(3*peakNum)])/(1.41421356*fitpar.fitParVal[4]),2.0) ) ;
-        evalGDer *= ( (1.0/(1.41421356*fitpar.fitParVal[4])) - (xval-fitpar.fitParVal[7+(3*peakNum)])/(1.41421356*fitpar.fitParVal[8+(3*peakNum)]*fitpar.fitParVal[8+(3*peakNum)]) );
-      }
-      break;
-    case 1:
-      evalGDer = fitpar.fitParVal[6+(3*peakNum)]*fitpar.fitParVal[3]*evalSkewedGaussTerm(peakNum,xval)/fitpar.fitParVal[4];
-      evalGDerT2 = 2.0*fitpar.fitParVal[6+(3*peakNum)]*fitpar.fitParVal[3]/2.5066;
-      if(fitpar.fixRelativeWidths){
-        evalGDerT2 *= expl( (xval-fitpar.fitParVal[7+(3*peakNum)])/fitpar.fitParVal[4] - powl((xval-fitpar.fitParVal[7+(3*peakNum)])/(1.41421356*fitpar.fitParVal[8]*fitpar.relWidths[peakNum]) + (fitpar.fitParVal[8]*fitpar.relWidths[peakNum])/(1.41421356*fitpar.fitParVal[4]),2.0) ) ;
-        evalGDerT2 = evalGDerT2/(fitpar.fitParVal[8]*fitpar.relWidths[peakNum]);
-      }else{
-        evalGDerT2 *= expl( (xval-fitpar.fitParVal[7+(3*peakNum)])/fitpar.fitParVal[4] - powl((xval-fitpar.fitParVal[7+(3*peakNum)])/(1.41421356*fitpar.fitParVal[8+(3*peakNum)]) + (fitpar.fitParVal[8+(3*peakNum)])/(1.41421356*fitpar.fitParVal[4]),2.0) ) ;
-        evalGDerT2 = evalGDerT2/fitpar.fitParVal[8+(3*peakNum)];
-      }
-      evalGDer = evalGDerT2 - evalGDer;
-      break;
-    case 0:
-      evalGDer = fitpar.fitParVal[3]*evalSkewedGaussTerm(peakNum,xval);
-      break;
-    default:
-      printf("WARNING: invalid skewed Gaussian derivative parameter (%i).\n",derPar);
-      break;
+  long double evalG = expl(-0.5*dx*dx/(width*width));
+  long double val = amp*(1.0 - r)*evalG;
+  der[0] = (1.0 - r)*evalG;
+  der[1] = val*dx/(width*width);
+  der[2] = val*dx*dx/(width*width*width);
+  if(par->fixRelativeWidths){
+    der[2] *= par->relWidths[peakNum]; //derivative with respect to the width of the first peak
   }
-  return evalGDer;
-}
+  der[3] = -1.0*amp*evalG;
+  der[4] = 0.;
 
-long double evalAllTermDerivative(const int peakNum, const long double xval, const int derPar, const int fitType){
-  long double val = evalGaussTermDerivative(peakNum,xval,derPar);
   if(fitType == 1){
-    val += evalSkewedGaussTermDerivative(peakNum,xval,derPar);
+    long double beta = par->fitParVal[4];
+    long double erfArg = dx/(1.41421356*width) + width/(1.41421356*beta);
+    long double evalSkG = expl(dx/beta)*erfcl(erfArg);
+    long double evalSkGDer = expl(dx/beta - erfArg*erfArg);
+    der[0] += r*evalSkG;
+    der[1] += 2.0*amp*r*evalSkGDer/(2.5066*width) - amp*r*evalSkG/beta;
+    der[2] += -2.0*amp*r/1.7725*evalSkGDer*( (1.0/(1.41421356*beta)) - dx/(1.41421356*width*width) );
+    der[3] += amp*evalSkG;
+    der[4] = 2.0*amp*r*evalSkGDer*width/(2.5066*beta*beta) - amp*r*dx*evalSkG/(beta*beta);
+    val += amp*r*evalSkG;
   }
+
   return val;
 }
 
-long double evalFitBG(const long double xval){
-  return fitpar.fitParVal[0] + xval*fitpar.fitParVal[1] + xval*xval*fitpar.fitParVal[2];
+long double evalFitBG(const fit_params *par, const long double xval){
+  return par->fitParVal[0] + xval*par->fitParVal[1] + xval*xval*par->fitParVal[2];
 }
 
-long double evalFit(const long double xval, const int fitType){
+long double evalFit(const fit_params *par, const long double xval, const int fitType){
   int i;
-  long double val = evalFitBG(xval);
-  for(i=0;i<fitpar.numFitPeaks;i++){
-    val += fitpar.fitParVal[6+(3*i)]*(1.0 - fitpar.fitParVal[3])*evalGaussTerm(i,xval);
+  long double val = evalFitBG(par,xval);
+  for(i=0;i<par->numFitPeaks;i++){
+    val += par->fitParVal[6+(3*i)]*(1.0 - par->fitParVal[3])*evalGaussTerm(par,i,xval);
     if(fitType == 1){
-      val += fitpar.fitParVal[6+(3*i)]*fitpar.fitParVal[3]*evalSkewedGaussTerm(i,xval);
+      val += par->fitParVal[6+(3*i)]*par->fitParVal[3]*evalSkewedGaussTerm(par,i,xval);
     }
   }
   return val;
 }
 
-long double evalFitOnePeak(const long double xval, const int peak, const int fitType){
-  if(peak>=fitpar.numFitPeaks)
+long double evalFitOnePeak(const fit_params *par, const long double xval, const int peak, const int fitType){
+  if(peak>=par->numFitPeaks)
     return 0.0;
-  long double val = evalFitBG(xval);
-  val += fitpar.fitParVal[6+(3*peak)]*(1.0 - fitpar.fitParVal[3])*evalGaussTerm(peak,xval);
+  long double val = evalFitBG(par,xval);
+  val += par->fitParVal[6+(3*peak)]*(1.0 - par->fitParVal[3])*evalGaussTerm(par,peak,xval);
   if(fitType == 1)
-    val += fitpar.fitParVal[6+(3*peak)]*fitpar.fitParVal[3]*evalSkewedGaussTerm(peak,xval);
+    val += par->fitParVal[6+(3*peak)]*par->fitParVal[3]*evalSkewedGaussTerm(par,peak,xval);
   return val;
 }
 
-double evalSymGaussArea(const int peakNum){
+double evalSymGaussArea(const fit_params *par, const int peakNum){
   //use Guassian integral
-  long double area = fitpar.fitParVal[6+(3*peakNum)]*(1.0 - fitpar.fitParVal[3])*fitpar.fitParVal[8+(3*peakNum)]*sqrt(2.0*G_PI)/(1.0*drawing.contractFactor);
+  long double area = par->fitParVal[6+(3*peakNum)]*(1.0 - par->fitParVal[3])*par->fitParVal[8+(3*peakNum)]*sqrt(2.0*G_PI)/(1.0*par->contractFactor);
   return (double)area;
 }
 
-double evalSkewedGaussArea(const int peakNum){
+double evalSkewedGaussArea(const fit_params *par, const int peakNum){
   //use definite integral of skewed Gaussian wrt x, taken
   //from -inf to inf (which collapses erf and erfc terms)
-  long double area = fitpar.fitParVal[6+(3*peakNum)]*fitpar.fitParVal[3]*fitpar.fitParVal[4]*expl(-2.0*fitpar.fitParVal[8+(3*peakNum)]*fitpar.fitParVal[8+(3*peakNum)]/(4.0*fitpar.fitParVal[4]*fitpar.fitParVal[4]));
+  long double area = par->fitParVal[6+(3*peakNum)]*par->fitParVal[3]*par->fitParVal[4]*expl(-2.0*par->fitParVal[8+(3*peakNum)]*par->fitParVal[8+(3*peakNum)]/(4.0*par->fitParVal[4]*par->fitParVal[4]));
   return (double)area;
 }
 
-double evalPeakArea(const int peakNum, const int fitType){
-  double area = evalSymGaussArea(peakNum);
+double evalPeakArea(const fit_params *par, const int peakNum, const int fitType){
+  double area = evalSymGaussArea(par,peakNum);
   if(fitType == 1){
-    area += evalSkewedGaussArea(peakNum);
+    area += evalSkewedGaussArea(par,peakNum);
   }
   return area;
 }
 
-double evalPeakAreaErr(int peakNum, const int fitType){
+double evalPeakAreaErr(const fit_params *par, const int peakNum, const int fitType){
   //propagate uncertainty through the expression in the function evalSymGaussArea()
-  long double err = (fitpar.fitParErr[6+(3*peakNum)]/fitpar.fitParVal[6+(3*peakNum)])*(fitpar.fitParErr[6+(3*peakNum)]/fitpar.fitParVal[6+(3*peakNum)]);
-  err += (fitpar.fitParErr[8+(3*peakNum)]/fitpar.fitParVal[8+(3*peakNum)])*(fitpar.fitParErr[8+(3*peakNum)]/fitpar.fitParVal[8+(3*peakNum)]);
-  err += (fitpar.fitParErr[3]/(1.0 - fitpar.fitParVal[3]))*(fitpar.fitParErr[3]/(1.0 - fitpar.fitParVal[3]));
+  long double err = (par->fitParErr[6+(3*peakNum)]/par->fitParVal[6+(3*peakNum)])*(par->fitParErr[6+(3*peakNum)]/par->fitParVal[6+(3*peakNum)]);
+  err += (par->fitParErr[8+(3*peakNum)]/par->fitParVal[8+(3*peakNum)])*(par->fitParErr[8+(3*peakNum)]/par->fitParVal[8+(3*peakNum)]);
+  err += (par->fitParErr[3]/(1.0 - par->fitParVal[3]))*(par->fitParErr[3]/(1.0 - par->fitParVal[3]));
   err = sqrtl(err);
-  err = err*evalSymGaussArea(peakNum);
+  err = err*evalSymGaussArea(par,peakNum);
   if(fitType == 1){
     //propagate uncertainty through the expression in the function evalSkewedGaussArea()
-    long double errsk = (fitpar.fitParErr[8+(3*peakNum)]/fitpar.fitParVal[8+(3*peakNum)])*(fitpar.fitParErr[8+(3*peakNum)]/fitpar.fitParVal[8+(3*peakNum)]);
-    errsk += (fitpar.fitParErr[4]/fitpar.fitParVal[4])*(fitpar.fitParErr[4]/fitpar.fitParVal[4]);
-    errsk *= fitpar.fitParVal[8+(3*peakNum)]*fitpar.fitParVal[8+(3*peakNum)]/fitpar.fitParVal[4]*fitpar.fitParVal[4];
+    long double errsk = (par->fitParErr[8+(3*peakNum)]/par->fitParVal[8+(3*peakNum)])*(par->fitParErr[8+(3*peakNum)]/par->fitParVal[8+(3*peakNum)]);
+    errsk += (par->fitParErr[4]/par->fitParVal[4])*(par->fitParErr[4]/par->fitParVal[4]);
+    errsk *= par->fitParVal[8+(3*peakNum)]*par->fitParVal[8+(3*peakNum)]/par->fitParVal[4]*par->fitParVal[4];
     errsk *= 0.5; //abs(constant) in the exponential term of evalSkewedGaussArea()
-    errsk += (fitpar.fitParErr[6+(3*peakNum)]/fitpar.fitParVal[6+(3*peakNum)])*(fitpar.fitParErr[6+(3*peakNum)]/fitpar.fitParVal[6+(3*peakNum)]);
-    errsk += (fitpar.fitParErr[3]/fitpar.fitParVal[3])*(fitpar.fitParErr[3]/fitpar.fitParVal[3]);
-    errsk += (fitpar.fitParErr[4]/fitpar.fitParVal[4])*(fitpar.fitParErr[4]/fitpar.fitParVal[4]);
+    errsk += (par->fitParErr[6+(3*peakNum)]/par->fitParVal[6+(3*peakNum)])*(par->fitParErr[6+(3*peakNum)]/par->fitParVal[6+(3*peakNum)]);
+    errsk += (par->fitParErr[3]/par->fitParVal[3])*(par->fitParErr[3]/par->fitParVal[3]);
+    errsk += (par->fitParErr[4]/par->fitParVal[4])*(par->fitParErr[4]/par->fitParVal[4]);
     errsk = sqrtl(errsk);
-    errsk = errsk*evalSkewedGaussArea(peakNum);
+    errsk = errsk*evalSkewedGaussArea(par,peakNum);
     //add all errors in quadrature
     err = sqrtl(err*err + errsk*errsk);
   }
   return (double)err;
 }
 
-//function returns chisq evaluated for the current fit
-double getFitChisq(const int fitType){
+//get the value of a channel from the data snapshot of a fit context
+//(channels outside of the snapshot are treated as empty)
+float getFitDataVal(const fit_context *ctx, const int ch){
+  if((ch < ctx->dataStartCh)||(ch >= (ctx->dataStartCh + ctx->numDataCh))){
+    return 0.;
+  }
+  return ctx->dataVal[ch - ctx->dataStartCh];
+}
+float getFitDataWeight(const fit_context *ctx, const int ch){
+  if((ch < ctx->dataStartCh)||(ch >= (ctx->dataStartCh + ctx->numDataCh))){
+    return 0.;
+  }
+  return ctx->dataWeight[ch - ctx->dataStartCh];
+}
+
+//copy the data in the fit region into the fit workspace of a fit context, and
+//allocate space for the fit function and its derivatives at each bin
+//returns 1 on success, 0 on failure
+int allocFitWorkspace(fit_context *ctx){
+  int i;
+  const fit_params *par = &ctx->par;
+  fit_workspace *ws = &ctx->ws;
+  memset(ws,0,sizeof(fit_workspace));
+  ws->dim = 6 + (3*(unsigned int)par->numFitPeaks);
+  for(i=par->fitStartCh;i<=par->fitEndCh;i+=par->contractFactor){
+    ws->numBins++;
+  }
+  if(ws->numBins <= 0){
+    return 0;
+  }
+  ws->xval = malloc((size_t)ws->numBins*sizeof(long double));
+  ws->yval = malloc((size_t)ws->numBins*sizeof(long double));
+  ws->dataWeight = malloc((size_t)ws->numBins*sizeof(long double));
+  ws->model = malloc((size_t)ws->numBins*sizeof(long double));
+  ws->jac = malloc((size_t)ws->numBins*ws->dim*sizeof(long double));
+  ws->curv = malloc(ws->dim*ws->dim*sizeof(long double));
+  ws->grad = malloc(ws->dim*sizeof(long double));
+  ws->numBlocks = (ws->numBins + FIT_BLOCK_BINS - 1)/FIT_BLOCK_BINS;
+  ws->block = calloc((size_t)ws->numBlocks,sizeof(fit_block));
+  if(ws->block != NULL){
+    ws->block[0].curv = malloc((size_t)ws->numBlocks*ws->dim*ws->dim*sizeof(long double));
+    ws->block[0].grad = malloc((size_t)ws->numBlocks*ws->dim*sizeof(long double));
+  }
+  if((ws->xval == NULL)||(ws->yval == NULL)||(ws->dataWeight == NULL)||(ws->model == NULL)||(ws->jac == NULL)||(ws->curv == NULL)||(ws->grad == NULL)||(ws->block == NULL)||(ws->block[0].curv == NULL)||(ws->block[0].grad == NULL)){
+    printf("ERROR: cannot allocate memory to fit %i bins.\n",ws->numBins);
+    return 0;
+  }
+  for(i=0;i<ws->numBlocks;i++){
+    ws->block[i].startBin = i*FIT_BLOCK_BINS;
+    ws->block[i].endBin = (i+1)*FIT_BLOCK_BINS;
+    if(ws->block[i].endBin > ws->numBins){
+      ws->block[i].endBin = ws->numBins;
+    }
+    ws->block[i].curv = ws->block[0].curv + (size_t)i*ws->dim*ws->dim;
+    ws->block[i].grad = ws->block[0].grad + (size_t)i*ws->dim;
+  }
+  ws->numThreads = (int)g_get_num_processors();
+  if((ctx->maxThreads > 0)&&(ws->numThreads > ctx->maxThreads)){
+    ws->numThreads = ctx->maxThreads;
+  }
+  for(i=0;i<ws->numBins;i++){
+    int ch = par->fitStartCh + i*par->contractFactor;
+    ws->xval[i] = (long double)ch;
+    ws->yval[i] = getFitDataVal(ctx,ch);
+    ws->dataWeight[i] = getFitDataWeight(ctx,ch);
+  }
+  return 1;
+}
+
+void freeFitWorkspace(fit_workspace *ws){
+  free(ws->xval);
+  free(ws->yval);
+  free(ws->dataWeight);
+  free(ws->model);
+  free(ws->jac);
+  free(ws->curv);
+  free(ws->grad);
+  if(ws->block != NULL){
+    free(ws->block[0].curv);
+    free(ws->block[0].grad);
+    free(ws->block);
+  }
+  free_lin_eq_ws(&ws->solver);
+  if(ws->pool != NULL){
+    g_thread_pool_free(ws->pool,FALSE,TRUE); //no blocks are queued between passes, so this just stops the threads
+    g_mutex_clear(&ws->blockLock);
+    g_cond_clear(&ws->blockDone);
+  }
+  memset(ws,0,sizeof(fit_workspace));
+}
+
+#define FIT_PASS_SUMS  0 //evaluate the fit function and derivatives, and sums for the curvature matrix and vector
+#define FIT_PASS_CHISQ 1 //evaluate chisq only
+
+//evaluate the fit function and its derivative with respect to each parameter
+//at each bin of a block, for the current parameter values, and find the
+//sums over the block used to set up the curvature matrix (see setupFitSums)
+//and chisq (see getFitChisq)
+void evalFitBlock(fit_context *ctx, fit_block *block, const int fitType){
   int i,j;
-  long double chisq = 0.;
-  long double f;
-  double yval,xval;
-  for (i=fitpar.fitStartCh;i<=fitpar.fitEndCh;i+=drawing.contractFactor){
-    xval = i;
-    yval = getSpBinVal(0,i);
+  const fit_params *par = &ctx->par;
+  fit_workspace *ws = &ctx->ws;
+  unsigned int k,l;
+  const unsigned int dim = ws->dim;
+  long double peakDer[5];
+  long double weight,ydiff;
+  memset(block->curv,0,dim*dim*sizeof(long double));
+  memset(block->grad,0,dim*sizeof(long double));
+  block->chisq = 0.;
+  for(i=block->startBin;i<block->endBin;i++){
+    long double xval = ws->xval[i];
+    long double *der = &ws->jac[(size_t)i*dim];
+    memset(der,0,dim*sizeof(long double));
     //background term
-    f = fitpar.fitParVal[0] + fitpar.fitParVal[1]*xval + fitpar.fitParVal[2]*xval*xval;
+    der[0] = 1.;
+    der[1] = xval;
+    der[2] = xval*xval;
+    long double f = evalFitBG(par,xval);
     //gaussian(s)
-    for(j=0;j<fitpar.numFitPeaks;j++){
-      f += fitpar.fitParVal[6+(3*j)]*(1.0 - fitpar.fitParVal[3])*evalGaussTerm(j,xval);
+    for(j=0;j<par->numFitPeaks;j++){
+      f += evalPeakTermDerivatives(par,j,xval,fitType,peakDer);
       if(fitType == 1){
-        f += fitpar.fitParVal[6+(3*j)]*fitpar.fitParVal[3]*evalSkewedGaussTerm(j,xval);
+        der[3] += peakDer[3];
+        der[4] += peakDer[4];
+      }
+      der[6+(3*j)] = peakDer[0];
+      der[7+(3*j)] = peakDer[1];
+      if(par->fixRelativeWidths){
+        der[8] += peakDer[2]; //widths of all peaks vary with the width of the first peak
+      }else{
+        der[8+(3*j)] = peakDer[2];
       }
-        
     }
-
-    //model cannot give less than 0 counts
-    /*if(f<0.)
-      return BIG_NUMBER;
-
-    //likelihood ratio chisq
-    if((f>0.)&&(yval > 0.)){
-      chisq += (f - yval + yval*log(yval/f));
-    }else{
-      chisq += f;
-    }*/
+    ws->model[i] = f;
     //pearson chisq
     if(f!=0.)
-      chisq += (f-yval)*(f-yval)/fabsl(f);
-    //printf("yval = %f, f = %f, chisq = %f\n",yval,f,chisq);
-    //getc(stdin);
+      block->chisq += (f-ws->yval[i])*(f-ws->yval[i])/fabsl(f);
+
+    ydiff = ws->yval[i] - f;
+    if(par->weightMode == 0){
+      weight = ws->dataWeight[i];
+    }else if(par->weightMode == 1){
+      weight = f;
+    }else{
+      weight = 1.;
+    }
+    if(weight < 0.){
+      weight=fabsl(weight);
+    }
+    if(weight != 0){
+      //rank-1 update of the upper triangle of the matrix
+      for(k=0;k<dim;k++){
+        if(der[k] == 0.){
+          continue; //unused or fixed parameter
+        }
+        long double derWeighted = der[k]/weight;
+        block->grad[k] += ydiff*derWeighted;
+        for(l=k;l<dim;l++){
+          block->curv[k*dim + l] += derWeighted*der[l];
+        }
+      }
+    }
   }
-  return (double)chisq;
 }
 
-unsigned char getParameterErrors(lin_eq_type *linEq){
-
+//evaluate chisq over the bins of a block, for the current parameter values
+//(the fit function derivatives aren't evaluated)
+void evalFitBlockChisq(const fit_context *ctx, fit_block *block, const int fitType){
   int i;
+  const fit_workspace *ws = &ctx->ws;
+  block->chisq = 0.;
+  for(i=block->startBin;i<block->endBin;i++){
+    long double f = evalFit(&ctx->par,ws->xval[i],fitType);
+    if(f!=0.)
+      block->chisq += (f-ws->yval[i])*(f-ws->yval[i])/fabsl(f);
+  }
+}
 
-  //Calculate uncertainties from linear equation solution
-  if(linEq->dim != 6 + (3*fitpar.numFitPeaks)){
-    printf("WARNING: trying to get parameter errors without all parameters in use!\n");
+//evaluate one block of the fit region, on a worker thread
+void fitBlockThread(gpointer data, gpointer user_data){
+  fit_block *block = (fit_block*)data;
+  fit_context *ctx = (fit_context*)user_data;
+  if(ctx->ws.blockPass == FIT_PASS_CHISQ){
+    evalFitBlockChisq(ctx,block,ctx->ws.blockFitType);
+  }else{
+    evalFitBlock(ctx,block,ctx->ws.blockFitType);
   }
-  for(i=0;i<linEq->dim;i++){
-    if(fitpar.fixPar[i] == 0){
-      //printf("i: %i, inv: %10.4Lf, weight: %10.4Lf\n",i,linEq->inv_matrix[i][i],linEq->mat_weights[i][i]);
-      fitpar.fitParErr[i]=sqrtl(fabsl(linEq->inv_matrix[i][i]*linEq->mat_weights[i][i]));
-    }else{
-      fitpar.fitParErr[i]=0.;
+  if(ctx->ws.pool != NULL){
+    g_mutex_lock(&ctx->ws.blockLock);
+    ctx->ws.numBlocksLeft--;
+    if(ctx->ws.numBlocksLeft == 0){
+      g_cond_signal(&ctx->ws.blockDone);
     }
+    g_mutex_unlock(&ctx->ws.blockLock);
   }
+}
 
-  if(fitpar.fixRelativeWidths){ 
-    for(i=1;i<fitpar.numFitPeaks;i++){
-      fitpar.fitParErr[8+(3*i)] = fitpar.relWidths[i]*sqrtl(fabsl(linEq->inv_matrix[8][8]*linEq->mat_weights[8][8]));
+//evaluate all blocks of the fit region (pass is FIT_PASS_SUMS or FIT_PASS_CHISQ),
+//on the workspace's pool of worker threads if there is more than one block
+//(the pool is started on the first pass, and reused for later passes)
+//returns chisq over the fit region (block sums are added in order, so that the
+//result doesn't depend on the number of threads)
+double runFitBlocks(fit_context *ctx, const int pass, const int fitType){
+  int i;
+  fit_workspace *ws = &ctx->ws;
+  long double chisq = 0.;
+  ws->blockPass = pass;
+  ws->blockFitType = fitType;
+  if((ws->pool == NULL)&&(ws->numBlocks > 1)&&(ws->numThreads > 1)){
+    g_mutex_init(&ws->blockLock);
+    g_cond_init(&ws->blockDone);
+    ws->pool = g_thread_pool_new(fitBlockThread,ctx,(ws->numBlocks < ws->numThreads) ? ws->numBlocks : ws->numThreads,FALSE,NULL);
+    if(ws->pool == NULL){
+      g_mutex_clear(&ws->blockLock);
+      g_cond_clear(&ws->blockDone);
+      ws->numThreads = 1; //don't try again on later passes
+    }
+  }
+  if(ws->pool != NULL){
+    g_mutex_lock(&ws->blockLock);
+    ws->numBlocksLeft = ws->numBlocks;
+    g_mutex_unlock(&ws->blockLock);
+    for(i=0;i<ws->numBlocks;i++){
+      g_thread_pool_push(ws->pool,&ws->block[i],NULL);
+    }
+    g_mutex_lock(&ws->blockLock);
+    while(ws->numBlocksLeft > 0){
+      g_cond_wait(&ws->blockDone,&ws->blockLock); //wait for all blocks to be evaluated
+    }
+    g_mutex_unlock(&ws->blockLock);
+  }else{
+    //single block, or no worker threads
+    for(i=0;i<ws->numBlocks;i++){
+      fitBlockThread(&ws->block[i],ctx);
     }
   }
+  for(i=0;i<ws->numBlocks;i++){
+    chisq += ws->block[i].chisq;
+  }
+  return (double)chisq;
+}
 
-  //add Guassian parameter errors in quadrature against Cramer–Rao lower bounds
-  //ie. I'm assuming the errors on the fit parameters and the errors from
-  //Poisson statistics are independent
-  for(i=0;i<fitpar.numFitPeaks;i++){
-    //Cramer–Rao lower bound variances
-    //(see https://en.wikipedia.org/wiki/Gaussian_function#Gaussian_profile_estimation for an explanation)
-    long double aCRLB = fabsl(3.0*fitpar.fitParVal[6+(3*i)]/(2.0*sqrt(2.0*G_PI)*fitpar.fitParVal[8+(3*i)]));
-    long double pCRLB = fabsl(fitpar.fitParVal[8+(3*i)]/(sqrt(2.0*G_PI)*fitpar.fitParVal[6+(3*i)]));
-    long double wCRLB = fabsl(fitpar.fitParVal[8+(3*i)]/(2.0*sqrt(2.0*G_PI)*fitpar.fitParVal[6+(3*i)]));
+//evaluate the fit function and its derivative with respect to each parameter
+//at each bin of a fit workspace, for the current parameter values, along with
+//the sums used by setupFitSums
+//returns chisq evaluated for the current fit (see getFitChisq)
+double evalFitWorkspace(fit_context *ctx, const int fitType){
+  return runFitBlocks(ctx,FIT_PASS_SUMS,fitType);
+}
 
-    fitpar.fitParErr[6+(3*i)] = sqrtl(fitpar.fitParErr[6+(3*i)]*fitpar.fitParErr[6+(3*i)] + aCRLB);
-    fitpar.fitParErr[7+(3*i)] = sqrtl(fitpar.fitParErr[7+(3*i)]*fitpar.fitParErr[7+(3*i)] + pCRLB);
-    fitpar.fitParErr[8+(3*i)] = sqrtl(fitpar.fitParErr[8+(3*i)]*fitpar.fitParErr[8+(3*i)] + wCRLB);
+//function returns chisq evaluated for the current fit, using the data
+//in a fit workspace (the fit function derivatives aren't evaluated)
+double getFitWorkspaceChisq(fit_context *ctx, const int fitType){
+  return runFitBlocks(ctx,FIT_PASS_CHISQ,fitType);
+}
+
+//factor the curvature matrix of the parameters which aren't fixed (scaled
+//so that its diagonal is 1 + flambda), using sums from setupFitSums
+//returns 1 if successful, 0 if the matrix is singular
+int factorFitMatrix(fit_workspace *ws, const double flambda){
+  unsigned int i,j;
+  if(alloc_lin_eq_ws(&ws->solver,ws->numActive)==0){
+    return 0;
+  }
+  for(i=0;i<ws->numActive;i++){
+    for(j=0;j<ws->numActive;j++){
+      if(i!=j){
+        ws->solver.matrix[i*ws->numActive + j] = (double)ws->curv[ws->activePar[i]*ws->dim + ws->activePar[j]]*ws->scale[i]*ws->scale[j];
+      }else{
+        ws->solver.matrix[i*ws->numActive + j] = flambda + 1.0;
+      }
+    }
   }
+  return factor_lin_eq(&ws->solver);
+}
 
+//find the change in each parameter for a fit iteration with the given flambda
+//(into ws->solution), using sums from setupFitSums
+//returns 1 if successful, 0 if the curvature matrix is singular
+int solveFitStep(fit_workspace *ws, const double flambda){
+  unsigned int i;
+  double vector[MAX_DIM];
+  if(factorFitMatrix(ws,flambda)==0){
+    return 0;
+  }
+  for(i=0;i<ws->numActive;i++){
+    vector[i] = (double)ws->grad[ws->activePar[i]]*ws->scale[i];
+  }
+  solve_factored_lin_eq(&ws->solver,vector,vector);
+  memset(ws->solution,0,sizeof(ws->solution));
+  for(i=0;i<ws->numActive;i++){
+    ws->solution[ws->activePar[i]] = vector[i]*ws->scale[i];
+  }
   return 1;
 }
 
+//get parameter errors from the diagonal of the inverse curvature matrix
+//(the rest of the inverse isn't needed), using sums from setupFitSums
+//returns 1 if successful
+unsigned char getParameterErrors(fit_context *ctx){
 
-void modifyLinEqFlambda(lin_eq_type *linEq, const double flambda){
-  int i;
-  //modify the curvature matrix
-  for(i=0;i<linEq->dim;i++){
-    linEq->matrix[i][i] = flambda + 1.0;
-  }
+  unsigned int i;
+  fit_params *par = &ctx->par;
+  fit_workspace *ws = &ctx->ws;
+  double invDiag[MAX_DIM];
 
-  /*printf("\nModifying flambda to %e, matrix\n", flambda);
-  int j;
-  for(i=0;i<linEq->dim;i++){
-    for(j=0;j<linEq->dim;j++){
-      printf("%10.4Lf ",linEq->matrix[i][j]);
-    }
-    printf("\n");
+  //Calculate uncertainties from linear equation solution
+  if(factorFitMatrix(ws,0.)==0){
+    return 0;
   }
-  printf("Weight Matrix\n");
-  for(i=0;i<linEq->dim;i++){
-    for(j=0;j<linEq->dim;j++){
-      printf("%10.4Lf ",linEq->mat_weights[i][j]);
+  get_inv_diag(&ws->solver,invDiag);
+  memset(par->fitParErr,0,sizeof(par->fitParErr));
+  for(i=0;i<ws->numActive;i++){
+    par->fitParErr[ws->activePar[i]] = sqrt(fabs(invDiag[i]))*ws->scale[i];
+  }
+
+  if(par->fixRelativeWidths){ 
+    for(i=1;i<par->numFitPeaks;i++){
+      par->fitParErr[8+(3*i)] = par->relWidths[i]*par->fitParErr[8];
     }
-    printf("\n");
   }
-  printf("Vector\n");
-  for(i=0;i<linEq->dim;i++){
-    printf("%10.4Lf ",linEq->vector[i]);
+
+  //add Guassian parameter errors in quadrature against Cramer–Rao lower bounds
+  //ie. I'm assuming the errors on the fit parameters and the errors from
+  //Poisson statistics are independent
+  for(i=0;i<par->numFitPeaks;i++){
+    //Cramer–Rao lower bound variances
+    //(see https://en.wikipedia.org/wiki/Gaussian_function#Gaussian_profile_estimation for an explanation)
+    long double aCRLB = fabsl(3.0*par->fitParVal[6+(3*i)]/(2.0*sqrt(2.0*G_PI)*par->fitParVal[8+(3*i)]));
+    long double pCRLB = fabsl(par->fitParVal[8+(3*i)]/(sqrt(2.0*G_PI)*par->fitParVal[6+(3*i)]));
+    long double wCRLB = fabsl(par->fitParVal[8+(3*i)]/(2.0*sqrt(2.0*G_PI)*par->fitParVal[6+(3*i)]));
+
+    par->fitParErr[6+(3*i)] = sqrtl(par->fitParErr[6+(3*i)]*par->fitParErr[6+(3*i)] + aCRLB);
+    par->fitParErr[7+(3*i)] = sqrtl(par->fitParErr[7+(3*i)]*par->fitParErr[7+(3*i)] + pCRLB);
+    par->fitParErr[8+(3*i)] = sqrtl(par->fitParErr[8+(3*i)]*par->fitParErr[8+(3*i)] + wCRLB);
   }
-  printf("\n\n");*/
 
+  return 1;
 }
 
 //setup sums for the non-linearized fit
 //using a CURFIT-like method
 //see eq. 2.4.14, 2.4.15, pg. 47 J. Wolberg 
 //'Data Analysis Using the Method of Least Squares'
+//the sums over each block of bins in the fit region are found when the fit
+//function is evaluated (see evalFitWorkspace), each bin adds a rank-1 update
 //returns 1 if successful
-int setupFitSums(lin_eq_type *linEq, const double flambda, const int fitType){
-
-  int i,j,k;
-  long double cmatrix[MAX_DIM][MAX_DIM];
-  memset(linEq->matrix,0,sizeof(linEq->matrix));
-  memset(linEq->vector,0,sizeof(linEq->vector));
-  memset(linEq->solution,0,sizeof(linEq->solution));
-  memset(linEq->inv_matrix,0,sizeof(linEq->inv_matrix));
-  memset(linEq->mat_weights,0,sizeof(linEq->mat_weights));
-  memset(cmatrix,0,sizeof(cmatrix));
-  long double xval,weight,ydiff;
-  long double rDerSum = 0.;
-  long double betaDerSum = 0.;
-  long double widthDerSum = 0.;
-  int peakNum, peakNum2, parNum, parNum2;
-
-  linEq->dim = 6 + (3*(unsigned int)fitpar.numFitPeaks);
-
-  for(i=fitpar.fitStartCh;i<=fitpar.fitEndCh;i+=drawing.contractFactor){
-
-    xval = (long double)(i);
-    ydiff = getSpBinVal(0,i) - evalFit(xval,fitType);
-
-    if(fitpar.weightMode == 0){
-      weight = getSpBinFitWeight(0,i);
-    }else if(fitpar.weightMode == 1){
-      weight = evalFit(xval,fitType);
-    }else{
-      weight = 1.;
-    }
+int setupFitSums(fit_context *ctx, const int fitType){
 
-    if(weight < 0.){
-      weight=fabsl(weight);
-    }
-
-    if(weight != 0){
-
-      //parameters 0-2: background (always used)
-      linEq->matrix[0][0] += 1./weight;
-      linEq->matrix[0][1] += xval/weight;
-      linEq->matrix[0][2] += xval*xval/weight;
-      linEq->matrix[1][1] += xval*xval/weight;
-      linEq->matrix[1][2] += xval*xval*xval/weight;
-      linEq->matrix[2][2] += xval*xval*xval*xval/weight;
-      linEq->vector[0] += ydiff/weight;
-      linEq->vector[1] += ydiff*xval/weight;
-      linEq->vector[2] += ydiff*xval*xval/weight;
-
-      if(fitType == 1){
-        //parameters 3 and 4: R and beta
-        rDerSum = 0.;
-        betaDerSum = 0.;
-        for(j=0;j<fitpar.numFitPeaks;j++){
-          rDerSum += evalAllTermDerivative(j,xval,3,fitType);
-          betaDerSum += evalSkewedGaussTermDerivative(j,xval,4);
-        }
-        linEq->matrix[0][3] += rDerSum/weight;
-        linEq->matrix[1][3] += xval*rDerSum/weight;
-        linEq->matrix[2][3] += xval*xval*rDerSum/weight;
-        linEq->matrix[3][3] += rDerSum*rDerSum/weight;
-        linEq->matrix[0][4] += betaDerSum/weight;
-        linEq->matrix[1][4] += xval*betaDerSum/weight;
-        linEq->matrix[2][4] += xval*xval*betaDerSum/weight;
-        linEq->matrix[3][4] += rDerSum*betaDerSum/weight;
-        linEq->matrix[4][4] += betaDerSum*betaDerSum/weight;
-        linEq->vector[3] += ydiff*rDerSum/weight;
-        linEq->vector[4] += ydiff*betaDerSum/weight;
-      }    
-
-      if(fitpar.fixRelativeWidths){
-        //parameter 8: width
-        widthDerSum = 0.;
-        for(j=0;j<fitpar.numFitPeaks;j++){
-          widthDerSum += evalAllTermDerivative(j,xval,2,fitType);
-        }
-        linEq->matrix[0][8] += widthDerSum/weight;
-        linEq->matrix[1][8] += xval*widthDerSum/weight;
-        linEq->matrix[2][8] += xval*xval*widthDerSum/weight;
-        if(fitType == 1){
-          linEq->matrix[3][8] += rDerSum*widthDerSum/weight;
-          linEq->matrix[4][8] += betaDerSum*widthDerSum/weight;
-        }
-        linEq->matrix[8][8] += widthDerSum*widthDerSum/weight;
-        linEq->vector[8] += ydiff*widthDerSum/weight;
-      
-        //parameters 7, 8, 10, 11, 13, 14... : amplitudes, positions
-        for(j=6;j<linEq->dim;j++){
-          peakNum = (int)((j-6)/3);
-          parNum = j % 3;
-          if(parNum < 2){
-            linEq->matrix[0][j] += evalAllTermDerivative(peakNum,xval,parNum,fitType)/weight;
-            linEq->matrix[1][j] += xval*evalAllTermDerivative(peakNum,xval,parNum,fitType)/weight;
-            linEq->matrix[2][j] += xval*xval*evalAllTermDerivative(peakNum,xval,parNum,fitType)/weight;
-            if(fitType == 1){
-              linEq->matrix[3][j] += rDerSum*evalAllTermDerivative(peakNum,xval,parNum,fitType)/weight;
-              linEq->matrix[4][j] += betaDerSum*evalAllTermDerivative(peakNum,xval,parNum,fitType)/weight;
-            }
-            if(j>=8){
-              linEq->matrix[8][j] += widthDerSum*evalAllTermDerivative(peakNum,xval,parNum,fitType)/weight;
-            }
-            linEq->vector[j] += ydiff*evalAllTermDerivative(peakNum,xval,parNum,fitType)/weight;
-            //printf("j: %i, j-4/2: %i, jmod2: %i\n",j,(int)(j-6)/2,j % 2);
-            for(k=6;k<=j;k++){
-              peakNum2 = (int)((k-6)/3);
-              parNum2 = k % 3;
-              if(parNum2 < 2){
-                linEq->matrix[k][j] += evalAllTermDerivative(peakNum,xval,parNum,fitType)*evalAllTermDerivative(peakNum2,xval,parNum2,fitType)/weight;
-              }
-            }
-          }
-          
-        }
-      }else{ //fitpar.fixRelativeWidths = 0
-        //parameters 7 and above: amplitudes, positions, widths
-        for(j=6;j<linEq->dim;j++){
-          peakNum = (int)((j-6)/3);
-          parNum = j % 3;
-          linEq->matrix[0][j] += evalAllTermDerivative(peakNum,xval,parNum,fitType)/weight;
-          linEq->matrix[1][j] += xval*evalAllTermDerivative(peakNum,xval,parNum,fitType)/weight;
-          linEq->matrix[2][j] += xval*xval*evalAllTermDerivative(peakNum,xval,parNum,fitType)/weight;
-          if(fitType == 1){
-            linEq->matrix[3][j] += rDerSum*evalAllTermDerivative(peakNum,xval,parNum,fitType)/weight;
-            linEq->matrix[4][j] += betaDerSum*evalAllTermDerivative(peakNum,xval,parNum,fitType)/weight;
-          }
-          linEq->vector[j] += ydiff*evalAllTermDerivative(peakNum,xval,parNum,fitType)/weight;
-          //printf("j: %i, j-3/3: %i, jmod3: %i\n",j,(int)(j-5)/3,j % 3);
-          for(k=6;k<=j;k++){
-            peakNum2 = (int)((k-6)/3);
-            parNum2 = k % 3;
-            linEq->matrix[k][j] += evalAllTermDerivative(peakNum,xval,parNum,fitType)*evalAllTermDerivative(peakNum2,xval,parNum2,fitType)/weight;
-            //printf("weight: %f, j: %i, k: %i, evalgaussder j: %f, evalgaussder k: %f\n",weight,j,k,evalAllTermDerivative((int)(j-5)/3,xval,j % 3),evalAllTermDerivative((int)(k-5)/3,xval,k % 3));
-          }
-        }
+  int i;
+  const fit_params *par = &ctx->par;
+  fit_workspace *ws = &ctx->ws;
+  unsigned int j,k;
+  const unsigned int dim = ws->dim;
+  memset(ws->curv,0,dim*dim*sizeof(long double));
+  memset(ws->grad,0,dim*sizeof(long double));
+
+  //add the sums from each block, in order
+  for(i=0;i<ws->numBlocks;i++){
+    for(j=0;j<dim;j++){
+      ws->grad[j] += ws->block[i].grad[j];
+      for(k=j;k<dim;k++){
+        ws->curv[j*dim + k] += ws->block[i].curv[j*dim + k];
       }
-
     }
-
   }
 
   //mirror the matrix
-  for(i=0;i<linEq->dim;i++){
-    for(j=(i+1);j<linEq->dim;j++){
-      linEq->matrix[j][i] = linEq->matrix[i][j];
+  for(j=0;j<dim;j++){
+    for(k=(j+1);k<dim;k++){
+      ws->curv[k*dim + j] = ws->curv[j*dim + k];
     }
   }
 
-  /*printf("Orig Matrix\n");
-  for(i=0;i<linEq->dim;i++){
-    for(j=0;j<linEq->dim;j++){
-      printf("%10.4Lf ",linEq->matrix[i][j]);
-    }
-    printf("\n");
-  }*/
-
-  //check if matrix has zeroes
-  for(i=0;i<linEq->dim;i++){
-    if(fitpar.fixPar[i] == 0){
-      if(linEq->matrix[i][i] == 0.){
-        printf("WARNING: matrix element %i is zero, cannot solve.\n",i);
+  //check if matrix has zeroes, and get the scaling of the curvature matrix
+  //for the parameters which aren't fixed (see factorFitMatrix)
+  ws->numActive = 0;
+  for(j=0;j<dim;j++){
+    if(par->fixPar[j] == 0){
+      if(ws->curv[j*dim + j] == 0.){
+        if(ctx->quiet == 0){
+          printf("WARNING: matrix element %u is zero, cannot solve.\n",j);
+        }
         return 0;
       }
+      ws->activePar[ws->numActive] = j;
+      ws->scale[ws->numActive] = (double)(1.0/sqrtl(fabsl(ws->curv[j*dim + j])));
+      ws->numActive++;
     }
   } 
 
-  //modify the curvature matrix
-  for(i=0;i<linEq->dim;i++){
-    if(fitpar.fixPar[i] == 0){
-      for(j=0;j<linEq->dim;j++){
-        if(fitpar.fixPar[j] == 0){
-          if(i!=j){
-            linEq->mat_weights[i][j] = 1.0/sqrtl(linEq->matrix[i][i]*linEq->matrix[j][j]);
-            cmatrix[i][j] = linEq->matrix[i][j]*linEq->mat_weights[i][j];
-          }
-        }
-      }
-      linEq->mat_weights[i][i] = 1.0/sqrtl(linEq->matrix[i][i]*linEq->matrix[i][i]);
-    }
-  }
-
-  memcpy(linEq->matrix,cmatrix,sizeof(linEq->matrix));
-
-  modifyLinEqFlambda(linEq,flambda);
-
-  /*printf("Matrix\n");
-  for(i=0;i<linEq->dim;i++){
-    for(j=0;j<linEq->dim;j++){
-      printf("%10.4Lf ",linEq->matrix[i][j]);
-    }
-    printf("\n");
-  }
-  printf("Weight Matrix\n");
-  for(i=0;i<linEq->dim;i++){
-    for(j=0;j<linEq->dim;j++){
-      printf("%10.4Lf ",linEq->mat_weights[i][j]);
-    }
-    printf("\n");
-  }
-  printf("Vector\n");
-  for(i=0;i<linEq->dim;i++){
-    printf("%10.4Lf ",linEq->vector[i]);
-  }
-  printf("\n");*/
-  //getc(stdin);
-
   return 1;
 
 }
 
 //function which specifies constraining conditions for peak fit parameters
-int areParsValid(const int fitType){
+int areParsValid(const fit_context *ctx, const int fitType){
   int i;
-  int fitRange = fitpar.fitEndCh - fitpar.fitStartCh;
-  for(i=0;i<fitpar.numFitPeaks;i+=3){
+  const fit_params *par = &ctx->par;
+  int fitRange = par->fitEndCh - par->fitStartCh;
+  for(i=0;i<par->numFitPeaks;i+=3){
     
-    if(fitpar.fitParVal[7+(3*i)] < fitpar.fitStartCh){
+    if(par->fitParVal[7+(3*i)] < par->fitStartCh){
       return 0;
     }
-    if(fitpar.fitParVal[7+(3*i)] > fitpar.fitEndCh){
+    if(par->fitParVal[7+(3*i)] > par->fitEndCh){
       return 0;
     }
-    if(fabsl(fitpar.fitParVal[7+(3*i)] - fitpar.fitPeakInitGuess[i]) > (fitRange)/2.){
+    if(fabsl(par->fitParVal[7+(3*i)] - par->fitPeakInitGuess[i]) > (fitRange)/2.){
       return 0;
     }
-    if(fabsl(fitpar.fitParVal[8+(3*i)]) > (fitRange)/2.){
+    if(fabsl(par->fitParVal[8+(3*i)]) > (fitRange)/2.){
       return 0;
-    }else if(fitpar.fitParVal[8+(3*i)] <= 0.){
+    }else if(par->fitParVal[8+(3*i)] <= 0.){
       return 0; //cannot have 0 or negative width
     }
-    if(getSpBinVal(0,(int)fitpar.fitPeakInitGuess[i]) > 0){
-      if(fitpar.fitParVal[6+(3*i)] < 0.){
+    if(getFitDataVal(ctx,(int)par->fitPeakInitGuess[i]) > 0){
+      if(par->fitParVal[6+(3*i)] < 0.){
         return 0;
       }
     }else{
-      if(fitpar.fitParVal[6+(3*i)] > 0.){
+      if(par->fitParVal[6+(3*i)] > 0.){
         return 0;
       }
     }
   }
   if(fitType == 1){
-    if(fitpar.fixPar[3]==0){
-      if(fitpar.fitParVal[3]!=fitpar.fitParVal[3]){
+    if(par->fixPar[3]==0){
+      if(par->fitParVal[3]!=par->fitParVal[3]){
         return 0;
       }
-      if((fitpar.fitParVal[3] < -1.0)||(fitpar.fitParVal[3] > 1.0)){
+      if((par->fitParVal[3] < -1.0)||(par->fitParVal[3] > 1.0)){
         return 0;
       }
     }
-    if(fitpar.fixPar[4]==0){
-      if(fitpar.fitParVal[4]!=fitpar.fitParVal[4]){
+    if(par->fixPar[4]==0){
+      if(par->fitParVal[4]!=par->fitParVal[4]){
         return 0;
       }
-      if(fitpar.fitParVal[4] < 0.0){
+      if(par->fitParVal[4] < 0.0){
         return 0;
       }
 
@@ -729,9 +754,11 @@ int areParsValid(const int fitType){
 
 //non-linearized fitting
 //return value: number of iterations performed (if fit not converged), -1 (if fit converged)
-int nonLinearizedGausFit(const unsigned int numIter, const double convergenceFrac, lin_eq_type *linEq, const int fitType){
+int nonLinearizedGausFit(const unsigned int numIter, const double convergenceFrac, fit_context *ctx, const int fitType){
 
   int i;
+  fit_params *par = &ctx->par;
+  fit_workspace *ws = &ctx->ws;
   int iterCurrent = 0;
   int conv = 0; //converged?
   int lmCount = 0; //counter if at a chisq local minimum
@@ -743,17 +770,21 @@ int nonLinearizedGausFit(const unsigned int numIter, const double convergenceFra
 
   while(iterCurrent < numIter){
 
-    iterStartChisq = getFitChisq(fitType);
-    memcpy(prevFitParVal,fitpar.fitParVal,sizeof(fitpar.fitParVal));
+    if((ctx->cancel != NULL)&&(g_atomic_int_get(ctx->cancel))){
+      return iterCurrent; //fit cancelled
+    }
 
-    /*printf("\nFit iteration %i - A: %Lf, B: %Lf, C: %Lf\n",iterCurrent, fitpar.fitParVal[0],fitpar.fitParVal[1],fitpar.fitParVal[2]);
-    for(i=0;i<fitpar.numFitPeaks;i++){
-      printf("A%i: %Lf, P%i: %Lf, W%i: %Lf\n",i+1,fitpar.fitParVal[6+(3*i)],i+1,fitpar.fitParVal[7+(3*i)],i+1,fitpar.fitParVal[8+(3*i)]);
+    iterStartChisq = evalFitWorkspace(ctx,fitType); //also evaluates derivatives used by setupFitSums
+    memcpy(prevFitParVal,par->fitParVal,sizeof(par->fitParVal));
+
+    /*printf("\nFit iteration %i - A: %Lf, B: %Lf, C: %Lf\n",iterCurrent, par->fitParVal[0],par->fitParVal[1],par->fitParVal[2]);
+    for(i=0;i<par->numFitPeaks;i++){
+      printf("A%i: %Lf, P%i: %Lf, W%i: %Lf\n",i+1,par->fitParVal[6+(3*i)],i+1,par->fitParVal[7+(3*i)],i+1,par->fitParVal[8+(3*i)]);
     }
     printf("chisq: %f\n",iterStartChisq);
     printf("\n");*/
 
-    if(!(setupFitSums(linEq,flambda,fitType))){
+    if(!(setupFitSums(ctx,fitType))){
       //the return value being less than the requested number of iterations indicates a failure
       return iterCurrent; 
     }
@@ -766,60 +797,49 @@ int nonLinearizedGausFit(const unsigned int numIter, const double convergenceFra
           flambda = .001;
         }
         //revert fit parameters
-        memcpy(fitpar.fitParVal,prevFitParVal,sizeof(fitpar.fitParVal));
-        //modify the matrix
-        modifyLinEqFlambda(linEq,flambda);
+        memcpy(par->fitParVal,prevFitParVal,sizeof(par->fitParVal));
       }
 
-      if(!(solve_lin_eq(linEq,1))){
+      if(!(solveFitStep(ws,flambda))){
         //the return value being less than the requested number of iterations indicates a failure
         return iterCurrent; 
       }else{
         iterCurrent++;
         conv=1;
 
-        /*printf("Inv Matrix\n");
-        int j;
-        for(i=0;i<linEq->dim;i++){
-          for(j=0;j<linEq->dim;j++){
-            printf("%10.4Lf ",linEq->inv_matrix[i][j]);
-          }
-          printf("\n");
-        }*/
-
         /*printf("Solution\n");
-        for(i=0;i<linEq->dim;i++){
-          printf("%10.4Lf ",linEq->solution[i]);
+        for(i=0;i<(int)ws->dim;i++){
+          printf("%10.4f ",ws->solution[i]);
         }
         printf("\n");*/
 
         //assign parameter values
-        for(i=0;i<linEq->dim;i++){
-          if(fitpar.fixPar[i] == 0){
-            if((fitpar.fitParVal[i]!=0.)&&(fabsl(linEq->solution[i]/fitpar.fitParVal[i]) > convergenceFrac)){
-              //printf("frac %i: %f\n",i,fabs(linEq->solution[i]/fitpar.fitParVal[i]));
+        for(i=0;i<(int)ws->dim;i++){
+          if(par->fixPar[i] == 0){
+            if((par->fitParVal[i]!=0.)&&(fabsl(ws->solution[i]/par->fitParVal[i]) > convergenceFrac)){
+              //printf("frac %i: %f\n",i,fabs(ws->solution[i]/par->fitParVal[i]));
               conv=0;
             }
-            fitpar.fitParVal[i] += linEq->solution[i];
-            //printf("par %i: %f\n",i,fitpar.fitParVal[i]);
+            par->fitParVal[i] += ws->solution[i];
+            //printf("par %i: %f\n",i,par->fitParVal[i]);
           }
         }
 
-        if(fitpar.fixRelativeWidths){
-          for(i=0;i<fitpar.numFitPeaks;i++){
-            if((fitpar.fitParVal[8+(3*i)]!=0.)&&(fabsl(fitpar.relWidths[i]*linEq->solution[8]/fitpar.fitParVal[8+(3*i)]) > convergenceFrac)){
+        if(par->fixRelativeWidths){
+          for(i=0;i<par->numFitPeaks;i++){
+            if((par->fitParVal[8+(3*i)]!=0.)&&(fabsl(par->relWidths[i]*ws->solution[8]/par->fitParVal[8+(3*i)]) > convergenceFrac)){
               conv=0;
             }
-            fitpar.fitParVal[8+(3*i)] += fitpar.relWidths[i]*linEq->solution[8];
-            //printf("par %i: %f\n",6+i,fitpar.fitParVal[6+i]);
+            par->fitParVal[8+(3*i)] += par->relWidths[i]*ws->solution[8];
+            //printf("par %i: %f\n",6+i,par->fitParVal[6+i]);
           }
         }
 
         //check chisq, if it increased change value of flambda and try again
-        iterEndChisq = getFitChisq(fitType);
+        iterEndChisq = getFitWorkspaceChisq(ctx,fitType);
         //printf("Start chisq: %f, end chisq: %f\n",iterStartChisq,iterEndChisq);
 
-        if(areParsValid(fitType) != 0){
+        if(areParsValid(ctx,fitType) != 0){
           if((iterEndChisq!=iterEndChisq)||((iterEndChisq > iterStartChisq)&&(iterEndChisq > 0.))){
             if(flambda < 2.0){
               flambda *= 2.0;
@@ -846,7 +866,7 @@ int nonLinearizedGausFit(const unsigned int numIter, const double convergenceFra
             doneIter = -1;
           }else{
             //revert fit parameters
-            memcpy(fitpar.fitParVal,prevFitParVal,sizeof(fitpar.fitParVal));
+            memcpy(par->fitParVal,prevFitParVal,sizeof(par->fitParVal));
             flambda /= 10.;
             doneIter = 1;
           }
@@ -864,106 +884,242 @@ int nonLinearizedGausFit(const unsigned int numIter, const double convergenceFra
 }
 
 
-//fitting routine
-void performGausFit(){
+//fitting routine, fits the data in a fit context starting from the initial
+//guesses in the context (see setFitInitGuesses)
+//returns 1 if successful, 0 if the fit failed
+int performGausFit(fit_context *ctx){
   int i;
-  lin_eq_type linEq;
+  fit_params *par = &ctx->par;
+
+  if(allocFitWorkspace(ctx)==0){
+    freeFitWorkspace(&ctx->ws);
+    return 0;
+  }
 
   //initially fix skew parameters (first fit symmetric shape, then vary these after)
-  fitpar.fitParVal[3] = 0.0; //unused in this fit
-  fitpar.fitParVal[4] = 0.0; //unused in this fit
-  fitpar.fixPar[3] = 1; //fix unused parameter at zero
-  fitpar.fixPar[4] = 1; //fix unused parameter at zero
+  par->fitParVal[3] = 0.0; //unused in this fit
+  par->fitParVal[4] = 0.0; //unused in this fit
+  par->fixPar[3] = 1; //fix unused parameter at zero
+  par->fixPar[4] = 1; //fix unused parameter at zero
 
   //do non-linearized fit
   unsigned int numNLIterTry = 50;
-  int numNLIter = nonLinearizedGausFit(numNLIterTry, 0.001, &linEq,0);
+  int numNLIter = nonLinearizedGausFit(numNLIterTry, 0.001, ctx, 0);
   if(numNLIter >= numNLIterTry){
     //printf("Fit did not converge after %i iterations.  Continuing...\n",numNLIter);
-    guiglobals.fittingSp = 4;
-    g_idle_add(update_gui_fit_state,NULL);
+    if(ctx->stageFunc != NULL){
+      ctx->stageFunc(4);
+    }
     numNLIterTry = 100;
-    numNLIter = nonLinearizedGausFit(numNLIterTry, 0.001, &linEq,0);
+    numNLIter = nonLinearizedGausFit(numNLIterTry, 0.001, ctx, 0);
   }
 
   if(numNLIter == -1){
-    if(fitpar.fitType == 0){
+    if((par->fitType == 0)&&(ctx->quiet == 0)){
       printf("Non-linear fit converged.\n");
     }
-    //fitpar.errFound = getParameterErrors(&linEq);
+    //par->errFound = getParameterErrors(ctx);
   }else if(numNLIter < numNLIterTry){
-    printf("WARNING: failed fit, iteration %i.\n",numNLIter);
-    guiglobals.fittingSp = 0;
-    g_idle_add(update_gui_fit_state,NULL);
-    g_idle_add(print_fit_error,NULL);
-    return;
+    if(ctx->quiet == 0){
+      printf("WARNING: failed fit, iteration %i.\n",numNLIter);
+    }
+    freeFitWorkspace(&ctx->ws);
+    return 0;
   }
 
   //for skewed Guassian, allow R and beta to vary
-  if(fitpar.fitType == 1){
-    guiglobals.fittingSp = 5;
-    g_idle_add(update_gui_fit_state,NULL);
-    fitpar.fitParVal[3] = 0.05;
-    fitpar.fitParVal[4] = fitpar.fitParVal[8] / 2.0;
-    fitpar.fixPar[3] = 0; //unfix the R parameter
-    fitpar.fixPar[4] = 0; //unfix the beta parameter
+  if(par->fitType == 1){
+    if(ctx->stageFunc != NULL){
+      ctx->stageFunc(5);
+    }
+    par->fitParVal[3] = 0.05;
+    par->fitParVal[4] = par->fitParVal[8] / 2.0;
+    par->fixPar[3] = 0; //unfix the R parameter
+    par->fixPar[4] = 0; //unfix the beta parameter
     numNLIterTry = 100;
-    numNLIter = nonLinearizedGausFit(numNLIterTry, 0.001, &linEq, fitpar.fitType);
+    numNLIter = nonLinearizedGausFit(numNLIterTry, 0.001, ctx, par->fitType);
 
     if(numNLIter == -1){
-      printf("Non-linear fit converged.\n");
+      if(ctx->quiet == 0){
+        printf("Non-linear fit converged.\n");
+      }
     }else if(numNLIter < numNLIterTry){
-      printf("WARNING: failed fit, iteration %i.\n",numNLIter);
-      guiglobals.fittingSp = 0;
-      g_idle_add(update_gui_fit_state,NULL);
-      g_idle_add(print_fit_error,NULL);
-      return;
+      if(ctx->quiet == 0){
+        printf("WARNING: failed fit, iteration %i.\n",numNLIter);
+      }
+      freeFitWorkspace(&ctx->ws);
+      return 0;
     }
   }
 
   //get fit parameter uncertainties
-  fitpar.errFound = 0;
-  modifyLinEqFlambda(&linEq,0.);
-  if(solve_lin_eq(&linEq,1)){
-    fitpar.errFound = getParameterErrors(&linEq);
+  par->errFound = getParameterErrors(ctx);
+
+  //make sure widths are positive
+  for(i=0;i<par->numFitPeaks;i++){
+    if(par->fitParVal[8+(3*i)] < 0.){
+      par->fitParVal[8+(3*i)] = fabsl(par->fitParVal[8+(3*i)]);
+    }
+  }
+
+  par->chisq = getFitWorkspaceChisq(ctx,par->fitType);
+  freeFitWorkspace(&ctx->ws);
+
+  return 1;
+}
+
+//allocate a fit context for the given fit region, peaks, and options, with
+//space for a snapshot of the data around the fit region (the data is copied
+//in separately, see copyDispFitData)
+//returns NULL if the fit region can't be fit
+fit_context *allocFitContext(const fit_params *par, const int contractFactor){
+
+  int endCh;
+  fit_context *ctx;
+
+  if(contractFactor <= 0){
+    return NULL;
+  }
+  int ndf = (int)((par->fitEndCh - par->fitStartCh)/(1.0*contractFactor)) - (3+(3*(int)par->numFitPeaks));
+  if(ndf <= 0){
+    printf("Not enough degrees of freedom to fit!\n");
+    return NULL;
   }
 
-  /*printf("Matrix\n");
-  int j;
-  for(i=0;i<linEq.dim;i++){
-    for(j=0;j<linEq.dim;j++){
-      printf("%Lf ",linEq.matrix[i][j]);
+  ctx = calloc(1,sizeof(fit_context));
+  if(ctx == NULL){
+    printf("ERROR: cannot allocate memory for fit.\n");
+    return NULL;
+  }
+  memcpy(&ctx->par,par,sizeof(fit_params));
+  ctx->par.contractFactor = contractFactor;
+  ctx->par.ndf = ndf;
+
+  //the initial guesses use data on either side of the fit region
+  ctx->dataStartCh = par->fitStartCh - FIT_GUESS_MARGIN*contractFactor;
+  if(ctx->dataStartCh < 0){
+    ctx->dataStartCh = 0;
+  }
+  endCh = par->fitEndCh + (FIT_GUESS_MARGIN+1)*contractFactor;
+  if(endCh > S32K){
+    endCh = S32K;
+  }
+  ctx->numDataCh = endCh - ctx->dataStartCh;
+  if(ctx->numDataCh > 0){
+    ctx->dataVal = malloc((size_t)ctx->numDataCh*sizeof(float));
+    ctx->dataWeight = malloc((size_t)ctx->numDataCh*sizeof(float));
+    if((ctx->dataVal == NULL)||(ctx->dataWeight == NULL)){
+      printf("ERROR: cannot allocate memory for fit data.\n");
+      free(ctx->dataVal);
+      free(ctx->dataWeight);
+      free(ctx);
+      return NULL;
     }
-    printf("\n");
+  }else{
+    ctx->numDataCh = 0;
   }
-  printf("Vector\n");
-  for(i=0;i<linEq.dim;i++){
-    printf("%Lf ",linEq.vector[i]);
+
+  return ctx;
+}
+
+void freeFitContext(fit_context *ctx){
+  if(ctx == NULL){
+    return;
   }
-  printf("\n");*/
-  //getc(stdin);
+  freeFitWorkspace(&ctx->ws);
+  free(ctx->dataVal);
+  free(ctx->dataWeight);
+  free(ctx);
+}
 
-  //make sure widths are positive
-  for(i=0;i<fitpar.numFitPeaks;i++){
-    if(fitpar.fitParVal[8+(3*i)] < 0.){
-      fitpar.fitParVal[8+(3*i)] = fabsl(fitpar.fitParVal[8+(3*i)]);
+//copy the values of the first displayed spectrum into the data snapshot of a
+//fit context, should be called from the main thread
+void copyDispFitData(fit_context *ctx){
+  int i;
+  updateDispBuf(); //fit using cached displayed values, see spectrum_data.c
+  for(i=0;i<ctx->numDataCh;i++){
+    ctx->dataVal[i] = getSpBinVal(0,ctx->dataStartCh+i);
+    ctx->dataWeight[i] = getSpBinFitWeight(0,ctx->dataStartCh+i);
+  }
+}
+
+//copy spectra (spectrum indices spInd, scaled by scaleFactor) into the data
+//snapshot of a fit context, in the same way as they would be displayed (see
+//getSpBinValOrWeight), if sumSp is set the spectra are summed and weighted as
+//in the summed multiplot mode, otherwise only the first spectrum is used
+//should be called from the main thread
+void copySpFitData(fit_context *ctx, const int *spInd, const double *scaleFactor, const int numSp, const int sumSp){
+  int i,j;
+  const int cf = ctx->par.contractFactor;
+  if((sumSp == 0)||(numSp <= 0)){
+    for(i=0;i<ctx->numDataCh;i++){
+      ctx->dataVal[i] = (numSp > 0) ? getSpBinValRaw(spInd[0],ctx->dataStartCh+i,scaleFactor[0],cf) : 0.0f;
+      ctx->dataWeight[i] = ctx->dataVal[i]; //single spectra are weighted using their values
+    }
+    return;
+  }
+  memset(ctx->dataVal,0,(size_t)ctx->numDataCh*sizeof(float));
+  memset(ctx->dataWeight,0,(size_t)ctx->numDataCh*sizeof(float));
+  for(j=0;j<numSp;j++){
+    for(i=0;i<ctx->numDataCh;i++){
+      int ch = ctx->dataStartCh+i;
+      ctx->dataVal[i] += (float)(scaleFactor[j]*getSpectrumRangeSum(spInd[j],ch,ch+cf));
+      ctx->dataWeight[i] += (float)(scaleFactor[j]*scaleFactor[j]*getSpectrumRangeAbsSum(spInd[j],ch,ch+cf));
     }
   }
-  
+}
+
+//finish a fit on the main thread, showing the fit results
+gboolean finish_fit(gpointer data){
+  fit_context *ctx = (fit_context*)data;
+  memcpy(&fitpar,&ctx->par,sizeof(fit_params));
+  freeFitContext(ctx);
   guiglobals.fittingSp = 6;
-  g_idle_add(update_gui_fit_state,NULL);
-  g_idle_add(print_fit_results,NULL);
+  update_gui_fit_state();
+  print_fit_results();
+  return FALSE; //stop running
+}
 
+//finish a failed fit on the main thread
+gboolean finish_failed_fit(gpointer data){
+  freeFitContext((fit_context*)data);
+  guiglobals.fittingSp = 0;
+  update_gui_fit_state();
+  print_fit_error();
+  return FALSE; //stop running
 }
-gpointer performGausFitThreaded(){
-  performGausFit();
-  g_thread_exit(NULL);
+
+//show the stage of a fit (passed in data) in the gui, on the main thread
+gboolean show_fit_stage(gpointer data){
+  int stage = GPOINTER_TO_INT(data);
+  if((guiglobals.fittingSp >= 3)&&(guiglobals.fittingSp < stage)){
+    //the fit is still running (the fit state may have been reset in the meantime)
+    guiglobals.fittingSp = (unsigned char)stage;
+    update_gui_fit_state();
+  }
+  return FALSE; //stop running
+}
+
+//show the stage of a fit in the gui, called from the fit thread
+void setFitGuiStage(const int stage){
+  g_idle_add(show_fit_stage,GINT_TO_POINTER(stage));
+}
+
+gpointer performGausFitThreaded(gpointer data){
+  fit_context *ctx = (fit_context*)data;
+  if(performGausFit(ctx)){
+    g_idle_add(finish_fit,ctx);
+  }else{
+    g_idle_add(finish_failed_fit,ctx);
+  }
   return NULL;
 }
 
 
 //do some math (assuming a Gaussian peak shape) to get a better initial estimate of the peak width
-long double widthGuess(const double centroidCh, const double widthInit){
+long double widthGuess(const fit_context *ctx, const double centroidCh, const double widthInit){
+
+  const fit_params *par = &ctx->par;
 
   int windowSize = 5;
   int halfSearchLength = 100;
@@ -981,18 +1137,18 @@ long double widthGuess(const double centroidCh, const double widthInit){
     lowWindowVal = 0.;
     highWindowVal = 0.;
     for(j=0;j<windowSize;j++){
-      lowWindowVal += getSpBinVal(0,(int)centroidCh+(drawing.contractFactor*(i + j)));
-      highWindowVal += getSpBinVal(0,(int)centroidCh+(drawing.contractFactor*(i + j + windowSize)));
+      lowWindowVal += getFitDataVal(ctx,(int)centroidCh+(par->contractFactor*(i + j)));
+      highWindowVal += getFitDataVal(ctx,(int)centroidCh+(par->contractFactor*(i + j + windowSize)));
     }
     filterVal = highWindowVal - lowWindowVal;
     if(filterVal < minFilterVal){
-      minChVal = (float)(centroidCh+(drawing.contractFactor*i));
+      minChVal = (float)(centroidCh+(par->contractFactor*i));
       minFilterVal = filterVal;
       ctr=0;
     }else{
       ctr++;
     }
-    //printf("i=%i, ch=%f, lowwindow=%f, highwindow=%f, filterVal=%f\n",i,centroidCh+(drawing.contractFactor*i),lowWindowVal,highWindowVal,filterVal);
+    //printf("i=%i, ch=%f, lowwindow=%f, highwindow=%f, filterVal=%f\n",i,centroidCh+(par->contractFactor*i),lowWindowVal,highWindowVal,filterVal);
     if(ctr>=scanPastLength){
       break;
     }
@@ -1009,18 +1165,18 @@ long double widthGuess(const double centroidCh, const double widthInit){
     lowWindowVal = 0.;
     highWindowVal = 0.;
     for(j=0;j<windowSize;j++){
-      lowWindowVal += getSpBinVal(0,(int)centroidCh+(drawing.contractFactor*(i - j - windowSize)));
-      highWindowVal += getSpBinVal(0,(int)centroidCh+(drawing.contractFactor*(i - j)));
+      lowWindowVal += getFitDataVal(ctx,(int)centroidCh+(par->contractFactor*(i - j - windowSize)));
+      highWindowVal += getFitDataVal(ctx,(int)centroidCh+(par->contractFactor*(i - j)));
     }
     filterVal = highWindowVal - lowWindowVal;
     if(filterVal > maxFilterVal){
-      maxChVal = (float)(centroidCh+(drawing.contractFactor*i));
+      maxChVal = (float)(centroidCh+(par->contractFactor*i));
       maxFilterVal = filterVal;
       ctr=0;
     }else{
       ctr++;
     }
-    //printf("i=%i, ch=%f, lowwindow=%f, highwindow=%f, filterVal=%f\n",i,centroidCh+(drawing.contractFactor*i),lowWindowVal,highWindowVal,filterVal);
+    //printf("i=%i, ch=%f, lowwindow=%f, highwindow=%f, filterVal=%f\n",i,centroidCh+(par->contractFactor*i),lowWindowVal,highWindowVal,filterVal);
     if(ctr>=scanPastLength){
       break;
     }
@@ -1060,15 +1216,16 @@ long double widthGuess(const double centroidCh, const double widthInit){
   //only get here if neither bound is valid
 
   //assume width is at least 2 bins
-  if(widthInit < drawing.contractFactor*2.)
-    return drawing.contractFactor*2.;
+  if(widthInit < par->contractFactor*2.)
+    return par->contractFactor*2.;
 
   return widthInit; //give up
 
 }
 
 //use a trapezoidal filter to determine the best peak location in the window
-float centroidGuess(const float centroidInit){
+float centroidGuess(const fit_context *ctx, const float centroidInit){
+  const fit_params *par = &ctx->par;
   int windowSize = 5;
   int halfSearchLength = 10;
   int i,j;
@@ -1084,8 +1241,8 @@ float centroidGuess(const float centroidInit){
     lowWindowVal = 0.;
     highWindowVal = 0.;
     for(j=0;j<windowSize;j++){
-      lowWindowVal += getSpBinVal(0,(int)centroidInit+(drawing.contractFactor*(i - halfSearchLength + j)));
-      highWindowVal += getSpBinVal(0,(int)centroidInit+(drawing.contractFactor*(i - halfSearchLength + j + windowSize)));
+      lowWindowVal += getFitDataVal(ctx,(int)centroidInit+(par->contractFactor*(i - halfSearchLength + j)));
+      highWindowVal += getFitDataVal(ctx,(int)centroidInit+(par->contractFactor*(i - halfSearchLength + j + windowSize)));
     }
     filterVal = highWindowVal - lowWindowVal;
     if(filterVal < minFilterVal){
@@ -1112,8 +1269,8 @@ float centroidGuess(const float centroidInit){
     lowWindowVal = 0.;
     highWindowVal = 0.;
     for(j=0;j<windowSize;j++){
-      lowWindowVal += getSpBinVal(0,(int)centroidInit+(drawing.contractFactor*(i - halfSearchLength + j)));
-      highWindowVal += getSpBinVal(0,(int)centroidInit+(drawing.contractFactor*(i - halfSearchLength + j + windowSize)));
+      lowWindowVal += getFitDataVal(ctx,(int)centroidInit+(par->contractFactor*(i - halfSearchLength + j)));
+      highWindowVal += getFitDataVal(ctx,(int)centroidInit+(par->contractFactor*(i - halfSearchLength + j + windowSize)));
     }
     filterVal = fabsf(highWindowVal - lowWindowVal);
     if(filterVal < minFilterVal){
@@ -1126,11 +1283,11 @@ float centroidGuess(const float centroidInit){
   return centroidVal;
 }
 
-int isCentroidNearOthers(const int centInd, const float dist){
+int isCentroidNearOthers(const fit_params *par, const int centInd, const float dist){
   int i;
-  for(i=0;i<fitpar.numFitPeaks;i++){
+  for(i=0;i<par->numFitPeaks;i++){
     if(i!=centInd){
-      if(fabs(fitpar.fitPeakInitGuess[centInd] - fitpar.fitPeakInitGuess[i])<dist){
+      if(fabs(par->fitPeakInitGuess[centInd] - par->fitPeakInitGuess[i])<dist){
         return 1;
       }
     }
@@ -1138,80 +1295,103 @@ int isCentroidNearOthers(const int centInd, const float dist){
   return 0;
 }
 
-int startGausFit(){
-  
-  fitpar.ndf = (int)((fitpar.fitEndCh - fitpar.fitStartCh)/(1.0*drawing.contractFactor)) - (3+(3*(int)fitpar.numFitPeaks));
-  if(fitpar.ndf <= 0){
-    printf("Not enough degrees of freedom to fit!\n");
-    return 0;
-  }
-
-  guiglobals.fittingSp = 3;
-  g_idle_add(update_gui_fit_state,NULL);
+//assign initial guesses for all fit parameters in a fit context, using the
+//peak positions given in the context
+void setFitInitGuesses(fit_context *ctx){
 
   int i;
-  fitpar.errFound = 0;
+  fit_params *par = &ctx->par;
+  par->errFound = 0;
+  par->chisq = 0.;
 
-  memset(fitpar.fixPar,0,sizeof(fitpar.fixPar));
-  memset(fitpar.fitParErr,0,sizeof(fitpar.fitParErr));
+  memset(par->fixPar,0,sizeof(par->fixPar));
+  memset(par->fitParErr,0,sizeof(par->fitParErr));
 
   //width parameters
-  fitpar.widthFGH[0] = 3.;
-  fitpar.widthFGH[1] = 2.;
-  fitpar.widthFGH[2] = 0.;
+  par->widthFGH[0] = 3.;
+  par->widthFGH[1] = 2.;
+  par->widthFGH[2] = 0.;
 
   //assign initial guesses for background
-  fitpar.fitParVal[0] = (getSpBinVal(0,fitpar.fitStartCh) + getSpBinVal(0,fitpar.fitEndCh))/2.0;
-  fitpar.fitParVal[1] = (getSpBinVal(0,fitpar.fitEndCh) - getSpBinVal(0,fitpar.fitStartCh))/(float)(fitpar.fitEndCh - fitpar.fitStartCh);
-  fitpar.fitParVal[2] = 0.0;
+  par->fitParVal[0] = (getFitDataVal(ctx,par->fitStartCh) + getFitDataVal(ctx,par->fitEndCh))/2.0;
+  par->fitParVal[1] = (getFitDataVal(ctx,par->fitEndCh) - getFitDataVal(ctx,par->fitStartCh))/(float)(par->fitEndCh - par->fitStartCh);
+  par->fitParVal[2] = 0.0;
 
   //assign initial guesses for non-linear params
-  for(i=0;i<fitpar.numFitPeaks;i++){
-    if(isCentroidNearOthers(i,10.0)==0){
-      fitpar.fitPeakInitGuess[i] = centroidGuess(fitpar.fitPeakInitGuess[i]); //guess peak positions
+  for(i=0;i<par->numFitPeaks;i++){
+    if(isCentroidNearOthers(par,i,10.0)==0){
+      par->fitPeakInitGuess[i] = centroidGuess(ctx,par->fitPeakInitGuess[i]); //guess peak positions
     }
-    fitpar.fitParVal[6+(3*i)] = getSpBinVal(0,(int)fitpar.fitPeakInitGuess[i]) - fitpar.fitParVal[0] - fitpar.fitParVal[1]*fitpar.fitPeakInitGuess[i];
-    fitpar.fitParVal[7+(3*i)] = fitpar.fitPeakInitGuess[i];
+    par->fitParVal[6+(3*i)] = getFitDataVal(ctx,(int)par->fitPeakInitGuess[i]) - par->fitParVal[0] - par->fitParVal[1]*par->fitPeakInitGuess[i];
+    par->fitParVal[7+(3*i)] = par->fitPeakInitGuess[i];
   }
 
   //fix relative widths if required
-  if(fitpar.fixRelativeWidths){
-    printf("Fitting with relative peak widths fixed.\n");
-    double firstWidthInitGuess = getFWHM(fitpar.fitPeakInitGuess[0],fitpar.widthFGH[0],fitpar.widthFGH[1],fitpar.widthFGH[2])/2.35482;
-    fitpar.fitParVal[8] = widthGuess(fitpar.fitPeakInitGuess[0],firstWidthInitGuess);
-    //printf("width guess: %f\n",fitpar.fitParVal[8]);
-    for(i=1;i<fitpar.numFitPeaks;i++){
-      fitpar.fitParVal[8+(3*i)] = fitpar.fitParVal[8]*(getFWHM(fitpar.fitPeakInitGuess[i],fitpar.widthFGH[0],fitpar.widthFGH[1],fitpar.widthFGH[2])/2.35482)/firstWidthInitGuess;
-      fitpar.fixPar[8+(3*i)] = 2; //mark these parameters as fixed relative
+  if(par->fixRelativeWidths){
+    double firstWidthInitGuess = getFWHM(par->fitPeakInitGuess[0],par->widthFGH[0],par->widthFGH[1],par->widthFGH[2])/2.35482;
+    par->fitParVal[8] = widthGuess(ctx,par->fitPeakInitGuess[0],firstWidthInitGuess);
+    //printf("width guess: %f\n",par->fitParVal[8]);
+    for(i=1;i<par->numFitPeaks;i++){
+      par->fitParVal[8+(3*i)] = par->fitParVal[8]*(getFWHM(par->fitPeakInitGuess[i],par->widthFGH[0],par->widthFGH[1],par->widthFGH[2])/2.35482)/firstWidthInitGuess;
+      par->fixPar[8+(3*i)] = 2; //mark these parameters as fixed relative
     }
-    for(i=0;i<fitpar.numFitPeaks;i++){
-      fitpar.relWidths[i] = fitpar.fitParVal[8+(3*i)]/fitpar.fitParVal[8];
-      //printf("Rel width %i: %f\n",i+1,fitpar.relWidths[i]);
+    for(i=0;i<par->numFitPeaks;i++){
+      par->relWidths[i] = par->fitParVal[8+(3*i)]/par->fitParVal[8];
+      //printf("Rel width %i: %f\n",i+1,par->relWidths[i]);
     }
   }else{
-    for(i=0;i<fitpar.numFitPeaks;i++){
-      fitpar.fitParVal[8+(3*i)] = widthGuess(fitpar.fitPeakInitGuess[i],getFWHM(fitpar.fitPeakInitGuess[i],fitpar.widthFGH[0],fitpar.widthFGH[1],fitpar.widthFGH[2])/2.35482);
+    for(i=0;i<par->numFitPeaks;i++){
+      par->fitParVal[8+(3*i)] = widthGuess(ctx,par->fitPeakInitGuess[i],getFWHM(par->fitPeakInitGuess[i],par->widthFGH[0],par->widthFGH[1],par->widthFGH[2])/2.35482);
     }
   }
 
-  if(fitpar.weightMode == 0){
+  par->fitParVal[5] = 0.0; //unused parameter
+  par->fixPar[5] = 1; //fix unused parameter at zero
+  
+  //printf("Initial guesses: %f %f %f %f %f %f %f %f\n",par->fitParVal[0],par->fitParVal[1],par->fitParVal[2],par->fitParVal[3],par->fitParVal[4],par->fitParVal[6],par->fitParVal[7],par->fitParVal[8]);
+
+}
+
+//fit the first displayed spectrum using the fit region and peaks in fitpar,
+//the fit runs on its own thread using a snapshot of the displayed data
+int startGausFit(){
+
+  fit_context *ctx = allocFitContext(&fitpar,drawing.contractFactor);
+  if(ctx == NULL){
+    return 0;
+  }
+
+  guiglobals.fittingSp = 3;
+  g_idle_add(update_gui_fit_state,NULL);
+
+  copyDispFitData(ctx);
+  if(ctx->par.fixRelativeWidths){
+    printf("Fitting with relative peak widths fixed.\n");
+  }
+  setFitInitGuesses(ctx);
+  memcpy(&fitpar,&ctx->par,sizeof(fit_params)); //show the initial guesses while fitting
+
+  if(ctx->par.weightMode == 0){
     printf("Weighting using data.\n");
-  }else if(fitpar.weightMode == 1){
+  }else if(ctx->par.weightMode == 1){
     printf("Weighting using fit function.\n");
   }else{
     printf("No weighting for fit.\n");
   }
 
-  fitpar.fitParVal[5] = 0.0; //unused parameter
-  fitpar.fixPar[5] = 1; //fix unused parameter at zero
-  
-  //printf("Initial guesses: %f %f %f %f %f %f %f %f\n",fitpar.fitParVal[0],fitpar.fitParVal[1],fitpar.fitParVal[2],fitpar.fitParVal[3],fitpar.fitParVal[4],fitpar.fitParVal[6],fitpar.fitParVal[7],fitpar.fitParVal[8]);
-
-  if (g_thread_try_new("fit_thread", performGausFitThreaded, NULL, NULL) == NULL){
+  ctx->stageFunc = setFitGuiStage;
+  GThread *thread = g_thread_try_new("fit_thread", performGausFitThreaded, ctx, NULL);
+  if(thread == NULL){
     printf("WARNING: Couldn't initialize thread for fit, will try on the main thread.\n");
-    performGausFit(); //try non-threaded fit
+    ctx->stageFunc = NULL;
+    if(performGausFit(ctx)){ //try non-threaded fit
+      finish_fit(ctx);
+    }else{
+      finish_failed_fit(ctx);
+    }
+  }else{
+    g_thread_unref(thread); //the fit thread finishes on its own
   }
   
-  
   return 1;
 }
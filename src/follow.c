@@ -0,0 +1,327 @@
+/* J. Williams, 2020-2021 */
+
+//This file contains routines for following opened files for changes, for
+//files which are rewritten while they are open (eg. by a data acquisition
+//system during an experiment).  The directories holding the opened files
+//are watched using inotify, and once a file has been written (closed after
+//writing, or renamed into place), its size and modification time are
+//compared against those when it was last read.  Changed files are re-read
+//on a worker thread, and only the spectra whose data differs are replaced
+//in the spectrum store (keeping their handles, so that the zoom, views,
+//scaling, and fit region are unaffected).  Spectra which were dropped as
+//empty when the file was opened are not followed.
+
+#define FOLLOW_SETTLE_MS 250 //time to wait after a file is written before checking it, so that several writes are handled at once
+#define FOLLOW_RETRY_MS  1000 //time to wait before checking again if files can't be re-read yet (eg. while another file is being opened)
+
+void freeFollowedFile(followed_file *f){
+  free(f->filename);
+  free(f->spHandle);
+  memset(f,0,sizeof(followed_file));
+}
+
+//start watching the directory holding a followed file, and make sure that none of
+//its spectra are loaded from it on demand (as the file contents may change)
+//returns 1 on success, 0 on failure
+int watchFollowedFile(followed_file *f){
+  if((followstate.inotifyFd < 0)||(f->wd >= 0)){
+    return 1;
+  }
+  char dirName[1024];
+  const char *name = getFileBasename(f->filename);
+  if(name == f->filename){
+    strncpy(dirName,".",sizeof(dirName));
+  }else{
+    snprintf(dirName,sizeof(dirName),"%.*s",(int)(name - f->filename),f->filename);
+  }
+  f->wd = inotify_add_watch(followstate.inotifyFd,dirName,IN_CLOSE_WRITE|IN_MOVED_TO);
+  if(f->wd < 0){
+    printf("WARNING: cannot follow file %s for changes.\n",f->filename);
+    return 0;
+  }
+  detachSpStoreFile(f->filename); //see spectrum_store.c
+  return 1;
+}
+
+//add an opened file to the list of files which may be followed, spHandle (numSp
+//handles, see import_job) is taken over by the list
+//returns 1 on success, 0 on failure
+int addFollowedFile(const char *filename, int *spHandle, const int numSp){
+  struct stat fileStat;
+  followed_file *newFile = realloc(followstate.file,(size_t)(followstate.numFiles+1)*sizeof(followed_file));
+  if(newFile == NULL){
+    free(spHandle);
+    return 0;
+  }
+  followstate.file = newFile;
+  followed_file *f = &followstate.file[followstate.numFiles];
+  memset(f,0,sizeof(followed_file));
+  f->filename = strdup(filename);
+  f->wd = -1;
+  f->numSp = numSp;
+  f->spHandle = spHandle;
+  if((f->filename == NULL)||(stat(filename,&fileStat)!=0)){
+    freeFollowedFile(f);
+    return 0;
+  }
+  f->size = fileStat.st_size;
+  f->mtime = fileStat.st_mtim;
+  followstate.numFiles++;
+  watchFollowedFile(f);
+  return 1;
+}
+
+//find an opened file in the list of files which may be followed
+//returns the index of the file, or -1 if it isn't in the list
+int findFollowedFile(const char *filename){
+  int i;
+  for(i=0;i<followstate.numFiles;i++){
+    if(strcmp(followstate.file[i].filename,filename)==0){
+      return i;
+    }
+  }
+  return -1;
+}
+
+//after an opened file has been written by jf3 itself (eg. when saving), take its
+//current size and modification time as those last read, so that the write isn't
+//treated as a change to be re-read
+void refreshFollowedFile(const char *filename){
+  struct stat fileStat;
+  int ind = findFollowedFile(filename);
+  if((ind < 0)||(stat(filename,&fileStat)!=0)){
+    return;
+  }
+  followed_file *f = &followstate.file[ind];
+  f->size = fileStat.st_size;
+  f->mtime = fileStat.st_mtim;
+  f->newSize = fileStat.st_size; //also kept if the file is being re-read (see endFollowRead)
+  f->newMtime = fileStat.st_mtim;
+}
+
+//forget all opened files (eg. when other files are opened in their place)
+void clearFollowedFiles(){
+  int i;
+  for(i=0;i<followstate.numFiles;i++){
+    if((followstate.inotifyFd >= 0)&&(followstate.file[i].wd >= 0)){
+      inotify_rm_watch(followstate.inotifyFd,followstate.file[i].wd); //watches on the same directory are shared, removing twice is harmless
+    }
+    freeFollowedFile(&followstate.file[i]);
+  }
+  free(followstate.file);
+  followstate.file = NULL;
+  followstate.numFiles = 0;
+  followstate.generation++; //any files being re-read are discarded
+}
+
+//re-read changed files, on a worker thread
+gpointer followReadThread(gpointer data){
+  int i,j;
+  for(i=0;i<followstate.numJobs;i++){
+    import_job *job = &followstate.job[i];
+    if(job->filename == NULL){
+      continue;
+    }
+    job->numSp = readSpectrumDataFile(job->filename,&job->imp); //see read_data.c
+    for(j=0;j<job->imp.numSp;j++){
+      //spectra may be set up to be loaded on demand (eg. from .jf3 files), load them now
+      loadSpStoreEntry(&job->imp.sp[j]); //see spectrum_store.c
+      detachSpStoreEntry(&job->imp.sp[j]);
+    }
+  }
+  g_idle_add(followstate.updateFunc,NULL);
+  return NULL;
+}
+
+//replace the spectra in the store which differ in a re-read file
+//returns the number of spectra replaced
+int updateFollowedFileSpectra(followed_file *f, import_job *job){
+  int i;
+  int numUpdated = 0;
+  if(job->numSp != f->numSp){
+    printf("WARNING: number of spectra in file %s changed from %i to %i, only the first %i will be updated (open the file again to see all spectra).\n",f->filename,f->numSp,job->numSp,(job->numSp < f->numSp) ? job->numSp : f->numSp);
+  }
+  for(i=0;(i<job->numSp)&&(i<f->numSp);i++){
+    int spInd = getSpIndexFromHandle(f->spHandle[i]);
+    if(spInd < 0){
+      continue; //dropped when opened, or deleted since
+    }
+    sp_store_entry *src = &job->imp.sp[i];
+    if(src->indexValid == 0){
+      trimSpStoreEntry(src);
+    }
+    int length = getSpectrumUsedLength(spInd);
+    if(getSpStoreEntryUsedLength(src) == length){
+      const double *data = getSpectrumData(spInd);
+      if((length == 0)||((data != NULL)&&(memcmp(data,src->data,(size_t)length*sizeof(double))==0))){
+        continue; //unchanged
+      }
+    }
+    adoptSpStoreEntry(spInd,src); //see spectrum_store.c
+    numUpdated++;
+    if(isSpSelected(spInd)){ //see spectrum_data.c
+      followstate.dispUpdated = 1;
+    }
+  }
+  return numUpdated;
+}
+
+//update the spectra from files re-read by followReadThread, to be called
+//on the main thread from the updateFunc passed to startFollowingFiles
+//(followstate.numSpUpdated and followstate.dispUpdated are set)
+void endFollowRead(){
+  int i;
+  if(followstate.thread != NULL){
+    g_thread_join(followstate.thread);
+    followstate.thread = NULL;
+  }
+  followstate.numSpUpdated = 0;
+  followstate.dispUpdated = 0;
+  for(i=0;i<followstate.numJobs;i++){
+    import_job *job = &followstate.job[i];
+    if(job->filename == NULL){
+      continue;
+    }
+    if(followstate.jobGeneration == followstate.generation){
+      followed_file *f = &followstate.file[i];
+      if(job->numSp > 0){
+        followstate.numSpUpdated += updateFollowedFileSpectra(f,job);
+        f->size = f->newSize;
+        f->mtime = f->newMtime;
+      }else{
+        printf("WARNING: cannot read changed file %s, keeping the previous data.\n",f->filename);
+      }
+    }
+    freeImportData(&job->imp);
+    g_free(job->filename);
+  }
+  free(followstate.job);
+  followstate.job = NULL;
+  followstate.numJobs = 0;
+}
+
+//check whether any followed files have changed, and start re-reading those which have
+gboolean checkFollowedFiles(gpointer data){
+  int i;
+  struct stat fileStat;
+  if((followstate.job != NULL)||(importstate.job != NULL)){
+    //check again once any files being read have been added
+    followstate.checkSource = g_timeout_add(FOLLOW_RETRY_MS,checkFollowedFiles,NULL);
+    return G_SOURCE_REMOVE;
+  }
+  followstate.checkSource = 0;
+  int numChanged = 0;
+  for(i=0;i<followstate.numFiles;i++){
+    followed_file *f = &followstate.file[i];
+    if(f->changed == 0){
+      continue;
+    }
+    f->changed = 0;
+    if(stat(f->filename,&fileStat)!=0){
+      continue; //may be in the middle of being replaced, will be written again
+    }
+    if((fileStat.st_size != f->size)||(fileStat.st_mtim.tv_sec != f->mtime.tv_sec)||(fileStat.st_mtim.tv_nsec != f->mtime.tv_nsec)){
+      f->newSize = fileStat.st_size;
+      f->newMtime = fileStat.st_mtim;
+      f->changed = 2; //to be re-read
+      numChanged++;
+    }
+  }
+  if(numChanged == 0){
+    return G_SOURCE_REMOVE;
+  }
+  followstate.job = calloc((size_t)followstate.numFiles,sizeof(import_job));
+  if(followstate.job == NULL){
+    return G_SOURCE_REMOVE;
+  }
+  followstate.numJobs = followstate.numFiles;
+  for(i=0;i<followstate.numFiles;i++){
+    if(followstate.file[i].changed == 2){
+      followstate.file[i].changed = 0;
+      followstate.job[i].filename = g_strdup(followstate.file[i].filename);
+      initImportData(&followstate.job[i].imp);
+      followstate.job[i].imp.listModeChannels = rawdata.listModeChannels;
+    }
+  }
+  followstate.jobGeneration = followstate.generation;
+  followstate.thread = g_thread_try_new("follow_thread", followReadThread, NULL, NULL);
+  if(followstate.thread == NULL){
+    followReadThread(NULL); //read the files on this thread instead
+  }
+  return G_SOURCE_REMOVE;
+}
+
+//handle inotify events, flagging followed files which have been written
+gboolean on_follow_event(gint fd, GIOCondition condition, gpointer user_data){
+  char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+  int i;
+  while(1){
+    ssize_t len = read(fd,buf,sizeof(buf));
+    if(len <= 0){
+      break; //no more events
+    }
+    char *ptr = buf;
+    while(ptr < buf + len){
+      const struct inotify_event *ev = (const struct inotify_event *)ptr;
+      for(i=0;i<followstate.numFiles;i++){
+        followed_file *f = &followstate.file[i];
+        if((ev->mask & IN_Q_OVERFLOW)||((ev->wd == f->wd)&&(ev->len > 0)&&(strcmp(ev->name,getFileBasename(f->filename))==0))){
+          f->changed = 1;
+        }
+      }
+      ptr += sizeof(struct inotify_event) + ev->len;
+    }
+  }
+  for(i=0;i<followstate.numFiles;i++){
+    if(followstate.file[i].changed){
+      if(followstate.checkSource == 0){
+        followstate.checkSource = g_timeout_add(FOLLOW_SETTLE_MS,checkFollowedFiles,NULL);
+      }
+      break;
+    }
+  }
+  return G_SOURCE_CONTINUE;
+}
+
+//start following the opened files (and any opened later) for changes,
+//updateFunc is called on the main thread once changed files have been re-read,
+//which should then call endFollowRead
+//returns 1 on success, 0 on failure
+int startFollowingFiles(GSourceFunc updateFunc){
+  int i;
+  followstate.updateFunc = updateFunc;
+  if(followstate.inotifyFd < 0){
+    followstate.inotifyFd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+    if(followstate.inotifyFd < 0){
+      printf("ERROR: cannot follow files for changes (inotify not available).\n");
+      return 0;
+    }
+    followstate.watchSource = g_unix_fd_add(followstate.inotifyFd,G_IO_IN,on_follow_event,NULL);
+  }
+  for(i=0;i<followstate.numFiles;i++){
+    watchFollowedFile(&followstate.file[i]);
+  }
+  return 1;
+}
+
+//stop following opened files for changes
+void stopFollowingFiles(){
+  int i;
+  if(followstate.checkSource != 0){
+    g_source_remove(followstate.checkSource);
+    followstate.checkSource = 0;
+  }
+  if(followstate.watchSource != 0){
+    g_source_remove(followstate.watchSource);
+    followstate.watchSource = 0;
+  }
+  if(followstate.inotifyFd >= 0){
+    close(followstate.inotifyFd); //removes all watches
+    followstate.inotifyFd = -1;
+  }
+  for(i=0;i<followstate.numFiles;i++){
+    followstate.file[i].wd = -1;
+    followstate.file[i].changed = 0;
+  }
+  followstate.generation++; //discard any files being re-read
+}
@@ -7,6 +7,8 @@
 void showPreferences(int page){
   gtk_notebook_set_current_page(preferences_notebook,page);
   gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(discard_empty_checkbutton),rawdata.dropEmptySpectra);
+  gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(lazy_load_checkbutton),rawdata.lazyLoadSpectra);
+  gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(follow_files_checkbutton),rawdata.followFiles);
   gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(bin_errors_checkbutton),guiglobals.showBinErrors);
   gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(round_errors_checkbutton),guiglobals.roundErrors);
   gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(dark_theme_checkbutton),guiglobals.preferDarkTheme);
@@ -19,6 +21,7 @@ void showPreferences(int page){
   gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(popup_results_checkbutton),guiglobals.popupFitResults);
   gtk_combo_box_set_active(GTK_COMBO_BOX(peak_shape_combobox),fitpar.fitType);
   gtk_combo_box_set_active(GTK_COMBO_BOX(weight_mode_combobox),fitpar.weightMode);
+  gtk_combo_box_set_active(GTK_COMBO_BOX(listmode_channels_combobox),getListModeShift(1024) - getListModeShift(rawdata.listModeChannels)); //1024 channels is the first entry
   gtk_window_present(preferences_window); //show the window
 }
 
@@ -70,6 +73,7 @@ void setSpOpenView(const char spOpened){
     gtk_widget_set_sensitive(GTK_WIDGET(append_button),FALSE);
     gtk_widget_set_sensitive(GTK_WIDGET(fit_button),FALSE);
     gtk_widget_set_sensitive(GTK_WIDGET(fit_fit_button),FALSE);
+    gtk_widget_set_sensitive(GTK_WIDGET(fit_batch_button),FALSE);
     gtk_widget_set_sensitive(GTK_WIDGET(manage_spectra_button),FALSE);
     gtk_widget_set_sensitive(GTK_WIDGET(autoscale_button),FALSE);
     gtk_widget_set_sensitive(GTK_WIDGET(display_button),FALSE);
@@ -132,7 +136,7 @@ void getViewStr(char *viewStr, const unsigned int strSize, const int viewNum){
         break;
       default:
         //single spectrum
-        snprintf(viewStr,strSize,"View of spectrum %i",rawdata.viewMultiPlots[viewNum][0]+1);
+        snprintf(viewStr,strSize,"View of spectrum %i",getSpIndexFromHandle(rawdata.viewMultiPlots[viewNum][0])+1);
         break;
     }
   }else{
@@ -357,7 +361,7 @@ void on_spectrum_selector_changed(GtkSpinButton *spin_button)
     if(spNum >= 0){
       //handle drawing individual spectra
       if(spNum < rawdata.numSpOpened){
-        drawing.multiPlots[0] = (unsigned char)spNum;
+        drawing.multiPlots[0] = spNum;
         drawing.multiplotMode = 0;//unset multiplot, if it is being used
         drawing.numMultiplotSp = 1;//unset multiplot
         drawing.scaleFactor[spNum] = 1.0; //reset any scaling from custom views
@@ -369,10 +373,7 @@ void on_spectrum_selector_changed(GtkSpinButton *spin_button)
       }else if(spNum < (rawdata.numSpOpened+rawdata.numViews)){
         //handle drawing views
         int viewNum = spNum - rawdata.numSpOpened;
-        drawing.numMultiplotSp = rawdata.viewNumMultiplotSp[viewNum];
-        drawing.multiplotMode = rawdata.viewMultiplotMode[viewNum];
-        memcpy(&drawing.scaleFactor,&rawdata.viewScaleFactor[viewNum],sizeof(drawing.scaleFactor));
-        memcpy(&drawing.multiPlots,&rawdata.viewMultiPlots[viewNum],sizeof(drawing.multiPlots));
+        setDrawingFromView(viewNum); //see spectrum_data.c
         drawing.displayedView = viewNum;
 
         gtk_label_set_text(display_spectrumname_label,rawdata.viewComment[viewNum]);
@@ -418,123 +419,86 @@ void on_spectrum_selector_changed(GtkSpinButton *spin_button)
   
 }
 
-//function for opening a single file without UI (ie. from the command line)
-//if append=1, append this file to already opened files
-void openSingleFile(char *filename, int append){
-  int i;
-  int openErr = 0;
-  if(append!=1){
-    rawdata.numSpOpened=0;
-    rawdata.numChComments=0;
-    rawdata.numViews=0;
-  }
-  int numSp = readSpectrumDataFile(filename,rawdata.hist,rawdata.numSpOpened);
-  if(numSp > 0){ //see read_data.c
-    rawdata.openedSp = 1;
-    //set comments and scaling for spectra just opened
-    for (i = rawdata.numSpOpened; i < (rawdata.numSpOpened+numSp); i++){
-      //printf("Comment %i: %s\n",j,rawdata.histComment[j]);
-      drawing.scaleFactor[i] = 1.00;
-    }
-    rawdata.numSpOpened = (unsigned char)(rawdata.numSpOpened+numSp);
-    //select the first non-empty spectrum by default
-    int sel = getFirstNonemptySpectrum(rawdata.numSpOpened);
-    if(sel >=0){
-      drawing.multiPlots[0] = (unsigned char)sel;
-      drawing.multiplotMode = 0; //file just opened, disable multiplot
-      setSpOpenView(1);
-      //set the range of selectable spectra values
-      gtk_adjustment_set_lower(spectrum_selector_adjustment, 1);
-      gtk_adjustment_set_upper(spectrum_selector_adjustment, rawdata.numSpOpened+rawdata.numViews);
-      gtk_spin_button_set_value(spectrum_selector, sel+1);
-    }else{
-      //no spectra with any data in the selected file
-      openErr = 2;
-    }
-  }else if (numSp == -1){
-    //too many files opened
-    openErr = 3;
-  }else if (numSp == -2){
-    //improper file type
-    openErr = 4;
-  }else{
-    //improper file format
-    openErr = 1;
-  }
-  
-  if(openErr>0){
-    GtkDialogFlags flags = GTK_DIALOG_DESTROY_WITH_PARENT;
-    GtkWidget *message_dialog = gtk_message_dialog_new(window, flags, GTK_MESSAGE_ERROR, GTK_BUTTONS_CLOSE, "Error opening spectrum data!");
-    char errMsg[256];
-    switch (openErr)
-    {
-      case 2:
-        snprintf(errMsg,256,"All spectrum data in file %s is empty.",filename);
-        break;
-      case 3:
-        snprintf(errMsg,256,"You are trying to open too many files at once.  Maximum number of individual spectra which may be imported is %i.",NSPECT);
-        break;
-      case 4:
-        snprintf(errMsg,256,"The file '%s' is not in a supported file format.",filename);
-        break;
-      default:
-        snprintf(errMsg,256,"Data does not exist in file %s or is incorrectly formatted.",filename);
-        break;
-    }
-    gtk_message_dialog_format_secondary_text(GTK_MESSAGE_DIALOG(message_dialog),"%s",errMsg);
-    gtk_dialog_run (GTK_DIALOG (message_dialog));
-    gtk_widget_destroy (message_dialog);
-    exit(-1); //quit the application
-  }
-
-  //autozoom if needed
-  if(guiglobals.autoZoom){
-    autoZoom();
-    gtk_range_set_value(GTK_RANGE(zoom_scale),log2(drawing.zoomLevel));
+//show the dialog for an error encountered when opening spectrum data
+void showOpenErrorDialog(const int openErr, const char *filename){
+  GtkDialogFlags flags = GTK_DIALOG_DESTROY_WITH_PARENT;
+  GtkWidget *message_dialog = gtk_message_dialog_new(window, flags, GTK_MESSAGE_ERROR, GTK_BUTTONS_CLOSE, "Error opening spectrum data!");
+  char errMsg[256];
+  switch (openErr)
+  {
+    case 2:
+      snprintf(errMsg,256,"All spectrum data in file %s is empty.",filename);
+      break;
+    case 3:
+      snprintf(errMsg,256,"You are trying to open too many files at once.  Maximum number of individual spectra which may be imported is %i.",NSPECT);
+      break;
+    case 4:
+      snprintf(errMsg,256,"The file '%s' is not in a supported file format.",filename);
+      break;
+    default:
+      snprintf(errMsg,256,"Data does not exist in file %s or is incorrectly formatted.",filename);
+      break;
   }
-
+  gtk_message_dialog_format_secondary_text(GTK_MESSAGE_DIALOG(message_dialog),"%s",errMsg);
+  gtk_dialog_run (GTK_DIALOG (message_dialog));
+  gtk_widget_destroy (message_dialog);
 }
 
-void on_open_button_clicked(GtkButton *b)
-{
-  unsigned int i,j;
-
-  GtkFileChooserNative *native = gtk_file_chooser_native_new ("Open Data File(s)", window, GTK_FILE_CHOOSER_ACTION_OPEN, "_Open", "_Cancel");
-  file_open_dialog = GTK_FILE_CHOOSER(native);
-  gtk_file_chooser_set_select_multiple(file_open_dialog, TRUE);
-  file_filter = gtk_file_filter_new();
-  gtk_file_filter_set_name(file_filter,"Spectrum Data (.jf3, .txt, .mca, .fmca, .spe, .C)");
-  gtk_file_filter_add_pattern(file_filter,"*.txt");
-  gtk_file_filter_add_pattern(file_filter,"*.mca");
-  gtk_file_filter_add_pattern(file_filter,"*.fmca");
-  gtk_file_filter_add_pattern(file_filter,"*.spe");
-  gtk_file_filter_add_pattern(file_filter,"*.C");
-  gtk_file_filter_add_pattern(file_filter,"*.jf3");
-  gtk_file_chooser_add_filter(file_open_dialog,file_filter);
-
-  int openErr = 0; //to track if there are any errors when opening spectra
-  if(gtk_native_dialog_run(GTK_NATIVE_DIALOG(native)) == GTK_RESPONSE_ACCEPT){
-
-    rawdata.numSpOpened = 0; //reset the open spectra
-    rawdata.numChComments = 0; //reset the number of comments
-    rawdata.numViews = 0; //reset the number of views
-    char *filename = NULL;
-    GSList *file_list = gtk_file_chooser_get_filenames(file_open_dialog);
-    for(i=0;i<g_slist_length(file_list);i++){
-      filename = g_slist_nth_data(file_list,i);
-      int numSp = readSpectrumDataFile(filename,rawdata.hist,rawdata.numSpOpened);
-      if(numSp > 0){ //see read_data.c
-        rawdata.openedSp = 1;
-        //set comments for spectra just opened
-        for (j = rawdata.numSpOpened; j < (rawdata.numSpOpened+numSp); j++){
-          //printf("Comment %i: %s\n",j,rawdata.histComment[j]);
-          drawing.scaleFactor[j] = 1.00;
-        }
-        rawdata.numSpOpened = (unsigned char)(rawdata.numSpOpened+numSp);
+//called on the main thread once followed files which changed have been re-read
+//(see follow.c), the spectra and zoom/views/fits are kept, so only a redraw is needed
+gboolean on_followed_files_updated(gpointer data){
+  endFollowRead(); //see follow.c
+  if(followstate.numSpUpdated > 0){
+    char updateMsg[256];
+    snprintf(updateMsg,256,"Updated %i spectra from changed files.",followstate.numSpUpdated);
+    gtk_label_set_text(bottom_info_text,updateMsg);
+    if(followstate.dispUpdated){
+      manualSpectrumAreaDraw();
+    }
+  }
+  return G_SOURCE_REMOVE;
+}
+
+//called on the main thread whenever a file being imported has been read (see
+//startImportFiles in read_data.c), adds any files which are ready to the
+//spectrum store in the order they were requested, and updates the UI
+gboolean on_import_file_done(gpointer data){
+  int i,job;
+  while((job = getNextImportFile()) >= 0){
+    if((importstate.append == 0)&&(importstate.numCommitted == 0)){
+      //replace the opened spectra, only once the first file has been read so
+      //that they can still be used while the files are being read
+      clearFollowedFiles(); //see follow.c
+      rawdata.numSpOpened = 0; //reset the open spectra
+      freeSpStore(); //release the data and handles of the old spectra, see spectrum_store.c
+      clearComments(); //reset comments, see comment_store.c
+      rawdata.numViews = 0; //reset the number of views
+    }
+    //after an error which stops the import, remaining files are discarded
+    int skip = ((importstate.openErr > 0)&&(importstate.openErr != 4));
+    int numSp = commitNextImportFile(rawdata.numSpOpened,skip); //see read_data.c
+    if(skip){
+      continue;
+    }
+    if(numSp > 0){
+      //follow the file for changes, see follow.c
+      addFollowedFile(importstate.job[job].filename,importstate.job[job].spHandle,importstate.job[job].numSp);
+      importstate.job[job].spHandle = NULL;
+      rawdata.openedSp = 1;
+      //reset scaling for spectra just opened
+      for (i = rawdata.numSpOpened; i < (rawdata.numSpOpened+numSp); i++){
+        drawing.scaleFactor[i] = 1.00;
+      }
+      rawdata.numSpOpened = rawdata.numSpOpened+numSp;
+      if(importstate.append){
+        setSpOpenView(1);
+        gtk_adjustment_set_upper(spectrum_selector_adjustment, rawdata.numSpOpened+rawdata.numViews);
+        on_spectrum_selector_changed(spectrum_selector); //update displayed name if needed
+      }else{
         //select the first non-empty spectrum by default
         int sel = getFirstNonemptySpectrum(rawdata.numSpOpened);
         if(sel >=0){
-          drawing.multiPlots[0] = (unsigned char)sel;
+          drawing.multiPlots[0] = sel;
           drawing.multiplotMode = 0; //files just opened, disable multiplot
           guiglobals.fittingSp = 0; //files just opened, reset fit state
           setSpOpenView(1);
@@ -545,66 +509,158 @@ void on_open_button_clicked(GtkButton *b)
           on_spectrum_selector_changed(spectrum_selector); //in case the value is the same as before
         }else{
           //no spectra with any data in the selected file
-          openErr = 2;
-          break;
+          importstate.openErr = 2;
+          importstate.errJob = job;
         }
-      }else if (numSp == -1){
+      }
+    }else if(importstate.openErr == 0){
+      if(numSp == -1){
         //too many files opened
-        openErr = 3;
-        break;
-      }else if (numSp == -2){
+        importstate.openErr = 3;
+      }else if(numSp == -2){
         //improper file type
-        openErr = 4;
+        importstate.openErr = 4;
       }else{
         //improper file format
-        openErr = 1;
-        break;
+        importstate.openErr = 1;
       }
+      importstate.errJob = job;
+    }
+    if((importstate.openErr > 0)&&(importstate.openErr != 4)){
+      g_atomic_int_set(&importstate.cancel,1); //don't bother reading files which haven't been started
     }
+  }
 
-    if(openErr>0){
-      GtkDialogFlags flags = GTK_DIALOG_DESTROY_WITH_PARENT;
-      GtkWidget *message_dialog = gtk_message_dialog_new(window, flags, GTK_MESSAGE_ERROR, GTK_BUTTONS_CLOSE, "Error opening spectrum data!");
-      char errMsg[256];
-      switch (openErr)
-      {
-        case 2:
-          snprintf(errMsg,256,"All spectrum data in file %s is empty.",filename);
-          break;
-        case 3:
-          snprintf(errMsg,256,"You are trying to open too many files at once.  Maximum number of individual spectra which may be imported is %i.",NSPECT);
-          break;
-        case 4:
-          snprintf(errMsg,256,"The file '%s' is not in a supported file format.",filename);
-          break;
-        default:
-          snprintf(errMsg,256,"Data does not exist in file %s or is incorrectly formatted.",filename);
-          break;
+  if((importstate.job == NULL)||(importstate.numCommitted < importstate.numJobs)){
+    if(importstate.job != NULL){
+      //show progress
+      char headerBarSub[256];
+      snprintf(headerBarSub,256,"Loading file %i of %i...",importstate.numCommitted+1,importstate.numJobs);
+      gtk_header_bar_set_subtitle(header_bar,headerBarSub);
+    }
+    return G_SOURCE_REMOVE; //wait for the next file to be read
+  }
+
+  //all files have been added
+  if(importstate.openErr > 0){
+    if(importstate.errJob >= 0){
+      showOpenErrorDialog(importstate.openErr,importstate.job[importstate.errJob].filename);
+    }
+    if(importstate.fromCmdLine){
+      exit(-1); //quit the application
+    }
+  }
+  if(importstate.append == 0){
+    //a single .jf3 file can be saved to incrementally, see write_data.c
+    sessionfile.filename[0] = '\0';
+    if((importstate.openErr == 0)&&(importstate.numJobs == 1)){
+      const char *dot = strrchr(importstate.job[0].filename,'.');
+      if((dot != NULL)&&(strcmp(dot+1,"jf3")==0)){
+        setSessionFile(importstate.job[0].filename,rawdata.metaGeneration);
       }
-      gtk_message_dialog_format_secondary_text(GTK_MESSAGE_DIALOG(message_dialog),"%s",errMsg);
-      gtk_dialog_run (GTK_DIALOG (message_dialog));
-      gtk_widget_destroy (message_dialog);
+    }
+  }
+  if(importstate.openErr == 0){
+    if(importstate.append){
+      rawdata.numFilesOpened = (unsigned char)(rawdata.numFilesOpened + importstate.numJobs);
     }else{
-      rawdata.numFilesOpened = (unsigned char)g_slist_length(file_list);
-      //set the title of the opened spectrum in the header bar
-      if(rawdata.numFilesOpened > 1){
-        char headerBarSub[256];
-        snprintf(headerBarSub,256,"%i files loaded",rawdata.numFilesOpened);
-        gtk_header_bar_set_subtitle(header_bar,headerBarSub);
-      }else{
-        gtk_header_bar_set_subtitle(header_bar,filename);
-      }
+      rawdata.numFilesOpened = (unsigned char)importstate.numJobs;
     }
-    g_slist_free(file_list);
-    g_free(filename);
   }
-  
+  //set the title of the opened spectrum in the header bar
+  if(rawdata.numFilesOpened > 1){
+    char headerBarSub[256];
+    snprintf(headerBarSub,256,"%i files loaded",rawdata.numFilesOpened);
+    gtk_header_bar_set_subtitle(header_bar,headerBarSub);
+  }else if((importstate.openErr == 0)&&(importstate.numJobs == 1)){
+    gtk_header_bar_set_subtitle(header_bar,importstate.job[0].filename);
+  }else{
+    gtk_header_bar_set_subtitle(header_bar,NULL);
+  }
+
   //autozoom if needed
-  if(guiglobals.autoZoom){
+  if((importstate.append == 0)&&(guiglobals.autoZoom)){
     autoZoom();
     gtk_range_set_value(GTK_RANGE(zoom_scale),log2(drawing.zoomLevel));
   }
 
+  endImportFiles(); //see read_data.c
+  if(rawdata.followFiles){
+    startFollowingFiles(on_followed_files_updated); //see follow.c
+  }
+  gtk_widget_set_sensitive(GTK_WIDGET(open_button),TRUE);
+  gtk_widget_set_sensitive(GTK_WIDGET(append_button),rawdata.openedSp);
+  manualSpectrumAreaDraw();
+
+  return G_SOURCE_REMOVE;
+}
+
+//start opening files, which are read in parallel on worker threads and then
+//added in order by on_import_file_done
+//if append=1, append the files to already opened files
+//if fromCmdLine=1, the application quits if any file can't be opened
+void startFileImport(char **filenames, const int numFiles, const int append, const int fromCmdLine){
+  if((importstate.job != NULL)||(numFiles <= 0)){
+    return; //import already in progress
+  }
+  importstate.append = (unsigned char)append;
+  importstate.fromCmdLine = (unsigned char)fromCmdLine;
+  importstate.openErr = 0;
+  importstate.errJob = -1;
+  if(startImportFiles(filenames,numFiles,on_import_file_done)){ //see read_data.c
+    gtk_widget_set_sensitive(GTK_WIDGET(open_button),FALSE);
+    gtk_widget_set_sensitive(GTK_WIDGET(append_button),FALSE);
+    char headerBarSub[256];
+    snprintf(headerBarSub,256,"Loading file 1 of %i...",numFiles);
+    gtk_header_bar_set_subtitle(header_bar,headerBarSub);
+  }
+}
+
+//start opening the files selected in a file chooser
+void startFileImportFromList(GSList *file_list, const int append){
+  unsigned int i;
+  unsigned int numFiles = g_slist_length(file_list);
+  char **filenames = malloc(numFiles*sizeof(char*));
+  if(filenames == NULL){
+    return;
+  }
+  for(i=0;i<numFiles;i++){
+    filenames[i] = g_slist_nth_data(file_list,i);
+  }
+  startFileImport(filenames,(int)numFiles,append,0);
+  free(filenames);
+}
+
+void on_open_button_clicked(GtkButton *b)
+{
+  //handle case where this is called by shortcut, and files are still being opened
+  if(importstate.job != NULL){
+    return;
+  }
+
+  GtkFileChooserNative *native = gtk_file_chooser_native_new ("Open Data File(s)", window, GTK_FILE_CHOOSER_ACTION_OPEN, "_Open", "_Cancel");
+  file_open_dialog = GTK_FILE_CHOOSER(native);
+  gtk_file_chooser_set_select_multiple(file_open_dialog, TRUE);
+  file_filter = gtk_file_filter_new();
+  gtk_file_filter_set_name(file_filter,"Spectrum Data (.jf3, .txt, .mca, .fmca, .spe, .C, .root, .evt, optionally .gz/.zst compressed)");
+  gtk_file_filter_add_pattern(file_filter,"*.txt");
+  gtk_file_filter_add_pattern(file_filter,"*.mca");
+  gtk_file_filter_add_pattern(file_filter,"*.fmca");
+  gtk_file_filter_add_pattern(file_filter,"*.spe");
+  gtk_file_filter_add_pattern(file_filter,"*.C");
+  gtk_file_filter_add_pattern(file_filter,"*.root");
+  gtk_file_filter_add_pattern(file_filter,"*.evt");
+  gtk_file_filter_add_pattern(file_filter,"*.gz");
+  gtk_file_filter_add_pattern(file_filter,"*.zst");
+  gtk_file_filter_add_pattern(file_filter,"*.jf3");
+  gtk_file_chooser_add_filter(file_open_dialog,file_filter);
+
+  if(gtk_native_dialog_run(GTK_NATIVE_DIALOG(native)) == GTK_RESPONSE_ACCEPT){
+    GSList *file_list = gtk_file_chooser_get_filenames(file_open_dialog);
+    startFileImportFromList(file_list,0);
+    g_slist_free_full(file_list,g_free);
+  }
+
   g_object_unref(native);
   manualSpectrumAreaDraw();
   
@@ -615,93 +671,32 @@ void on_append_button_clicked(GtkButton *b)
 {
 
   //handle case where this is called by shortcut, and spectra are not open
-  if(rawdata.openedSp == 0){
+  //(or files are still being opened)
+  if((rawdata.openedSp == 0)||(importstate.job != NULL)){
     return;
   }
-
-  unsigned int i,j;
   
   GtkFileChooserNative *native = gtk_file_chooser_native_new ("Add More Data File(s)", window, GTK_FILE_CHOOSER_ACTION_OPEN, "_Open", "_Cancel");
   file_open_dialog = GTK_FILE_CHOOSER(native);
   gtk_file_chooser_set_select_multiple(file_open_dialog, TRUE);
   file_filter = gtk_file_filter_new();
-  gtk_file_filter_set_name(file_filter,"Spectrum Data (.jf3, .txt, .mca, .fmca, .spe, .C)");
+  gtk_file_filter_set_name(file_filter,"Spectrum Data (.jf3, .txt, .mca, .fmca, .spe, .C, .root, .evt, optionally .gz/.zst compressed)");
   gtk_file_filter_add_pattern(file_filter,"*.txt");
   gtk_file_filter_add_pattern(file_filter,"*.mca");
   gtk_file_filter_add_pattern(file_filter,"*.fmca");
   gtk_file_filter_add_pattern(file_filter,"*.spe");
   gtk_file_filter_add_pattern(file_filter,"*.C");
+  gtk_file_filter_add_pattern(file_filter,"*.root");
+  gtk_file_filter_add_pattern(file_filter,"*.evt");
+  gtk_file_filter_add_pattern(file_filter,"*.gz");
+  gtk_file_filter_add_pattern(file_filter,"*.zst");
   gtk_file_filter_add_pattern(file_filter,"*.jf3");
   gtk_file_chooser_add_filter(file_open_dialog,file_filter);
 
-  int openErr = 0; //to track if there are any errors when opening spectra
   if(gtk_native_dialog_run(GTK_NATIVE_DIALOG(native)) == GTK_RESPONSE_ACCEPT){
-
-    char *filename = NULL;
     GSList *file_list = gtk_file_chooser_get_filenames(file_open_dialog);
-    for(i=0;i<g_slist_length(file_list);i++){
-      filename = g_slist_nth_data(file_list,i);
-      int numSp = readSpectrumDataFile(filename,rawdata.hist,rawdata.numSpOpened);
-      if(numSp > 0){ //see read_data.c
-        rawdata.openedSp = 1;
-        //set comments for spectra just opened
-        for (j = rawdata.numSpOpened; j < (rawdata.numSpOpened+numSp); j++){
-          //printf("Comment %i: %s\n",j,rawdata.histComment[j]);
-          drawing.scaleFactor[j] = 1.00;
-        }
-        rawdata.numSpOpened = (unsigned char)(rawdata.numSpOpened+numSp);
-        setSpOpenView(1);
-        gtk_adjustment_set_upper(spectrum_selector_adjustment, rawdata.numSpOpened+rawdata.numViews);
-        on_spectrum_selector_changed(spectrum_selector); //update displayed name if needed
-      }else if (numSp == -1){
-        //too many files opened
-        openErr = 3;
-        break;
-      }else if (numSp == -2){
-        //improper file type
-        openErr = 4;
-      }else{
-        //improper file format
-        openErr = 1;
-        break;
-      }
-    }
-
-    if(openErr>0){
-      GtkDialogFlags flags = GTK_DIALOG_DESTROY_WITH_PARENT;
-      GtkWidget *message_dialog = gtk_message_dialog_new(window, flags, GTK_MESSAGE_ERROR, GTK_BUTTONS_CLOSE, "Error opening spectrum data!");
-      char errMsg[256];
-      switch (openErr)
-      {
-        case 2:
-          snprintf(errMsg,256,"All spectrum data in file %s is empty.",filename);
-          break;
-        case 3:
-          snprintf(errMsg,256,"You are trying to open too many files at once.  Maximum number of individual spectra which may be imported is %i.",NSPECT);
-          break;
-        case 4:
-          snprintf(errMsg,256,"The file '%s' is not in a supported file format.",filename);
-          break;
-        default:
-          snprintf(errMsg,256,"Data does not exist in file %s or is incorrectly formatted.",filename);
-          break;
-      }
-      gtk_message_dialog_format_secondary_text(GTK_MESSAGE_DIALOG(message_dialog),"%s",errMsg);
-      gtk_dialog_run (GTK_DIALOG (message_dialog));
-      gtk_widget_destroy (message_dialog);
-    }else{
-      rawdata.numFilesOpened = (unsigned char)(rawdata.numFilesOpened + g_slist_length(file_list));
-      //set the title of the opened spectrum in the header bar
-      if(rawdata.numFilesOpened > 1){
-        char headerBarSub[256];
-        snprintf(headerBarSub,256,"%i files loaded",rawdata.numFilesOpened);
-        gtk_header_bar_set_subtitle(header_bar,headerBarSub);
-      }else{
-        gtk_header_bar_set_subtitle(header_bar,filename);
-      }
-    }
-    g_slist_free(file_list);
-    g_free(filename);
+    startFileImportFromList(file_list,1);
+    g_slist_free_full(file_list,g_free);
   }
 
   g_object_unref(native);
@@ -709,12 +704,52 @@ void on_append_button_clicked(GtkButton *b)
   
 }
 
+//show the dialog for an error encountered when saving a .jf3 file
+void showSaveErrorDialog(const int saveErr, const char *filename){
+  GtkDialogFlags flags = GTK_DIALOG_DESTROY_WITH_PARENT;
+  GtkWidget *message_dialog = gtk_message_dialog_new(window, flags, GTK_MESSAGE_ERROR, GTK_BUTTONS_CLOSE, "Error saving spectrum data!");
+  char errMsg[512];
+  switch (saveErr)
+  {
+    case 1:
+      snprintf(errMsg,512,"Error writing to file %s.",filename);
+      break;
+    default:
+      snprintf(errMsg,512,"Unknown error saving spectrum data.");
+      break;
+  }
+  gtk_message_dialog_format_secondary_text(GTK_MESSAGE_DIALOG(message_dialog),"%s",errMsg);
+  gtk_dialog_run(GTK_DIALOG(message_dialog));
+  gtk_widget_destroy(message_dialog);
+}
+
+//called on the main thread once a .jf3 file has been written (see startSaveJF3 in write_data.c)
+gboolean on_save_done(gpointer data){
+  char fileName[256];
+  strncpy(fileName,savestate.job.filename,255);
+  fileName[255] = '\0';
+  int saveErr = endSaveThread();
+  if(saveErr>0){
+    gtk_label_set_text(bottom_info_text,"");
+    showSaveErrorDialog(saveErr,fileName);
+  }else{
+    //update the status bar
+    char saveMsg[512];
+    snprintf(saveMsg,512,"Saved data to file %s.",fileName);
+    gtk_label_set_text(bottom_info_text,saveMsg);
+  }
+  return G_SOURCE_REMOVE;
+}
+
 void on_save_button_clicked(GtkButton *b)
 {
   //handle case where this is called by shortcut, and spectra are not open
   if(rawdata.openedSp == 0){
     return;
   }
+  if(savestate.active){
+    return; //still writing the last file
+  }
 
   GtkFileChooserNative *native = gtk_file_chooser_native_new ("Save Spectrum Data", window, GTK_FILE_CHOOSER_ACTION_SAVE, "_Save", "_Cancel");
   file_save_dialog = GTK_FILE_CHOOSER(native);
@@ -724,8 +759,10 @@ void on_save_button_clicked(GtkButton *b)
   gtk_file_filter_set_name(file_filter,"jf3 sessions (.jf3)");
   gtk_file_filter_add_pattern(file_filter,"*.jf3");
   gtk_file_chooser_add_filter(file_save_dialog,file_filter);
+  if(sessionfile.filename[0] != '\0'){
+    gtk_file_chooser_set_filename(file_save_dialog,sessionfile.filename); //saving to the session file is fastest
+  }
 
-  int saveErr = 0; //to track if there are any errors when opening spectra
   if (gtk_native_dialog_run(GTK_NATIVE_DIALOG(native)) == GTK_RESPONSE_ACCEPT){
 
     char *fn = NULL;
@@ -735,30 +772,14 @@ void on_save_button_clicked(GtkButton *b)
     strncpy(fileName,tok,255);
     //save as a .jf3 file by default
     strncat(fileName,".jf3",255);
-    //write file
-    saveErr = writeJF3(fileName, rawdata.hist);
-
-    if(saveErr>0){
-      GtkDialogFlags flags = GTK_DIALOG_DESTROY_WITH_PARENT;
-      GtkWidget *message_dialog = gtk_message_dialog_new(window, flags, GTK_MESSAGE_ERROR, GTK_BUTTONS_CLOSE, "Error saving spectrum data!");
-      char errMsg[512];
-      switch (saveErr)
-      {
-        case 1:
-          snprintf(errMsg,512,"Error writing to file %s.",fileName);
-          break;
-        default:
-          snprintf(errMsg,512,"Unknown error saving spectrum data.");
-          break;
-      }
-      gtk_message_dialog_format_secondary_text(GTK_MESSAGE_DIALOG(message_dialog),"%s",errMsg);
-      gtk_dialog_run(GTK_DIALOG(message_dialog));
-      gtk_widget_destroy(message_dialog);
-    }else{
+    //write file (on a worker thread, on_save_done is called when finished)
+    if(startSaveJF3(fileName,on_save_done)==0){
       //update the status bar
       char saveMsg[512];
-      snprintf(saveMsg,512,"Saved data to file %s.",fileName);
+      snprintf(saveMsg,512,"Saving data to file %s...",fileName);
       gtk_label_set_text(bottom_info_text,saveMsg);
+    }else{
+      showSaveErrorDialog(1,fileName);
     }
     g_free(fn);
   }
@@ -786,7 +807,7 @@ void on_save_radware_button_clicked(GtkButton *b){
   int i;
   guiglobals.exportFileType = 1; //exporting to radware format
   gtk_label_set_text(export_description_label,"Export to .spe format:");
-  if(rawdata.numChComments > 0)
+  if(comstore.numComments > 0)
     gtk_label_set_text(export_note_label,"NOTE: Exported data will be truncated to the first 4096 bins.\nComments will not be exported (incomatible with .spe format).");
   else
     gtk_label_set_text(export_note_label,"NOTE: Exported data will be truncated to the first 4096 bins.");
@@ -818,7 +839,45 @@ void on_export_mode_combobox_changed (GtkComboBox *widget, gpointer user_data){
   }
 }
 
+//show the dialog for an error encountered when exporting spectrum data
+void showExportErrorDialog(const int saveErr){
+  GtkDialogFlags flags = GTK_DIALOG_DESTROY_WITH_PARENT;
+  GtkWidget *message_dialog = gtk_message_dialog_new(window, flags, GTK_MESSAGE_ERROR, GTK_BUTTONS_CLOSE, "Error exporting spectrum data!");
+  char errMsg[256];
+  switch (saveErr)
+  {
+    case 2:
+      snprintf(errMsg,256,"Error processing spectrum data.");
+      break;
+    case 1:
+      snprintf(errMsg,256,"Error writing to file.");
+      break;
+    default:
+      snprintf(errMsg,256,"Unknown error exporting spectrum data.");
+      break;
+  }
+  gtk_message_dialog_format_secondary_text(GTK_MESSAGE_DIALOG(message_dialog),"%s",errMsg);
+  gtk_dialog_run (GTK_DIALOG (message_dialog));
+  gtk_widget_destroy (message_dialog);
+}
+
+//called on the main thread once an exported file has been written (see startExportTXT in write_data.c)
+gboolean on_export_done(gpointer data){
+  int saveErr = endSaveThread();
+  if(saveErr>0){
+    gtk_label_set_text(bottom_info_text,"");
+    showExportErrorDialog(saveErr);
+  }else{
+    //update the status bar
+    gtk_label_set_text(bottom_info_text,"Successfully exported data.");
+  }
+  return G_SOURCE_REMOVE;
+}
+
 void on_export_save_button_clicked(GtkButton *b){
+  if(savestate.active){
+    return; //still writing the last file
+  }
   //get export settings
   int exportMode = gtk_combo_box_get_active(GTK_COMBO_BOX(export_mode_combobox));
   int rebin = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(export_rebin_checkbutton));
@@ -862,30 +921,15 @@ void on_export_save_button_clicked(GtkButton *b){
         break;
       case 0:
       default:
-        //text
-        saveErr = exportTXT(fileName, exportMode, rebin);
+        //text (on a worker thread, on_export_done is called when finished)
+        saveErr = startExportTXT(fileName, exportMode, rebin, on_export_done);
         break;
     }
 
     if(saveErr>0){
-      GtkDialogFlags flags = GTK_DIALOG_DESTROY_WITH_PARENT;
-      GtkWidget *message_dialog = gtk_message_dialog_new(window, flags, GTK_MESSAGE_ERROR, GTK_BUTTONS_CLOSE, "Error exporting spectrum data!");
-      char errMsg[256];
-      switch (saveErr)
-      {
-        case 2:
-          snprintf(errMsg,256,"Error processing spectrum data.");
-          break;
-        case 1:
-          snprintf(errMsg,256,"Error writing to file.");
-          break;
-        default:
-          snprintf(errMsg,256,"Unknown error exporting spectrum data.");
-          break;
-      }
-      gtk_message_dialog_format_secondary_text(GTK_MESSAGE_DIALOG(message_dialog),"%s",errMsg);
-      gtk_dialog_run (GTK_DIALOG (message_dialog));
-      gtk_widget_destroy (message_dialog);
+      showExportErrorDialog(saveErr);
+    }else if(savestate.active){
+      gtk_label_set_text(bottom_info_text,"Exporting data...");
     }else{
       //update the status bar
       char saveMsg[256];
@@ -1005,6 +1049,7 @@ void on_contract_scale_changed(GtkRange *range, gpointer user_data){
     for(i=0;i<3;i++){
       fitpar.fitParVal[i] *= 1.0*drawing.contractFactor/oldContractFactor;
     }
+    fitpar.contractFactor = drawing.contractFactor;
   }
   manualSpectrumAreaDraw(); //redraw the spectrum
 }
@@ -1060,6 +1105,7 @@ void on_calibrate_ok_button_clicked(GtkButton *b)
     calpar.calpar0 = (float)constPar;
     calpar.calpar1 = (float)linPar;
     calpar.calpar2 = (float)quadPar;
+    rawdata.metaGeneration++;
     //printf("Calibration parameters: %f %f %f, drawing.calMode: %i, calpar.calUnit: %s\n",calpar.calpar0,calpar.calpar1,calpar.calpar2,drawing.calMode,drawing.calUnit);
     updateConfigFile();
     gtk_widget_hide(GTK_WIDGET(calibrate_window)); //close the calibration window
@@ -1081,6 +1127,7 @@ void on_remove_calibration_button_clicked(GtkButton *b)
   calpar.calpar0=0.0;
   calpar.calpar1=1.0;
   calpar.calpar2=0.0;
+  rawdata.metaGeneration++;
   updateConfigFile();
   gtk_widget_hide(GTK_WIDGET(calibrate_window)); //close the calibration window
   manualSpectrumAreaDraw();
@@ -1140,10 +1187,10 @@ void on_comment_entry_changed(GtkEntry *entry, gpointer user_data)
   }else{
     if(guiglobals.commentEditMode==0){
       //editing spectrum/view channel comment
-      if(guiglobals.commentEditInd>=0){
+      if(getComment(guiglobals.commentEditInd) != NULL){
         const gchar *entryText;
         entryText = gtk_entry_get_text(entry);
-        if(strncmp(entryText,rawdata.chanComment[guiglobals.commentEditInd],256)==0){
+        if(strncmp(entryText,getComment(guiglobals.commentEditInd)->text,256)==0){
           gtk_widget_set_sensitive(GTK_WIDGET(comment_ok_button),FALSE);
           return;
         }
@@ -1182,10 +1229,7 @@ void on_comment_ok_button_clicked(GtkButton *b)
 
             drawing.displayedView = rawdata.numViews;
 
-            rawdata.viewMultiplotMode[rawdata.numViews] = drawing.multiplotMode;
-            rawdata.viewNumMultiplotSp[rawdata.numViews] = drawing.numMultiplotSp;
-            memcpy(&rawdata.viewScaleFactor[rawdata.numViews],&drawing.scaleFactor,sizeof(drawing.scaleFactor));
-            memcpy(&rawdata.viewMultiPlots[rawdata.numViews],&drawing.multiPlots,sizeof(drawing.multiPlots));
+            setViewFromDrawing(rawdata.numViews); //see spectrum_data.c
 
             //setup default view name
             char viewStr[256];
@@ -1194,12 +1238,12 @@ void on_comment_ok_button_clicked(GtkButton *b)
             rawdata.numViews++;
           }
         }
-        strncpy(rawdata.chanComment[(int)rawdata.numChComments],gtk_entry_get_text(comment_entry),256);
-        rawdata.numChComments++;
+        addComment(guiglobals.newCommentView,guiglobals.newCommentSp,guiglobals.newCommentCh,guiglobals.newCommentVal,gtk_entry_get_text(comment_entry)); //see comment_store.c
       }else{
         //editing an existing comment
-        if(guiglobals.commentEditInd < NCHCOM){
-          strncpy(rawdata.chanComment[guiglobals.commentEditInd],gtk_entry_get_text(comment_entry),256);
+        chan_comment *com = getComment(guiglobals.commentEditInd);
+        if(com != NULL){
+          strncpy(com->text,gtk_entry_get_text(comment_entry),sizeof(com->text)-1);
         }
       }
     }else if(guiglobals.commentEditMode==1){
@@ -1210,10 +1254,7 @@ void on_comment_ok_button_clicked(GtkButton *b)
 
           drawing.displayedView = rawdata.numViews;
 
-          rawdata.viewMultiplotMode[rawdata.numViews] = drawing.multiplotMode;
-          rawdata.viewNumMultiplotSp[rawdata.numViews] = drawing.numMultiplotSp;
-          memcpy(&rawdata.viewScaleFactor[rawdata.numViews],&drawing.scaleFactor,sizeof(drawing.scaleFactor));
-          memcpy(&rawdata.viewMultiPlots[rawdata.numViews],&drawing.multiPlots,sizeof(drawing.multiPlots));
+          setViewFromDrawing(rawdata.numViews); //see spectrum_data.c
 
           strncpy(rawdata.viewComment[rawdata.numViews],gtk_entry_get_text(comment_entry),256);
           rawdata.numViews++;
@@ -1224,6 +1265,7 @@ void on_comment_ok_button_clicked(GtkButton *b)
         strncpy(rawdata.viewComment[drawing.displayedView],gtk_entry_get_text(comment_entry),256);
       }
     }
+    rawdata.metaGeneration++; //comments, titles, or views changed
 
     gtk_widget_hide(GTK_WIDGET(comment_window)); //close the comment window
     manualSpectrumAreaDraw(); //redraw the spectrum
@@ -1239,16 +1281,8 @@ void on_remove_comment_button_clicked(GtkButton *b)
 {
   if(guiglobals.commentEditInd == -1){
     printf("WARNING: attempting to delete a comment that doesn't exist!\n");
-  }else if(guiglobals.commentEditInd < NCHCOM){
-    //shorten the comment array
-    int i;
-    for(i=guiglobals.commentEditInd+1;i<rawdata.numChComments;i++){
-      rawdata.chanCommentCh[i-1]=rawdata.chanCommentCh[i];
-      rawdata.chanCommentSp[i-1]=rawdata.chanCommentSp[i];
-      rawdata.chanCommentVal[i-1]=rawdata.chanCommentVal[i];
-      strncpy(rawdata.chanComment[i-1],rawdata.chanComment[i],256);
-    }
-    rawdata.numChComments--;
+  }else{
+    deleteComment(guiglobals.commentEditInd); //see comment_store.c
   }
   gtk_widget_hide(GTK_WIDGET(comment_window)); //close the comment window
   manualSpectrumAreaDraw(); //redraw the spectrum
@@ -1406,7 +1440,8 @@ void on_multiplot_make_view_button_clicked(GtkButton *b)
     gtk_tree_model_get(model,&iter,1,&val,3,&spInd,-1); //get whether the spectrum is selected and the spectrum index
     if((spInd < NSPECT)&&(selectedSpCount<NSPECT)){
       if(val==TRUE){
-        rawdata.viewMultiPlots[rawdata.numViews][selectedSpCount]=(unsigned char)spInd;
+        rawdata.viewMultiPlots[rawdata.numViews][selectedSpCount]=getSpHandle(spInd);
+        rawdata.viewScaleFactor[rawdata.numViews][selectedSpCount]=drawing.scaleFactor[spInd];
         selectedSpCount++;
       }
     }
@@ -1436,15 +1471,13 @@ void on_multiplot_make_view_button_clicked(GtkButton *b)
       rawdata.viewMultiplotMode[rawdata.numViews]++; //value of 0 means no multiplot
     }
 
-    //setup scale factors
-    memcpy(&rawdata.viewScaleFactor[rawdata.numViews],&drawing.scaleFactor,sizeof(drawing.scaleFactor));
-
     //setup default view name
     char viewStr[256];
     getViewStr(viewStr,256,rawdata.numViews);
 
     memcpy(rawdata.viewComment[rawdata.numViews],viewStr,sizeof(viewStr));
     rawdata.numViews++;
+    rawdata.metaGeneration++;
 
     //switch to display the custom views
     gtk_widget_show(GTK_WIDGET(view_list_box));
@@ -1482,7 +1515,7 @@ void on_multiplot_ok_button_clicked(GtkButton *b)
       if(spInd>=0){
         if((spInd < NSPECT)&&(selectedSpCount<NSPECT)){
           if(val==TRUE){
-            drawing.multiPlots[selectedSpCount]=(unsigned char)spInd;
+            drawing.multiPlots[selectedSpCount]=spInd;
             selectedSpCount++;
           }
         }
@@ -1553,10 +1586,7 @@ void on_multiplot_ok_button_clicked(GtkButton *b)
 
       if((viewInd>=0)&&(viewInd<rawdata.numViews)){
         //setup a multiplot view
-        drawing.multiplotMode = rawdata.viewMultiplotMode[viewInd];
-        drawing.numMultiplotSp = rawdata.viewNumMultiplotSp[viewInd];
-        memcpy(&drawing.scaleFactor,&rawdata.viewScaleFactor[viewInd],sizeof(drawing.scaleFactor));
-        memcpy(&drawing.multiPlots,&rawdata.viewMultiPlots[viewInd],sizeof(drawing.multiPlots));
+        setDrawingFromView(viewInd); //see spectrum_data.c
         drawing.displayedView = viewInd;
         gtk_spin_button_set_value(spectrum_selector, rawdata.numSpOpened+viewInd+1);
       }
@@ -1593,6 +1623,7 @@ void on_manage_name_cell_edited(GtkCellRendererText *cell, gchar *path_string, g
 
   //edit the histogram or view comment
   if(spInd>=0){
+    rawdata.metaGeneration++;
     if(spInd<rawdata.numSpOpened){
       snprintf(rawdata.histComment[spInd],256,"%s",new_text);
       gtk_list_store_set(manage_liststore,&iter,0,rawdata.histComment[spInd],-1); //set the boolean value (change checkbox value)
@@ -1830,6 +1861,249 @@ void on_fit_preferences_button_clicked(GtkButton *b)
   showPreferences(1);
 }
 
+//update the progress bar and buttons of the batch fit window
+void update_batch_fit_progress(){
+  char progressStr[64];
+  gboolean running = isBatchFitRunning() ? TRUE : FALSE;
+  if(batchstate.numJobs > 0){
+    snprintf(progressStr,64,"%i of %i spectra fit",batchstate.numCollected,batchstate.numJobs);
+    gtk_progress_bar_set_fraction(batch_fit_progress_bar,batchstate.numCollected/(1.0*batchstate.numJobs));
+  }else{
+    snprintf(progressStr,64,"No spectra fit");
+    gtk_progress_bar_set_fraction(batch_fit_progress_bar,0.);
+  }
+  gtk_progress_bar_set_text(batch_fit_progress_bar,progressStr);
+  gtk_widget_set_sensitive(GTK_WIDGET(batch_fit_select_tree_view),!running);
+  gtk_widget_set_sensitive(GTK_WIDGET(batch_fit_select_all_button),!running);
+  gtk_widget_set_sensitive(GTK_WIDGET(batch_fit_start_button),!running);
+  gtk_widget_set_sensitive(GTK_WIDGET(batch_fit_export_button),(!running)&&(batchstate.numCollected > 0));
+}
+
+//add the results of one fit of a batch fit to the results table
+void add_batch_fit_results(const int jobNum){
+  int i,j;
+  GtkTreeIter iter;
+  const batch_fit_job *job = &batchstate.job[jobNum];
+  if(job->result == 1){
+    double vals[3], errs[3];
+    char peakStr[16], valStr[3][50], chisqStr[50];
+    snprintf(chisqStr,50,"%f",job->par.chisq/(1.0*job->par.ndf));
+    for(i=0;i<job->par.numFitPeaks;i++){
+      getFitPeakVals(&job->par,i,vals,errs); //see batch_fit.c
+      for(j=0;j<3;j++){
+        getFormattedValAndUncertainty(vals[j],errs[j],valStr[j],50,1,guiglobals.roundErrors);
+      }
+      snprintf(peakStr,16,"%i",i+1);
+      gtk_list_store_append(batch_fit_results_liststore,&iter);
+      gtk_list_store_set(batch_fit_results_liststore,&iter,0,job->name,1,peakStr,2,valStr[0],3,valStr[1],4,valStr[2],5,chisqStr,-1);
+    }
+  }else{
+    const char *resultStr = "Fit failed";
+    if(job->result == 3){
+      resultStr = "Cancelled";
+    }else if(job->result == 4){
+      resultStr = "Not fit (no spectra)";
+    }
+    gtk_list_store_append(batch_fit_results_liststore,&iter);
+    gtk_list_store_set(batch_fit_results_liststore,&iter,0,job->name,1,"-",2,resultStr,3,"-",4,"-",5,"-",-1);
+  }
+}
+
+//called on the main thread whenever a fit of a batch fit has finished
+gboolean on_batch_fit_done(gpointer data){
+  int jobNum;
+  while((jobNum = collectNextBatchFitJob()) >= 0){ //see batch_fit.c
+    add_batch_fit_results(jobNum);
+  }
+  update_batch_fit_progress();
+  return FALSE; //stop running
+}
+
+//list the spectra and views which can be batch fit, spectra are listed by
+//handle (see spectrum_store.c) so that those already selected stay selected,
+//views are listed by number so the list must be made again whenever they
+//change (see on_batch_fit_start_button_clicked)
+void setup_batch_fit_select_list(){
+  GtkTreeIter iter;
+  gboolean val = FALSE;
+  int i;
+  int spHandle = -1;
+  unsigned char spSelected[NSPECT];
+  GtkTreeModel *model = GTK_TREE_MODEL(batch_fit_select_liststore);
+
+  memset(spSelected,0,sizeof(spSelected));
+  gboolean readingTreeModel = gtk_tree_model_get_iter_first(model, &iter);
+  while(readingTreeModel){
+    gtk_tree_model_get(model,&iter,1,&val,2,&spHandle,-1);
+    if((val==TRUE)&&(spHandle >= 0)&&(spHandle < NSPECT)){
+      spSelected[spHandle] = 1;
+    }
+    readingTreeModel = gtk_tree_model_iter_next(model, &iter);
+  }
+
+  gtk_list_store_clear(batch_fit_select_liststore);
+  for(i=0;i<rawdata.numSpOpened;i++){
+    spHandle = getSpHandle(i);
+    val = ((spHandle >= 0)&&(spSelected[spHandle])) ? TRUE : FALSE;
+    gtk_list_store_append(batch_fit_select_liststore,&iter);
+    gtk_list_store_set(batch_fit_select_liststore,&iter,0,rawdata.histComment[i],1,val,2,spHandle,3,-1,-1);
+  }
+  for(i=0;i<rawdata.numViews;i++){
+    if(rawdata.viewMultiplotMode[i] < 2){
+      //only single spectra and summed views can be fit
+      gtk_list_store_append(batch_fit_select_liststore,&iter);
+      gtk_list_store_set(batch_fit_select_liststore,&iter,0,rawdata.viewComment[i],1,FALSE,2,-1,3,i,-1);
+    }
+  }
+  batchstate.selMetaGeneration = rawdata.metaGeneration;
+}
+
+void on_fit_batch_button_clicked(GtkButton *b)
+{
+  char regionStr[256];
+
+  if(isBatchFitRunning()){
+    gtk_window_present(batch_fit_window); //show the fits which are running
+    return;
+  }
+  if((fitpar.numFitPeaks <= 0)||(fitpar.fitStartCh < 0)||(fitpar.fitEndCh < 0)){
+    return; //no fit region or peaks
+  }
+
+  //use the fit region and peaks from the displayed spectrum
+  memcpy(&batchstate.par,&fitpar,sizeof(fit_params));
+  batchstate.contractFactor = drawing.contractFactor;
+  if(calpar.calMode == 1){
+    snprintf(regionStr,256,"Fit region: %.1f to %.1f %s, %i peak(s)",getCalVal(fitpar.fitStartCh),getCalVal(fitpar.fitEndCh),calpar.calUnit,fitpar.numFitPeaks);
+  }else{
+    snprintf(regionStr,256,"Fit region: channels %i to %i, %i peak(s)",fitpar.fitStartCh,fitpar.fitEndCh,fitpar.numFitPeaks);
+  }
+  gtk_label_set_text(batch_fit_region_label,regionStr);
+
+  //list the spectra and views which can be fit
+  setup_batch_fit_select_list();
+
+  update_batch_fit_progress();
+  gtk_window_present(batch_fit_window); //show the window
+}
+
+void on_batch_fit_cell_toggled(GtkCellRendererToggle *c, gchar *path_string){
+  GtkTreeIter iter;
+  gboolean val = FALSE;
+  GtkTreeModel *model = gtk_tree_view_get_model(batch_fit_select_tree_view);
+  gtk_tree_model_get_iter_from_string(model, &iter, path_string);
+  gtk_tree_model_get(model,&iter,1,&val,-1); //get the boolean value
+  gtk_list_store_set(batch_fit_select_liststore,&iter,1,!val,-1); //set the boolean value (change checkbox value)
+}
+
+void on_batch_fit_select_all_button_clicked(GtkButton *b)
+{
+  GtkTreeIter iter;
+  GtkTreeModel *model = gtk_tree_view_get_model(batch_fit_select_tree_view);
+  gboolean readingTreeModel = gtk_tree_model_get_iter_first(model, &iter);
+  while(readingTreeModel){
+    gtk_list_store_set(batch_fit_select_liststore,&iter,1,TRUE,-1);
+    readingTreeModel = gtk_tree_model_iter_next(model, &iter);
+  }
+}
+
+void on_batch_fit_start_button_clicked(GtkButton *b)
+{
+  GtkTreeIter iter;
+  gboolean val = FALSE;
+  int spHandle = -1;
+  int viewNum = -1;
+  int numEntries = 0;
+  GtkTreeModel *model = gtk_tree_view_get_model(batch_fit_select_tree_view);
+
+  if(batchstate.selMetaGeneration != rawdata.metaGeneration){
+    //spectra or views were opened, deleted, or renamed since the list was made
+    setup_batch_fit_select_list();
+    GtkDialogFlags flags = GTK_DIALOG_DESTROY_WITH_PARENT;
+    GtkWidget *message_dialog = gtk_message_dialog_new(batch_fit_window, flags, GTK_MESSAGE_INFO, GTK_BUTTONS_CLOSE, "Spectra have changed!");
+    gtk_message_dialog_format_secondary_text(GTK_MESSAGE_DIALOG(message_dialog),"The opened spectra or views have changed since they were listed.  Check which spectra and views are selected, then start the fit again.");
+    gtk_dialog_run (GTK_DIALOG (message_dialog));
+    gtk_widget_destroy (message_dialog);
+    return;
+  }
+
+  int *entry = malloc((size_t)(NSPECT+MAXNVIEWS)*sizeof(int));
+  if(entry == NULL){
+    return;
+  }
+
+  //get the selected spectra and views, numbered as in the manage window (see getBatchFitEntrySp)
+  gboolean readingTreeModel = gtk_tree_model_get_iter_first(model, &iter);
+  while(readingTreeModel){
+    gtk_tree_model_get(model,&iter,1,&val,2,&spHandle,3,&viewNum,-1); //get whether the entry is selected, and the spectrum or view
+    if((val==TRUE)&&(numEntries < NSPECT+MAXNVIEWS)){
+      int spInd = getSpIndexFromHandle(spHandle);
+      if(spInd >= 0){
+        entry[numEntries] = spInd;
+        numEntries++;
+      }else if((viewNum >= 0)&&(viewNum < rawdata.numViews)){
+        entry[numEntries] = rawdata.numSpOpened+viewNum;
+        numEntries++;
+      }
+    }
+    readingTreeModel = gtk_tree_model_iter_next(model, &iter);
+  }
+
+  if(numEntries > 0){
+    gtk_list_store_clear(batch_fit_results_liststore);
+    if(startBatchFit(&batchstate.par,batchstate.contractFactor,entry,numEntries,on_batch_fit_done)==0){ //see batch_fit.c
+      GtkDialogFlags flags = GTK_DIALOG_DESTROY_WITH_PARENT;
+      GtkWidget *message_dialog = gtk_message_dialog_new(batch_fit_window, flags, GTK_MESSAGE_ERROR, GTK_BUTTONS_CLOSE, "Cannot fit data!");
+      gtk_message_dialog_format_secondary_text(GTK_MESSAGE_DIALOG(message_dialog),"The fit region and peaks can't be fit.  Try again using a wider fit region or fewer peaks.");
+      gtk_dialog_run (GTK_DIALOG (message_dialog));
+      gtk_widget_destroy (message_dialog);
+    }
+  }
+  free(entry);
+  update_batch_fit_progress();
+}
+
+void on_batch_fit_cancel_button_clicked(GtkButton *b)
+{
+  if(isBatchFitRunning()){
+    cancelBatchFit(); //see batch_fit.c
+  }else{
+    gtk_widget_hide(GTK_WIDGET(batch_fit_window)); //close the window
+  }
+}
+
+gboolean on_batch_fit_window_delete(GtkWidget *widget, GdkEvent *event, gpointer user_data){
+  cancelBatchFit(); //stop any fits which are running, see batch_fit.c
+  gtk_widget_hide(widget);
+  return TRUE; //so that the window is hidden, not destroyed
+}
+
+void on_batch_fit_export_button_clicked(GtkButton *b)
+{
+  GtkFileChooserNative *native = gtk_file_chooser_native_new ("Export Fit Results", batch_fit_window, GTK_FILE_CHOOSER_ACTION_SAVE, "_Export", "_Cancel");
+  file_save_dialog = GTK_FILE_CHOOSER(native);
+  gtk_file_chooser_set_select_multiple(file_save_dialog, FALSE);
+  gtk_file_chooser_set_do_overwrite_confirmation(file_save_dialog, TRUE);
+  file_filter = gtk_file_filter_new();
+  gtk_file_filter_set_name(file_filter,"CSV files (.csv)");
+  gtk_file_filter_add_pattern(file_filter,"*.csv");
+  gtk_file_chooser_add_filter(file_save_dialog,file_filter);
+
+  if (gtk_native_dialog_run(GTK_NATIVE_DIALOG(native)) == GTK_RESPONSE_ACCEPT){
+    char *fn = gtk_file_chooser_get_filename(file_save_dialog);
+    if(writeBatchFitCSV(fn)==0){ //see batch_fit.c
+      GtkDialogFlags flags = GTK_DIALOG_DESTROY_WITH_PARENT;
+      GtkWidget *message_dialog = gtk_message_dialog_new(batch_fit_window, flags, GTK_MESSAGE_ERROR, GTK_BUTTONS_CLOSE, "Error saving file!");
+      gtk_message_dialog_format_secondary_text(GTK_MESSAGE_DIALOG(message_dialog),"Cannot write to the file %s.  Check that the location is writeable.",fn);
+      gtk_dialog_run (GTK_DIALOG (message_dialog));
+      gtk_widget_destroy (message_dialog);
+    }
+    g_free(fn);
+  }
+
+  g_object_unref(native);
+}
+
 void on_toggle_discard_empty(GtkToggleButton *togglebutton, gpointer user_data)
 {
   if(gtk_toggle_button_get_active(togglebutton))
@@ -1837,6 +2111,23 @@ void on_toggle_discard_empty(GtkToggleButton *togglebutton, gpointer user_data)
   else
     rawdata.dropEmptySpectra=0;
 }
+void on_toggle_lazy_load(GtkToggleButton *togglebutton, gpointer user_data)
+{
+  if(gtk_toggle_button_get_active(togglebutton))
+    rawdata.lazyLoadSpectra=1;
+  else
+    rawdata.lazyLoadSpectra=0;
+}
+void on_toggle_follow_files(GtkToggleButton *togglebutton, gpointer user_data)
+{
+  if(gtk_toggle_button_get_active(togglebutton)){
+    rawdata.followFiles=1;
+    startFollowingFiles(on_followed_files_updated); //see follow.c
+  }else{
+    rawdata.followFiles=0;
+    stopFollowingFiles();
+  }
+}
 void on_toggle_bin_errors(GtkToggleButton *togglebutton, gpointer user_data)
 {
   if(gtk_toggle_button_get_active(togglebutton))
@@ -1924,6 +2215,7 @@ void on_preferences_apply_button_clicked(GtkButton *b)
 {
   fitpar.fitType = (unsigned char)gtk_combo_box_get_active(GTK_COMBO_BOX(peak_shape_combobox));
   fitpar.weightMode = (unsigned char)gtk_combo_box_get_active(GTK_COMBO_BOX(weight_mode_combobox));
+  rawdata.listModeChannels = 1024 << gtk_combo_box_get_active(GTK_COMBO_BOX(listmode_channels_combobox));
   updateConfigFile();
   manualSpectrumAreaDraw(); //redraw the spectrum
   gtk_widget_hide(GTK_WIDGET(preferences_window)); //close the preferences window
@@ -2089,6 +2381,8 @@ void iniitalizeUIElements(){
   gtk_window_set_transient_for(GTK_WINDOW(shortcuts_window), window); //center shortcuts window on main window
   help_window = GTK_WINDOW(gtk_builder_get_object(builder, "help_window"));
   gtk_window_set_transient_for(GTK_WINDOW(help_window), window); //center help window on main window
+  batch_fit_window = GTK_WINDOW(gtk_builder_get_object(builder, "batch_fit_window"));
+  gtk_window_set_transient_for(batch_fit_window, window); //center batch fit window on main window
   about_dialog = GTK_ABOUT_DIALOG(gtk_builder_get_object(builder, "about_dialog"));
   gtk_window_set_transient_for(GTK_WINDOW(about_dialog), window); //center about dialog on main window
   main_window_accelgroup = GTK_ACCEL_GROUP(gtk_builder_get_object(builder, "main_window_accelgroup"));
@@ -2130,8 +2424,22 @@ void iniitalizeUIElements(){
   fit_cancel_button = GTK_BUTTON(gtk_builder_get_object(builder, "fit_cancel_button"));
   fit_fit_button = GTK_BUTTON(gtk_builder_get_object(builder, "fit_fit_button"));
   fit_preferences_button = GTK_BUTTON(gtk_builder_get_object(builder, "fit_preferences_button"));
+  fit_batch_button = GTK_BUTTON(gtk_builder_get_object(builder, "fit_batch_button"));
   fit_spinner = GTK_SPINNER(gtk_builder_get_object(builder, "fit_spinner"));
 
+  //batch fit window UI elements
+  batch_fit_region_label = GTK_LABEL(gtk_builder_get_object(builder, "batch_fit_region_label"));
+  batch_fit_select_liststore = GTK_LIST_STORE(gtk_builder_get_object(builder, "batch_fit_select_liststore"));
+  batch_fit_results_liststore = GTK_LIST_STORE(gtk_builder_get_object(builder, "batch_fit_results_liststore"));
+  batch_fit_select_tree_view = GTK_TREE_VIEW(gtk_builder_get_object(builder, "batch_fit_select_tree_view"));
+  batch_fit_select_column2 = GTK_TREE_VIEW_COLUMN(gtk_builder_get_object(builder, "batch_fit_select_column2"));
+  batch_fit_select_cr2 = GTK_CELL_RENDERER(gtk_builder_get_object(builder, "batch_fit_select_cr2"));
+  batch_fit_progress_bar = GTK_PROGRESS_BAR(gtk_builder_get_object(builder, "batch_fit_progress_bar"));
+  batch_fit_select_all_button = GTK_BUTTON(gtk_builder_get_object(builder, "batch_fit_select_all_button"));
+  batch_fit_start_button = GTK_BUTTON(gtk_builder_get_object(builder, "batch_fit_start_button"));
+  batch_fit_cancel_button = GTK_BUTTON(gtk_builder_get_object(builder, "batch_fit_cancel_button"));
+  batch_fit_export_button = GTK_BUTTON(gtk_builder_get_object(builder, "batch_fit_export_button"));
+
   //calibration window UI elements
   calibrate_ok_button = GTK_WIDGET(gtk_builder_get_object(builder, "options_ok_button"));
   remove_calibration_button = GTK_WIDGET(gtk_builder_get_object(builder, "remove_calibration_button"));
@@ -2201,6 +2509,8 @@ void iniitalizeUIElements(){
   preferences_button = GTK_MODEL_BUTTON(gtk_builder_get_object(builder, "preferences_button"));
   preferences_notebook = GTK_NOTEBOOK(gtk_builder_get_object(builder, "preferences_notebook"));
   discard_empty_checkbutton = GTK_CHECK_BUTTON(gtk_builder_get_object(builder, "discard_empty_checkbutton"));
+  lazy_load_checkbutton = GTK_CHECK_BUTTON(gtk_builder_get_object(builder, "lazy_load_checkbutton"));
+  follow_files_checkbutton = GTK_CHECK_BUTTON(gtk_builder_get_object(builder, "follow_files_checkbutton"));
   bin_errors_checkbutton = GTK_CHECK_BUTTON(gtk_builder_get_object(builder, "bin_errors_checkbutton"));
   round_errors_checkbutton = GTK_CHECK_BUTTON(gtk_builder_get_object(builder, "round_errors_checkbutton"));
   autozoom_checkbutton = GTK_CHECK_BUTTON(gtk_builder_get_object(builder, "autozoom_checkbutton"));
@@ -2211,6 +2521,7 @@ void iniitalizeUIElements(){
   relative_widths_checkbutton = GTK_CHECK_BUTTON(gtk_builder_get_object(builder, "relative_widths_checkbutton"));
   peak_shape_combobox = GTK_COMBO_BOX_TEXT(gtk_builder_get_object(builder, "peak_shape_combobox"));
   weight_mode_combobox = GTK_COMBO_BOX_TEXT(gtk_builder_get_object(builder, "weight_mode_combobox"));
+  listmode_channels_combobox = GTK_COMBO_BOX_TEXT(gtk_builder_get_object(builder, "listmode_channels_combobox"));
   popup_results_checkbutton = GTK_CHECK_BUTTON(gtk_builder_get_object(builder, "popup_results_checkbutton"));
   animation_checkbutton = GTK_CHECK_BUTTON(gtk_builder_get_object(builder, "animation_checkbutton"));
   preferences_apply_button = GTK_BUTTON(gtk_builder_get_object(builder, "preferences_apply_button"));
@@ -2247,6 +2558,12 @@ void iniitalizeUIElements(){
   g_signal_connect(G_OBJECT(fit_fit_button), "clicked", G_CALLBACK(on_fit_fit_button_clicked), NULL);
   g_signal_connect(G_OBJECT(fit_cancel_button), "clicked", G_CALLBACK(on_fit_cancel_button_clicked), NULL);
   g_signal_connect(G_OBJECT(fit_preferences_button), "clicked", G_CALLBACK(on_fit_preferences_button_clicked), NULL);
+  g_signal_connect(G_OBJECT(fit_batch_button), "clicked", G_CALLBACK(on_fit_batch_button_clicked), NULL);
+  g_signal_connect(G_OBJECT(batch_fit_select_cr2), "toggled", G_CALLBACK(on_batch_fit_cell_toggled), NULL);
+  g_signal_connect(G_OBJECT(batch_fit_select_all_button), "clicked", G_CALLBACK(on_batch_fit_select_all_button_clicked), NULL);
+  g_signal_connect(G_OBJECT(batch_fit_start_button), "clicked", G_CALLBACK(on_batch_fit_start_button_clicked), NULL);
+  g_signal_connect(G_OBJECT(batch_fit_cancel_button), "clicked", G_CALLBACK(on_batch_fit_cancel_button_clicked), NULL);
+  g_signal_connect(G_OBJECT(batch_fit_export_button), "clicked", G_CALLBACK(on_batch_fit_export_button_clicked), NULL);
   g_signal_connect(G_OBJECT(display_button), "clicked", G_CALLBACK(on_display_button_clicked), NULL);
   g_signal_connect(G_OBJECT(calibrate_ok_button), "clicked", G_CALLBACK(on_calibrate_ok_button_clicked), NULL);
   g_signal_connect(G_OBJECT(comment_ok_button), "clicked", G_CALLBACK(on_comment_ok_button_clicked), NULL);
@@ -2258,6 +2575,8 @@ void iniitalizeUIElements(){
   g_signal_connect(G_OBJECT(logscale_button), "toggled", G_CALLBACK(on_toggle_logscale), NULL);
   g_signal_connect(G_OBJECT(cursor_draw_button), "toggled", G_CALLBACK(on_toggle_cursor), NULL);
   g_signal_connect(G_OBJECT(discard_empty_checkbutton), "toggled", G_CALLBACK(on_toggle_discard_empty), NULL);
+  g_signal_connect(G_OBJECT(lazy_load_checkbutton), "toggled", G_CALLBACK(on_toggle_lazy_load), NULL);
+  g_signal_connect(G_OBJECT(follow_files_checkbutton), "toggled", G_CALLBACK(on_toggle_follow_files), NULL);
   g_signal_connect(G_OBJECT(export_options_save_button), "clicked", G_CALLBACK(on_export_save_button_clicked), NULL);
   g_signal_connect(G_OBJECT(export_image_save_button), "clicked", G_CALLBACK(on_export_image_button_clicked), NULL);
   g_signal_connect(G_OBJECT(bin_errors_checkbutton), "toggled", G_CALLBACK(on_toggle_bin_errors), NULL);
@@ -2298,6 +2617,7 @@ void iniitalizeUIElements(){
   g_signal_connect(G_OBJECT(shortcuts_window), "delete-event", G_CALLBACK(gtk_widget_hide_on_delete), NULL); //so that the window is hidden, not destroyed, when hitting the x button
   g_signal_connect(G_OBJECT(help_window), "delete-event", G_CALLBACK(gtk_widget_hide_on_delete), NULL); //so that the window is hidden, not destroyed, when hitting the x button
   g_signal_connect(G_OBJECT(about_dialog), "delete-event", G_CALLBACK(gtk_widget_hide_on_delete), NULL); //so that the window is hidden, not destroyed, when hitting the x button
+  g_signal_connect(G_OBJECT(batch_fit_window), "delete-event", G_CALLBACK(on_batch_fit_window_delete), NULL); //stop any fits and hide the window when hitting the x button
 
   //setup keyboard shortcuts
   gtk_accel_group_connect(main_window_accelgroup, GDK_KEY_f, (GdkModifierType)0, GTK_ACCEL_VISIBLE, g_cclosure_new(G_CALLBACK(on_fit_button_clicked), NULL, 0));
@@ -2325,6 +2645,7 @@ void iniitalizeUIElements(){
   //set attributes
   gtk_tree_view_column_add_attribute(multiplot_column2,multiplot_cr2, "active",1);
   gtk_tree_view_column_add_attribute(manage_column2,manage_cr2, "active",1);
+  gtk_tree_view_column_add_attribute(batch_fit_select_column2,batch_fit_select_cr2, "active",1);
 
   //set default values
   rawdata.openedSp = 0;
@@ -2347,8 +2668,12 @@ void iniitalizeUIElements(){
   drawing.zoomYLastFrameTime = 0;
   calpar.calMode = 0;
   rawdata.dropEmptySpectra = 1;
+  rawdata.lazyLoadSpectra = 0;
+  rawdata.followFiles = 0;
+  rawdata.listModeChannels = LISTMODE_DEFAULT_CHANNELS;
+  followstate.inotifyFd = -1;
   rawdata.numSpOpened = 0;
-  rawdata.numChComments = 0;
+  clearComments(); //see comment_store.c
   drawing.displayedView = -1;
   drawing.multiplotMode = 0;
   drawing.numMultiplotSp = 1;
@@ -7,11 +7,21 @@
 
 //routines
 #include "utils.c" //standalone utility functions
+#include "spectrum_kernels.c" //vectorized kernels for bulk operations on spectrum data
+#include "spectrum_codec.c" //encoding of spectrum data in .jf3 files
+#include "spectrum_store.c" //storage for imported spectrum/histogram data
+#include "comment_store.c" //storage for channel comments
 #include "spectrum_data.c" //functions which access imported spectrum/histogram data
 #include "fit_data.c" //functions for fitting imported data
+#include "batch_fit.c" //fitting many spectra at once
 #include "spectrum_drawing.c" //functions for drawing imported data
 //read/write routines
+#include "spectrum_import.c" //holding data read from files before it is added to the spectrum store
+#include "data_stream.c" //reading (possibly compressed) data files as a stream
+#include "read_root.c" //reading histograms from binary ROOT files
+#include "read_listmode.c" //histogramming list-mode event files
 #include "read_data.c"
+#include "follow.c" //following opened files for changes
 #include "write_data.c"
 #include "read_config.c" //functions for reading/writing user preferences 
 //GTK interaction routines
@@ -20,26 +30,23 @@
 int main(int argc, char *argv[])
 {
   
+  //list the histograms in ROOT files without opening them, if requested
+  if((argc > 2)&&(strcmp(argv[1],"--list-root")==0)){
+    int i;
+    for(i=2;i<argc;i++){
+      listROOTHistograms(argv[i]); //see read_root.c
+    }
+    return 0;
+  }
+
+  initSpStore(); //see spectrum_store.c
   gtk_init(&argc, &argv); //initialize GTK
   iniitalizeUIElements(); //see gui.c
 
-  //open a file if requested from the command line
+  //open files if requested from the command line (the files are read in
+  //the background once the main loop starts, see gui.c)
   if(argc > 1){
-    int i;
-    openSingleFile(argv[1],0);
-    for(i=2;i<argc;i++){
-      openSingleFile(argv[i],1);
-    }
-    //set headerbar info for opened files
-    if(argc>2){
-      char headerBarSub[256];
-      rawdata.numFilesOpened = (unsigned char)(argc - 1);
-      snprintf(headerBarSub,256,"%i files loaded",rawdata.numFilesOpened);
-      gtk_header_bar_set_subtitle(header_bar,headerBarSub);
-    }else{
-      gtk_header_bar_set_subtitle(header_bar,argv[1]);
-    }
-    gtk_widget_set_sensitive(GTK_WIDGET(append_button),TRUE);
+    startFileImport(&argv[1],argc-1,0,1);
   }
 
   //setup config file
@@ -81,6 +88,16 @@ int main(int argc, char *argv[])
   gtk_widget_show(GTK_WIDGET(window)); //show the window
   gtk_main(); //start GTK main loop
 
+  if(savestate.active){
+    endSaveThread(); //finish writing any file still being saved (see write_data.c)
+  }
+  if(followstate.job != NULL){
+    endFollowRead(); //wait for any files still being re-read (see follow.c)
+  }
+  stopFollowingFiles();
+  clearFollowedFiles();
+  freeSpStore(); //see spectrum_store.c
+  freeCommentStore(); //see comment_store.c
   return 0;
 }
 
@@ -1,17 +1,35 @@
 /* J. Williams, 2020-2021 */
 
+#define _POSIX_C_SOURCE 200809L //for strtok_r (file readers may run on worker threads)
+
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
 #include <gtk/gtk.h>
 #include <gtk/gtkx.h>
+#include <glib-unix.h>
 #include <cairo.h>
 #include <stdio.h>
 #include <ctype.h>
 #include <math.h>
+#include <time.h>
 #include <libgen.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/inotify.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <zlib.h>
+#ifdef JF3_ZSTD
+#include <zstd.h> //optional, see Makefile
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define JF3_SIMD_X86 //use SSE2/AVX2 kernels where supported (see spectrum_kernels.c)
+#endif
 
 #include "lin_eq_solver.h"
 
@@ -23,9 +41,9 @@
 
 /* Data file specs (be careful if changing these, can break compatibility) */
 #define S32K      32768 //maximum number of channels per spectrum in .mca and .fmca (changing breaks file compatibility)
-#define NSPECT    100   //maximum number of spectra which may be opened at once (for compatibility should be 255 or less)
+#define NSPECT    1000  //maximum number of spectra which may be opened at once (spectrum data itself is allocated on demand, see spectrum_store.c)
 #define MAXNVIEWS 100   //maximum number of views which can be saved by the user
-#define NCHCOM    1000  //maximum number of comments that can be placed by the user on individual channels
+#define SP_CACHE_CHANNELS (64*S32K) //maximum number of channels of spectra loaded from files on demand to keep in memory at once (see spectrum_store.c)
 
 /* GUI globals */
 GtkWindow *window;
@@ -56,8 +74,17 @@ GtkGesture *spectrum_drag_gesture;
 //fit overlay/revealer
 GtkRevealer *revealer_info_panel;
 GtkLabel *revealer_info_label;
-GtkButton *fit_cancel_button, *fit_fit_button, *fit_preferences_button;
+GtkButton *fit_cancel_button, *fit_fit_button, *fit_preferences_button, *fit_batch_button;
 GtkSpinner *fit_spinner;
+//batch fit dialog
+GtkWindow *batch_fit_window;
+GtkLabel *batch_fit_region_label;
+GtkListStore *batch_fit_select_liststore, *batch_fit_results_liststore;
+GtkTreeView *batch_fit_select_tree_view;
+GtkTreeViewColumn *batch_fit_select_column2;
+GtkCellRenderer *batch_fit_select_cr2;
+GtkProgressBar *batch_fit_progress_bar;
+GtkButton *batch_fit_select_all_button, *batch_fit_start_button, *batch_fit_cancel_button, *batch_fit_export_button;
 //Calibration dialog
 GtkWidget *calibrate_ok_button, *remove_calibration_button;
 GtkWindow *calibrate_window;
@@ -112,11 +139,11 @@ GtkButton *export_image_save_button;
 GtkModelButton *preferences_button;
 GtkWindow *preferences_window;
 GtkNotebook *preferences_notebook;
-GtkCheckButton *discard_empty_checkbutton, *bin_errors_checkbutton, *round_errors_checkbutton, *dark_theme_checkbutton;
+GtkCheckButton *discard_empty_checkbutton, *lazy_load_checkbutton, *follow_files_checkbutton, *bin_errors_checkbutton, *round_errors_checkbutton, *dark_theme_checkbutton;
 GtkCheckButton *spectrum_label_checkbutton, *spectrum_comment_checkbutton, *spectrum_gridline_checkbutton, *autozoom_checkbutton;
 GtkCheckButton *relative_widths_checkbutton;
 GtkButton *preferences_apply_button;
-GtkComboBoxText *peak_shape_combobox, *weight_mode_combobox;
+GtkComboBoxText *peak_shape_combobox, *weight_mode_combobox, *listmode_channels_combobox;
 GtkCheckButton *popup_results_checkbutton;
 GtkCheckButton *animation_checkbutton;
 //shortcuts window
@@ -148,35 +175,111 @@ struct {
   unsigned char roundErrors; //0=don't round, 1=round
   unsigned char autoZoom; //0=don't autozoom, 1=autozoom
   unsigned char commentEditMode; //0=editing comment, 1=editing view title
-  int commentEditInd;
+  int commentEditInd; //id of the comment being edited (see comment_store.c), -1 if making a new comment
+  unsigned char newCommentView; //0=new comment is on spectrum, 1=new comment is on view
+  int newCommentSp; //spectrum handle or view number at which the new comment will be placed
+  int newCommentCh; //channel at which the new comment will be placed
+  float newCommentVal; //y-value at which the new comment will be placed
   char preferDarkTheme; //0=prefer light, 1=prefer dark
   char popupFitResults; //0=don't popup results after fit, 1=popup results
   char useZoomAnimations; //0=don't use, 1=use
   char exportFileType; //0=text, 1=radware
 } guiglobals;
 
+//min/max level-of-detail pyramid over an array of values (see utils.c)
+//node i of level l covers values i*2^l to (i+1)*2^l - 1, level 0 is the values themselves
+typedef struct {
+  float *min; //minimum value of each node, for levels 1 and up
+  float *max; //maximum value of each node, for levels 1 and up
+  int levelStart[32]; //index of the first node of level l+1 in the min and max arrays
+  int numLevels; //number of levels above the values themselves
+  int length; //number of values
+} minmax_pyramid;
+
+//spectrum data storage (see spectrum_store.c)
+typedef struct {
+  double *data; //histogram data for a single spectrum
+  int length; //number of channels containing data (channels beyond this are empty)
+  int allocLength; //number of channels allocated
+  double *cumSum; //cumulative sums of the data, cumSum[i] is the sum of channels 0 to i-1
+  double *cumAbsSum; //cumulative sums of absolute values, only allocated if the data has negative values
+  minmax_pyramid pyr; //min/max pyramid of the data, for fast autoscaling and drawing
+  int indexValid; //whether the cumulative sums and min/max pyramid are up to date with the data
+  char *srcFile; //if set, the data is loaded on demand from this file, and may be unloaded again when not used (length is always valid)
+  long srcOffset; //position of the data in srcFile
+  unsigned char srcType; //type of the values in srcFile: 0=32-bit integer array, 1=32-bit float array, 2=encoded block (see spectrum_codec.c)
+  unsigned char srcCodec; //codec of the data in srcFile, for encoded blocks
+  unsigned int srcLength; //length of the data in srcFile in bytes, for encoded blocks
+  unsigned char srcLoaded; //whether the data from srcFile is currently loaded
+  unsigned int lastUsed; //value of the store use counter when the entry was last used, for unloading the least recently used entries
+} sp_store_entry;
+
+struct {
+  sp_store_entry *sp; //entries for each spectrum, indexed by spectrum handle
+  int numAlloc; //number of entries allocated
+  int spHandle[NSPECT]; //handle of the spectrum at each index (indexed the same way as histComment), -1 if none
+  int spIndex[NSPECT]; //index of the spectrum with each handle, -1 if the handle is unused
+  unsigned int generation; //incremented whenever stored data changes
+  unsigned int useCounter; //incremented whenever an entry loaded on demand is used
+} spstore;
+
+//channel comment storage (see comment_store.c)
+typedef struct {
+  char text[256]; //comment text
+  unsigned char view; //0=comment is on spectrum, 1=comment is on view
+  int sp; //spectrum handle (see spectrum_store.c) or view number at which the comment is displayed
+  int ch; //channel at which the comment is displayed
+  float val; //y-value at which the comment is displayed
+  unsigned char used; //0=deleted or never used, 1=in use
+} chan_comment;
+
+typedef struct {
+  int *ids; //comment ids, sorted by channel (may contain deleted comments)
+  int num; //number of ids in the list
+  int numAlloc; //number of ids allocated
+  int numDeleted; //number of deleted comments still in the list
+} comment_list;
+
+struct {
+  chan_comment *com; //comments, indexed by comment id
+  int numAlloc; //number of comments allocated
+  int numUsed; //number of comment ids which have been handed out
+  int *freeIds; //deleted comment ids available for reuse
+  int numFree; //number of ids in freeIds
+  comment_list list[NSPECT+MAXNVIEWS]; //sorted comment lists for each spectrum handle, followed by each view
+  int numComments; //number of comments which have been placed
+} comstore;
+
 //raw histogram data globals
 struct {
-  double hist[NSPECT][S32K]; //spectrum histogram data
   char histComment[NSPECT][256]; //spectrum description/comment
   char openedSp; //0=not opened, 1=opened
-  unsigned char numSpOpened; //number of spectra in the opened file(s)
+  int numSpOpened; //number of spectra in the opened file(s)
   unsigned char numFilesOpened; //number of files containing spectra opened
   char viewComment[MAXNVIEWS][256]; //view description/comment
   unsigned char viewMultiplotMode[MAXNVIEWS]; //multiplot mode for each saved view
-  unsigned char viewNumMultiplotSp[MAXNVIEWS]; //number of spectra to show for each saved view
-  double viewScaleFactor[MAXNVIEWS][NSPECT]; //scaling factors for each spectrum in each saved view
-  unsigned char viewMultiPlots[MAXNVIEWS][NSPECT]; //indices of all the spectra to show for each saved view
+  int viewNumMultiplotSp[MAXNVIEWS]; //number of spectra to show for each saved view
+  double viewScaleFactor[MAXNVIEWS][NSPECT]; //scaling factors for each spectrum in each saved view (in the same order as viewMultiPlots)
+  int viewMultiPlots[MAXNVIEWS][NSPECT]; //handles (see spectrum_store.c) of all the spectra to show for each saved view
   unsigned char numViews; //number of views that have been saved
-  char chanComment[NCHCOM][256]; //channel comment text
-  unsigned char chanCommentView[NCHCOM]; //0=comment is on spectrum, 1=comment is on view
-  unsigned char chanCommentSp[NCHCOM]; //spectrum/view number at which channel comments are displayed
-  int chanCommentCh[NCHCOM]; //channels at which channel comments are displayed
-  float chanCommentVal[NCHCOM]; //y-values at which channel comments are displayed
-  unsigned int numChComments; //number of comments which have been placed
   char dropEmptySpectra; //0=don't discard empty spectra on import, 1=discard
+  char lazyLoadSpectra; //0=load all spectra on import, 1=load spectra from .mca/.fmca files when first used
+  char followFiles; //0=don't follow opened files, 1=update spectra whenever opened files change (see follow.c)
+  int listModeChannels; //number of channels in spectra histogrammed from list-mode event files (.evt), see read_listmode.c
+  unsigned int metaGeneration; //incremented whenever spectrum titles, views, comments, or the calibration change
 } rawdata;
 
+//.jf3 file which the session was opened from or last saved to, which
+//can be saved to incrementally (see write_data.c)
+struct {
+  char filename[256]; //empty if there is none
+  dev_t dev; //device and inode of the file, as it may be saved to under a different name
+  ino_t ino;
+  off_t size; //size of the file when it was last read or written, to detect changes made outside of jf3
+  struct timespec mtime; //modification time of the file when it was last read or written
+  unsigned int metaGeneration; //value of rawdata.metaGeneration matching the titles, views, comments and calibration in the file
+} sessionfile;
+
 //spectrum drawing globals
 struct {
   int lowerLimit, upperLimit; //lower and upper limits to plot spectrum (in uncalibrated units ie. channels)
@@ -192,27 +295,324 @@ struct {
   float scaleLevelMax[MAX_DISP_SP], scaleLevelMin[MAX_DISP_SP]; //the y scale values, ie. the maximum and minimum values to show on the y axis
   int contractFactor; //the number of channels per bin (default=1)
   unsigned char multiplotMode; //0=no multiplot, 1=summed spectra, 2=overlay spectra (common scaling), 3=overlay spectra (independent scaling), 4=stacked view
-  unsigned char numMultiplotSp; //number of spectra to show in multiplot mode
+  int numMultiplotSp; //number of spectra to show in multiplot mode
   double scaleFactor[NSPECT]; //scaling factors for each spectrum
-  unsigned char multiPlots[NSPECT]; //indices of all the spectra to show in multiplot mode
+  int multiPlots[NSPECT]; //indices of all the spectra to show in multiplot mode
   int displayedView; //-1 if no view is being displayed, -2 if temporary view dispalyed, otherwise the index of the displayed view
   float spColors[MAX_DISP_SP*3];
   signed char highlightedPeak; //the peak to highlight when drawing spectra, -1=don't highlight
-  signed char highlightedComment; //the comment to highlight when drawing spectra, -1=don't highlight
+  int highlightedComment; //id of the comment to highlight when drawing spectra, -1=don't highlight
 } drawing;
 
-//calibration globals
+//cached values of the displayed spectra, for drawing and fitting (see spectrum_data.c)
 struct {
+  float val[MAX_DISP_SP][S32K]; //value of the displayed (contracted, scaled, summed) bin starting at each channel
+  float weight[S32K]; //fit weight of the bin starting at each channel (summed spectra only, otherwise the value is used)
+  int valid; //whether the cached values were built from the parameters below
+  unsigned char multiplotMode; //parameters used to build the cached values
+  int numMultiplotSp;
+  int multiPlots[NSPECT];
+  double scaleFactor[NSPECT]; //scaling factor for each entry in multiPlots
+  int contractFactor;
+  unsigned int storeGeneration;
+} dispbuf;
+
+//calibration globals
+typedef struct {
   unsigned char calMode; //0=no calibration, 1=calibration enabled
   float calpar0,calpar1,calpar2; //0th, 1st, and 2nd order calibration parameters
   char calUnit[16]; //name of the unit used for calibration
   char calYUnit[32]; //name of the y-axis units
-} calpar;
+} cal_params;
+cal_params calpar;
+
+//directory entry for a spectrum stored in a version 3 .jf3 file (see write_data.c)
+typedef struct
+{
+  long long unsigned int offset; //position of the encoded spectrum data in the file
+  unsigned int encLength; //length of the encoded spectrum data, in bytes
+  unsigned int numCh; //number of channels stored
+  unsigned char codec; //codec used to encode the data (see spectrum_codec.c)
+} jf3_dir_entry;
+
+//positions of the sections of a version 4 .jf3 file, stored after the version number (see write_data.c)
+typedef struct
+{
+  long long unsigned int metaOffset; //position of the metadata section (titles, views, comments, calibration)
+  long long unsigned int dirOffset; //position of the spectrum directory
+} jf3_superblock;
+
+#define DATA_STREAM_BLOCK_SIZE 1048576 //size of each block of decompressed data
+#define DATA_STREAM_NUM_BLOCKS 4 //number of blocks which may be decompressed ahead of the reader
+
+//sequential reading of a data file, which may be compressed (see data_stream.c)
+typedef struct {
+  int fd;
+  unsigned char compression; //0=uncompressed, 1=gzip, 2=zstd
+  gzFile gz; //gzip decompression state
+#ifdef JF3_ZSTD
+  ZSTD_DStream *zds; //zstd decompression state
+  ZSTD_inBuffer zIn; //compressed data read from the file, not yet decompressed
+  unsigned char *zInBuf;
+  size_t zInBufSize;
+  size_t zFrameLeft; //non-zero if the file ends part way through a frame
+#endif
+  GThread *thread; //thread decompressing the file ahead of the reader, NULL if decompressing on the reading thread (or uncompressed)
+  GMutex lock; //protects head, numFull, done, and cancel
+  GCond cond; //signalled whenever a block is filled or emptied
+  unsigned char *block[DATA_STREAM_NUM_BLOCKS]; //ring of decompressed blocks
+  size_t blockLen[DATA_STREAM_NUM_BLOCKS];
+  int head; //next block to be read
+  int numFull; //number of blocks which have been decompressed and not yet read
+  size_t pos; //position in the head block
+  int done; //set once the whole file has been decompressed (or decompression failed)
+  int cancel; //set to stop the decompressing thread early
+  int err; //set if reading or decompression failed
+} data_stream;
+
+//buffered line-by-line reading of text files, with no limit on line length (see read_data.c)
+typedef struct {
+  data_stream stream;
+  char *buf; //buffered file contents (with space for a terminating null after bufSize characters)
+  size_t bufSize; //size of the buffer
+  size_t start; //position of the first unread character in the buffer
+  size_t end; //position after the last character read into the buffer
+  int eof; //whether the end of the file has been reached
+  int err; //whether reading failed (eg. out of memory)
+} line_reader;
+
+//table of the histograms declared in a ROOT macro (.C) file, mapping their names
+//to spectrum numbers (see read_data.c), as an open addressing hash table
+#define ROOT_MACRO_HASH_SIZE 4096 //number of slots (power of 2, well above NSPECT)
+typedef struct {
+  char *name[ROOT_MACRO_HASH_SIZE]; //histogram name in each slot, NULL if the slot is unused
+  int spNum[ROOT_MACRO_HASH_SIZE]; //spectrum number of the histogram in each slot
+  unsigned char nonPoissonErr[NSPECT]; //whether bin errors which aren't sqrt(content) were set on each spectrum
+} root_macro_names;
+
+//cursor for reading big-endian values from a buffer holding part of a ROOT file (see read_root.c)
+typedef struct {
+  const unsigned char *data;
+  size_t length;
+  size_t pos; //position of the next value to read
+  int err; //set if a value runs past the end of the buffer
+} root_buf;
+
+//key of an object in a ROOT file, giving its location and type (see read_root.c)
+typedef struct {
+  char className[32];
+  char name[256];
+  char title[256];
+  short cycle; //objects saved several times under the same name have increasing cycle numbers
+  long long int seekKey; //position of the key in the file
+  long long int seekPdir; //position of the directory holding the key
+  int nbytes; //size of the key and the (compressed) object data
+  int objLen; //size of the uncompressed object data
+  short keyLen; //size of the key, the object data follows it
+} root_key;
+
+//part of a list-mode event file, histogrammed by one worker thread (see read_listmode.c)
+typedef struct {
+  int fd;
+  long long int start, end; //range of the file to histogram (whole events)
+  int shift; //number of low bits dropped from ADC values to get channel numbers
+  int numCh; //number of channels per spectrum
+  unsigned int *hist[NSPECT]; //private histogram for each detector, NULL if no events were seen
+  long long unsigned int numDropped; //events from detectors which can't be shown
+  int err; //set if reading failed
+} listmode_range;
+
+//growable buffer of bytes (see utils.c)
+typedef struct {
+  unsigned char *data;
+  size_t length; //number of bytes stored
+  size_t allocLength; //number of bytes allocated
+  int err; //whether appending failed (eg. out of memory), in which case data stops growing
+} byte_buffer;
 
-//fitting globals
+//spectrum to be written to a .jf3 file (see write_data.c)
+typedef struct {
+  jf3_dir_entry dir; //directory entry for the spectrum, the offset is filled in when written unless the data is already in the file
+  unsigned char source; //where the encoded data comes from: 0=spData of the save job (at srcOffset), 1=copied from srcFile (at srcOffset), 2=already in the file being written (at dir.offset)
+  char *srcFile; //file to copy the encoded data from
+  long long unsigned int srcOffset; //position of the encoded data in spData or srcFile
+} save_sp;
+
+//snapshot of data to be written to a file, which can be written
+//without accessing any global data (eg. on a worker thread, see write_data.c)
+typedef struct {
+  char filename[256]; //file to write
+  unsigned char type; //0=.jf3 session, 1=.txt columns, 2=.jf3 session appended to the existing file
+  byte_buffer header; //data written before the spectra (.jf3: the metadata section, empty if the existing one is kept)
+  byte_buffer trailer; //data written after the spectra
+  int numSp; //number of spectra to write
+  save_sp *sp; //.jf3: each spectrum to write
+  byte_buffer spData; //.jf3: encoded data for spectra which aren't copied from other files
+  long long unsigned int appendOffset; //.jf3 appended: size of the existing file, where new data is written
+  long long unsigned int metaOffset; //.jf3 appended: position of the existing metadata section, if kept
+  unsigned int metaGeneration; //.jf3: value of rawdata.metaGeneration when the snapshot was taken
+  unsigned int storeGeneration; //.jf3: value of spstore.generation when the snapshot was taken
+  float *vals; //.txt: values for each spectrum (numRows values per spectrum)
+  int numRows; //.txt: number of rows of values
+  unsigned char spaceAfterVals; //.txt: whether each value is followed by a space (rather than only a newline at the end of each row)
+} save_job;
+
+//data read in from a single file, before it is added to the spectrum store (see spectrum_import.c)
+typedef struct {
+  char text[256]; //comment text
+  unsigned char view; //0=comment is on spectrum, 1=comment is on view
+  int sp; //spectrum or view number within the file
+  int ch; //channel at which the comment is displayed
+  float val; //y-value at which the comment is displayed
+} import_comment;
+
+typedef struct {
+  char comment[256]; //view description/comment
+  unsigned char multiplotMode; //multiplot mode for the view
+  int numMultiplotSp; //number of spectra shown in the view
+  int *multiPlots; //spectrum numbers within the file of the spectra shown in the view
+  double *scaleFactor; //scaling factor for each spectrum shown in the view
+} import_view;
+
+typedef struct {
+  sp_store_entry *sp; //data for each spectrum read in
+  char (*title)[256]; //title for each spectrum read in
+  int numSp; //number of spectra read in
+  int numSpAlloc; //number of spectra allocated
+  import_comment *com; //channel comments read in
+  int numCom, numComAlloc;
+  import_view *view; //views read in
+  int numViews, numViewsAlloc;
+  cal_params cal; //calibration read in
+  unsigned char hasCalPar; //1 if the calibration parameters and mode were read in
+  unsigned char hasCalUnit; //1 if the calibration (x-axis) unit was read in
+  unsigned char hasCalYUnit; //1 if the y-axis unit was read in
+  unsigned char lazyLoad; //set before reading: if 1, spectra from .mca/.fmca files are loaded when first used rather than when read in
+  int listModeChannels; //set before reading: number of channels in spectra histogrammed from list-mode event files (.evt), 0 for the default
+  int listModeThreads; //set before reading: maximum number of threads to histogram list-mode event files on, 0 for one per processor
+} import_data;
+
+#define DATA_SNIFF_BYTES 4096 //number of bytes at the start of a data file used to identify its format
+#define DATA_PROBE_MIN_SCORE 30 //minimum probe score for a format to be used when it doesn't match the file extension
+
+//a data file format which may be read in, identified by the contents of the
+//start of the file (see getDataFileFormat in read_data.c)
+typedef struct {
+  const char *ext; //usual file extension (without the dot)
+  const char *desc; //description of the format
+  int (*probe)(const unsigned char *head, const size_t len, const long long int fileSize); //how likely it is (0-100) that a file starting with head (len bytes, null terminated) is in this format, fileSize is -1 if not known (compressed)
+  int (*estimateNumSp)(const unsigned char *head, const size_t len, const long long int fileSize); //estimated number of spectra in the file, 0 if unknown (may be NULL)
+  int (*read)(const char *filename, import_data *imp); //reads the file into imported data (see spectrum_import.c)
+  unsigned char compressible; //whether the file may be read when compressed (see data_stream.c)
+} data_format;
+
+//file being read in by the parallel import pipeline (see read_data.c)
+typedef struct {
+  char *filename;
+  import_data imp; //data read from the file
+  int numSp; //result of reading the file: number of spectra read, 0 if reading failed, -2 if the file type is unsupported
+  gint done; //set by the worker thread once the file has been read
+  int *spHandle; //once added to the spectrum store, the handle of the spectrum holding each spectrum read (-1 if dropped)
+} import_job;
+
+struct {
+  import_job *job; //files being imported, in the order that they are added to the spectrum store
+  int numJobs;
+  int numCommitted; //number of files which have been added to the spectrum store (or skipped)
+  gint cancel; //set to skip reading any files which haven't been started yet
+  GThreadPool *pool; //worker threads reading the files
+  GSourceFunc doneFunc; //called on the main thread whenever a file has been read
+  unsigned char append; //0=replacing opened data, 1=appending to opened data
+  unsigned char fromCmdLine; //1 if the files were given on the command line
+  int openErr; //first error encountered (see gui.c), 0 if none
+  int errJob; //file at which the first error was encountered
+} importstate;
+
+//state of a file being written on a worker thread (see write_data.c)
 struct {
+  unsigned char active; //whether a file is being written
+  GThread *thread; //thread writing the file, NULL if written without a thread
+  save_job job; //data being written
+  int err; //result of writing the file (see writeSaveJob)
+  GSourceFunc doneFunc; //called on the main thread when done
+} savestate;
+
+//opened file, which may be followed for changes (see follow.c)
+typedef struct {
+  char *filename;
+  int wd; //inotify watch on the directory holding the file, -1 if not watched
+  off_t size; //size of the file when it was last read
+  struct timespec mtime; //modification time of the file when it was last read
+  off_t newSize; //size and modification time of the file being re-read
+  struct timespec newMtime;
+  int numSp; //number of spectra read from the file
+  int *spHandle; //handle of the spectrum holding each spectrum read from the file (-1 if dropped)
+  unsigned char changed; //set when the file has been written since it was last checked
+} followed_file;
+
+//state of following opened files for changes (see follow.c)
+struct {
+  followed_file *file; //files opened, in the order they were opened
+  int numFiles;
+  unsigned int generation; //incremented whenever the list of opened files is cleared
+  int inotifyFd; //-1 if files aren't being followed
+  guint watchSource; //main loop source handling inotify events, 0 if none
+  guint checkSource; //pending check for changed files, 0 if none
+  GThread *thread; //thread re-reading changed files, NULL if none
+  import_job *job; //files being re-read (indexed the same way as file, filename is NULL for files not being re-read)
+  int numJobs;
+  unsigned int jobGeneration; //value of generation when the files being re-read were checked
+  GSourceFunc updateFunc; //called on the main thread after spectra have been updated
+  int numSpUpdated; //number of spectra updated in the last update
+  unsigned char dispUpdated; //whether any displayed spectra were updated in the last update
+} followstate;
+
+#define FIT_BLOCK_BINS 256 //number of bins in each block of the fit region which is evaluated separately (eg. on its own thread)
+
+//block of bins in the fit region, with sums for those bins (see fit_data.c)
+typedef struct {
+  int startBin, endBin; //bins startBin to endBin-1 of the fit region
+  long double *curv; //sums for the curvature matrix over the bins in the block
+  long double *grad; //sums for the vector over the bins in the block
+  long double chisq; //chisq over the bins in the block
+} fit_block;
+
+//data and derivatives used by the fitter (see fit_data.c), for each bin in the
+//fit region, so that each iteration evaluates the fit function only once per bin
+typedef struct {
+  int numBins; //number of bins in the fit region
+  unsigned int dim; //number of fit parameters (including fixed parameters)
+  long double *xval; //channel of each bin
+  long double *yval; //data in each bin
+  long double *dataWeight; //weight of each bin from the data (used for weightMode 0)
+  long double *model; //fit function evaluated at each bin
+  long double *jac; //derivative of the fit function with respect to each parameter (dim values) at each bin
+  long double *curv; //sums for the curvature matrix (dim*dim), see setupFitSums
+  long double *grad; //sums for the vector (dim)
+  unsigned int numActive; //number of parameters which aren't fixed
+  unsigned int activePar[MAX_DIM]; //index of each parameter which isn't fixed
+  double scale[MAX_DIM]; //scaling of each parameter which isn't fixed (1/sqrt of its curvature matrix diagonal)
+  double solution[MAX_DIM]; //change in each parameter (0 for fixed parameters) found by solveFitStep
+  lin_eq_ws solver; //solver for the curvature matrix of the parameters which aren't fixed (see lin_eq_solver.c)
+  fit_block *block; //blocks of bins, sums are always found per block and then added in order, so that results don't depend on the number of threads
+  int numBlocks;
+  int numThreads; //number of threads to evaluate blocks on
+  int blockPass; //what is being evaluated for each block (see runFitBlocks)
+  int blockFitType; //fit type for the blocks being evaluated
+  GThreadPool *pool; //worker threads evaluating blocks, started on the first pass and kept until the workspace is freed, NULL if not used
+  GMutex blockLock; //protects numBlocksLeft (only initialized if pool is set)
+  GCond blockDone; //signalled when the last block of a pass has been evaluated
+  int numBlocksLeft; //number of blocks of the current pass still being evaluated
+} fit_workspace;
+
+#define FIT_GUESS_MARGIN 128 //number of bins (in units of the contraction factor) on either side of the fit region used to make initial guesses
+
+//fit parameters
+typedef struct {
   int fitStartCh, fitEndCh; //upper and lower channel bounds for fitting
+  int contractFactor; //contraction factor of the fitted data (peak areas are given for uncontracted bins)
   int ndf; //DOF for fit
+  double chisq; //chisq of the fit
   float fitPeakInitGuess[MAX_FIT_PK]; //initial guess of peak positions, in channels
   double widthFGH[3]; //F,G,H parameters used to evaluate widths
   unsigned char numFitPeaks; //number of peaks to fit
@@ -232,5 +632,45 @@ struct {
   long double fitParVal[6+(3*MAX_FIT_PK)]; //parameter values found by the fitter
   long double fitParErr[6+(3*MAX_FIT_PK)]; //errors in parameter values
   unsigned char fixPar[6+(3*MAX_FIT_PK)]; //0=don't fix parameter, 1=fix at current value, 2=fix at relative value
-} fitpar;
+} fit_params;
+
+//everything used by a fit (see fit_data.c), so that fits don't depend on
+//the gui state and more than one fit can be run at a time
+typedef struct {
+  fit_params par; //fit parameters, initial guesses, and results
+  int dataStartCh; //first channel in the data snapshot
+  int numDataCh; //number of channels in the data snapshot
+  float *dataVal; //snapshot of the data over the fit region and the channels around it used for initial guesses
+  float *dataWeight; //snapshot of the weight of each channel from the data (see getSpBinFitWeight)
+  fit_workspace ws;
+  void (*stageFunc)(const int stage); //called (on the fit thread) when the fit moves to a new stage, can be NULL
+  const gint *cancel; //if set, the fit is stopped once the value is nonzero, can be NULL
+  int maxThreads; //maximum number of threads to evaluate the fit function on, 0 for one per processor
+  unsigned char quiet; //if set, messages about the progress of the fit aren't printed (eg. for batch fits, whose results are shown together)
+} fit_context;
+
+fit_params fitpar; //fit shown in the gui, copied from the fit context when a fit finishes
+
+//spectrum or view being fit as part of a batch fit (see batch_fit.c)
+typedef struct {
+  char name[256]; //name of the spectrum or view
+  fit_context *ctx; //fit being run, NULL once the results have been collected
+  fit_params par; //fit results, once collected
+  unsigned char result; //0=not fit yet, 1=fit, 2=fit failed, 3=cancelled, 4=not fit (no spectra)
+  unsigned char collected; //whether the results have been collected on the main thread
+  gint done; //set by the worker thread once the fit has finished
+} batch_fit_job;
+
+//state of a batch fit (see batch_fit.c)
+struct {
+  fit_params par; //fit region, peaks, and options to use for the next batch fit
+  int contractFactor; //contraction factor to use for the next batch fit
+  batch_fit_job *job; //spectra and views being fit, in the order that they were selected
+  int numJobs;
+  int numCollected; //number of fits whose results have been collected on the main thread
+  gint cancel; //set to stop any fits which are running or haven't been started yet
+  GThreadPool *pool; //worker threads running the fits
+  GSourceFunc doneFunc; //called on the main thread whenever a fit has finished
+  unsigned int selMetaGeneration; //value of rawdata.metaGeneration when the list of spectra and views to fit was made
+} batchstate;
 
@@ -1,110 +1,150 @@
 #include "lin_eq_solver.h"
 
-int solve_lin_eq(lin_eq_type *lin_eq, int weighted)
+//set the dimension of the equations to be solved using a workspace, growing
+//it if needed (the workspace must be zeroed before first use)
+//returns 1 on success, 0 on failure
+int alloc_lin_eq_ws(lin_eq_ws *ws, const unsigned int dim)
 {
-
-  int i,j;//iterators
-  const unsigned int n=lin_eq->dim;//dimension of the matrix (assume square)
-
-  if(n > MAX_DIM)
+  if(dim > MAX_DIM)
     {
       printf("Too many parameters in linear equation.");
       return 0;
     }
-  
-  if(get_inv(lin_eq)==0) //compute the inverse matrix
+  if(dim > ws->allocDim)
     {
-      //printf("Linear equation set has no solutions.\n");
-      return 0;
+      double *matrix = realloc(ws->matrix,dim*dim*sizeof(double));
+      if(matrix==NULL)
+        return 0;
+      ws->matrix = matrix;
+      unsigned int *perm = realloc(ws->perm,dim*sizeof(unsigned int));
+      if(perm==NULL)
+        return 0;
+      ws->perm = perm;
+      double *work = realloc(ws->work,dim*sizeof(double));
+      if(work==NULL)
+        return 0;
+      ws->work = work;
+      ws->allocDim = dim;
     }
-  
-  //use inverse matrix to find solutions
-  memset(lin_eq->solution,0,sizeof(lin_eq->solution));
-  if(weighted){
-    for(i=0;i<n;i++)
-      for(j=0;j<n;j++)
-        lin_eq->solution[i]+=lin_eq->inv_matrix[i][j]*lin_eq->vector[j]*lin_eq->mat_weights[i][j];
-  }else{
-    for(i=0;i<n;i++)
-      for(j=0;j<n;j++)
-        lin_eq->solution[i]+=lin_eq->inv_matrix[i][j]*lin_eq->vector[j];
-  }
-  
+  ws->dim = dim;
   return 1;
 }
 
-//get the inverse matrix using Gauss-Jordan elimination
-int get_inv(lin_eq_type *lin_eq)
+void free_lin_eq_ws(lin_eq_ws *ws)
 {
+  free(ws->matrix);
+  free(ws->perm);
+  free(ws->work);
+  memset(ws,0,sizeof(lin_eq_ws));
+}
 
-  int i,j,k,l;//iterators
-  const unsigned int n=lin_eq->dim;//dimension of the matrix (assume square) 
-  long double s;//storage variable
+//factor the matrix in a workspace as P*A*P^T = L*D*L^T, using symmetric
+//pivoting on the largest remaining diagonal element
+//(L is stored below the diagonal, with D on the diagonal)
+//returns 1 on success, 0 if the matrix is singular
+int factor_lin_eq(lin_eq_ws *ws)
+{
+  unsigned int i,j,k,p;//iterators
+  const unsigned int n=ws->dim;//dimension of the matrix
+  double *a=ws->matrix;
+  double s;//storage variable
+  unsigned int t;
 
-  //allocate the identity matrix to be transformed to the inverse
-  long double *id = malloc(MAX_DIM*MAX_DIM*sizeof(long double));
-  memset(id,0,MAX_DIM*MAX_DIM*sizeof(long double));
-  for(i=0;i<n;i++)
-    for(j=0;j<n;j++)
-      if(i==j)
-        id[i*MAX_DIM + j]=1.0L;
-        
-  memcpy(lin_eq->inv_matrix,lin_eq->matrix,sizeof(lin_eq->matrix));
-        
   for(i=0;i<n;i++)
+    ws->perm[i]=i;
+
+  for(k=0;k<n;k++)
     {
-      for(j=i;j<n;j++)
+      //find the pivot
+      p=k;
+      for(i=k+1;i<n;i++)
+        if(fabs(a[i*n + i]) > fabs(a[p*n + p]))
+          p=i;
+      if((a[p*n + p]==0.0)||(!isfinite(a[p*n + p])))
+        return 0;//matrix is singular
+      if(p!=k)
         {
-          if(lin_eq->inv_matrix[j][i]!=0.0L)
+          //swap rows (including the part of L already found) and columns
+          for(j=0;j<n;j++)
             {
-              for(k=0;k<n;k++)
-                {
-                  s=lin_eq->inv_matrix[i][k];
-                  lin_eq->inv_matrix[i][k]=lin_eq->inv_matrix[j][k];
-                  lin_eq->inv_matrix[j][k]=s;
-                  
-                  s=id[i*MAX_DIM + k];
-                  id[i*MAX_DIM + k]=id[j*MAX_DIM + k];
-                  id[j*MAX_DIM + k]=s;
-                }
-              s=1.0L/lin_eq->inv_matrix[i][i];
-              for(k=0;k<n;k++)
-                {
-                  lin_eq->inv_matrix[i][k]=s*lin_eq->inv_matrix[i][k];
-                  id[i*MAX_DIM + k]=s*id[i*MAX_DIM + k];
-                }
-              for(k=0;k<n;k++)
-                if(k!=i)
-                  {
-                    s=-1.0L*lin_eq->inv_matrix[k][i];
-                    for(l=0;l<n;l++)
-                      {
-                        lin_eq->inv_matrix[k][l]=lin_eq->inv_matrix[k][l] + s*lin_eq->inv_matrix[i][l];
-                        id[k*MAX_DIM + l]=id[k*MAX_DIM + l] + s*id[i*MAX_DIM + l];
-                      }
-                  }
+              s=a[k*n + j];
+              a[k*n + j]=a[p*n + j];
+              a[p*n + j]=s;
+            }
+          for(i=k;i<n;i++)
+            {
+              s=a[i*n + k];
+              a[i*n + k]=a[i*n + p];
+              a[i*n + p]=s;
+            }
+          t=ws->perm[k];
+          ws->perm[k]=ws->perm[p];
+          ws->perm[p]=t;
+        }
+      //eliminate, updating the remaining (symmetric) matrix
+      const double d=a[k*n + k];
+      for(i=k+1;i<n;i++)
+        ws->work[i]=a[i*n + k];
+      for(i=k+1;i<n;i++)
+        {
+          a[i*n + k]=ws->work[i]/d;
+          for(j=k+1;j<=i;j++)
+            {
+              a[i*n + j]-=a[i*n + k]*ws->work[j];
+              a[j*n + i]=a[i*n + j];
             }
-          break;
         }
-      if(lin_eq->inv_matrix[j][i]==0.0L)
-        return 0;//matrix is singular
     }
-        
-  //print the new identity matrix      
-  /*for(i=0;i<n;i++)
-    for(j=0;j<n;j++)
-     printf("id[%i][%i] = %0.6LE\n",i,j,lin_eq->inv_matrix[i][j]);*/
-  
-  memcpy(lin_eq->inv_matrix,id,MAX_DIM*MAX_DIM*sizeof(long double));
-  
-  //print the inverse matrix
-  /*printf("\n");
-  for(i=0;i<n;i++)
-    for(j=0;j<n;j++)
-     printf("inverse[%i][%i] = %0.6LE\n",i,j,lin_eq->inv_matrix[i][j]);*/
-  
-  free(id);
 
   return 1;
+}
+
+//solve the equations using the factorization from factor_lin_eq
+//(vector and solution may be the same)
+void solve_factored_lin_eq(const lin_eq_ws *ws, const double *vector, double *solution)
+{
+  int i,j;//iterators
+  const int n=(int)ws->dim;
+  const double *a=ws->matrix;
+  double *y=ws->work;
+
+  for(i=0;i<n;i++)
+    y[i]=vector[ws->perm[i]];
+  //forward substitution with L, then scale by D
+  for(i=0;i<n;i++)
+    for(j=0;j<i;j++)
+      y[i]-=a[i*n + j]*y[j];
+  for(i=0;i<n;i++)
+    y[i]/=a[i*n + i];
+  //back substitution with L^T
+  for(i=n-1;i>=0;i--)
+    for(j=i+1;j<n;j++)
+      y[i]-=a[j*n + i]*y[j];
+  for(i=0;i<n;i++)
+    solution[ws->perm[i]]=y[i];
+}
+
+//get the diagonal elements of the inverse matrix, using the factorization
+//from factor_lin_eq (the rest of the inverse isn't formed)
+void get_inv_diag(const lin_eq_ws *ws, double *diag)
+{
+  unsigned int i,j,k;//iterators
+  const unsigned int n=ws->dim;
+  const double *a=ws->matrix;
+  double *z=ws->work;
 
+  //diagonal element m of the inverse is z^T D^-1 z, where L z = P e_m
+  for(k=0;k<n;k++)
+    {
+      memset(z,0,n*sizeof(double));
+      z[k]=1.0;
+      double s=1.0/a[k*n + k];
+      for(i=k+1;i<n;i++)
+        {
+          for(j=k;j<i;j++)
+            z[i]-=a[i*n + j]*z[j];
+          s+=z[i]*z[i]/a[i*n + i];
+        }
+      diag[ws->perm[k]]=s;
+    }
 }
@@ -4,23 +4,28 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <math.h>
 
 #define MAX_DIM 36 //for jf3, should be 6 + 3*MAX_FIT_PK
 
+//workspace for solving symmetric linear equations, which may be reused
+//for any number of equations (of up to allocDim dimensions) without
+//reallocating
 typedef struct
 {
   //properties set by the user
-  long double matrix[MAX_DIM][MAX_DIM];
-  long double mat_weights[MAX_DIM][MAX_DIM];
-  long double vector[MAX_DIM];
-  unsigned int dim;
+  unsigned int dim; //dimension of the equations (set by alloc_lin_eq_ws)
+  double *matrix; //symmetric matrix (dim*dim, row-major), replaced by its factorization by factor_lin_eq
   //properties determined by the solver
-  long double inv_matrix[MAX_DIM][MAX_DIM];//inverse of matrix specified above
-  long double solution[MAX_DIM];
-}lin_eq_type;
+  unsigned int *perm; //pivot order, row i of the factorization is row perm[i] of the matrix
+  double *work;
+  unsigned int allocDim;
+}lin_eq_ws;
 
-int solve_lin_eq(lin_eq_type *lin_eq,int);
-long double det(int m, lin_eq_type *lin_eq);
-int get_inv(lin_eq_type *lin_eq);
+int alloc_lin_eq_ws(lin_eq_ws *ws, const unsigned int dim);
+void free_lin_eq_ws(lin_eq_ws *ws);
+int factor_lin_eq(lin_eq_ws *ws);
+void solve_factored_lin_eq(const lin_eq_ws *ws, const double *vector, double *solution);
+void get_inv_diag(const lin_eq_ws *ws, double *diag);
 
 #endif
@@ -42,6 +42,20 @@ int readConfigFile(FILE *file, int keepCalibration)
           rawdata.dropEmptySpectra = 0;
         }
       }
+      if(strcmp(par,"lazy_load_spectra") == 0){
+        if(strcmp(val,"yes") == 0){
+          rawdata.lazyLoadSpectra = 1;
+        }else{
+          rawdata.lazyLoadSpectra = 0;
+        }
+      }
+      if(strcmp(par,"follow_files") == 0){
+        if(strcmp(val,"yes") == 0){
+          rawdata.followFiles = 1;
+        }else{
+          rawdata.followFiles = 0;
+        }
+      }
       if(strcmp(par,"show_bin_errors") == 0){
         if(strcmp(val,"yes") == 0){
           guiglobals.showBinErrors = 1;
@@ -110,6 +124,11 @@ int readConfigFile(FILE *file, int keepCalibration)
         if(ucVal <= 2)
           fitpar.weightMode = ucVal;
       }
+      if(strcmp(par,"list_mode_channels") == 0){
+        int iVal = atoi(val);
+        if(getListModeShift(iVal) >= 0) //see read_listmode.c
+          rawdata.listModeChannels = iVal;
+      }
       if(strcmp(par,"fit_type") == 0){
         unsigned char ucVal = (unsigned char)atoi(val);
         if(ucVal <= 1)
@@ -184,6 +203,17 @@ int writeConfigFile(FILE *file)
   }else{
     fprintf(file,"discard_empty_spectra=no\n");
   }
+  if(rawdata.lazyLoadSpectra == 1){
+    fprintf(file,"lazy_load_spectra=yes\n");
+  }else{
+    fprintf(file,"lazy_load_spectra=no\n");
+  }
+  if(rawdata.followFiles == 1){
+    fprintf(file,"follow_files=yes\n");
+  }else{
+    fprintf(file,"follow_files=no\n");
+  }
+  fprintf(file,"list_mode_channels=%i\n",rawdata.listModeChannels);
   if(guiglobals.showBinErrors == 1){
     fprintf(file,"show_bin_errors=yes\n");
   }else{
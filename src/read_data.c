@@ -7,730 +7,1527 @@
 //.mca - integer array
 //.fmca - float array
 //.C - ROOT macro
+//.root - ROOT file (see read_root.c)
+//.evt - list-mode events (see read_listmode.c)
+//The format of a file is identified from its contents (see getDataFileFormat),
+//so that files without the usual extension may still be read.
 
-//function reads an .jf3 file into a double array and returns the array
-int readJF3(const char *filename, double outHist[NSPECT][S32K], const unsigned int outHistStartSp)
+//set up a spectrum in a .jf3 file to be loaded on demand (see spectrum_store.c), given
+//the position and length of its encoded data in the file, and the codec used (see spectrum_codec.c)
+//returns 1 on success, 0 if the parameters are invalid
+int setJF3SpectrumSource(sp_store_entry *sp, const char *filename, const long long unsigned int offset, const unsigned int encLength, const unsigned int numCh, const unsigned char codec){
+  if((numCh > S32K)||(codec > 4)||(encLength > getMaxEncodedSpectrumLength((int)numCh,codec))){
+    return 0;
+  }
+  if((numCh == 0)||(codec == 0)){
+    sp->length = 0;
+    return (numCh == 0)&&(codec == 0);
+  }
+  sp->srcFile = strdup(filename);
+  if(sp->srcFile == NULL){
+    return 0;
+  }
+  sp->srcOffset = (long)offset;
+  sp->srcType = 2;
+  sp->srcCodec = codec;
+  sp->srcLength = encLength;
+  sp->length = (int)numCh;
+  return 1;
+}
+
+//reads the contents of a version 2 .jf3 file (after the version number)
+//into imported data (see spectrum_import.c) and returns the number of spectra read in
+//(spectrum data itself is loaded from the file on demand)
+int readJF3v2(FILE *inp, const char *filename, import_data *imp)
 {
   unsigned int i,j;
   unsigned char ucharBuf, numSpec;
   unsigned int uintBuf;
-  FILE *inp;
-  unsigned char startNumViews = rawdata.numViews;
 
-  if ((inp = fopen(filename, "r")) == NULL) //open the file
-  {
-    printf("ERROR: Cannot open the input file: %s\n", filename);
-    printf("Check that the file exists.\n");
-    exit(-1);
-  }
+  //version 2 of file format
+  if(fread(&ucharBuf, sizeof(unsigned char), 1, inp)!=1){return 0;}
+  numSpec = ucharBuf;
+  if(numSpec > 0){
 
-  if(fread(&ucharBuf, sizeof(unsigned char), 1, inp)!=1){fclose(inp); return 0;}
-  if(ucharBuf==2){
-    //version 2 of file format
-    if(fread(&ucharBuf, sizeof(unsigned char), 1, inp)!=1){fclose(inp); return 0;}
-    numSpec = ucharBuf;
-    if(numSpec > 0){
+    if(setImportNumSp(imp,numSpec)==0){return 0;}
 
-      if((numSpec + outHistStartSp)>NSPECT){
-        printf("Cannot open file %s, number of spectra would exceed maximum!\n", filename);
-        fclose(inp);
-        return -1; //over-import error
-      }
+    //read labels
+    for(i=0;i<numSpec;i++){
+      if(fread(getImportTitle(imp,(int)i),256, 1, inp)!=1){return 0;}
+    }
 
-      //read labels
-      for(i=0;i<numSpec;i++){
-        if(i<NSPECT){
-          if(fread(rawdata.histComment[i+outHistStartSp],sizeof(rawdata.histComment[i+outHistStartSp]), 1, inp)!=1){fclose(inp); return 0;}
-        }
-      }
+    //read calibration parameters
+    if(fread(&imp->cal, sizeof(cal_params), 1, inp)!=1){return 0;}
+    if((imp->cal.calpar1==0.0)&&(imp->cal.calpar2==0.0)){
+      //invalid calibration, fix parameters
+      imp->cal.calpar1=1.0;
+    }
+    imp->cal.calUnit[sizeof(imp->cal.calUnit)-1] = '\0';
+    imp->cal.calYUnit[sizeof(imp->cal.calYUnit)-1] = '\0';
+    imp->hasCalPar = 1;
+    imp->hasCalUnit = 1;
+    imp->hasCalYUnit = 1;
 
-      //read calibration parameters
-      if(fread(&calpar, sizeof(calpar), 1, inp)!=1){fclose(inp); return 0;}
-      if((calpar.calpar1==0.0)&&(calpar.calpar2==0.0)){
-        //invalid calibration, fix parameters
-        calpar.calpar1=1.0;
-      }
+    //read comments
+    if(fread(&uintBuf, sizeof(unsigned int), 1, inp)!=1){return 0;}
+    for(i=0;i<uintBuf;i++){
+      unsigned char commentView;
+      int commentCh;
+      float commentVal;
+      char commentText[256];
+      if(fread(&commentView,sizeof(commentView), 1, inp)!=1){return 0;}
+      if(fread(&ucharBuf,sizeof(unsigned char), 1, inp)!=1){return 0;}
+      if(fread(&commentCh,sizeof(commentCh), 1, inp)!=1){return 0;}
+      if(fread(&commentVal,sizeof(commentVal), 1, inp)!=1){return 0;}
+      if(fread(commentText,sizeof(commentText), 1, inp)!=1){return 0;}
+      commentText[255] = '\0';
+      addImportComment(imp,commentView,ucharBuf,commentCh,commentVal,commentText);
+    }
 
-      //read comments
-      if(fread(&uintBuf, sizeof(unsigned int), 1, inp)!=1){fclose(inp); return 0;}
-      if(outHistStartSp == 0){
-        //no comments exist already
-        rawdata.numChComments = uintBuf;
-        for(i=0;i<rawdata.numChComments;i++){
-          if(i<NCHCOM){
-            if(fread(&rawdata.chanCommentView[i],sizeof(rawdata.chanCommentView[i]), 1, inp)!=1){fclose(inp); return 0;}
-            if(fread(&rawdata.chanCommentSp[i],sizeof(rawdata.chanCommentSp[i]), 1, inp)!=1){fclose(inp); return 0;}
-            if(fread(&rawdata.chanCommentCh[i],sizeof(rawdata.chanCommentCh[i]), 1, inp)!=1){fclose(inp); return 0;}
-            if(fread(&rawdata.chanCommentVal[i],sizeof(rawdata.chanCommentVal[i]), 1, inp)!=1){fclose(inp); return 0;}
-            if(fread(rawdata.chanComment[i],sizeof(rawdata.chanComment[i]), 1, inp)!=1){fclose(inp); return 0;}
-          }
-        }
-      }else{
-        //appending spectra, comments may already exist
-        for(i=rawdata.numChComments;i<rawdata.numChComments+uintBuf;i++){
-          if(i<NCHCOM){
-            if(fread(&rawdata.chanCommentView[i],sizeof(rawdata.chanCommentView[i]), 1, inp)!=1){fclose(inp); return 0;}
-            if(fread(&rawdata.chanCommentSp[i],sizeof(rawdata.chanCommentSp[i]), 1, inp)!=1){fclose(inp); return 0;}
-            if(rawdata.chanCommentView[i] == 1){
-              rawdata.chanCommentSp[i]=(unsigned char)(rawdata.chanCommentSp[i]+startNumViews); //assign to the correct (appended) view
-            }else{
-              rawdata.chanCommentSp[i]=(unsigned char)(rawdata.chanCommentSp[i]+outHistStartSp); //assign to the correct (appended) spectrum
-            }
-            //printf("Comment %i went to sp %i\n",i,rawdata.chanCommentSp[i]+1);
-            if(fread(&rawdata.chanCommentCh[i],sizeof(rawdata.chanCommentCh[i]), 1, inp)!=1){fclose(inp); return 0;}
-            if(fread(&rawdata.chanCommentVal[i],sizeof(rawdata.chanCommentVal[i]), 1, inp)!=1){fclose(inp); return 0;}
-            if(fread(rawdata.chanComment[i],sizeof(rawdata.chanComment[i]), 1, inp)!=1){fclose(inp); return 0;}
-          }
-        }
-        rawdata.numChComments += uintBuf;
-        if(rawdata.numChComments > NCHCOM){
-          printf("WARNING: over-imported comments.  Truncating.\n");
-          rawdata.numChComments = NCHCOM;
-        }
+    //read views
+    if(fread(&uintBuf, sizeof(unsigned int), 1, inp)!=1){return 0;}
+    for(i=0;i<uintBuf;i++){
+      char viewComment[256];
+      unsigned char viewMultiplotMode;
+      int viewMultiPlots[256];
+      double viewScaleFactor[256];
+      if(fread(viewComment,sizeof(viewComment),1,inp)!=1){return 0;}
+      viewComment[255] = '\0';
+      if(fread(&viewMultiplotMode,sizeof(unsigned char),1,inp)!=1){return 0;}
+      if(fread(&ucharBuf,sizeof(unsigned char),1,inp)!=1){return 0;}
+      unsigned int viewNumMultiplotSp = ucharBuf;
+      for(j=0;j<viewNumMultiplotSp;j++){
+        if(fread(&ucharBuf,sizeof(unsigned char),1,inp)!=1){return 0;}
+        viewMultiPlots[j] = ucharBuf;
+      }
+      for(j=0;j<viewNumMultiplotSp;j++){
+        if(fread(&viewScaleFactor[j],sizeof(double),1,inp)!=1){return 0;}
       }
+      addImportView(imp,viewComment,viewMultiplotMode,(int)viewNumMultiplotSp,viewMultiPlots,viewScaleFactor);
+    }
 
-      //read views
-      if(fread(&uintBuf, sizeof(unsigned int), 1, inp)!=1){fclose(inp); return 0;}
-      if(outHistStartSp == 0){
-        //no comments exist already
-        rawdata.numViews = (unsigned char)uintBuf;
-        for(i=0;i<rawdata.numViews;i++){
-          if(i<MAXNVIEWS){
-            memset(rawdata.viewScaleFactor[i],0,sizeof(rawdata.viewScaleFactor[i]));
-            if(fread(&rawdata.viewComment[i],sizeof(rawdata.viewComment[i]),1,inp)!=1){fclose(inp); return 0;}
-            if(fread(&rawdata.viewMultiplotMode[i],sizeof(unsigned char),1,inp)!=1){fclose(inp); return 0;}
-            if(fread(&rawdata.viewNumMultiplotSp[i],sizeof(unsigned char),1,inp)!=1){fclose(inp); return 0;}
-            for(j=0;j<rawdata.viewNumMultiplotSp[i];j++){
-              if(fread(&rawdata.viewMultiPlots[i][j],sizeof(unsigned char),1,inp)!=1){fclose(inp); return 0;}
-            }
-            for(j=0;j<rawdata.viewNumMultiplotSp[i];j++){
-              if(rawdata.viewMultiPlots[i][j]<NSPECT){
-                if(fread(&rawdata.viewScaleFactor[i][rawdata.viewMultiPlots[i][j]],sizeof(double),1,inp)!=1){fclose(inp); return 0;}
-              }
-            }
-          }
-        }
-      }else{
-        //appending spectra, comments may already exist
-        for(i=rawdata.numViews;i<rawdata.numViews+uintBuf;i++){
-          if(i<MAXNVIEWS){
-            memset(rawdata.viewScaleFactor[i],0,sizeof(rawdata.viewScaleFactor[i]));
-            if(fread(&rawdata.viewComment[i],sizeof(rawdata.viewComment[i]),1,inp)!=1){fclose(inp); return 0;}
-            if(fread(&rawdata.viewMultiplotMode[i],sizeof(unsigned char),1,inp)!=1){fclose(inp); return 0;}
-            if(fread(&rawdata.viewNumMultiplotSp[i],sizeof(unsigned char),1,inp)!=1){fclose(inp); return 0;}
-            for(j=0;j<rawdata.viewNumMultiplotSp[i];j++){
-              if(fread(&rawdata.viewMultiPlots[i][j],sizeof(unsigned char),1,inp)!=1){fclose(inp); return 0;}
-            }
-            for(j=0;j<rawdata.viewNumMultiplotSp[i];j++){
-              if(rawdata.viewMultiPlots[i][j]<NSPECT){
-                if(fread(&rawdata.viewScaleFactor[i][rawdata.viewMultiPlots[i][j]],sizeof(double),1,inp)!=1){fclose(inp); return 0;}
-              }
-            }
-            //realign view data
-            for(j=0;j<rawdata.viewNumMultiplotSp[i];j++){
-              if((j+outHistStartSp)<NSPECT){
-                rawdata.viewScaleFactor[i][j+outHistStartSp]=rawdata.viewScaleFactor[i][j];
-                rawdata.viewMultiPlots[i][j+outHistStartSp]=rawdata.viewMultiPlots[i][j];
-              }else{
-                printf("WARINING: cannot re-align appended view.\n");
-              }
-            }
-          }
-        }
-        rawdata.numViews = (unsigned char)(rawdata.numViews+uintBuf);
-        if(rawdata.numViews > MAXNVIEWS){
-          printf("WARNING: over-imported views.  Truncating.\n");
-          rawdata.numViews = MAXNVIEWS;
+    //printf("num comments: %i\n",comstore.numComments);
+    
+    //find the spectra, which are loaded from the file on demand
+    //(the format has no directory, so the packets are scanned through to find where each spectrum is)
+    signed char scharBuf;
+    char doneSp;
+    float vals[128];
+    for(i=0;i<numSpec;i++){
+      off_t spStart = ftello(inp);
+      unsigned int numCh = 0;
+      doneSp = 0;
+      while(doneSp==0){
+        //read packet header
+        if(fread(&scharBuf,sizeof(signed char), 1, inp)!=1){return 0;}
+        unsigned int numVals = 1;
+        if(scharBuf == 0){
+          numCh++; //final value
+          doneSp = 1; //move on to the next spectrum
+        }else if(scharBuf > 0){
+          numCh += (unsigned int)scharBuf; //duplicated entries
+        }else{
+          numVals = (unsigned int)abs(scharBuf); //non-duplicated entries
+          numCh += numVals;
         }
+        if(fread(vals,sizeof(float)*numVals, 1, inp)!=1){return 0;}
+        if(numCh > S32K){return 0;}
       }
+      if(setJF3SpectrumSource(&imp->sp[i],filename,(long long unsigned int)spStart,(unsigned int)(ftello(inp)-spStart),numCh,4)==0){return 0;}
+    }
 
-      //printf("num comments: %i\n",rawdata.numChComments);
-      
-      //read spectra
-      signed char scharBuf;
-      char doneSp;
-      unsigned int spInd;
-      float val;
-      for(i=0;i<numSpec;i++){
-        
-        doneSp = 0;
-        spInd = 0;
-        while(doneSp==0){
-          //read packet header
-          if(fread(&scharBuf,sizeof(signed char), 1, inp)!=1){fclose(inp); return 0;}
-          //printf("read packet counter: %i\n",scharBuf);
-          if(scharBuf == 0){
-            if(fread(&val,sizeof(float), 1, inp)!=1){fclose(inp); return 0;} //read in final value
-            outHist[i+outHistStartSp][spInd] = (double)val;
-            spInd++;
-            doneSp = 1; //move on to the next spectrum
-          }else if(scharBuf > 0){
-            //duplicated entries
-            if(fread(&val,sizeof(float), 1, inp)!=1){fclose(inp); return 0;} //read in value
-            for(j=0;j<scharBuf;j++){
-              outHist[i+outHistStartSp][spInd+j] = (double)val;
-            }
-            spInd += (unsigned int)scharBuf;
-          }else{
-            //non-duplicated entries
-            unsigned int numEntr = (unsigned int)abs(scharBuf);
-            for(j=0;j<numEntr;j++){
-              if(fread(&val,sizeof(float), 1, inp)!=1){fclose(inp); return 0;} //read in value
-              outHist[i+outHistStartSp][spInd+j] = (double)val;
-              //printf("val %f\n",val);
-            }
-            spInd += numEntr;
-          }
+  }else{
+    printf("ERROR: file %s contains no spectra.\n",filename);
+    return 0;
+  }
 
-        }
+  return numSpec;
+}
 
-        //fill the rest of the histogram
-        for(j=spInd;j<S32K;j++)
-          outHist[i+outHistStartSp][j] = 0.;
-      }
+//read a string stored as a length (unsigned char) followed by the characters
+//into str (which must have space for 256 characters)
+//returns 1 on success, 0 on failure
+int readJF3String(FILE *inp, char *str){
+  unsigned char len;
+  if(fread(&len,sizeof(unsigned char),1,inp)!=1){return 0;}
+  if(len > 0){
+    if(fread(str,len,1,inp)!=1){return 0;}
+  }
+  str[len] = '\0';
+  return 1;
+}
 
-    }else{
-      printf("ERROR: file %s contains no spectra.\n",filename);
-      fclose(inp);
+//reads the metadata section of a version 3 or 4 .jf3 file (number of spectra,
+//calibration, titles, comments, and views) into imported data (see spectrum_import.c)
+//and returns the number of spectra (-1 if there are too many spectra)
+//see snapshotJF3 in write_data.c for the format
+int readJF3Metadata(FILE *inp, const char *filename, import_data *imp)
+{
+  unsigned int i,j;
+  unsigned int numSpec, uintBuf;
+
+  if(fread(&numSpec, sizeof(unsigned int), 1, inp)!=1){return 0;}
+  if(numSpec == 0){
+    printf("ERROR: file %s contains no spectra.\n",filename);
+    return 0;
+  }
+  if(numSpec >= NSPECT){
+    printf("Cannot open file %s, number of spectra would exceed maximum!\n", filename);
+    return -1; //over-import error
+  }
+  if(setImportNumSp(imp,(int)numSpec)==0){return 0;}
+
+  //read calibration parameters
+  if(fread(&imp->cal, sizeof(cal_params), 1, inp)!=1){return 0;}
+  if((imp->cal.calpar1==0.0)&&(imp->cal.calpar2==0.0)){
+    //invalid calibration, fix parameters
+    imp->cal.calpar1=1.0;
+  }
+  imp->cal.calUnit[sizeof(imp->cal.calUnit)-1] = '\0';
+  imp->cal.calYUnit[sizeof(imp->cal.calYUnit)-1] = '\0';
+  imp->hasCalPar = 1;
+  imp->hasCalUnit = 1;
+  imp->hasCalYUnit = 1;
+
+  //read labels
+  for(i=0;i<numSpec;i++){
+    if(readJF3String(inp,getImportTitle(imp,(int)i))==0){return 0;}
+  }
+
+  //read comments
+  if(fread(&uintBuf, sizeof(unsigned int), 1, inp)!=1){return 0;}
+  for(i=0;i<uintBuf;i++){
+    unsigned char commentView;
+    unsigned int commentSp;
+    int commentCh;
+    float commentVal;
+    char commentText[256];
+    if(fread(&commentView,sizeof(commentView), 1, inp)!=1){return 0;}
+    if(fread(&commentSp,sizeof(commentSp), 1, inp)!=1){return 0;}
+    if(fread(&commentCh,sizeof(commentCh), 1, inp)!=1){return 0;}
+    if(fread(&commentVal,sizeof(commentVal), 1, inp)!=1){return 0;}
+    if(readJF3String(inp,commentText)==0){return 0;}
+    addImportComment(imp,commentView,(int)commentSp,commentCh,commentVal,commentText);
+  }
+
+  //read views
+  if(fread(&uintBuf, sizeof(unsigned int), 1, inp)!=1){return 0;}
+  for(i=0;i<uintBuf;i++){
+    char viewComment[256];
+    unsigned char viewMultiplotMode;
+    unsigned int viewNumMultiplotSp;
+    int viewMultiPlots[NSPECT];
+    double viewScaleFactor[NSPECT];
+    if(readJF3String(inp,viewComment)==0){return 0;}
+    if(fread(&viewMultiplotMode,sizeof(unsigned char),1,inp)!=1){return 0;}
+    if(fread(&viewNumMultiplotSp,sizeof(unsigned int),1,inp)!=1){return 0;}
+    if(viewNumMultiplotSp > NSPECT){return 0;}
+    for(j=0;j<viewNumMultiplotSp;j++){
+      unsigned int viewSp;
+      if(fread(&viewSp,sizeof(unsigned int),1,inp)!=1){return 0;}
+      viewMultiPlots[j] = (int)viewSp;
+    }
+    if(viewNumMultiplotSp > 0){
+      if(fread(viewScaleFactor,sizeof(double)*viewNumMultiplotSp,1,inp)!=1){return 0;}
+    }
+    addImportView(imp,viewComment,viewMultiplotMode,(int)viewNumMultiplotSp,viewMultiPlots,viewScaleFactor);
+  }
+
+  return (int)numSpec;
+}
+
+//reads the directory of numSpec spectra in a version 3 or 4 .jf3 file into imported data,
+//spectra are set up to be loaded from the file on demand
+//returns 1 on success, 0 on failure
+int readJF3Directory(FILE *inp, const char *filename, import_data *imp, const unsigned int numSpec)
+{
+  unsigned int i;
+  struct stat fileStat;
+  if(fstat(fileno(inp),&fileStat)!=0){return 0;}
+  for(i=0;i<numSpec;i++){
+    jf3_dir_entry dirEntry;
+    if(fread(&dirEntry,sizeof(jf3_dir_entry),1,inp)!=1){return 0;}
+    if((dirEntry.offset > (long long unsigned int)fileStat.st_size)||(dirEntry.encLength > (long long unsigned int)fileStat.st_size - dirEntry.offset)){
+      printf("ERROR: spectrum %u lies outside of file %s.\n",i+1,filename);
       return 0;
     }
-  }else{
-    printf("ERROR: file %s has unknown .jf3 file format version (%i).\n",filename,ucharBuf);
-    fclose(inp);
+    if(setJF3SpectrumSource(&imp->sp[i],filename,dirEntry.offset,dirEntry.encLength,dirEntry.numCh,dirEntry.codec)==0){
+      printf("ERROR: invalid data for spectrum %u in file %s.\n",i+1,filename);
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+//reads the contents of a version 3 .jf3 file (after the version number)
+//into imported data (see spectrum_import.c) and returns the number of spectra
+//read in (-1 if there are too many spectra)
+//(spectrum data itself is loaded from the file on demand)
+int readJF3v3(FILE *inp, const char *filename, import_data *imp)
+{
+  //the directory directly follows the metadata
+  int numSpec = readJF3Metadata(inp,filename,imp);
+  if(numSpec <= 0){
+    return numSpec;
+  }
+  if(readJF3Directory(inp,filename,imp,(unsigned int)numSpec)==0){
     return 0;
   }
+  return numSpec;
+}
 
-  fclose(inp);
+//reads the contents of a version 4 .jf3 file (after the version number)
+//into imported data (see spectrum_import.c) and returns the number of spectra
+//read in (-1 if there are too many spectra)
+//(spectrum data itself is loaded from the file on demand)
+int readJF3v4(FILE *inp, const char *filename, import_data *imp)
+{
+  jf3_superblock sb;
+  unsigned int numDirSpec;
+  if(fread(&sb,sizeof(jf3_superblock),1,inp)!=1){return 0;}
+  if(fseeko(inp,(off_t)sb.metaOffset,SEEK_SET)!=0){return 0;}
+  int numSpec = readJF3Metadata(inp,filename,imp);
+  if(numSpec <= 0){
+    return numSpec;
+  }
+  if(fseeko(inp,(off_t)sb.dirOffset,SEEK_SET)!=0){return 0;}
+  if(fread(&numDirSpec,sizeof(unsigned int),1,inp)!=1){return 0;}
+  if(numDirSpec != (unsigned int)numSpec){
+    printf("ERROR: directory of file %s doesn't match the number of spectra.\n",filename);
+    return 0;
+  }
+  if(readJF3Directory(inp,filename,imp,numDirSpec)==0){
+    return 0;
+  }
   return numSpec;
 }
 
-//function reads an .mca file into a double array and returns the number of spectra read in
-int readMCA(const char *filename, double outHist[NSPECT][S32K], const unsigned int outHistStartSp)
+//function reads an .jf3 file into imported data (see spectrum_import.c) and returns the number of spectra read in
+int readJF3(const char *filename, import_data *imp)
 {
-  unsigned int i, j;
-  int tmpHist[S32K];
+  int numSpec = 0;
+  unsigned char version;
   FILE *inp;
 
   if ((inp = fopen(filename, "r")) == NULL) //open the file
   {
     printf("ERROR: Cannot open the input file: %s\n", filename);
     printf("Check that the file exists.\n");
-    exit(-1);
+    return 0;
+  }
+
+  if(fread(&version, sizeof(unsigned char), 1, inp)!=1){fclose(inp); return 0;}
+  if(version==2){
+    numSpec = readJF3v2(inp,filename,imp);
+  }else if(version==3){
+    numSpec = readJF3v3(inp,filename,imp);
+  }else if(version==4){
+    numSpec = readJF3v4(inp,filename,imp);
+  }else{
+    printf("ERROR: file %s has unknown .jf3 file format version (%i).\n",filename,version);
   }
 
-  //get the number of spectra in the .mca file
-  unsigned int numSpec = S32K;
-  for (i = 0; i < numSpec; i++)
-    if (fread(tmpHist, S32K * sizeof(int), 1, inp) != 1)
-    {
-      numSpec = i;
-      break;
-    }
   fclose(inp);
-  //printf("number of spectra in file '%s': %i\n",filename,numSpec);	
-  if((outHistStartSp+numSpec)>=NSPECT){
-    printf("Cannot open file %s, number of spectra would exceed maximum!\n", filename);
-    fclose(inp);
-    return -1; //over-import error
+  return numSpec;
+}
+
+//reads a compressed file of S32K channel arrays (see readBinaryArrays) as a
+//stream (see data_stream.c), one array at a time, since the number of
+//spectra isn't known until the whole file has been decompressed
+//spectra are always loaded when read in (imp->lazyLoad is ignored)
+int readBinaryArrayStream(const char *filename, import_data *imp, const unsigned char type)
+{
+  const size_t spBytes = S32K*4;
+  data_stream inp;
+  int numSpec = 0;
+  int err = 0;
+
+  if (openDataStream(&inp, filename) == 0) //open the file
+  {
+    printf("ERROR: Cannot open the input file: %s\n", filename);
+    printf("Check that the file exists.\n");
+    return 0;
+  }
+  void *buf = malloc(spBytes);
+  if(buf == NULL){
+    closeDataStream(&inp);
+    return 0;
   }
 
-  if ((inp = fopen(filename, "r")) != NULL){ //reopen the file
-    for (i = outHistStartSp; i < (outHistStartSp+numSpec); i++)
-    {
-      if (fread(tmpHist, S32K * sizeof(int), 1, inp) != 1)
-      {
-        printf("ERROR: Cannot read spectrum %i from the .mca file: %s\n", i, filename);
-        printf("Verify that the format and number of spectra in the file are correct.\n");
-        exit(-1);
-      }
-      else{
-        for (j = 0; j < S32K; j++){
-          outHist[i][j] = (double)tmpHist[j];
-        }
+  while(readDataStream(&inp,buf,spBytes) == spBytes){ //any partial spectrum at the end is ignored
+    if((numSpec+1) >= NSPECT){
+      printf("Cannot open file %s, number of spectra would exceed maximum!\n", filename);
+      err = -1; //over-import error
+      break;
+    }
+    if(setImportNumSp(imp,numSpec+1)==0){
+      break;
+    }
+    int numCh = getArrayUsedLength(buf,S32K,type); //see spectrum_kernels.c
+    if(numCh > 0){
+      double *outHist = allocImportSpectrum(imp,numSpec,numCh);
+      if(outHist == NULL){
+        printf("ERROR: cannot allocate memory for spectrum %i of file: %s\n", numSpec, filename);
+        err = 1;
+        break;
       }
-      snprintf(rawdata.histComment[i],256,"Spectrum %i of %s",i-outHistStartSp+1,basename((char*)filename));
+      convertArrayToDoubles(outHist,buf,numCh,type); //see spectrum_kernels.c
     }
+    snprintf(getImportTitle(imp,numSpec),256,"Spectrum %i of %s",numSpec+1,getFileBasename(filename));
+    numSpec++;
+  }
+  if(inp.err){
+    printf("ERROR: Cannot read the input file: %s\n", filename);
+    err = 1;
   }
 
-  fclose(inp);
-  return (int)numSpec;
+  free(buf);
+  closeDataStream(&inp);
+  if(err){
+    return (err < 0) ? -1 : 0;
+  }
+  return numSpec;
 }
 
-//function reads an .fmca file into a double array and returns the number of spectra read in
-int readFMCA(const char *filename, double outHist[NSPECT][S32K], const unsigned int outHistStartSp)
+//function reads a file containing a sequence of S32K channel arrays of
+//32-bit integers (type=0, .mca) or floats (type=1, .fmca) into imported data
+//(see spectrum_import.c) and returns the number of spectra read in
+//the file is mapped into memory, the number of spectra is given by its size,
+//and each array is converted directly into spectrum data (only up to the
+//last non-empty channel)
+//if imp->lazyLoad is set, the arrays are only scanned for their length, and
+//loaded when first used (see loadSpStoreEntry in spectrum_store.c)
+int readBinaryArrays(const char *filename, import_data *imp, const unsigned char type)
 {
-  unsigned int i, j;
-  float tmpHist[S32K];
-  FILE *inp;
+  int i;
+  struct stat st;
+  const size_t spBytes = S32K*4;
+  int fd;
 
-  if ((inp = fopen(filename, "r")) == NULL) //open the file
+  if(getDataFileCompression(filename) != DATA_COMPRESSION_NONE){
+    return readBinaryArrayStream(filename,imp,type); //can't be mapped
+  }
+
+  if ((fd = open(filename, O_RDONLY)) < 0) //open the file
   {
     printf("ERROR: Cannot open the input file: %s\n", filename);
     printf("Check that the file exists.\n");
-    exit(-1); //over-import error
+    return 0;
+  }
+  if(fstat(fd,&st) != 0){
+    close(fd);
+    return 0;
   }
 
-  //get the number of spectra in the .fmca file
-  unsigned int numSpec = S32K;
-  for (i = 0; i < numSpec; i++)
-    if (fread(tmpHist, S32K * sizeof(float), 1, inp) != 1)
-    {
-      numSpec = i;
-      break;
-    }
-  fclose(inp);
-  //printf("number of spectra in file '%s': %i\n",filename,numSpec);
-  if((outHistStartSp+numSpec)>=NSPECT){
+  //get the number of spectra in the file (any partial spectrum at the end is ignored)
+  if((st.st_size / (off_t)spBytes) >= NSPECT){
     printf("Cannot open file %s, number of spectra would exceed maximum!\n", filename);
-    fclose(inp);
-    return -1;
+    close(fd);
+    return -1; //over-import error
+  }
+  int numSpec = (int)(st.st_size / (off_t)spBytes);
+  //printf("number of spectra in file '%s': %i\n",filename,numSpec);
+  if(numSpec == 0){
+    close(fd);
+    return 0;
+  }
+  if(setImportNumSp(imp,numSpec)==0){
+    close(fd);
+    return 0;
   }
 
-  if ((inp = fopen(filename, "r")) != NULL){ //reopen the file
-    for (i = outHistStartSp; i < (outHistStartSp+numSpec); i++)
-    {
-      if (fread(tmpHist, S32K * sizeof(float), 1, inp) != 1)
-      {
-        printf("ERROR: Cannot read spectrum %i from the .fmca file: %s\n", i, filename);
+  size_t mapBytes = (size_t)numSpec*spBytes;
+  const char *map = mmap(NULL,mapBytes,PROT_READ,MAP_PRIVATE,fd,0);
+  void *buf = NULL;
+  if(map == MAP_FAILED){
+    //can't map the file (eg. on some network filesystems), read it one spectrum at a time instead
+    map = NULL;
+    buf = malloc(spBytes);
+    if(buf == NULL){
+      close(fd);
+      return 0;
+    }
+  }else{
+    posix_madvise((void*)map,mapBytes,POSIX_MADV_SEQUENTIAL);
+  }
+
+  for (i = 0; i < numSpec; i++){
+    const void *vals;
+    if(map != NULL){
+      vals = map + (size_t)i*spBytes;
+    }else{
+      if(pread(fd,buf,spBytes,(off_t)((size_t)i*spBytes)) != (ssize_t)spBytes){
+        printf("ERROR: Cannot read spectrum %i from the file: %s\n", i, filename);
         printf("Verify that the format and number of spectra in the file are correct.\n");
-        exit(-1);
+        free(buf);
+        close(fd);
+        return 0;
       }
-      else
-      {
-        for (j = 0; j < S32K; j++)
-          outHist[i][j] = (double)tmpHist[j];
+      vals = buf;
+    }
+    int numCh = getArrayUsedLength(vals,S32K,type); //see spectrum_kernels.c
+    if(imp->lazyLoad){
+      sp_store_entry *sp = &imp->sp[i];
+      sp->srcFile = strdup(filename);
+      if(sp->srcFile == NULL){
+        break;
+      }
+      sp->srcOffset = (long)((size_t)i*spBytes);
+      sp->srcType = type;
+      sp->length = numCh;
+    }else if(numCh > 0){
+      double *outHist = allocImportSpectrum(imp,i,numCh);
+      if(outHist == NULL){
+        break;
       }
-      snprintf(rawdata.histComment[i],256,"Spectrum %i of %s",i-outHistStartSp+1,basename((char*)filename));
+      convertArrayToDoubles(outHist,vals,numCh,type); //see spectrum_kernels.c
     }
+    snprintf(getImportTitle(imp,i),256,"Spectrum %i of %s",i+1,getFileBasename(filename));
   }
 
-  fclose(inp);
-  return (int)numSpec;
+  if(map != NULL){
+    munmap((void*)map,mapBytes);
+  }
+  free(buf);
+  close(fd);
+  if(i < numSpec){
+    printf("ERROR: cannot allocate memory for spectrum %i of file: %s\n", i, filename);
+    return 0;
+  }
+  return numSpec;
+}
+
+//function reads an .mca file into imported data (see spectrum_import.c) and returns the number of spectra read in
+int readMCA(const char *filename, import_data *imp)
+{
+  return readBinaryArrays(filename,imp,0);
+}
+
+//function reads an .fmca file into imported data (see spectrum_import.c) and returns the number of spectra read in
+int readFMCA(const char *filename, import_data *imp)
+{
+  return readBinaryArrays(filename,imp,1);
 }
 
-//function reads an .spe file into a double array and returns the array
-int readSPE(const char *filename, double outHist[NSPECT][S32K], const unsigned int outHistStartSp)
+//function reads an .spe file into imported data (see spectrum_import.c) and returns the number of spectra read in
+int readSPE(const char *filename, import_data *imp)
 {
   unsigned int i;
   float inpHist[4096];
-  FILE *inp;
+  data_stream inp;
 
   //radware file header info
   char spLabel[8], header[24];
   int32_t intBuf = 1;
 
-  if ((inp = fopen(filename, "r")) == NULL) //open the file
+  if (openDataStream(&inp, filename) == 0) //open the file (see data_stream.c)
   {
     printf("ERROR: Cannot open the input file: %s\n", filename);
     printf("Check that the file exists.\n");
-    exit(-1);
+    return 0;
   }
 
   //read .spe header
-  if(fread(&intBuf,sizeof(int32_t),1,inp)!=1) return 0;
-  if(fread(&spLabel,sizeof(spLabel),1,inp)!=1) return 0;
-  if(fread(header, 24, 1, inp) != 1){
+  if((readDataStream(&inp,&intBuf,sizeof(int32_t))!=sizeof(int32_t))||(readDataStream(&inp,&spLabel,sizeof(spLabel))!=sizeof(spLabel))||(readDataStream(&inp,header,24)!=24)){
     printf("ERROR: Cannot read header from the .spe file: %s\n", filename);
     printf("Verify that the format of the file is correct.\n");
-    fclose(inp);
+    closeDataStream(&inp);
     return 0;
   }
-  unsigned int numElementsRead = (unsigned int)fread(inpHist, sizeof(float), 4096, inp);
+  unsigned int numElementsRead = (unsigned int)(readDataStream(&inp, inpHist, sizeof(inpHist))/sizeof(float));
   if(numElementsRead < 1){
     printf("ERROR: Cannot read spectrum from the .spe file: %s\n", filename);
-    printf("fread code: %u\n",numElementsRead);
     printf("Verify that the format of the file is correct.\n");
-    fclose(inp);
+    closeDataStream(&inp);
     return 0;
   }
 
-  if(outHistStartSp>=NSPECT){
-    printf("Cannot open file %s, number of spectra would exceed maximum!\n", filename);
-    fclose(inp);
-    return -1; //over-import error
-  }
-
   //convert input data to double
+  double *outHist = allocImportSpectrum(imp,0,(int)numElementsRead);
+  if(outHist == NULL){
+    closeDataStream(&inp);
+    return 0;
+  }
   for (i = 0; i < numElementsRead; i++)
-    outHist[outHistStartSp][i] = (double)inpHist[i];
-  for (i = numElementsRead; i < S32K; i++)
-    outHist[outHistStartSp][i] = 0.;
+    outHist[i] = (double)inpHist[i];
 
   gchar *label = g_convert(spLabel, -1, "UTF-8", "ISO-8859-1", NULL, NULL, NULL); //can get weirdly encoded junk, make sure it is properly converted to UTF-8
-  snprintf(rawdata.histComment[outHistStartSp],256,"%s %s",label,basename((char*)filename));
+  snprintf(getImportTitle(imp,0),256,"%s %s",label,getFileBasename(filename));
   g_free(label);
 
-  fclose(inp);
+  closeDataStream(&inp);
   return 1;
 }
 
-int readTXT(const char *filename, double outHist[NSPECT][S32K], const unsigned int outHistStartSp)
+//open a text file (which may be compressed, see data_stream.c) for reading line by line
+//returns 1 on success, 0 on failure
+int openLineReader(line_reader *lr, const char *filename){
+  memset(lr,0,sizeof(line_reader));
+  if(openDataStream(&lr->stream,filename) == 0){
+    return 0;
+  }
+  lr->bufSize = 1048576;
+  lr->buf = malloc(lr->bufSize+1);
+  if(lr->buf == NULL){
+    closeDataStream(&lr->stream);
+    return 0;
+  }
+  return 1;
+}
+
+void closeLineReader(line_reader *lr){
+  closeDataStream(&lr->stream);
+  free(lr->buf);
+  memset(lr,0,sizeof(line_reader));
+}
+
+//get the next line of a text file, without the line ending
+//the line is null-terminated in place in the buffer, and may be modified
+//by the caller, but is only valid until the next call
+//returns NULL at the end of the file, or if reading fails (lr->err is set)
+char *getNextLine(line_reader *lr){
+  while(1){
+    char *lineStart = lr->buf + lr->start;
+    char *nl = memchr(lineStart,'\n',lr->end - lr->start);
+    if(nl != NULL){
+      *nl = '\0';
+      lr->start = (size_t)(nl - lr->buf) + 1;
+      if((nl > lineStart)&&(nl[-1] == '\r')){
+        nl[-1] = '\0';
+      }
+      return lineStart;
+    }
+    if(lr->eof){
+      if(lr->start < lr->end){
+        //last line, with no line ending
+        lr->buf[lr->end] = '\0';
+        if(lr->buf[lr->end-1] == '\r'){
+          lr->buf[lr->end-1] = '\0';
+        }
+        lr->start = lr->end;
+        return lineStart;
+      }
+      return NULL;
+    }
+    //move the partial line to the start of the buffer, and read more of the file
+    size_t partialLength = lr->end - lr->start;
+    if((partialLength > 0)&&(lr->start > 0)){
+      memmove(lr->buf,lineStart,partialLength);
+    }
+    lr->start = 0;
+    lr->end = partialLength;
+    if(lr->end == lr->bufSize){
+      //line is longer than the buffer
+      char *newBuf = realloc(lr->buf,lr->bufSize*2+1);
+      if(newBuf == NULL){
+        printf("ERROR: cannot allocate memory for a line of %lu characters.\n",(long unsigned int)(lr->bufSize*2));
+        lr->err = 1;
+        return NULL;
+      }
+      lr->buf = newBuf;
+      lr->bufSize *= 2;
+    }
+    size_t numRead = readDataStream(&lr->stream,lr->buf + lr->end,lr->bufSize - lr->end);
+    if(numRead == 0){
+      if(lr->stream.err){
+        lr->err = 1;
+        return NULL;
+      }
+      lr->eof = 1;
+    }
+    lr->end += numRead;
+  }
+}
+
+//get the next space-separated token of a line, null-terminating it in place
+//and advancing *pos past it
+//returns NULL if there are no more tokens
+char *getNextToken(char **pos){
+  char *p = *pos;
+  while((*p == ' ')||(*p == '\t')){
+    p++;
+  }
+  if(*p == '\0'){
+    *pos = p;
+    return NULL;
+  }
+  char *tok = p;
+  while((*p != '\0')&&(*p != ' ')&&(*p != '\t')){
+    p++;
+  }
+  if(*p != '\0'){
+    *p = '\0';
+    p++;
+  }
+  *pos = p;
+  return tok;
+}
+
+//get the rest of a line after the last token read with getNextToken
+//returns NULL if there is nothing left
+char *getRestOfLine(char **pos){
+  char *rest = *pos;
+  if(*rest == '\0'){
+    return NULL;
+  }
+  *pos = rest + strlen(rest);
+  return rest;
+}
+
+//get the directive at the start of a line from a .txt file
+//returns the directive number (position in txtDirectives), or -1 if the line is data
+int getTXTDirective(const char *line){
+  static const char *txtDirectives[10] = {"SPECTRUM1","TITLE","VIEW","VIEWPAR","VIEWSP","VIEWSCALE","COMMENT","CALPAR","CALXUNIT","CALYUNIT"};
+  int i;
+  while((*line == ' ')||(*line == '\t')){
+    line++;
+  }
+  if((*line < 'A')||(*line > 'Z')){
+    return -1; //directives start with an uppercase letter, data doesn't
+  }
+  size_t len = strcspn(line," \t");
+  for(i=0;i<10;i++){
+    if((strlen(txtDirectives[i]) == len)&&(strncmp(line,txtDirectives[i],len) == 0)){
+      return i;
+    }
+  }
+  return -1;
+}
+
+//function reads a column plaintext .txt file into imported data (see spectrum_import.c)
+//the file is read in a single pass, directives (titles, views, comments, calibration)
+//may be placed anywhere in the file
+//returns the number of spectra read in (0 on failure, -1 if there are too many columns)
+int readTXT(const char *filename, import_data *imp)
 {
-  unsigned int i,j;
-  unsigned int numElementsRead = 0;
-  char str[1024], str2[1024];
-  char *tok;
-  FILE *inp;
+  int i;
+  int numRowsRead = 0;
+  int numColumns = 0; // the detected number of columns in the first line of data
   double num[NSPECT];
-  int numColumns = 0; // the detected number of columns in the first line
-  unsigned char startNumViews = rawdata.numViews;
+  char *line, *pos, *tok, *end;
+  line_reader lr;
+  int viewState = 0; //0=no view being read, 1=VIEW read, 2=VIEWPAR read, 3=VIEWSP read
+  char viewComment[256];
+  unsigned char viewMultiplotMode = 0;
+  int viewNumMultiplotSp = 0;
+  int viewMultiPlots[NSPECT];
+  double viewScaleFactor[NSPECT];
 
-  if ((inp = fopen(filename, "r")) == NULL){ //open the file
+  if(openLineReader(&lr,filename) == 0){ //open the file
     printf("ERROR: Cannot open the input file: %s\n", filename);
     printf("Check that the file exists.\n");
-    exit(-1);
-  }else{
-    while(!(feof(inp)))//go until the end of file is reached
-      {
-        if(numElementsRead<S32K){
-          if(fgets(str,1024,inp)!=NULL){ //get an entire line
-            strncpy(str2,str,1024);
-            int numLineEntries = 0;
-            tok = strtok(str2," ");
-            if((strcmp(tok,"SPECTRUM1")==0)||(strcmp(tok,"TITLE")==0)||(strcmp(tok,"VIEW")==0)||(strcmp(tok,"VIEWPAR")==0)||(strcmp(tok,"VIEWSP")==0)||(strcmp(tok,"VIEWSCALE")==0)||(strcmp(tok,"COMMENT")==0)||(strcmp(tok,"CALPAR")==0)||(strcmp(tok,"CALXUNIT")==0)||(strcmp(tok,"CALYUNIT")==0)){
-              numLineEntries = 0;
-            }else{
-              //line is data
-              while(tok!=NULL){
-                if(numLineEntries<NSPECT){
-                  num[numLineEntries] = atof(tok);
-                  //printf("numLineEntries: %i, num: %f\n",numLineEntries, num[numLineEntries]);
-                  numLineEntries++;
-                  tok = strtok(NULL," ");
-                }else{
-                  numLineEntries++;
-                  break;
-                }
-              }
-              numLineEntries--;
+    return 0;
+  }
+  
+  while((line = getNextLine(&lr)) != NULL){
+    int directive = getTXTDirective(line);
+    if(directive < 0){
+      //line is data
+      int numLineEntries = 0;
+      pos = line;
+      while(1){
+        while((*pos == ' ')||(*pos == '\t')){
+          pos++;
+        }
+        if(*pos == '\0'){
+          break;
+        }
+        double val = parseDouble(pos,&end); //see utils.c
+        //skip any trailing characters in the entry, as atof would
+        while((*end != '\0')&&(*end != ' ')&&(*end != '\t')){
+          end++;
+        }
+        pos = end;
+        if(numLineEntries < NSPECT){
+          num[numLineEntries] = val;
+        }
+        numLineEntries++;
+      }
+      if(numLineEntries > NSPECT){
+        printf("Cannot open file %s, number of columns (%i) exceeds the maximum number of spectra!\n",filename,numLineEntries);
+        closeLineReader(&lr);
+        return -1;
+      }
+      if(numLineEntries > 0){
+        viewState = 0;
+        if(numColumns == 0){
+          numColumns = numLineEntries;
+          //set default histogram titles
+          if(setImportNumSp(imp,numColumns)==0){
+            closeLineReader(&lr);
+            return 0;
+          }
+          for(i=0;i<numColumns;i++){
+            if(getImportTitle(imp,i)[0] == '\0'){ //not already set by a TITLE directive
+              snprintf(getImportTitle(imp,i),256,"Spectrum %i of %s",i,getFileBasename(filename));
             }
-            if(numLineEntries > 0){
-              if(numColumns == 0){
-                numColumns = numLineEntries;
-                //set default histogram titles
-                for(i=0;i<numColumns;i++){
-                  snprintf(rawdata.histComment[outHistStartSp+i],256,"Spectrum %i of %s",i,basename((char*)filename));
+          }
+        }else if(numLineEntries != numColumns){
+          printf("ERROR: inconsistent number of columns (%i) in line %i of file: %s\n",numLineEntries,numRowsRead,filename);
+          closeLineReader(&lr);
+          return 0;
+        }
+        if(numRowsRead < S32K){
+          for(i=0;i<numLineEntries;i++){
+            setSpStoreEntryBinVal(&imp->sp[i],numRowsRead,num[i]); //see spectrum_store.c
+          }
+        }else if(numRowsRead == S32K){
+          printf("WARNING: file %s has more than %i channels of data, extra channels are ignored.\n",filename,S32K);
+        }
+        numRowsRead++;
+      }
+      continue;
+    }
+
+    pos = line;
+    getNextToken(&pos); //skip the directive itself
+    switch(directive){
+      case 6:
+        //COMMENT view sp ch val text
+        viewState = 0;
+        if((tok = getNextToken(&pos))!=NULL){
+          unsigned char commentView = (unsigned char)atoi(tok);
+          if((tok = getNextToken(&pos))!=NULL){
+            int commentSp = atoi(tok);
+            if((tok = getNextToken(&pos))!=NULL){
+              int commentCh = atoi(tok);
+              if((tok = getNextToken(&pos))!=NULL){
+                float commentVal = (float)parseDouble(tok,NULL);
+                if((tok = getRestOfLine(&pos))!=NULL){
+                  addImportComment(imp,commentView,commentSp,commentCh,commentVal,tok);
                 }
-              }else if(numLineEntries != numColumns){
-                printf("ERROR: inconsistent number of columns (%i) in line %i of file: %s\n",numLineEntries,numElementsRead,filename);
-                fclose(inp);
-                return 0;
               }
-              for(i=0;i<numLineEntries;i++){
-                outHist[outHistStartSp+i][numElementsRead]=num[i];
-              }
-              numElementsRead++;
-            }else{
-              tok = strtok(str," ");
-              if(tok!=NULL){
-                if(strcmp(tok,"COMMENT")==0){
-                  if(rawdata.numChComments < NCHCOM){
-                    tok = strtok(NULL," ");
-                    if(tok!=NULL){
-                      rawdata.chanCommentView[rawdata.numChComments] = (unsigned char)atoi(tok);
-                      tok = strtok(NULL," ");
-                      if(tok!=NULL){
-                        rawdata.chanCommentSp[rawdata.numChComments] = (unsigned char)atoi(tok);
-                        if(outHistStartSp > 0){
-                          if(rawdata.chanCommentView[rawdata.numChComments] == 1){
-                            rawdata.chanCommentSp[rawdata.numChComments]=(unsigned char)(rawdata.chanCommentSp[rawdata.numChComments]+startNumViews); //assign to the correct (appended) view
-                          }else{
-                            rawdata.chanCommentSp[rawdata.numChComments]=(unsigned char)(rawdata.chanCommentSp[rawdata.numChComments]+outHistStartSp); //assign to the correct (appended) spectrum
-                          }
-                        }
-                        tok = strtok(NULL," ");
-                        if(tok!=NULL){
-                          rawdata.chanCommentCh[rawdata.numChComments] = atoi(tok);
-                          tok = strtok(NULL," ");
-                          if(tok!=NULL){
-                            rawdata.chanCommentVal[rawdata.numChComments] = (float)atof(tok);
-                            tok = strtok(NULL,""); //get the rest of the string
-                            if(tok!=NULL){
-                              strncpy(rawdata.chanComment[rawdata.numChComments],tok,sizeof(rawdata.chanComment[rawdata.numChComments])-1);
-                              rawdata.chanComment[rawdata.numChComments][strcspn(rawdata.chanComment[rawdata.numChComments], "\r\n")] = 0;//strips newline characters from the string
-                              rawdata.numChComments += 1;
-                            }
-                          }
-                        }
-                      }
-                    }
-                  }
-                }else if(strcmp(tok,"TITLE")==0){
-                  tok = strtok(NULL," ");
-                  if(tok!=NULL){
-                    int spID = atoi(tok) - 1 + (int)outHistStartSp;
-                    if((spID >= 0)&&(spID < NSPECT)){
-                      tok = strtok(NULL,""); //get the rest of the string
-                      if(tok!=NULL){
-                        strncpy(rawdata.histComment[spID],tok,sizeof(rawdata.histComment[spID])-1);
-                        rawdata.histComment[spID][strcspn(rawdata.histComment[spID], "\r\n")] = 0;//strips newline characters from the string
-                      }
-                    }						
-                  }
-                }else if(strcmp(tok,"VIEW")==0){
-                  if(rawdata.numViews < MAXNVIEWS){
-                    tok = strtok(NULL,""); //get the rest of the string
-                    if(tok!=NULL){
-                      strncpy(rawdata.viewComment[rawdata.numViews],tok,sizeof(rawdata.viewComment[rawdata.numViews])-1);
-                      rawdata.viewComment[rawdata.numViews][strcspn(rawdata.viewComment[rawdata.numViews], "\r\n")] = 0;//strips newline characters from the string
-                      if(fgets(str,256,inp)!=NULL){ //get an entire line
-                        tok = strtok(str," ");
-                        if(tok!=NULL){
-                          if(strcmp(tok,"VIEWPAR")==0){
-                            tok = strtok(NULL," ");
-                            if(tok!=NULL){
-                              rawdata.viewMultiplotMode[rawdata.numViews] = (unsigned char)atoi(tok);
-                              tok = strtok(NULL," ");
-                              if(tok!=NULL){
-                                rawdata.viewNumMultiplotSp[rawdata.numViews] = (unsigned char)atoi(tok);
-                                if(fgets(str,256,inp)!=NULL){ //get an entire line
-                                  tok = strtok(str," ");
-                                  if(tok!=NULL){
-                                    if(strcmp(tok,"VIEWSP")==0){
-                                      for(i=0;i<rawdata.viewNumMultiplotSp[rawdata.numViews];i++){
-                                        tok = strtok(NULL," ");
-                                        if(tok!=NULL){
-                                          rawdata.viewMultiPlots[rawdata.numViews][i] = (unsigned char)atoi(tok);
-                                        }
-                                      }
-                                      if(fgets(str,256,inp)!=NULL){ //get an entire line
-                                        tok = strtok(str," ");
-                                        if(tok!=NULL){
-                                          if(strcmp(tok,"VIEWSCALE")==0){
-                                            for(i=0;i<rawdata.viewNumMultiplotSp[rawdata.numViews];i++){
-                                              if(rawdata.viewMultiPlots[rawdata.numViews][i]<NSPECT){
-                                                tok = strtok(NULL," ");
-                                                if(tok!=NULL){
-                                                  rawdata.viewScaleFactor[rawdata.numViews][rawdata.viewMultiPlots[rawdata.numViews][i]] = atof(tok);
-                                                }
-                                              }
-                                            }
-                                            rawdata.numViews = (unsigned char)(rawdata.numViews+1);
-                                          }
-                                        }
-                                      }
-                                    }
-                                  }
-                                }
-                              }
-                            }
-                          }
-                        }
-                      }
-                    }
-                  }
-                }else if(strcmp(tok,"CALPAR")==0){
-                  tok = strtok(NULL," ");
-                  if(tok!=NULL){
-                    calpar.calpar0 = (float)atof(tok);
-                    tok = strtok(NULL," ");
-                    if(tok!=NULL){
-                      calpar.calpar1 = (float)atof(tok);
-                      tok = strtok(NULL," ");
-                      if(tok!=NULL){
-                        calpar.calpar2 = (float)atof(tok);
-                        tok = strtok(NULL," ");
-                        if(tok!=NULL){
-                          calpar.calMode = (unsigned char)atoi(tok);
-                        }
-                      }
-                    }
-                  }
-                  if((calpar.calpar1==0.0)&&(calpar.calpar2==0.0)){
-                    //invalid calibration, fix parameters
-                    calpar.calpar1=1.0;
-                  }
-                }else if(strcmp(tok,"CALXUNIT")==0){
-                  tok = strtok(NULL,""); //get the rest of the string
-                  if(tok!=NULL){
-                    strncpy(calpar.calUnit,tok,sizeof(calpar.calUnit)-1);
-                    calpar.calUnit[strcspn(calpar.calUnit, "\r\n")] = 0;//strips newline characters from the string
-                  }						
-                }else if(strcmp(tok,"CALYUNIT")==0){
-                  tok = strtok(NULL,""); //get the rest of the string
-                  if(tok!=NULL){
-                    strncpy(calpar.calYUnit,tok,sizeof(calpar.calYUnit)-1);
-                    calpar.calYUnit[strcspn(calpar.calYUnit, "\r\n")] = 0;//strips newline characters from the string
-                  }						
-                }
+            }
+          }
+        }
+        break;
+      case 1:
+        //TITLE sp text
+        viewState = 0;
+        if((tok = getNextToken(&pos))!=NULL){
+          int spNum = atoi(tok) - 1;
+          if((tok = getRestOfLine(&pos))!=NULL){
+            if((spNum >= 0)&&(spNum < NSPECT)&&(setImportNumSp(imp,spNum+1))){
+              strncpy(getImportTitle(imp,spNum),tok,255);
+            }
+          }
+        }
+        break;
+      case 2:
+        //VIEW comment, followed by VIEWPAR, VIEWSP, and VIEWSCALE lines
+        viewState = 0;
+        if(imp->numViews < MAXNVIEWS){
+          if((tok = getRestOfLine(&pos))!=NULL){
+            memset(viewComment,0,sizeof(viewComment));
+            strncpy(viewComment,tok,sizeof(viewComment)-1);
+            viewState = 1;
+          }
+        }
+        break;
+      case 3:
+        //VIEWPAR multiplotMode numMultiplotSp
+        if(viewState == 1){
+          viewState = 0;
+          if((tok = getNextToken(&pos))!=NULL){
+            viewMultiplotMode = (unsigned char)atoi(tok);
+            if((tok = getNextToken(&pos))!=NULL){
+              viewNumMultiplotSp = atoi(tok);
+              if(viewNumMultiplotSp < 0){
+                viewNumMultiplotSp = 0;
+              }else if(viewNumMultiplotSp > NSPECT){
+                viewNumMultiplotSp = NSPECT;
               }
+              memset(viewMultiPlots,0,sizeof(viewMultiPlots));
+              memset(viewScaleFactor,0,sizeof(viewScaleFactor));
+              viewState = 2;
             }
           }
+        }
+        break;
+      case 4:
+        //VIEWSP sp1 sp2 ...
+        if(viewState == 2){
+          for(i=0;i<viewNumMultiplotSp;i++){
+            if((tok = getNextToken(&pos))!=NULL){
+              viewMultiPlots[i] = atoi(tok);
+            }
+          }
+          viewState = 3;
         }else{
-          break;
+          viewState = 0;
         }
-        
-      }
+        break;
+      case 5:
+        //VIEWSCALE scale1 scale2 ...
+        if(viewState == 3){
+          for(i=0;i<viewNumMultiplotSp;i++){
+            if((tok = getNextToken(&pos))!=NULL){
+              viewScaleFactor[i] = parseDouble(tok,NULL);
+            }
+          }
+          addImportView(imp,viewComment,viewMultiplotMode,viewNumMultiplotSp,viewMultiPlots,viewScaleFactor);
+        }
+        viewState = 0;
+        break;
+      case 7:
+        //CALPAR calpar0 calpar1 calpar2 calMode
+        viewState = 0;
+        imp->hasCalPar = 1;
+        if((tok = getNextToken(&pos))!=NULL){
+          imp->cal.calpar0 = (float)parseDouble(tok,NULL);
+          if((tok = getNextToken(&pos))!=NULL){
+            imp->cal.calpar1 = (float)parseDouble(tok,NULL);
+            if((tok = getNextToken(&pos))!=NULL){
+              imp->cal.calpar2 = (float)parseDouble(tok,NULL);
+              if((tok = getNextToken(&pos))!=NULL){
+                imp->cal.calMode = (unsigned char)atoi(tok);
+              }
+            }
+          }
+        }
+        if((imp->cal.calpar1==0.0)&&(imp->cal.calpar2==0.0)){
+          //invalid calibration, fix parameters
+          imp->cal.calpar1=1.0;
+        }
+        break;
+      case 8:
+        //CALXUNIT unit
+        viewState = 0;
+        if((tok = getRestOfLine(&pos))!=NULL){
+          imp->hasCalUnit = 1;
+          strncpy(imp->cal.calUnit,tok,sizeof(imp->cal.calUnit)-1);
+        }
+        break;
+      case 9:
+        //CALYUNIT unit
+        viewState = 0;
+        if((tok = getRestOfLine(&pos))!=NULL){
+          imp->hasCalYUnit = 1;
+          strncpy(imp->cal.calYUnit,tok,sizeof(imp->cal.calYUnit)-1);
+        }
+        break;
+      default:
+        //SPECTRUM1 (column headers)
+        viewState = 0;
+        break;
+    }
+  }
+
+  if(lr.err){
+    printf("ERROR: Cannot read the input file: %s\n", filename);
+    closeLineReader(&lr);
+    return 0;
   }
+  closeLineReader(&lr);
 
   //check for import errors
-  if(numElementsRead == 0){
+  if(numRowsRead == 0){
     printf("ERROR: Empty input file: %s\n", filename);
-    fclose(inp);
     return 0;
   }
 
-  for(i=0;i<numColumns;i++){
-    for(j=numElementsRead;j<S32K;j++){
-      outHist[outHistStartSp+i][j]=0.;
+  imp->numSp = numColumns; //ignore titles for columns that don't exist
+  return numColumns;
+}
+
+//get the slot of a histogram name (len characters) in a ROOT macro name table,
+//which either holds the name or is the unused slot where it should be added
+int getRootMacroNameSlot(const root_macro_names *names, const char *name, const size_t len){
+  size_t i;
+  unsigned int hash = 2166136261u; //FNV-1a
+  for(i=0;i<len;i++){
+    hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+  }
+  unsigned int slot = hash & (ROOT_MACRO_HASH_SIZE-1);
+  while(names->name[slot] != NULL){
+    if((strncmp(names->name[slot],name,len)==0)&&(names->name[slot][len] == '\0')){
+      break;
     }
+    slot = (slot + 1) & (ROOT_MACRO_HASH_SIZE-1);
   }
+  return (int)slot;
+}
 
-  fclose(inp);
-  return numColumns;
+//get the length of the C identifier at the start of a string
+size_t getIdentifierLength(const char *str){
+  size_t len = 0;
+  while(isalnum((unsigned char)str[len])||(str[len] == '_')){
+    len++;
+  }
+  return len;
 }
 
-//function reads an .C ROOT macro file into a double array and returns the number of spectra read in
-int readROOT(const char *filename, double outHist[NSPECT][S32K], const unsigned int outHistStartSp)
+//function reads an .C ROOT macro file into imported data (see spectrum_import.c) and returns the number of spectra read in
+//the file is read in a single pass, each histogram declared (TH1F, TH1D, TH1I, TH1S, or TH1C) is
+//read in as a spectrum, and SetBinContent calls on any declared histogram are applied to its
+//spectrum, in whatever order they appear (a histogram declared again under the same name is read
+//in as a new spectrum, and takes later calls)
+int readROOT(const char *filename, import_data *imp)
 {
+  line_reader lr;
+  char *line;
+  int histNum = 0;
+  int numNonPoissonErr = 0;
 
-  FILE *inp;
-
-  if ((inp = fopen(filename, "r")) == NULL) //open the file
-  {
+  if(openLineReader(&lr,filename) == 0){ //open the file
     printf("ERROR: Cannot open the input file: %s\n", filename);
     printf("Check that the file exists.\n");
-    exit(-1); //over-import error
-  }
-
-  char *tok;
-  char histType = 0; //0=no hist, 1=TH1F,TH1D,TH1I
-  unsigned int histNum=0;
-  int ind;
-  double val;
-  char *str = malloc(1024);
-  char *histName = malloc(256);
-  strncpy(histName,"",256);
-
-  //read the input file
-  if(fgets(str,1024,inp)!=NULL){
-    while((!feof(inp))&&(fgets(str,1024,inp))) //check for end of file and read next line
-      {
-        //printf("%s",str); //print the line
-        tok = strtok (str," *->(),");
-        if(tok!=NULL){
-          if(histType>0){
-            if(outHistStartSp+histNum<=NSPECT){
-              if(strncmp(tok,histName,256)==0){
-                if(histType==1){
-                  //parse TH1F
-                  tok = strtok (NULL," *->(),");
-                  if((tok!=NULL)&&(strncmp(tok,"SetBinContent",256)==0)){
-                    tok = strtok (NULL," *->(),");
-                    if(tok!=NULL){
-                      ind=atoi(tok);
-                      tok = strtok (NULL," *->(),");
-                      if(tok!=NULL){
-                        val=atof(tok);
-                        //printf("Read bin %i with value %f\n",ind,val);
-                        if((ind>=0)&&(ind<S32K)){
-                          outHist[outHistStartSp+histNum-1][ind]=val;
-                        }
-                      }
-                    }
-                  }
-                }
-              }
-            }
-          }
+    return 0;
+  }
+  root_macro_names *names = calloc(1,sizeof(root_macro_names));
+  if(names == NULL){
+    closeLineReader(&lr);
+    return 0;
+  }
 
-          if((strncmp(tok,"TH1F",256)==0)||(strncmp(tok,"TH1D",256)==0)||(strncmp(tok,"TH1I",256)==0)){
-            //printf("1-D histogram (floating point) found.\n");
-            histType = 1;
-            tok = strtok (NULL," *");
-            if(tok!=NULL){
-              //printf("Histogram name: %s\n",tok);
-              strncpy(histName,tok,255);
-              histNum++;
-              if(outHistStartSp+histNum<=NSPECT){
-                //get rid of any previous histogram values (for when overwriting other histos)
-                memset(outHist[outHistStartSp+histNum-1],0,sizeof(outHist[outHistStartSp+histNum-1]));
-                snprintf(rawdata.histComment[outHistStartSp+histNum-1],256,"Spectrum %i of %s",histNum,basename((char*)filename));
-              }
-            }
-          }
+  while((line = getNextLine(&lr)) != NULL){
+    char *pos = line;
+    while((*pos == ' ')||(*pos == '\t')){
+      pos++;
+    }
+    size_t len = getIdentifierLength(pos);
+    if(len == 0){
+      continue;
+    }
+    if((len == 4)&&(strncmp(pos,"TH1",3)==0)&&(strchr("FDISC",pos[3]) != NULL)){
+      //histogram declaration, eg. 'TH1F *name = new TH1F(...);'
+      pos += len;
+      while((*pos == ' ')||(*pos == '\t')||(*pos == '*')){
+        pos++;
+      }
+      len = getIdentifierLength(pos);
+      if(len == 0){
+        continue;
+      }
+      histNum++;
+      if(histNum > NSPECT){
+        continue; //too many spectra, reported below
+      }
+      int slot = getRootMacroNameSlot(names,pos,len);
+      if(names->name[slot] == NULL){
+        names->name[slot] = strndup(pos,len);
+        if(names->name[slot] == NULL){
+          break;
         }
-        
       }
-  }else{
-    printf("Specified file %s has nothing in it.\n",filename);
-    fclose(inp);
-    free(histName);
-    free(str);
+      names->spNum[slot] = histNum-1; //a histogram declared again takes later calls
+      //get rid of any previous histogram values (for when the same histogram is defined again)
+      clearImportSpectrum(imp,histNum-1);
+      snprintf(getImportTitle(imp,histNum-1),256,"Spectrum %i of %s",histNum,getFileBasename(filename));
+    }else if((pos[len] == '-')&&(pos[len+1] == '>')){
+      //method call, eg. 'name->SetBinContent(bin,value);'
+      int slot = getRootMacroNameSlot(names,pos,len);
+      if(names->name[slot] == NULL){
+        continue; //not a histogram
+      }
+      int spNum = names->spNum[slot];
+      pos += len + 2;
+      int isError;
+      if(strncmp(pos,"SetBinContent(",14)==0){
+        isError = 0;
+        pos += 14;
+      }else if(strncmp(pos,"SetBinError(",12)==0){
+        isError = 1;
+        pos += 12;
+      }else{
+        continue;
+      }
+      char *end;
+      long ind = strtol(pos,&end,10);
+      if((end == pos)||(*end != ',')){
+        continue;
+      }
+      double val = parseDouble(end+1,NULL); //see utils.c
+      if((ind<0)||(ind>=S32K)){
+        continue;
+      }
+      if(isError == 0){
+        setImportBinVal(imp,spNum,(int)ind,val);
+      }else if(names->nonPoissonErr[spNum] == 0){
+        //bin errors can't be stored, but note whether they differ from those assumed when fitting
+        //(ROOT writes errors after the contents)
+        const sp_store_entry *sp = &imp->sp[spNum];
+        double content = (ind < sp->length) ? sp->data[ind] : 0.;
+        if(fabs(val*val - fabs(content)) > 1E-6*(fabs(content) + 1.)){
+          names->nonPoissonErr[spNum] = 1;
+          numNonPoissonErr++;
+        }
+      }
+    }
+  }
+
+  int err = lr.err;
+  closeLineReader(&lr);
+  int i;
+  for(i=0;i<ROOT_MACRO_HASH_SIZE;i++){
+    free(names->name[i]);
+  }
+  free(names);
+
+  if(err){
+    printf("ERROR: Cannot read the input file: %s\n", filename);
     return 0;
   }
+  if(histNum > NSPECT){
+    printf("Cannot open file %s, number of spectra would exceed maximum!\n", filename);
+    return -1; //over-import error
+  }
+  if(histNum == 0){
+    printf("ERROR: No histograms found in file: %s\n", filename);
+    return 0;
+  }
+  if(numNonPoissonErr > 0){
+    printf("WARNING: %i histogram(s) in file %s have bin errors other than sqrt(content), which are not kept.  Fits weighted using data assume sqrt(content) errors.\n",numNonPoissonErr,filename);
+  }
+  return histNum;
+}
 
-  fclose(inp);
-  free(histName);
-  free(str);
-  return (int)histNum;
+//checks whether the start of a file looks like text (no control characters
+//other than whitespace), used to tell text and binary formats apart
+int isTextHead(const unsigned char *head, const size_t len){
+  size_t i;
+  if(len == 0){
+    return 0;
+  }
+  for(i=0;i<len;i++){
+    if((head[i] < 0x20)&&(head[i] != '\t')&&(head[i] != '\n')&&(head[i] != '\r')){
+      return 0;
+    }
+  }
+  return 1;
+}
+
+//get the number of numeric columns in the first data line (ignoring
+//directives, see getTXTDirective) of a text file starting with head
+//returns 0 if there is no complete data line, or it contains anything else
+int getTXTHeadNumColumns(const unsigned char *head, const size_t len){
+  char line[DATA_SNIFF_BYTES+1];
+  size_t pos = 0;
+  while(pos < len){
+    size_t lineLen = strcspn((const char*)head+pos,"\r\n");
+    if((pos + lineLen >= len)||(lineLen >= sizeof(line))){
+      return 0; //line not completely in the head of the file
+    }
+    memcpy(line,head+pos,lineLen);
+    line[lineLen] = '\0';
+    pos += lineLen + 1;
+    if(getTXTDirective(line) >= 0){
+      continue;
+    }
+    char *tokPos = line;
+    char *tok;
+    int numCol = 0;
+    while((tok = getNextToken(&tokPos)) != NULL){
+      char *end;
+      strtod(tok,&end);
+      if((end == tok)||(*end != '\0')){
+        return 0;
+      }
+      numCol++;
+    }
+    if(numCol > 0){
+      return numCol;
+    }
+  }
+  return 0;
+}
+
+int probeJF3(const unsigned char *head, const size_t len, const long long int fileSize){
+  unsigned int numSpec;
+  jf3_superblock sb;
+  if(len < 2){
+    return 0;
+  }
+  if(head[0] == 2){
+    return (head[1] > 0) ? 30 : 0;
+  }else if((head[0] == 3)&&(len >= 1+sizeof(unsigned int))){
+    memcpy(&numSpec,head+1,sizeof(unsigned int));
+    return ((numSpec > 0)&&(numSpec < NSPECT)) ? 50 : 0;
+  }else if((head[0] == 4)&&(len >= 1+sizeof(jf3_superblock))){
+    memcpy(&sb,head+1,sizeof(jf3_superblock));
+    if((sb.metaOffset < 1+sizeof(jf3_superblock))||(sb.dirOffset <= sb.metaOffset)){
+      return 0;
+    }
+    if(fileSize < 0){
+      return 60;
+    }
+    return (sb.dirOffset < (long long unsigned int)fileSize) ? 90 : 0;
+  }
+  return 0;
+}
+
+int estimateJF3NumSp(const unsigned char *head, const size_t len, const long long int fileSize){
+  unsigned int numSpec;
+  if((len >= 2)&&(head[0] == 2)){
+    return head[1];
+  }else if((len >= 1+sizeof(unsigned int))&&(head[0] == 3)){
+    memcpy(&numSpec,head+1,sizeof(unsigned int));
+    return (numSpec < NSPECT) ? (int)numSpec : 0;
+  }
+  return 0; //version 4 files store the number of spectra at the end
+}
+
+//integer arrays: non-negative counts, which are well below the bit patterns
+//of float counts (and which look like denormals when read as floats)
+int probeMCA(const unsigned char *head, const size_t len, const long long int fileSize){
+  size_t i;
+  int32_t val;
+  if((len < sizeof(int32_t))||(isTextHead(head,len))){
+    return 0;
+  }
+  if((fileSize >= 0)&&(fileSize < S32K*4)){
+    return 0;
+  }
+  for(i=0;i+sizeof(int32_t)<=len;i+=sizeof(int32_t)){
+    memcpy(&val,head+i,sizeof(int32_t));
+    if((val < 0)||(val >= (1 << 28))){
+      return 0;
+    }
+  }
+  return ((fileSize >= 0)&&((fileSize % (S32K*4)) == 0)) ? 80 : 60;
+}
+
+//float arrays: valid floats, without denormals or infinities/NaNs
+int probeFMCA(const unsigned char *head, const size_t len, const long long int fileSize){
+  size_t i;
+  uint32_t val;
+  if((len < sizeof(uint32_t))||(isTextHead(head,len))){
+    return 0;
+  }
+  if((fileSize >= 0)&&(fileSize < S32K*4)){
+    return 0;
+  }
+  for(i=0;i+sizeof(uint32_t)<=len;i+=sizeof(uint32_t)){
+    memcpy(&val,head+i,sizeof(uint32_t));
+    uint32_t exponent = (val >> 23) & 0xFF;
+    if(((exponent == 0)&&((val & 0x7FFFFF) != 0))||(exponent == 0xFF)){
+      return 0;
+    }
+  }
+  return ((fileSize >= 0)&&((fileSize % (S32K*4)) == 0)) ? 70 : 50;
+}
+
+int estimateBinaryArrayNumSp(const unsigned char *head, const size_t len, const long long int fileSize){
+  if((fileSize < 0)||((fileSize / (S32K*4)) >= NSPECT)){
+    return 0;
+  }
+  return (int)(fileSize / (S32K*4));
+}
+
+//RadWare .spe: a Fortran record of 24 bytes (label and dimensions), followed
+//by the record of channel data
+int probeSPE(const unsigned char *head, const size_t len, const long long int fileSize){
+  int32_t recLen, dim, dataLen;
+  if(len < 36){
+    return 0;
+  }
+  memcpy(&recLen,head,sizeof(int32_t));
+  memcpy(&dim,head+12,sizeof(int32_t));
+  memcpy(&dataLen,head+32,sizeof(int32_t));
+  if((recLen != 24)||(memcmp(head,head+28,sizeof(int32_t)) != 0)){
+    return 0;
+  }
+  if((dim < 1)||(dim > 4096)||(dataLen != dim*4)){
+    return 10;
+  }
+  if((fileSize >= 0)&&(fileSize < 40 + dataLen)){
+    return 10;
+  }
+  return 95;
+}
+
+int estimateSPENumSp(const unsigned char *head, const size_t len, const long long int fileSize){
+  return 1;
 }
 
-//reads a file containing spectrum data into an array
-//returns the number of spectra read (0 if reading fails, -1 if too many files)
-int readSpectrumDataFile(const char *filename, double outHist[NSPECT][S32K], const unsigned int outHistStartSp)
+int probeTXT(const unsigned char *head, const size_t len, const long long int fileSize){
+  if(isTextHead(head,len)==0){
+    return 0;
+  }
+  size_t lineLen = strspn((const char*)head," \t\r\n");
+  if(getTXTDirective((const char*)head+lineLen) >= 0){
+    return 80;
+  }
+  if(getTXTHeadNumColumns(head,len) > 0){
+    return 60;
+  }
+  return 10; //text, but not recognizably spectrum data
+}
+
+int estimateTXTNumSp(const unsigned char *head, const size_t len, const long long int fileSize){
+  int numCol = getTXTHeadNumColumns(head,len);
+  return (numCol < NSPECT) ? numCol : 0;
+}
+
+//ROOT macros: text which creates and fills histograms
+int probeROOTMacro(const unsigned char *head, const size_t len, const long long int fileSize){
+  if(isTextHead(head,len)==0){
+    return 0;
+  }
+  if((strstr((const char*)head,"TH1") != NULL)&&((strstr((const char*)head,"SetBinContent") != NULL)||(strstr((const char*)head,"Fill") != NULL))){
+    return 90;
+  }
+  return 0;
+}
+
+int probeROOTFile(const unsigned char *head, const size_t len, const long long int fileSize){
+  return ((len >= 4)&&(memcmp(head,"root",4) == 0)) ? 100 : 0;
+}
+
+//list-mode events: whole events, from detectors which may be opened, in time order
+int probeListMode(const unsigned char *head, const size_t len, const long long int fileSize){
+  size_t i;
+  uint16_t det;
+  uint64_t ts, lastTs = 0;
+  int allZero = 1;
+  if((len < LISTMODE_EVENT_BYTES)||(isTextHead(head,len))){
+    return 0;
+  }
+  for(i=0;i+LISTMODE_EVENT_BYTES<=len;i+=LISTMODE_EVENT_BYTES){
+    memcpy(&det,head+i,sizeof(uint16_t));
+    memcpy(&ts,head+i+4,sizeof(uint64_t));
+    if((det >= NSPECT)||(ts < lastTs)){
+      return 0;
+    }
+    if((det != 0)||(ts != 0)||(head[i+2] != 0)||(head[i+3] != 0)){
+      allZero = 0;
+    }
+    lastTs = ts;
+  }
+  if(allZero){
+    return 10;
+  }
+  return ((fileSize >= 0)&&((fileSize % LISTMODE_EVENT_BYTES) != 0)) ? 40 : 70; //any partial event at the end is ignored
+}
+
+//data file formats which may be read in
+//(compressed .root and .jf3 files can't be read, since they are read in
+//random order, and are already compressed)
+static const data_format dataFormats[] = {
+  {"jf3", "jf3", probeJF3, estimateJF3NumSp, readJF3, 0},
+  {"mca", "integer array", probeMCA, estimateBinaryArrayNumSp, readMCA, 1},
+  {"fmca", "float array", probeFMCA, estimateBinaryArrayNumSp, readFMCA, 1},
+  {"spe", "RadWare", probeSPE, estimateSPENumSp, readSPE, 1},
+  {"txt", "plaintext", probeTXT, estimateTXTNumSp, readTXT, 1},
+  {"C", "ROOT macro", probeROOTMacro, NULL, readROOT, 1},
+  {"root", "ROOT", probeROOTFile, NULL, readROOTFile, 0}, //see read_root.c
+  {"evt", "list-mode event", probeListMode, NULL, readListMode, 1} //see read_listmode.c
+};
+#define NUM_DATA_FORMATS (int)(sizeof(dataFormats)/sizeof(data_format))
+
+//read the first (up to) len bytes of a data file into head, decompressing it
+//if needed (see data_stream.c), and null terminate them
+//fileSize is set to the size of the file, or -1 if it is compressed
+//returns the number of bytes read, or -1 if the file can't be opened
+long long int readDataFileHead(const char *filename, unsigned char *head, const size_t len, long long int *fileSize){
+  data_stream inp;
+  struct stat st;
+  if(openDataStreamReadAhead(&inp,filename,0)==0){
+    return -1;
+  }
+  *fileSize = -1;
+  if((inp.compression == DATA_COMPRESSION_NONE)&&(fstat(inp.fd,&st) == 0)){
+    *fileSize = (long long int)st.st_size;
+  }
+  size_t numRead = readDataStream(&inp,head,len);
+  head[numRead] = '\0';
+  closeDataStream(&inp);
+  return (long long int)numRead;
+}
+
+//identify the format of a data file from the start of its contents (head,
+//len bytes), preferring the format indicated by the file extension ext if
+//the contents are consistent with it, and no other format is a clearly
+//better match
+//returns NULL if the format isn't recognized
+const data_format *getDataFileFormat(const char *filename, const char *ext, const unsigned char *head, const size_t len, const long long int fileSize){
+  int i;
+  int score[NUM_DATA_FORMATS];
+  int extFormat = -1;
+  int bestFormat = -1;
+  for(i=0;i<NUM_DATA_FORMATS;i++){
+    score[i] = dataFormats[i].probe(head,len,fileSize);
+    if(strcmp(ext,dataFormats[i].ext) == 0){
+      extFormat = i;
+    }
+    if((bestFormat < 0)||(score[i] > score[bestFormat])){
+      bestFormat = i;
+    }
+  }
+  if((extFormat >= 0)&&((score[extFormat] >= DATA_PROBE_MIN_SCORE)||((score[extFormat] > 0)&&(score[bestFormat] < DATA_PROBE_MIN_SCORE)))){
+    return &dataFormats[extFormat];
+  }
+  if(score[bestFormat] >= DATA_PROBE_MIN_SCORE){
+    printf("NOTE: reading file %s as %s (.%s) data.\n",filename,dataFormats[bestFormat].desc,dataFormats[bestFormat].ext);
+    return &dataFormats[bestFormat];
+  }
+  if(extFormat >= 0){
+    return &dataFormats[extFormat]; //let the reader report what is wrong with the file
+  }
+  return NULL;
+}
+
+//reads a file containing spectrum data into imported data (see spectrum_import.c),
+//which may then be added to the spectrum store using commitImportData
+//does not access any global data, so may be called from a worker thread
+//returns the number of spectra read (0 if reading fails, -1 if too many spectra, -2 if the file type is unsupported)
+int readSpectrumDataFile(const char *filename, import_data *imp)
 {
   int numSpec = 0;
+  char ext[16];
+  unsigned char head[DATA_SNIFF_BYTES+1];
+  long long int fileSize;
 
-  const char *dot = strrchr(filename, '.'); //get the file extension
-  if(dot==NULL){
-    return -2; //invalid file type
+  //the format is identified from the start of the file, using the file
+  //extension (looking through any compression suffix, see data_stream.c)
+  //only to choose between formats which the contents are consistent with
+  if(getDataFileExtension(filename,ext,sizeof(ext))==0){
+    ext[0] = '\0';
   }
-  if (strcmp(dot + 1, "mca") == 0)
-    numSpec = readMCA(filename, outHist, outHistStartSp);
-  else if (strcmp(dot + 1, "fmca") == 0)
-    numSpec = readFMCA(filename, outHist, outHistStartSp);
-  else if (strcmp(dot + 1, "spe") == 0)
-    numSpec = readSPE(filename, outHist, outHistStartSp);
-  else if (strcmp(dot + 1, "txt") == 0)
-    numSpec = readTXT(filename, outHist, outHistStartSp);
-  else if (strcmp(dot + 1, "C") == 0)
-    numSpec = readROOT(filename, outHist, outHistStartSp);
-  else if (strcmp(dot + 1, "jf3") == 0)
-    numSpec = readJF3(filename, outHist, outHistStartSp);
-  else{
+  long long int headLen = readDataFileHead(filename,head,DATA_SNIFF_BYTES,&fileSize);
+  if(headLen < 0){
+    printf("ERROR: Cannot open the input file: %s\n", filename);
+    printf("Check that the file exists.\n");
+    return 0;
+  }
+  const data_format *format = getDataFileFormat(filename,ext,head,(size_t)headLen,fileSize);
+  if(format == NULL){
     //printf("Improper format of input file: %s\n", filename);
     //printf("Supported file formats are: jf3 (.jf3), plaintext (.txt) integer array (.mca), float array (.fmca), radware (.spe), or ROOT macro (.C) files.\n");
+    return -2; //invalid file type
+  }
+  if((format->compressible == 0)&&(getDataFileCompression(filename) != DATA_COMPRESSION_NONE)){
+    printf("ERROR: cannot open compressed file %s, only .mca, .fmca, .spe, .txt, .C, and .evt files may be compressed.\n",filename);
     return -2;
   }
 
-  if((numSpec==-1)||(((int)outHistStartSp+numSpec)>=NSPECT)){
-    return -1; //too many spectra opened
+  //allocate space for all of the spectra at once, if the number can be estimated
+  if(format->estimateNumSp != NULL){
+    reserveImportSpectra(imp,format->estimateNumSp(head,(size_t)headLen,fileSize)); //see spectrum_import.c
   }
+  numSpec = format->read(filename, imp);
 
-  if(numSpec >= 0){
-    printf("Opened file: %s, number of spectra read in: %u\n", filename, numSpec);
+  if(numSpec > 0){
+    //shrink storage for the spectra just read in to the channels actually used, and build their indices
+    finalizeImportData(imp); //see spectrum_import.c
+  }
 
-    //discard empty spectra
-    if(rawdata.dropEmptySpectra){
-      unsigned int i;
-      int checkedSpCount = 0;
-      unsigned int passedSpCount = 0;
-      int passed = 0;
-      while(checkedSpCount < numSpec){
-        passed = 0;
-        for(i=0;i<S32K;i++){
-          if(outHist[outHistStartSp+passedSpCount][i] != 0.){
-            //printf("Passed spectrum %i\n",checkedSpCount);
-            passed = 1;
-            passedSpCount++;
-            break;
-          }
-        }
-        if(passed == 0){
-          //spectrum was empty, overwrite it
-          for(i=passedSpCount;i<(numSpec-1);i++){
-            memcpy(outHist[outHistStartSp+i],outHist[outHistStartSp+i+1],sizeof(outHist[i+1]));
-          }
-        }
-        checkedSpCount++;
-      }
-      int dropCount = numSpec-(int)passedSpCount;
-      if(dropCount>0)
-        printf("Dropped %i empty spectra.\n",dropCount);
-      return (int)passedSpCount;
+  return numSpec;
+}
+
+//read one file of a parallel import, on a worker thread
+void importFileThread(gpointer data, gpointer user_data){
+  import_job *job = (import_job*)data;
+  if(g_atomic_int_get(&importstate.cancel) == 0){
+    job->numSp = readSpectrumDataFile(job->filename,&job->imp);
+  }else{
+    job->numSp = 0;
+  }
+  g_atomic_int_set(&job->done,1);
+  g_idle_add(importstate.doneFunc,NULL); //let the main thread add the data to the spectrum store
+}
+
+//start reading numFiles files in parallel on a pool of worker threads
+//doneFunc is called on the main thread (from the GTK main loop) each time a file
+//has been read, files should then be added to the spectrum store in order using
+//commitNextImportFile
+//returns 1 on success, 0 on failure (eg. if an import is already in progress)
+int startImportFiles(char **filenames, const int numFiles, GSourceFunc doneFunc){
+  int i;
+  if((importstate.job != NULL)||(numFiles <= 0)){
+    return 0;
+  }
+  importstate.job = calloc((size_t)numFiles,sizeof(import_job));
+  if(importstate.job == NULL){
+    printf("ERROR: cannot allocate memory to import %i files.\n",numFiles);
+    return 0;
+  }
+  importstate.numJobs = numFiles;
+  importstate.numCommitted = 0;
+  importstate.doneFunc = doneFunc;
+  g_atomic_int_set(&importstate.cancel,0);
+  int numProc = (int)g_get_num_processors();
+  int numThreads = numProc;
+  if(numThreads > numFiles){
+    numThreads = numFiles;
+  }
+  for(i=0;i<numFiles;i++){
+    importstate.job[i].filename = g_strdup(filenames[i]);
+    initImportData(&importstate.job[i].imp);
+    importstate.job[i].imp.lazyLoad = (unsigned char)rawdata.lazyLoadSpectra;
+    importstate.job[i].imp.listModeChannels = rawdata.listModeChannels;
+    //list-mode files are histogrammed on their own pool of threads (see read_listmode.c),
+    //share the processors between the files being read at once
+    importstate.job[i].imp.listModeThreads = (numProc/numThreads > 1) ? numProc/numThreads : 1;
+  }
+  importstate.pool = g_thread_pool_new(importFileThread,NULL,numThreads,FALSE,NULL);
+  if(importstate.pool == NULL){
+    //no worker threads, read the files one at a time on this thread instead
+    printf("WARNING: cannot start worker threads, reading files sequentially.\n");
+    for(i=0;i<numFiles;i++){
+      importstate.job[i].imp.listModeThreads = 0;
+      importFileThread(&importstate.job[i],NULL);
     }
+    return 1;
+  }
+  for(i=0;i<numFiles;i++){
+    g_thread_pool_push(importstate.pool,&importstate.job[i],NULL);
+  }
+  return 1;
+}
+
+//get the index of the next file of a parallel import to be added to the
+//spectrum store, or -1 if that file hasn't been read yet (or all files have
+//been added)
+int getNextImportFile(){
+  if((importstate.job == NULL)||(importstate.numCommitted >= importstate.numJobs)){
+    return -1;
+  }
+  if(g_atomic_int_get(&importstate.job[importstate.numCommitted].done) == 0){
+    return -1;
+  }
+  return importstate.numCommitted;
+}
+
+//add the next file of a parallel import (which must have been read, see
+//getNextImportFile) to the spectrum store, starting at index outHistStartSp
+//if skip is set, the file's data is discarded instead
+//returns the number of spectra added (0 if reading failed, -1 if too many
+//spectra, -2 if the file type is unsupported)
+int commitNextImportFile(const int outHistStartSp, const int skip){
+  import_job *job = &importstate.job[importstate.numCommitted];
+  int numSp = job->numSp;
+  if(skip){
+    numSp = 0;
+  }else if(numSp > 0){
+    job->spHandle = malloc((size_t)numSp*sizeof(int));
+    numSp = commitImportData(&job->imp,job->filename,outHistStartSp,rawdata.dropEmptySpectra,job->spHandle); //see spectrum_import.c
   }
+  freeImportData(&job->imp);
+  importstate.numCommitted++;
+  return numSp;
+}
 
-  return numSpec;
+//clean up once all files of a parallel import have been added to the spectrum
+//store (or if the import is abandoned, in which case the remaining files are discarded)
+void endImportFiles(){
+  int i;
+  if(importstate.job == NULL){
+    return;
+  }
+  g_atomic_int_set(&importstate.cancel,1);
+  if(importstate.pool != NULL){
+    g_thread_pool_free(importstate.pool,FALSE,TRUE); //wait for any files still being read
+    importstate.pool = NULL;
+  }
+  for(i=0;i<importstate.numJobs;i++){
+    freeImportData(&importstate.job[i].imp);
+    g_free(importstate.job[i].filename);
+    free(importstate.job[i].spHandle);
+  }
+  free(importstate.job);
+  importstate.job = NULL;
+  importstate.numJobs = 0;
+  importstate.numCommitted = 0;
 }
@@ -0,0 +1,290 @@
+/* J. Williams, 2020-2021 */
+
+//This file contains routines for histogramming list-mode event files
+//(.evt), as written by some data acquisition systems.  Each event is a
+//fixed 12 byte little-endian record:
+//
+//  uint16 detector id, uint16 energy (ADC value), uint64 timestamp
+//
+//Events from detector n are histogrammed into spectrum n, with the 16-bit
+//ADC range compressed into the number of channels set in the preferences
+//(a power of 2, eg. 8192 channels puts ADC values 0-7 in channel 0, 8-15
+//in channel 1, etc.).  Timestamps aren't used.
+//
+//Files are never read in whole: they are split into ranges which are
+//histogrammed on a pool of worker threads, each streaming its range in
+//large chunks into its own private histograms (so that no locking is
+//needed), which are then summed once all ranges are done.  Compressed
+//files (eg. .evt.gz) can only be read from start to end, so are
+//histogrammed as a single range while being decompressed on another thread.
+
+#define LISTMODE_EVENT_BYTES      12 //size of a single event record
+#define LISTMODE_CHUNK_EVENTS     262144 //number of events read at once by each thread (3 MB)
+#define LISTMODE_MAX_RANGE_EVENTS 4000000000ULL //maximum number of events in a range, so that private histogram counts can't overflow
+#define LISTMODE_DEFAULT_CHANNELS 8192
+#define LISTMODE_MAX_DETECTORS    (NSPECT-1) //number of detector ids which can be histogrammed (at most NSPECT-1 spectra can be opened, see commitImportData)
+
+//get the number of low bits to drop from 16-bit ADC values to get
+//channel numbers for spectra with numCh channels (a power of 2, up to S32K)
+//returns -1 if numCh is invalid
+int getListModeShift(const int numCh){
+  int shift;
+  for(shift=0;shift<=16;shift++){
+    if((65536 >> shift) == numCh){
+      return ((65536 >> shift) <= S32K) ? shift : -1;
+    }
+  }
+  return -1;
+}
+
+//add numEvents events from buf to the private histograms of a range
+//returns 1 on success, 0 if memory can't be allocated
+int histogramListModeEvents(listmode_range *r, const unsigned char *buf, const size_t numEvents){
+  size_t i;
+  for(i=0;i<numEvents;i++){
+    const unsigned char *ev = &buf[i*LISTMODE_EVENT_BYTES];
+    unsigned int det = (unsigned int)ev[0] | ((unsigned int)ev[1] << 8);
+    unsigned int adc = (unsigned int)ev[2] | ((unsigned int)ev[3] << 8);
+    if(det >= LISTMODE_MAX_DETECTORS){
+      r->numDropped++;
+      continue;
+    }
+    if(r->hist[det] == NULL){
+      r->hist[det] = calloc((size_t)r->numCh,sizeof(unsigned int));
+      if(r->hist[det] == NULL){
+        return 0;
+      }
+    }
+    r->hist[det][adc >> r->shift]++;
+  }
+  return 1;
+}
+
+//histogram the events in one range of a list-mode event file, on a worker thread
+void histogramListModeRange(gpointer data, gpointer user_data){
+  listmode_range *r = (listmode_range*)data;
+  unsigned char *buf = malloc(LISTMODE_CHUNK_EVENTS*LISTMODE_EVENT_BYTES);
+  if(buf == NULL){
+    r->err = 1;
+    return;
+  }
+  posix_fadvise(r->fd,(off_t)r->start,(off_t)(r->end - r->start),POSIX_FADV_SEQUENTIAL);
+  long long int pos = r->start;
+  while(pos < r->end){
+    size_t len = LISTMODE_CHUNK_EVENTS*LISTMODE_EVENT_BYTES;
+    if((long long int)len > (r->end - pos)){
+      len = (size_t)(r->end - pos);
+    }
+    ssize_t numRead = pread(r->fd,buf,len,(off_t)pos);
+    if(numRead < LISTMODE_EVENT_BYTES){
+      r->err = 1; //file shrunk or can't be read
+      break;
+    }
+    size_t numEvents = (size_t)numRead / LISTMODE_EVENT_BYTES; //a short read may end part way through an event
+    if(histogramListModeEvents(r,buf,numEvents)==0){
+      r->err = 1;
+      break;
+    }
+    pos += (long long int)(numEvents*LISTMODE_EVENT_BYTES);
+  }
+  free(buf);
+}
+
+//histogram an uncompressed list-mode event file, split into ranges which
+//are histogrammed in parallel on up to maxThreads threads (0 for one per
+//processor, eg. fewer when other files are being read at the same time)
+//returns the ranges (numRanges of them), or NULL if the file can't be read or is empty
+listmode_range *histogramListModeFile(const char *filename, const int shift, const int numCh, const int maxThreads, int *numRanges){
+  int i;
+  struct stat st;
+  int fd;
+
+  if ((fd = open(filename, O_RDONLY)) < 0) //open the file
+  {
+    printf("ERROR: Cannot open the input file: %s\n", filename);
+    printf("Check that the file exists.\n");
+    return NULL;
+  }
+  if(fstat(fd,&st) != 0){
+    close(fd);
+    return NULL;
+  }
+  long long int numEvents = (long long int)st.st_size / LISTMODE_EVENT_BYTES;
+  if(((long long int)st.st_size % LISTMODE_EVENT_BYTES) != 0){
+    printf("WARNING: file %s ends part way through an event, which is ignored.\n",filename);
+  }
+  if(numEvents == 0){
+    close(fd);
+    return NULL;
+  }
+
+  //split the file into ranges of whole events, one per thread (or more for
+  //very large files, to keep the private histogram counts from overflowing)
+  int numThreads = (int)g_get_num_processors();
+  if((maxThreads > 0)&&(numThreads > maxThreads)){
+    numThreads = maxThreads;
+  }
+  long long int numChunks = (numEvents + LISTMODE_CHUNK_EVENTS - 1)/LISTMODE_CHUNK_EVENTS;
+  *numRanges = (numChunks < numThreads) ? (int)numChunks : numThreads;
+  while(((long long unsigned int)numEvents / (long long unsigned int)(*numRanges)) >= LISTMODE_MAX_RANGE_EVENTS){
+    *numRanges *= 2;
+  }
+  listmode_range *range = calloc((size_t)(*numRanges),sizeof(listmode_range));
+  if(range == NULL){
+    close(fd);
+    return NULL;
+  }
+  for(i=0;i<*numRanges;i++){
+    range[i].fd = fd;
+    range[i].start = (numEvents*i/(*numRanges))*LISTMODE_EVENT_BYTES;
+    range[i].end = (numEvents*(i+1)/(*numRanges))*LISTMODE_EVENT_BYTES;
+    range[i].shift = shift;
+    range[i].numCh = numCh;
+  }
+
+  GThreadPool *pool = NULL;
+  if(*numRanges > 1){
+    pool = g_thread_pool_new(histogramListModeRange,NULL,(*numRanges < numThreads) ? *numRanges : numThreads,FALSE,NULL);
+  }
+  if(pool != NULL){
+    for(i=0;i<*numRanges;i++){
+      g_thread_pool_push(pool,&range[i],NULL);
+    }
+    g_thread_pool_free(pool,FALSE,TRUE); //wait for all ranges to be histogrammed
+  }else{
+    //single range, or no worker threads
+    for(i=0;i<*numRanges;i++){
+      histogramListModeRange(&range[i],NULL);
+    }
+  }
+  close(fd);
+  return range;
+}
+
+//histogram a compressed list-mode event file, which can only be read from
+//start to end, as a single range (decompression runs on its own thread,
+//see data_stream.c)
+//returns the range, or NULL if the file can't be read or is empty
+listmode_range *histogramListModeStream(const char *filename, const int shift, const int numCh){
+  data_stream inp;
+  if(openDataStream(&inp,filename) == 0){
+    printf("ERROR: Cannot open the input file: %s\n", filename);
+    printf("Check that the file exists.\n");
+    return NULL;
+  }
+  listmode_range *range = calloc(1,sizeof(listmode_range));
+  unsigned char *buf = malloc(LISTMODE_CHUNK_EVENTS*LISTMODE_EVENT_BYTES);
+  if((range == NULL)||(buf == NULL)){
+    free(range);
+    free(buf);
+    closeDataStream(&inp);
+    return NULL;
+  }
+  range->fd = -1;
+  range->shift = shift;
+  range->numCh = numCh;
+  long long unsigned int numEvents = 0;
+  size_t numRead;
+  do{
+    numRead = readDataStream(&inp,buf,LISTMODE_CHUNK_EVENTS*LISTMODE_EVENT_BYTES);
+    if((numEvents + numRead/LISTMODE_EVENT_BYTES) >= LISTMODE_MAX_RANGE_EVENTS){
+      printf("ERROR: too many events in compressed file %s, decompress it first.\n",filename);
+      range->err = 1;
+      break;
+    }
+    if(histogramListModeEvents(range,buf,numRead/LISTMODE_EVENT_BYTES)==0){
+      range->err = 1;
+      break;
+    }
+    numEvents += numRead/LISTMODE_EVENT_BYTES;
+  }while(numRead == LISTMODE_CHUNK_EVENTS*LISTMODE_EVENT_BYTES);
+  if((numRead % LISTMODE_EVENT_BYTES) != 0){
+    printf("WARNING: file %s ends part way through an event, which is ignored.\n",filename);
+  }
+  range->err |= inp.err;
+  free(buf);
+  closeDataStream(&inp);
+  if(numEvents == 0){
+    free(range);
+    return NULL;
+  }
+  return range;
+}
+
+//function reads a list-mode event file (.evt, which may be compressed) into
+//imported data (see spectrum_import.c), histogramming the events from each
+//detector into a spectrum with imp->listModeChannels channels
+//returns the number of spectra read in (0 if reading fails)
+int readListMode(const char *filename, import_data *imp)
+{
+  int i,j,k;
+
+  int numCh = (imp->listModeChannels > 0) ? imp->listModeChannels : LISTMODE_DEFAULT_CHANNELS;
+  int shift = getListModeShift(numCh);
+  if(shift < 0){
+    printf("WARNING: invalid number of list-mode channels (%i), using %i.\n",numCh,LISTMODE_DEFAULT_CHANNELS);
+    numCh = LISTMODE_DEFAULT_CHANNELS;
+    shift = getListModeShift(numCh);
+  }
+
+  int numRanges = 1;
+  listmode_range *range;
+  if(getDataFileCompression(filename) != DATA_COMPRESSION_NONE){
+    range = histogramListModeStream(filename,shift,numCh); //see data_stream.c
+  }else{
+    range = histogramListModeFile(filename,shift,numCh,imp->listModeThreads,&numRanges);
+  }
+  if(range == NULL){
+    return 0;
+  }
+
+  //sum the private histograms into the imported spectra
+  int numSpec = 0;
+  int err = 0;
+  long long unsigned int numDropped = 0;
+  for(i=0;i<numRanges;i++){
+    err |= range[i].err;
+    numDropped += range[i].numDropped;
+  }
+  for(j=0;(j<NSPECT)&&(err==0);j++){
+    double *outHist = NULL;
+    for(i=0;i<numRanges;i++){
+      const unsigned int *hist = range[i].hist[j];
+      if(hist == NULL){
+        continue;
+      }
+      if(outHist == NULL){
+        outHist = allocImportSpectrum(imp,j,numCh); //zeroed
+        if(outHist == NULL){
+          err = 1;
+          break;
+        }
+      }
+      for(k=0;k<numCh;k++){
+        outHist[k] += (double)hist[k];
+      }
+    }
+    if(outHist != NULL){
+      numSpec = j+1;
+    }
+  }
+  for(i=0;i<numRanges;i++){
+    for(j=0;j<NSPECT;j++){
+      free(range[i].hist[j]);
+    }
+  }
+  free(range);
+  if(err){
+    printf("ERROR: cannot read events from file: %s\n", filename);
+    return 0;
+  }
+  if(numDropped > 0){
+    printf("WARNING: %llu events in file %s are from detectors numbered %i or higher, which are not shown (at most %i spectra can be opened).\n",numDropped,filename,LISTMODE_MAX_DETECTORS,NSPECT-1);
+  }
+
+  setImportNumSp(imp,numSpec); //detectors without events have empty spectra
+  for(j=0;j<numSpec;j++){
+    snprintf(getImportTitle(imp,j),256,"Detector %i of %s",j,getFileBasename(filename));
+  }
+  return numSpec;
+}
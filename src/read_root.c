@@ -0,0 +1,491 @@
+/* J. Williams, 2020-2021 */
+
+//This file contains routines for reading 1-D histograms (TH1D, TH1F, TH1I,
+//TH1S, and TH1C) directly from binary ROOT files (.root), without needing
+//ROOT itself.  All values in ROOT files are big-endian.
+//
+//A ROOT file starts with a header giving the position of the top directory,
+//and each directory has a list of keys, one per object, giving the class,
+//name, and location of the object.  Objects are stored after their key,
+//compressed in blocks of up to 16 MB, each with a 9 byte header (2 character
+//algorithm, method, and 3 byte little-endian compressed and uncompressed
+//sizes).  Only zlib compression ("ZL", the default in ROOT) is supported.
+//
+//A histogram object is streamed as a byte count and version, the TH1 base
+//class (with its own byte count, so that it can be skipped), and the bin
+//contents as a TArray (number of bins including under/overflow, then the
+//values).  Bin n is put in channel n, as when reading .C macro files.
+
+#define ROOT_BYTECOUNT_MASK 0x40000000 //set in byte counts, to tell them apart from class tags
+#define ROOT_MAX_DIR_DEPTH  16 //maximum depth of subdirectories to look for histograms in
+#define ROOT_MAX_KEYS_LEN   268435456 //maximum size of the key list of a directory
+#define ROOT_MAX_ZLIB_RATIO 1032 //maximum ratio of uncompressed to compressed size for zlib (deflate) data
+
+unsigned char getRootU8(root_buf *b){
+  if((b->err)||(b->pos + 1 > b->length)){
+    b->err = 1;
+    return 0;
+  }
+  return b->data[b->pos++];
+}
+
+unsigned short getRootU16(root_buf *b){
+  unsigned short val = (unsigned short)(getRootU8(b) << 8);
+  return (unsigned short)(val | getRootU8(b));
+}
+
+unsigned int getRootU32(root_buf *b){
+  unsigned int val = (unsigned int)getRootU16(b) << 16;
+  return val | getRootU16(b);
+}
+
+long long unsigned int getRootU64(root_buf *b){
+  long long unsigned int val = (long long unsigned int)getRootU32(b) << 32;
+  return val | getRootU32(b);
+}
+
+//read a string, stored as a length (unsigned char, or 255 followed by a uint32 for long strings)
+//followed by the characters, into str (which is truncated to strLen-1 characters)
+void getRootString(root_buf *b, char *str, const size_t strLen){
+  size_t len = getRootU8(b);
+  if(len == 255){
+    len = getRootU32(b);
+  }
+  if((b->err)||(len > b->length - b->pos)){
+    b->err = 1;
+    str[0] = '\0';
+    return;
+  }
+  size_t copyLen = (len < strLen) ? len : strLen-1;
+  memcpy(str,&b->data[b->pos],copyLen);
+  str[copyLen] = '\0';
+  b->pos += len;
+}
+
+//read len bytes at offset in a file
+//returns 1 on success, 0 on failure
+int readRootBytes(const int fd, const long long int offset, const size_t len, unsigned char *buf){
+  size_t numRead = 0;
+  while(numRead < len){
+    ssize_t n = pread(fd,&buf[numRead],len-numRead,(off_t)(offset + (long long int)numRead));
+    if(n < 0){
+      if(errno == EINTR){
+        continue;
+      }
+      return 0;
+    }
+    if(n == 0){
+      return 0; //past the end of the file
+    }
+    numRead += (size_t)n;
+  }
+  return 1;
+}
+
+//read a key from a buffer
+//returns 1 on success, 0 if the key is invalid
+int getRootKey(root_buf *b, root_key *key){
+  memset(key,0,sizeof(root_key));
+  key->nbytes = (int)getRootU32(b);
+  unsigned short version = getRootU16(b);
+  key->objLen = (int)getRootU32(b);
+  getRootU32(b); //date and time
+  key->keyLen = (short)getRootU16(b);
+  key->cycle = (short)getRootU16(b);
+  if(version > 1000){
+    //large file, 64-bit positions
+    key->seekKey = (long long int)getRootU64(b);
+    key->seekPdir = (long long int)getRootU64(b);
+  }else{
+    key->seekKey = (long long int)getRootU32(b);
+    key->seekPdir = (long long int)getRootU32(b);
+  }
+  getRootString(b,key->className,sizeof(key->className));
+  getRootString(b,key->name,sizeof(key->name));
+  getRootString(b,key->title,sizeof(key->title));
+  if((b->err)||(key->keyLen <= 0)||(key->nbytes < key->keyLen)||(key->objLen < 0)||(key->seekKey < 0)){
+    return 0;
+  }
+  return 1;
+}
+
+//get the type of bin values of a histogram class: 1=double (TH1D), 2=float (TH1F), 3=int32 (TH1I),
+//4=int16 (TH1S), 5=char (TH1C), or 0 if the class isn't a supported histogram type
+int getRootHistType(const char *className){
+  if(strcmp(className,"TH1D")==0){
+    return 1;
+  }else if(strcmp(className,"TH1F")==0){
+    return 2;
+  }else if(strcmp(className,"TH1I")==0){
+    return 3;
+  }else if(strcmp(className,"TH1S")==0){
+    return 4;
+  }else if(strcmp(className,"TH1C")==0){
+    return 5;
+  }
+  return 0;
+}
+
+//add a histogram key to a list, replacing any earlier cycle of the same histogram
+//returns 1 on success, 0 on failure
+int addRootHistKey(const root_key *key, root_key **keys, int *numKeys){
+  int i;
+  for(i=0;i<*numKeys;i++){
+    if(((*keys)[i].seekPdir == key->seekPdir)&&(strcmp((*keys)[i].name,key->name)==0)){
+      if(key->cycle > (*keys)[i].cycle){
+        (*keys)[i] = *key;
+      }
+      return 1;
+    }
+  }
+  if((*numKeys % 64) == 0){
+    root_key *newKeys = realloc(*keys,(size_t)(*numKeys + 64)*sizeof(root_key));
+    if(newKeys == NULL){
+      return 0;
+    }
+    *keys = newKeys;
+  }
+  (*keys)[*numKeys] = *key;
+  (*numKeys)++;
+  return 1;
+}
+
+//read the keys of the histograms in a directory (and its subdirectories) of a ROOT file,
+//given the position of the directory's key list
+//returns 1 on success, 0 if the file is invalid
+int readRootDirectory(const int fd, const long long int seekKeys, const int depth, root_key **keys, int *numKeys){
+  unsigned char lenBuf[4];
+  int i;
+  if((depth > ROOT_MAX_DIR_DEPTH)||(seekKeys <= 0)){
+    return 0;
+  }
+  if(readRootBytes(fd,seekKeys,sizeof(lenBuf),lenBuf)==0){
+    return 0;
+  }
+  root_buf b = {lenBuf,sizeof(lenBuf),0,0};
+  unsigned int keysLen = getRootU32(&b); //size of the key list (stored as a key followed by the keys)
+  if((keysLen < sizeof(lenBuf))||(keysLen > ROOT_MAX_KEYS_LEN)){
+    return 0;
+  }
+  unsigned char *keysBuf = malloc(keysLen);
+  if(keysBuf == NULL){
+    return 0;
+  }
+  if(readRootBytes(fd,seekKeys,keysLen,keysBuf)==0){
+    free(keysBuf);
+    return 0;
+  }
+  b.data = keysBuf;
+  b.length = keysLen;
+  b.pos = 0;
+  root_key key;
+  int success = getRootKey(&b,&key);
+  b.pos = (size_t)key.keyLen;
+  int numDirKeys = (int)getRootU32(&b);
+  for(i=0;(i<numDirKeys)&&success;i++){
+    if(getRootKey(&b,&key)==0){
+      success = 0;
+      break;
+    }
+    if(getRootHistType(key.className) > 0){
+      success = addRootHistKey(&key,keys,numKeys);
+    }else if((strcmp(key.className,"TDirectoryFile")==0)||(strcmp(key.className,"TDirectory")==0)){
+      //subdirectory, stored (uncompressed) as a version, creation and modification times,
+      //sizes of the key list and name, and positions of the directory, its parent, and its key list
+      unsigned char dirBuf[42];
+      if(readRootBytes(fd,key.seekKey + key.keyLen,sizeof(dirBuf),dirBuf)){
+        root_buf db = {dirBuf,sizeof(dirBuf),0,0};
+        unsigned short version = getRootU16(&db);
+        db.pos += 16;
+        long long int subSeekKeys;
+        if(version > 1000){
+          db.pos += 16;
+          subSeekKeys = (long long int)getRootU64(&db);
+        }else{
+          db.pos += 8;
+          subSeekKeys = (long long int)getRootU32(&db);
+        }
+        if(readRootDirectory(fd,subSeekKeys,depth+1,keys,numKeys)==0){
+          printf("WARNING: cannot read ROOT directory %s, skipping.\n",key.name);
+        }
+      }
+    }
+  }
+  free(keysBuf);
+  return success;
+}
+
+//list the histograms in an open ROOT file, without reading them
+//keys is set to an array (which should be freed) of the keys of the histograms found
+//returns the number of histograms found, or -1 if the file isn't a valid ROOT file
+int listRootHistKeys(const int fd, root_key **keys){
+  unsigned char hdr[64];
+  *keys = NULL;
+  int numKeys = 0;
+  if(readRootBytes(fd,0,sizeof(hdr),hdr)==0){
+    return -1;
+  }
+  if(memcmp(hdr,"root",4)!=0){
+    return -1;
+  }
+  //file header: version, start of the top directory, end of the file, free segment position and size,
+  //number of free segments, size of the top directory's key and name
+  root_buf b = {hdr,sizeof(hdr),4,0};
+  unsigned int version = getRootU32(&b);
+  long long int begin = (long long int)getRootU32(&b);
+  b.pos += (version >= 1000000) ? 16 : 8; //64-bit positions in large files
+  b.pos += 8;
+  long long int nbytesName = (long long int)getRootU32(&b);
+  if(b.err){
+    return -1;
+  }
+  //top directory, see readRootDirectory for its layout
+  unsigned char dirBuf[42];
+  if(readRootBytes(fd,begin + nbytesName,sizeof(dirBuf),dirBuf)==0){
+    return -1;
+  }
+  b.data = dirBuf;
+  b.length = sizeof(dirBuf);
+  b.pos = 0;
+  unsigned short dirVersion = getRootU16(&b);
+  b.pos += 16;
+  long long int seekKeys;
+  if(dirVersion > 1000){
+    b.pos += 16;
+    seekKeys = (long long int)getRootU64(&b);
+  }else{
+    b.pos += 8;
+    seekKeys = (long long int)getRootU32(&b);
+  }
+  if(readRootDirectory(fd,seekKeys,0,keys,&numKeys)==0){
+    free(*keys);
+    *keys = NULL;
+    return -1;
+  }
+  return numKeys;
+}
+
+//read and decompress the object data of a key
+//returns the data (objLen bytes, to be freed), or NULL on failure
+unsigned char *readRootObject(const int fd, const root_key *key){
+  struct stat st;
+  size_t dataLen = (size_t)(key->nbytes - key->keyLen);
+  size_t objLen = (size_t)key->objLen;
+  //check the sizes against the file before allocating, so that a corrupt key can't ask for huge allocations
+  if(fstat(fd,&st) != 0){
+    return NULL;
+  }
+  if((long long int)key->seekKey + (long long int)key->nbytes > (long long int)st.st_size){
+    return NULL; //object data runs past the end of the file
+  }
+  if(objLen > dataLen*ROOT_MAX_ZLIB_RATIO){
+    return NULL; //more data than can be decompressed from the object
+  }
+  unsigned char *obj = malloc(objLen > 0 ? objLen : 1);
+  if(obj == NULL){
+    return NULL;
+  }
+  if(dataLen == objLen){
+    //uncompressed
+    if(readRootBytes(fd,key->seekKey + key->keyLen,dataLen,obj)==0){
+      free(obj);
+      return NULL;
+    }
+    return obj;
+  }
+  unsigned char *data = malloc(dataLen > 0 ? dataLen : 1);
+  if(data == NULL){
+    free(obj);
+    return NULL;
+  }
+  if(readRootBytes(fd,key->seekKey + key->keyLen,dataLen,data)==0){
+    free(data);
+    free(obj);
+    return NULL;
+  }
+  //decompress each block
+  size_t inPos = 0, outPos = 0;
+  while(outPos < objLen){
+    if(dataLen - inPos < 9){
+      break;
+    }
+    const unsigned char *blk = &data[inPos];
+    size_t compLen = (size_t)blk[3] | ((size_t)blk[4] << 8) | ((size_t)blk[5] << 16);
+    size_t uncompLen = (size_t)blk[6] | ((size_t)blk[7] << 8) | ((size_t)blk[8] << 16);
+    if((blk[0] != 'Z')||(blk[1] != 'L')){
+      printf("ERROR: unsupported compression algorithm (%c%c) for ROOT object %s, only zlib is supported.\n",isprint(blk[0]) ? blk[0] : '?',isprint(blk[1]) ? blk[1] : '?',key->name);
+      break;
+    }
+    if((compLen > dataLen - inPos - 9)||(uncompLen > objLen - outPos)){
+      break;
+    }
+    uLongf destLen = (uLongf)uncompLen;
+    if((uncompress(&obj[outPos],&destLen,&blk[9],(uLong)compLen) != Z_OK)||(destLen != uncompLen)){
+      break;
+    }
+    inPos += 9 + compLen;
+    outPos += uncompLen;
+  }
+  free(data);
+  if(outPos != objLen){
+    free(obj);
+    return NULL;
+  }
+  return obj;
+}
+
+//find the bin contents in a histogram object, setting b to the position of the first bin
+//returns the number of bins (including under/overflow), or -1 if the object is invalid
+int getRootHistNumBins(root_buf *b, const int histType){
+  static const size_t valSize[6] = {0,8,4,4,2,1};
+  unsigned int byteCount = getRootU32(b);
+  getRootU16(b); //version
+  if((byteCount & ROOT_BYTECOUNT_MASK)==0){
+    return -1; //streamed without byte counts by an old version of ROOT
+  }
+  //skip the TH1 base class, using its byte count
+  byteCount = getRootU32(b);
+  if(((byteCount & ROOT_BYTECOUNT_MASK)==0)||(b->err)){
+    return -1;
+  }
+  byteCount &= ~(unsigned int)ROOT_BYTECOUNT_MASK;
+  if(byteCount > b->length - b->pos){
+    return -1;
+  }
+  b->pos += byteCount;
+  //bin contents
+  int numBins = (int)getRootU32(b);
+  if((b->err)||(numBins < 0)||(histType < 1)||(histType > 5)||((size_t)numBins > (b->length - b->pos)/valSize[histType])){
+    return -1;
+  }
+  return numBins;
+}
+
+//read numCh bin values of a histogram, starting at the position found by getRootHistNumBins
+void getRootHistBins(root_buf *b, const int histType, double *out, const int numCh){
+  int i;
+  for(i=0;i<numCh;i++){
+    switch(histType){
+      case 1:
+        {
+          long long unsigned int bits = getRootU64(b);
+          double val;
+          memcpy(&val,&bits,sizeof(double));
+          out[i] = val;
+        }
+        break;
+      case 2:
+        {
+          unsigned int bits = getRootU32(b);
+          float val;
+          memcpy(&val,&bits,sizeof(float));
+          out[i] = (double)val;
+        }
+        break;
+      case 3:
+        out[i] = (double)(int)getRootU32(b);
+        break;
+      case 4:
+        out[i] = (double)(short)getRootU16(b);
+        break;
+      case 5:
+      default:
+        out[i] = (double)(signed char)getRootU8(b);
+        break;
+    }
+  }
+}
+
+//print a list of the histograms in a ROOT file, without reading them
+//returns the number of histograms found, or -1 if the file can't be read
+int listROOTHistograms(const char *filename){
+  int i;
+  int fd = open(filename,O_RDONLY);
+  if(fd < 0){
+    printf("ERROR: Cannot open the input file: %s\n", filename);
+    return -1;
+  }
+  root_key *keys;
+  int numKeys = listRootHistKeys(fd,&keys);
+  close(fd);
+  if(numKeys < 0){
+    printf("ERROR: %s is not a valid ROOT file.\n", filename);
+    return -1;
+  }
+  printf("%s: %i histogram(s)\n",filename,numKeys);
+  for(i=0;i<numKeys;i++){
+    printf("  %-6s %s;%i \"%s\"\n",keys[i].className,keys[i].name,keys[i].cycle,keys[i].title);
+  }
+  free(keys);
+  return numKeys;
+}
+
+//function reads the 1-D histograms in a binary .root file into imported data (see spectrum_import.c) and returns the number of spectra read in
+int readROOTFile(const char *filename, import_data *imp)
+{
+  int i;
+  int fd = open(filename,O_RDONLY);
+  if(fd < 0){
+    printf("ERROR: Cannot open the input file: %s\n", filename);
+    printf("Check that the file exists.\n");
+    return 0;
+  }
+  root_key *keys;
+  int numKeys = listRootHistKeys(fd,&keys);
+  if(numKeys < 0){
+    printf("ERROR: %s is not a valid ROOT file.\n", filename);
+    close(fd);
+    return 0;
+  }
+  if(numKeys == 0){
+    printf("ERROR: No 1-D histograms (TH1D, TH1F, TH1I, TH1S, or TH1C) found in file: %s\n", filename);
+    close(fd);
+    free(keys);
+    return 0;
+  }
+  if(numKeys >= NSPECT){
+    printf("Cannot open file %s, number of spectra would exceed maximum!\n", filename);
+    close(fd);
+    free(keys);
+    return -1;
+  }
+
+  int numSpec = 0;
+  for(i=0;i<numKeys;i++){
+    unsigned char *obj = readRootObject(fd,&keys[i]);
+    if(obj == NULL){
+      printf("WARNING: cannot read histogram %s from file %s, skipping.\n",keys[i].name,filename);
+      continue;
+    }
+    int histType = getRootHistType(keys[i].className);
+    root_buf b = {obj,(size_t)keys[i].objLen,0,0};
+    int numBins = getRootHistNumBins(&b,histType);
+    if(numBins < 0){
+      printf("WARNING: invalid histogram %s in file %s, skipping.\n",keys[i].name,filename);
+      free(obj);
+      continue;
+    }
+    int numCh = (numBins > 0) ? numBins - 1 : 0; //bin n goes in channel n, dropping the overflow bin
+    if(numCh > S32K){
+      printf("WARNING: histogram %s has %i bins, only the first %i will be read.\n",keys[i].name,numBins-2,S32K-1);
+      numCh = S32K;
+    }
+    double *outHist = allocImportSpectrum(imp,numSpec,numCh);
+    if((outHist == NULL)&&(numCh > 0)){
+      free(obj);
+      break;
+    }
+    getRootHistBins(&b,histType,outHist,numCh);
+    free(obj);
+    snprintf(getImportTitle(imp,numSpec),256,"%s",(keys[i].title[0] != '\0') ? keys[i].title : keys[i].name);
+    numSpec++;
+  }
+  close(fd);
+  free(keys);
+
+  imp->numSp = numSpec; //drop any spectra left over from skipped histograms
+  if(numSpec == 0){
+    printf("ERROR: Cannot read any histograms from file: %s\n", filename);
+  }
+  return numSpec;
+}
@@ -0,0 +1,182 @@
+/* J. Williams, 2020-2021 */
+
+//This file contains the codecs used to store spectrum data in .jf3 files
+//(format version 3 and up, see write_data.c).  Each spectrum is stored as
+//a single block, covering the channels up to the last non-empty one:
+//
+//codec 0: empty spectrum, no data
+//codec 1: integer-valued data, stored as the difference from the previous
+//         channel, zigzag encoded (so that small negative differences are
+//         small numbers) and written as a variable length integer (7 bits
+//         per byte, high bit set on all but the last byte)
+//codec 2: raw 32-bit floats, for data which is exactly representable as floats
+//codec 3: raw 64-bit doubles, for anything else
+//codec 4: run-length encoded floats, as used in version 2 .jf3 files (only
+//         decoded, not written): packets of a header (signed char) n and
+//         32-bit floats, n>0 repeats the following value n times, n<0 is
+//         followed by -n values, and n=0 is followed by the final value
+//
+//Counts in gamma-ray spectra change slowly from channel to channel, so
+//most channels take a single byte with codec 1.  These routines don't
+//touch any global data, so they can be used from any thread.
+
+#define JF3_MAX_VARINT_BYTES 10 //maximum number of bytes in an encoded 64-bit value
+
+//get the codec to use for numCh channels of spectrum data
+unsigned char getSpectrumCodec(const double *data, const int numCh){
+  int i;
+  unsigned char codec = 1;
+  if(numCh <= 0){
+    return 0;
+  }
+  for(i=0;i<numCh;i++){
+    double val = data[i];
+    if(codec == 1){
+      if((fabs(val) < 4.5E15)&&(val == (double)(long long int)val)){
+        continue; //integer-valued, and differences fit in 64 bits
+      }
+      codec = 2;
+    }
+    if((double)(float)val != val){
+      return 3;
+    }
+  }
+  return codec;
+}
+
+//get the maximum number of bytes needed to store numCh channels with a codec
+size_t getMaxEncodedSpectrumLength(const int numCh, const unsigned char codec){
+  switch(codec){
+    case 1:
+      return (size_t)numCh*JF3_MAX_VARINT_BYTES;
+    case 2:
+      return (size_t)numCh*sizeof(float);
+    case 3:
+      return (size_t)numCh*sizeof(double);
+    case 4:
+      return (size_t)numCh*(1+sizeof(float));
+    case 0:
+    default:
+      return 0;
+  }
+}
+
+//encode numCh channels of spectrum data using a codec (see getSpectrumCodec),
+//out must have space for getMaxEncodedSpectrumLength bytes, codec 4 can't be written
+//returns the number of bytes written to out
+size_t encodeSpectrum(const double *data, const int numCh, const unsigned char codec, unsigned char *out){
+  int i;
+  size_t len = 0;
+  switch(codec){
+    case 1:
+      {
+        long long int prev = 0;
+        for(i=0;i<numCh;i++){
+          long long int cur = (long long int)data[i];
+          long long int diff = cur - prev;
+          long long unsigned int zz = ((long long unsigned int)diff << 1) ^ (long long unsigned int)(diff >> 63);
+          while(zz >= 0x80){
+            out[len++] = (unsigned char)(zz | 0x80);
+            zz >>= 7;
+          }
+          out[len++] = (unsigned char)zz;
+          prev = cur;
+        }
+      }
+      break;
+    case 2:
+      for(i=0;i<numCh;i++){
+        float val = (float)data[i];
+        memcpy(&out[len],&val,sizeof(float));
+        len += sizeof(float);
+      }
+      break;
+    case 3:
+      memcpy(out,data,(size_t)numCh*sizeof(double));
+      len = (size_t)numCh*sizeof(double);
+      break;
+    case 0:
+    default:
+      break;
+  }
+  return len;
+}
+
+//decode numCh channels of spectrum data from inLen bytes encoded with a codec
+//returns 1 on success, 0 if the encoded data is invalid
+int decodeSpectrum(const unsigned char *in, const size_t inLen, const unsigned char codec, double *out, const int numCh){
+  int i;
+  size_t pos = 0;
+  switch(codec){
+    case 1:
+      {
+        long long int prev = 0;
+        for(i=0;i<numCh;i++){
+          long long unsigned int zz = 0;
+          int shift = 0;
+          while(1){
+            if((pos >= inLen)||(shift > 63)){
+              return 0;
+            }
+            unsigned char b = in[pos++];
+            zz |= (long long unsigned int)(b & 0x7F) << shift;
+            if((b & 0x80) == 0){
+              break;
+            }
+            shift += 7;
+          }
+          long long int diff = (long long int)(zz >> 1) ^ -(long long int)(zz & 1);
+          prev = (long long int)((long long unsigned int)prev + (long long unsigned int)diff); //wraps rather than overflowing on invalid data
+          out[i] = (double)prev;
+        }
+      }
+      return (pos == inLen);
+    case 2:
+      if(inLen != (size_t)numCh*sizeof(float)){
+        return 0;
+      }
+      for(i=0;i<numCh;i++){
+        float val;
+        memcpy(&val,&in[(size_t)i*sizeof(float)],sizeof(float));
+        out[i] = (double)val;
+      }
+      return 1;
+    case 3:
+      if(inLen != (size_t)numCh*sizeof(double)){
+        return 0;
+      }
+      memcpy(out,in,inLen);
+      return 1;
+    case 4:
+      i = 0;
+      while(1){
+        if(pos >= inLen){
+          return 0;
+        }
+        int hdr = (signed char)in[pos++];
+        int numVals = (hdr < 0) ? -hdr : 1;
+        int numCopies = (hdr > 0) ? hdr : 1;
+        if(((inLen - pos) < (size_t)numVals*sizeof(float))||((numCh - i) < numVals*numCopies)){
+          return 0;
+        }
+        int j;
+        for(j=0;j<numVals;j++){
+          float val;
+          memcpy(&val,&in[pos],sizeof(float));
+          pos += sizeof(float);
+          int k;
+          for(k=0;k<numCopies;k++){
+            out[i++] = (double)val;
+          }
+        }
+        if(hdr == 0){
+          break; //final packet
+        }
+      }
+      return ((pos == inLen)&&(i == numCh));
+    case 0:
+      return (numCh == 0);
+    default:
+      return 0;
+  }
+}
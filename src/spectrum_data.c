@@ -8,10 +8,11 @@ int getFirstViewDependingOnSp(const int spInd){
   if((spInd<0)||(spInd>=rawdata.numSpOpened)){
     return -1;
   }
+  int spHandle = getSpHandle(spInd);
   int i,j;
   for(i=0;i<rawdata.numViews;i++){
     for(j=0;j<rawdata.viewNumMultiplotSp[i];j++){
-      if(rawdata.viewMultiPlots[i][j] == spInd){
+      if(rawdata.viewMultiPlots[i][j] == spHandle){
         return i;
       }
     }
@@ -19,6 +20,91 @@ int getFirstViewDependingOnSp(const int spInd){
   return -1;
 }
 
+//save the currently displayed spectra and their scaling as the view at index viewInd
+void setViewFromDrawing(const int viewInd){
+  if((viewInd<0)||(viewInd>=MAXNVIEWS)){
+    return;
+  }
+  int i;
+  rawdata.metaGeneration++;
+  rawdata.viewMultiplotMode[viewInd] = drawing.multiplotMode;
+  rawdata.viewNumMultiplotSp[viewInd] = drawing.numMultiplotSp;
+  for(i=0;i<drawing.numMultiplotSp;i++){
+    rawdata.viewMultiPlots[viewInd][i] = getSpHandle(drawing.multiPlots[i]);
+    rawdata.viewScaleFactor[viewInd][i] = drawing.scaleFactor[drawing.multiPlots[i]];
+  }
+}
+
+//display the spectra in the view at index viewInd, with the scaling saved in the view
+void setDrawingFromView(const int viewInd){
+  if((viewInd<0)||(viewInd>=rawdata.numViews)){
+    return;
+  }
+  int i,spInd;
+  drawing.multiplotMode = rawdata.viewMultiplotMode[viewInd];
+  drawing.numMultiplotSp = 0;
+  for(i=0;i<rawdata.viewNumMultiplotSp[viewInd];i++){
+    spInd = getSpIndexFromHandle(rawdata.viewMultiPlots[viewInd][i]);
+    if((spInd>=0)&&(spInd<rawdata.numSpOpened)){
+      drawing.multiPlots[drawing.numMultiplotSp] = spInd;
+      drawing.scaleFactor[spInd] = rawdata.viewScaleFactor[viewInd][i];
+      drawing.numMultiplotSp++;
+    }
+  }
+  if(drawing.numMultiplotSp == 0){
+    //no valid spectra in view, fall back to the first spectrum
+    drawing.multiPlots[0] = 0;
+    drawing.numMultiplotSp = 1;
+  }
+}
+
+//delete the view at index viewInd, along with its comments
+void deleteView(const int viewInd){
+  int i;
+  if((viewInd<0)||(viewInd>=rawdata.numViews)){
+    return;
+  }
+  rawdata.metaGeneration++;
+
+  //delete comments associated with the view
+  deleteViewComments(viewInd,rawdata.numViews); //see comment_store.c
+
+  //delete view
+  for(i=viewInd;i<(rawdata.numViews-1);i++){
+    memcpy(&rawdata.viewComment[i],&rawdata.viewComment[i+1],sizeof(rawdata.viewComment[i]));
+    memcpy(&rawdata.viewMultiplotMode[i],&rawdata.viewMultiplotMode[i+1],sizeof(rawdata.viewMultiplotMode[i]));
+    memcpy(&rawdata.viewNumMultiplotSp[i],&rawdata.viewNumMultiplotSp[i+1],sizeof(rawdata.viewNumMultiplotSp[i]));
+    memcpy(&rawdata.viewScaleFactor[i],&rawdata.viewScaleFactor[i+1],sizeof(rawdata.viewScaleFactor[i]));
+    memcpy(&rawdata.viewMultiPlots[i],&rawdata.viewMultiPlots[i+1],sizeof(rawdata.viewMultiPlots[i]));
+  }
+  rawdata.numViews = (unsigned char)(rawdata.numViews-1);
+}
+
+//remove the spectrum with handle spHandle from all views, before the handle
+//is released (otherwise it could be reused for an unrelated spectrum),
+//views left without any spectra are deleted
+void removeSpFromViews(const int spHandle){
+  int i,j,k;
+  if(spHandle < 0){
+    return;
+  }
+  for(i=rawdata.numViews-1;i>=0;i--){
+    for(j=rawdata.viewNumMultiplotSp[i]-1;j>=0;j--){
+      if(rawdata.viewMultiPlots[i][j] == spHandle){
+        for(k=j;k<(rawdata.viewNumMultiplotSp[i]-1);k++){
+          rawdata.viewMultiPlots[i][k] = rawdata.viewMultiPlots[i][k+1];
+          rawdata.viewScaleFactor[i][k] = rawdata.viewScaleFactor[i][k+1];
+        }
+        rawdata.viewNumMultiplotSp[i]--;
+        rawdata.metaGeneration++;
+      }
+    }
+    if(rawdata.viewNumMultiplotSp[i] <= 0){
+      deleteView(i);
+    }
+  }
+}
+
 void deleteSpectrumOrView(const int spInd){
   
   //printf("deleting spectrum %i\n",spInd);
@@ -27,28 +113,22 @@ void deleteSpectrumOrView(const int spInd){
     return;
   }
 
-  int i,j;
+  int i;
+  rawdata.metaGeneration++; //titles and views change
 
   if(spInd<rawdata.numSpOpened){
     //deleting spectrum data
+    int spHandle = getSpHandle(spInd);
+
+    //delete comments (comments on other spectra refer to them by handle, so don't need to change)
+    deleteCommentsOn(0,spHandle); //see comment_store.c
 
-    //delete comments
-    for(i=0;i<rawdata.numChComments;i++){
-      if(rawdata.chanCommentView[i] == 0){
-        if(rawdata.chanCommentSp[i] == spInd){
-          //delete the comment
-          for(j=i;j<(rawdata.numChComments-1);j++){
-            memcpy(&rawdata.chanComment[j],&rawdata.chanComment[j+1],sizeof(rawdata.chanComment[j]));
-            memcpy(&rawdata.chanCommentView[j],&rawdata.chanCommentView[j+1],sizeof(rawdata.chanCommentView[j]));
-            memcpy(&rawdata.chanCommentSp[j],&rawdata.chanCommentSp[j+1],sizeof(rawdata.chanCommentSp[j]));
-            memcpy(&rawdata.chanCommentCh[j],&rawdata.chanCommentCh[j+1],sizeof(rawdata.chanCommentCh[j]));
-            memcpy(&rawdata.chanCommentVal[j],&rawdata.chanCommentVal[j+1],sizeof(rawdata.chanCommentVal[j]));
-          }
-          rawdata.numChComments -= 1;
-          i -= 1; //indices have shifted, reheck the current index
-        }else if(rawdata.chanCommentSp[i] > spInd){
-          //change to the new index for the spectrum
-          rawdata.chanCommentSp[i] = (unsigned char)(rawdata.chanCommentSp[i]-1);
+    //stop following the spectrum for changes in its file (the handle may be reused), see follow.c
+    for(i=0;i<followstate.numFiles;i++){
+      int j;
+      for(j=0;j<followstate.file[i].numSp;j++){
+        if(followstate.file[i].spHandle[j] == spHandle){
+          followstate.file[i].spHandle[j] = -1;
         }
       }
     }
@@ -58,63 +138,19 @@ void deleteSpectrumOrView(const int spInd){
     while(deletingViews){
       int viewToDel = getFirstViewDependingOnSp(spInd);
       if(viewToDel >= 0){
-
-        //delete comments associated with the view
-        for(i=0;i<rawdata.numChComments;i++){
-          if(rawdata.chanCommentView[i] == 1){
-            if(rawdata.chanCommentSp[i] == viewToDel){
-              //delete the comment
-              for(j=i;j<(rawdata.numChComments-1);j++){
-                memcpy(&rawdata.chanComment[j],&rawdata.chanComment[j+1],sizeof(rawdata.chanComment[j]));
-                memcpy(&rawdata.chanCommentView[j],&rawdata.chanCommentView[j+1],sizeof(rawdata.chanCommentView[j]));
-                memcpy(&rawdata.chanCommentSp[j],&rawdata.chanCommentSp[j+1],sizeof(rawdata.chanCommentSp[j]));
-                memcpy(&rawdata.chanCommentCh[j],&rawdata.chanCommentCh[j+1],sizeof(rawdata.chanCommentCh[j]));
-                memcpy(&rawdata.chanCommentVal[j],&rawdata.chanCommentVal[j+1],sizeof(rawdata.chanCommentVal[j]));
-              }
-              rawdata.numChComments -= 1;
-              i -= 1; //indices have shifted, reheck the current index
-            }else if(rawdata.chanCommentSp[i] > viewToDel){
-              //change to the new index for the view
-              rawdata.chanCommentSp[i] = (unsigned char)(rawdata.chanCommentSp[i]-1);
-            }
-          }
-        }
-
-        //delete view
-        for(i=viewToDel;i<(rawdata.numViews-1);i++){
-          memcpy(&rawdata.viewComment[i],&rawdata.viewComment[i+1],sizeof(rawdata.viewComment[i]));
-          memcpy(&rawdata.viewMultiplotMode[i],&rawdata.viewMultiplotMode[i+1],sizeof(rawdata.viewMultiplotMode[i]));
-          memcpy(&rawdata.viewNumMultiplotSp[i],&rawdata.viewNumMultiplotSp[i+1],sizeof(rawdata.viewNumMultiplotSp[i]));
-          memcpy(&rawdata.viewScaleFactor[i],&rawdata.viewScaleFactor[i+1],sizeof(rawdata.viewScaleFactor[i]));
-          memcpy(&rawdata.viewMultiPlots[i],&rawdata.viewMultiPlots[i+1],sizeof(rawdata.viewMultiPlots[i]));
-        }
-        if(rawdata.numViews > 0){
-          rawdata.numViews = (unsigned char)(rawdata.numViews-1);
-        }
+        deleteView(viewToDel);
       }else{
         deletingViews = 0;
       }
     }
 
-    //realign view data so that it still points to the proper spectra
-    for(i=0;i<rawdata.numViews;i++){
-      for(j=0;j<rawdata.viewNumMultiplotSp[i];j++){
-        if(rawdata.viewMultiPlots[i][j] > spInd){
-          rawdata.viewMultiPlots[i][j] = (unsigned char)(rawdata.viewMultiPlots[i][j]-1);
-        }
-      }
-      for(j=spInd;j<(rawdata.numSpOpened-1);j++){
-        rawdata.viewScaleFactor[i][j]=rawdata.viewScaleFactor[i][j+1];
-      }
-    }
-
-    //delete spectrum data
+    //delete spectrum data (views refer to spectra by handle, so don't need to be realigned)
+    removeSpectrumFromStore(spInd,rawdata.numSpOpened);
     for(i=spInd;i<(rawdata.numSpOpened-1);i++){
-      memcpy(&rawdata.hist[i],&rawdata.hist[i+1],sizeof(rawdata.hist[i]));
       memcpy(&rawdata.histComment[i],&rawdata.histComment[i+1],sizeof(rawdata.histComment[i]));
     }
     if(rawdata.numSpOpened > 0){
-      rawdata.numSpOpened = (unsigned char)(rawdata.numSpOpened-1);
+      rawdata.numSpOpened = rawdata.numSpOpened-1;
     }
     if(rawdata.numSpOpened == 0){
       rawdata.openedSp = 0;
@@ -124,39 +160,7 @@ void deleteSpectrumOrView(const int spInd){
     //deleting view
 
     int viewInd = spInd - rawdata.numSpOpened;
-
-    //delete comments associated with the view
-    for(i=0;i<rawdata.numChComments;i++){
-      if(rawdata.chanCommentView[i] == 1){
-        if(rawdata.chanCommentSp[i] == viewInd){
-          //delete the comment
-          for(j=i;j<(rawdata.numChComments-1);j++){
-            memcpy(&rawdata.chanComment[j],&rawdata.chanComment[j+1],sizeof(rawdata.chanComment[j]));
-            memcpy(&rawdata.chanCommentView[j],&rawdata.chanCommentView[j+1],sizeof(rawdata.chanCommentView[j]));
-            memcpy(&rawdata.chanCommentSp[j],&rawdata.chanCommentSp[j+1],sizeof(rawdata.chanCommentSp[j]));
-            memcpy(&rawdata.chanCommentCh[j],&rawdata.chanCommentCh[j+1],sizeof(rawdata.chanCommentCh[j]));
-            memcpy(&rawdata.chanCommentVal[j],&rawdata.chanCommentVal[j+1],sizeof(rawdata.chanCommentVal[j]));
-          }
-          rawdata.numChComments -= 1;
-          i -= 1; //indices have shifted, reheck the current index
-        }else if(rawdata.chanCommentSp[i] > viewInd){
-          //change to the new index for the view
-          rawdata.chanCommentSp[i] = (unsigned char)(rawdata.chanCommentSp[i]-1);
-        }
-      }
-    }
-
-    //delete view
-    for(i=viewInd;i<(rawdata.numViews-1);i++){
-      memcpy(&rawdata.viewComment[i],&rawdata.viewComment[i+1],sizeof(rawdata.viewComment[i]));
-      memcpy(&rawdata.viewMultiplotMode[i],&rawdata.viewMultiplotMode[i+1],sizeof(rawdata.viewMultiplotMode[i]));
-      memcpy(&rawdata.viewNumMultiplotSp[i],&rawdata.viewNumMultiplotSp[i+1],sizeof(rawdata.viewNumMultiplotSp[i]));
-      memcpy(&rawdata.viewScaleFactor[i],&rawdata.viewScaleFactor[i+1],sizeof(rawdata.viewScaleFactor[i]));
-      memcpy(&rawdata.viewMultiPlots[i],&rawdata.viewMultiPlots[i+1],sizeof(rawdata.viewMultiPlots[i]));
-    }
-    if(rawdata.numViews > 0){
-      rawdata.numViews = (unsigned char)(rawdata.numViews-1);
-    }
+    deleteView(viewInd);
 
   }
 
@@ -169,12 +173,10 @@ int getFirstNonemptySpectrum(const int numSpOpened){
   if(numSpOpened>=NSPECT){
     return -1;
   }
-  int i,j;
+  int i;
   for(i=0;i<numSpOpened;i++){
-    for(j=0;j<S32K;j++){
-      if(rawdata.hist[i][j]!=0.0){
-        return i;
-      }
+    if(!isSpectrumEmpty(i)){
+      return i;
     }
   }
   return -1;
@@ -202,20 +204,93 @@ double getCalWidth(const double val){
 }
 
 //lower level spectrum data access routine which takes rebinning into account
+//(contracted bins are taken from the cumulative sums, see spectrum_store.c)
 float getSpBinValRaw(const int spNumRaw, const int bin, const double scaleFactor, const int contractFactor){
 
-  if(spNumRaw >= NSPECT){
+  if((spNumRaw >= NSPECT)||(spNumRaw < 0)){
     return 0;
   }
 
+  return (float)(scaleFactor*getSpectrumRangeSum(spNumRaw,bin,bin+contractFactor));
+}
+
+//check whether the cached displayed spectrum values are up to date
+//with the current display parameters and spectrum data
+int isDispBufCurrent(){
+  if(!dispbuf.valid){
+    return 0;
+  }
+  if((dispbuf.multiplotMode != drawing.multiplotMode)||(dispbuf.numMultiplotSp != drawing.numMultiplotSp)||(dispbuf.contractFactor != drawing.contractFactor)||(dispbuf.storeGeneration != spstore.generation)){
+    return 0;
+  }
   int i;
-  float val = 0.;
-  for(i=0;i<contractFactor;i++){
-    if((bin+i) < S32K){
-      val += (float)(scaleFactor*rawdata.hist[spNumRaw][bin+i]);
+  for(i=0;i<drawing.numMultiplotSp;i++){
+    if(dispbuf.multiPlots[i] != drawing.multiPlots[i]){
+      return 0;
+    }
+    if(dispbuf.scaleFactor[i] != drawing.scaleFactor[drawing.multiPlots[i]]){
+      return 0;
     }
   }
-  return val;
+  return 1;
+}
+
+//rebuild the cached displayed spectrum values if the display parameters
+//(selected spectra, scaling, contraction) or spectrum data have changed,
+//should be called from the main thread before drawing or fitting
+void updateDispBuf(){
+
+  if(isDispBufCurrent()){
+    return;
+  }
+
+  dispbuf.valid = 0;
+  if((drawing.numMultiplotSp <= 0)||(drawing.numMultiplotSp > NSPECT)||(drawing.contractFactor <= 0)){
+    return;
+  }
+  if((drawing.multiplotMode != 1)&&(drawing.numMultiplotSp > MAX_DISP_SP)){
+    return;
+  }
+
+  int i;
+  double sf;
+  dispbuf.multiplotMode = drawing.multiplotMode;
+  dispbuf.numMultiplotSp = drawing.numMultiplotSp;
+  dispbuf.contractFactor = drawing.contractFactor;
+  dispbuf.storeGeneration = spstore.generation;
+  for(i=0;i<drawing.numMultiplotSp;i++){
+    dispbuf.multiPlots[i] = drawing.multiPlots[i];
+    dispbuf.scaleFactor[i] = drawing.scaleFactor[drawing.multiPlots[i]];
+  }
+
+  switch(drawing.multiplotMode){
+    case 1:
+      //sum spectra
+      memset(dispbuf.val[0],0,sizeof(dispbuf.val[0]));
+      memset(dispbuf.weight,0,sizeof(dispbuf.weight));
+      for(i=0;i<drawing.numMultiplotSp;i++){
+        sf = dispbuf.scaleFactor[i];
+        getSpectrumWindowSums(drawing.multiPlots[i],dispbuf.val[0],S32K,drawing.contractFactor,sf,0,1);
+        getSpectrumWindowSums(drawing.multiPlots[i],dispbuf.weight,S32K,drawing.contractFactor,sf*sf,1,1);
+      }
+      break;
+    case 4:
+      //stacked
+    case 3:
+      //overlay (independent scaling)
+    case 2:
+      //overlay (common scaling)
+    case 0:
+      //no multiplot
+      for(i=0;i<drawing.numMultiplotSp;i++){
+        getSpectrumWindowSums(drawing.multiPlots[i],dispbuf.val[i],S32K,drawing.contractFactor,dispbuf.scaleFactor[i],0,0);
+      }
+      break;
+    default:
+      return;
+  }
+
+  dispbuf.valid = 1;
 }
 
 //if getWeight is set, will return weight values for fitting
@@ -226,21 +301,30 @@ float getSpBinValOrWeight(const int dispSpNum, const int bin, const int getWeigh
     return 0;
   }
 
-  int j,k;
+  //use cached values where available (see updateDispBuf)
+  if((dispbuf.valid)&&(bin >= 0)&&(bin < S32K)){
+    if(drawing.multiplotMode == 1){
+      if(getWeight){
+        return dispbuf.weight[bin];
+      }
+      return dispbuf.val[0][bin];
+    }
+    return dispbuf.val[dispSpNum][bin];
+  }
+
+  int k;
   float val = 0.;
 
   switch(drawing.multiplotMode){
     case 1:
       //sum spectra
-      for(j=0;j<drawing.contractFactor;j++){
-        if(getWeight){
-          for(k=0;k<drawing.numMultiplotSp;k++){
-            val += (float)(drawing.scaleFactor[drawing.multiPlots[k]]*drawing.scaleFactor[drawing.multiPlots[k]]*fabs(rawdata.hist[drawing.multiPlots[k]][bin+j]));
-          }
-        }else{
-          for(k=0;k<drawing.numMultiplotSp;k++){
-            val += (float)(drawing.scaleFactor[drawing.multiPlots[k]]*rawdata.hist[drawing.multiPlots[k]][bin+j]);
-          }
+      if(getWeight){
+        for(k=0;k<drawing.numMultiplotSp;k++){
+          val += (float)(drawing.scaleFactor[drawing.multiPlots[k]]*drawing.scaleFactor[drawing.multiPlots[k]]*getSpectrumRangeAbsSum(drawing.multiPlots[k],bin,bin+drawing.contractFactor));
+        }
+      }else{
+        for(k=0;k<drawing.numMultiplotSp;k++){
+          val += (float)(drawing.scaleFactor[drawing.multiPlots[k]]*getSpectrumRangeSum(drawing.multiPlots[k],bin,bin+drawing.contractFactor));
         }
       }
       break;
@@ -268,6 +352,49 @@ float getSpBinValOrWeight(const int dispSpNum, const int bin, const int getWeigh
 float getDispSpBinVal(const int dispSpNum, const int bin){
   return getSpBinValOrWeight(dispSpNum,drawing.lowerLimit+bin,0);
 }
+//get the minimum and maximum values of the displayed spectrum over bins
+//startBin to endBin-1, in the same units as getDispSpBinVal
+//minVal and maxVal are only changed if the range contains values beyond them
+void getDispSpMinMax(const int dispSpNum, const int startBin, const int endBin, float *minVal, float *maxVal){
+  if((dispSpNum >= drawing.numMultiplotSp)||(dispSpNum < 0)){
+    return;
+  }
+  if((drawing.contractFactor <= 1)&&(drawing.multiplotMode != 1)){
+    //uncontracted single spectrum, use the min/max pyramid
+    float spMin = (float)BIG_NUMBER;
+    float spMax = (float)SMALL_NUMBER;
+    getSpectrumRangeMinMax(drawing.multiPlots[dispSpNum],drawing.lowerLimit+startBin,drawing.lowerLimit+endBin,&spMin,&spMax);
+    if(spMin > spMax){
+      return; //empty range
+    }
+    double sf = drawing.scaleFactor[drawing.multiPlots[dispSpNum]];
+    float scaledMin = (float)(sf*spMin);
+    float scaledMax = (float)(sf*spMax);
+    if(sf < 0.){
+      scaledMin = (float)(sf*spMax);
+      scaledMax = (float)(sf*spMin);
+    }
+    if(scaledMin < *minVal){
+      *minVal = scaledMin;
+    }
+    if(scaledMax > *maxVal){
+      *maxVal = scaledMax;
+    }
+  }else{
+    //contracted or summed spectra, check each displayed bin
+    int i;
+    for(i=startBin;i<endBin;i+=drawing.contractFactor){
+      float val = getDispSpBinVal(dispSpNum, i);
+      if(val < *minVal){
+        *minVal = val;
+      }
+      if(val > *maxVal){
+        *maxVal = val;
+      }
+    }
+  }
+}
+
 float getSpBinVal(const int dispSpNum, const int bin){
   return getSpBinValOrWeight(dispSpNum,bin,0);
 }
@@ -74,7 +74,7 @@ float getCursorYVal(const double cursorx, const double cursory, const double xor
   return 0; //cursor not over spectrum
 }
 
-//get the index of the comment at which the cursor is over
+//get the id of the comment at which the cursor is over (see comment_store.c)
 //return -1 if no comment is at the cursor position
 //some shameless magic numbers used to map channel and y-values to comment indicator size
 int getCommentAtCursor(const double cursorx, const double cursory, const double xorigin, const double yorigin){
@@ -87,81 +87,54 @@ int getCommentAtCursor(const double cursorx, const double cursory, const double
     float cursorCh = getCursorChannel(cursorx, cursory, xorigin, yorigin);
     float cursorYVal = getCursorYVal(cursorx, cursory, xorigin, yorigin);
     //printf("cursorCh: %f, cursorYVal: %f\n",cursorCh,cursorYVal);
+    unsigned char commentView;
+    int commentSp;
     switch (drawing.multiplotMode)
     {
       case 1:
         //sum plot mode
-        for(i=0;i<rawdata.numChComments;i++){
-          if(rawdata.chanCommentView[i] == 1){
-            if(rawdata.chanCommentSp[i] == drawing.displayedView){
-              //check proximity to channel
-              if(fabsf((float)rawdata.chanCommentCh[i] - cursorCh) < (30.0f*((float)(drawing.upperLimit - drawing.lowerLimit)/(float)dasize.width))){
-                //check proximity to y-val
-                float chYVal = rawdata.chanCommentVal[i];
-                if(chYVal < drawing.scaleLevelMin[0]){
-                  chYVal = drawing.scaleLevelMin[0];
-                }else if(chYVal > drawing.scaleLevelMax[0]){
-                  chYVal = drawing.scaleLevelMax[0];
-                }
-                if(fabs(chYVal - cursorYVal) < (30.0*(drawing.scaleLevelMax[0] - drawing.scaleLevelMin[0])/(float)dasize.height)){
-                  return i; //this comment is close
-                }
-              }
-            }
-          }
-        }
+        commentView = 1;
+        commentSp = drawing.displayedView;
         break;
       case 0:
         //single plot mode
         if(drawing.displayedView == -1){
-          for(i=0;i<rawdata.numChComments;i++){
-            if(rawdata.chanCommentView[i] == 0){
-              if(rawdata.chanCommentSp[i] == drawing.multiPlots[0]){
-                //check proximity to channel
-                if(fabsf((float)rawdata.chanCommentCh[i] - cursorCh) < (30.0f*((float)(drawing.upperLimit - drawing.lowerLimit)/(float)dasize.width))){
-                  //check proximity to y-val
-                  float chYVal = rawdata.chanCommentVal[i];
-                  if(chYVal < drawing.scaleLevelMin[0]){
-                    chYVal = drawing.scaleLevelMin[0];
-                  }else if(chYVal > drawing.scaleLevelMax[0]){
-                    chYVal = drawing.scaleLevelMax[0];
-                  }
-                  if(fabs(chYVal - cursorYVal) < (30.0*(drawing.scaleLevelMax[0] - drawing.scaleLevelMin[0])/(float)dasize.height)){
-                    return i; //this comment is close
-                  }
-                }
-              }
-            }
-          }
+          commentView = 0;
+          commentSp = getSpHandle(drawing.multiPlots[0]);
         }else{
           //scaled single spectrum view
-          for(i=0;i<rawdata.numChComments;i++){
-            if(rawdata.chanCommentView[i] == 1){
-              if(rawdata.chanCommentSp[i] == drawing.displayedView){
-                //check proximity to channel
-                if(fabsf((float)rawdata.chanCommentCh[i] - cursorCh) < (30.0f*((float)(drawing.upperLimit - drawing.lowerLimit)/(float)dasize.width))){
-                  //check proximity to y-val
-                  float chYVal = rawdata.chanCommentVal[i];
-                  if(chYVal < drawing.scaleLevelMin[0]){
-                    chYVal = drawing.scaleLevelMin[0];
-                  }else if(chYVal > drawing.scaleLevelMax[0]){
-                    chYVal = drawing.scaleLevelMax[0];
-                  }
-                  if(fabs(chYVal - cursorYVal) < (30.0*(drawing.scaleLevelMax[0] - drawing.scaleLevelMin[0])/(float)dasize.height)){
-                    return i; //this comment is close
-                  }
-                }
-              }
-            }
-          }
+          commentView = 1;
+          commentSp = drawing.displayedView;
         }
-        
         break;
       default:
-        break;
+        return -1; //comments not implemented for the drawing mode
+    }
+    //only comments within the channel proximity window need to be checked
+    float chWindow = 30.0f*((float)(drawing.upperLimit - drawing.lowerLimit)/(float)dasize.width);
+    int start, end;
+    const comment_list *list = getCommentsInRange(commentView,commentSp,(int)floorf(cursorCh - chWindow),(int)ceilf(cursorCh + chWindow),&start,&end);
+    for(i=start;i<end;i++){
+      const chan_comment *com = getComment(list->ids[i]);
+      if(com == NULL){
+        continue; //deleted comment
+      }
+      //check proximity to channel
+      if(fabsf((float)com->ch - cursorCh) < chWindow){
+        //check proximity to y-val
+        float chYVal = com->val;
+        if(chYVal < drawing.scaleLevelMin[0]){
+          chYVal = drawing.scaleLevelMin[0];
+        }else if(chYVal > drawing.scaleLevelMax[0]){
+          chYVal = drawing.scaleLevelMax[0];
+        }
+        if(fabs(chYVal - cursorYVal) < (30.0*(drawing.scaleLevelMax[0] - drawing.scaleLevelMin[0])/(float)dasize.height)){
+          return list->ids[i]; //this comment is close
+        }
+      }
     }
   }
-  return -1; //cursor not over a comment, or comments not implemented for the drawing mode
+  return -1; //cursor not over a comment
 }
 
 
@@ -207,17 +180,16 @@ void setPlotLimits(){
 void autoZoom(){
   if(drawing.multiplotMode == 0){
     int i;
-    for(i=0;i<S32K;i++){
-      if(rawdata.hist[drawing.multiPlots[0]][i] != 0.){
+    const double *data = getSpectrumData(drawing.multiPlots[0]);
+    int spLength = getSpectrumUsedLength(drawing.multiPlots[0]);
+    for(i=0;i<spLength;i++){
+      if(data[i] != 0.){
         drawing.lowerLimit = i;
         break;
       }
     }
-    for(i=S32K-1;i>=0;i--){
-      if(rawdata.hist[drawing.multiPlots[0]][i] != 0.){
-        drawing.upperLimit = i;
-        break;
-      }
+    if(spLength > 0){
+      drawing.upperLimit = spLength - 1;
     }
     drawing.xChanFocus = (int)((drawing.upperLimit + drawing.lowerLimit)/2.0);
     drawing.zoomFocusFrac = 0.5;
@@ -484,6 +456,7 @@ void on_spectrum_click(GtkWidget *widget, GdkEventButton *event, gpointer data){
             fitpar.fitPeakInitGuess[fitpar.numFitPeaks] = cursorChan - 0.5f;
             printf("Fitting peak at channel %f\n",fitpar.fitPeakInitGuess[fitpar.numFitPeaks]);
             gtk_widget_set_sensitive(GTK_WIDGET(fit_fit_button),TRUE);
+            gtk_widget_set_sensitive(GTK_WIDGET(fit_batch_button),TRUE);
             fitpar.numFitPeaks++;
           }
         }
@@ -534,31 +507,22 @@ void on_spectrum_click(GtkWidget *widget, GdkEventButton *event, gpointer data){
             //summed single plot
             //offer option to create a new summed spectrum and comment on that
             guiglobals.commentEditInd = getCommentAtCursor(event->x, event->y, 80.0, 40.0);
-            if((guiglobals.commentEditInd >= 0)&&(guiglobals.commentEditInd < NCHCOM)){
+            if(getComment(guiglobals.commentEditInd) != NULL){
               guiglobals.commentEditMode=0;
               gtk_window_set_title(comment_window,"Edit Comment");
               gtk_widget_set_sensitive(GTK_WIDGET(remove_comment_button),TRUE);
               gtk_widget_set_visible(GTK_WIDGET(remove_comment_button),TRUE);
-              gtk_entry_set_text(comment_entry, rawdata.chanComment[guiglobals.commentEditInd]);
+              gtk_entry_set_text(comment_entry, getComment(guiglobals.commentEditInd)->text);
               gtk_button_set_label(comment_ok_button,"Apply");
               gtk_widget_set_sensitive(GTK_WIDGET(comment_ok_button),FALSE);
             }else{
-              if(rawdata.numChComments >= NCHCOM){
-                printf("Cannot add any more comments.\n");
-                GtkDialogFlags flags = GTK_DIALOG_DESTROY_WITH_PARENT;
-                GtkWidget *message_dialog = gtk_message_dialog_new(window, flags, GTK_MESSAGE_ERROR, GTK_BUTTONS_CLOSE, "Cannot add comment!");
-                gtk_message_dialog_format_secondary_text(GTK_MESSAGE_DIALOG(message_dialog),"The maximum number of comments has been reached.  Older comments must be deleted before more can be added.");
-                gtk_dialog_run(GTK_DIALOG(message_dialog));
-                gtk_widget_destroy(message_dialog);
-                return;
-              }
               gtk_widget_set_sensitive(GTK_WIDGET(remove_comment_button),FALSE);
               //setup comment data
-              rawdata.chanCommentVal[(int)rawdata.numChComments] = cursorYVal;
-              rawdata.chanCommentCh[(int)rawdata.numChComments] = (int)cursorChan;
-              rawdata.chanCommentView[(int)rawdata.numChComments] = 1;
+              guiglobals.newCommentVal = cursorYVal;
+              guiglobals.newCommentCh = (int)cursorChan;
+              guiglobals.newCommentView = 1;
               if(drawing.displayedView >= 0){
-                rawdata.chanCommentSp[(int)rawdata.numChComments] = (unsigned char)drawing.displayedView;
+                guiglobals.newCommentSp = drawing.displayedView;
                 gtk_button_set_label(comment_ok_button,"Apply");
               }else if (drawing.displayedView == -2){
                 //this is a view that hasn't been saved yet
@@ -571,7 +535,7 @@ void on_spectrum_click(GtkWidget *widget, GdkEventButton *event, gpointer data){
                   gtk_widget_destroy(message_dialog);
                   return;
                 }
-                rawdata.chanCommentSp[(int)rawdata.numChComments] = rawdata.numViews;
+                guiglobals.newCommentSp = rawdata.numViews;
                 gtk_button_set_label(comment_ok_button,"Save View and Apply");
               }else{
                 printf("WARNING: undefined view state, not displaying edit window.\n");
@@ -592,36 +556,27 @@ void on_spectrum_click(GtkWidget *widget, GdkEventButton *event, gpointer data){
             //open a dialog for the user to write a comment
             //printf("Double click on channel %f, value %f\n",cursorChan,cursorYVal);
             guiglobals.commentEditInd = getCommentAtCursor(event->x, event->y, 80.0, 40.0);
-            if((guiglobals.commentEditInd >= 0)&&(guiglobals.commentEditInd < NCHCOM)){
+            if(getComment(guiglobals.commentEditInd) != NULL){
               guiglobals.commentEditMode=0;
               gtk_window_set_title(comment_window,"Edit Comment");
               gtk_widget_set_sensitive(GTK_WIDGET(remove_comment_button),TRUE);
               gtk_widget_set_visible(GTK_WIDGET(remove_comment_button),TRUE);
-              gtk_entry_set_text(comment_entry, rawdata.chanComment[guiglobals.commentEditInd]);
+              gtk_entry_set_text(comment_entry, getComment(guiglobals.commentEditInd)->text);
               gtk_button_set_label(comment_ok_button,"Apply");
               gtk_widget_set_sensitive(GTK_WIDGET(comment_ok_button),FALSE);
             }else{
-              if(rawdata.numChComments >= NCHCOM){
-                printf("Cannot add any more comments.\n");
-                GtkDialogFlags flags = GTK_DIALOG_DESTROY_WITH_PARENT;
-                GtkWidget *message_dialog = gtk_message_dialog_new(window, flags, GTK_MESSAGE_ERROR, GTK_BUTTONS_CLOSE, "Cannot add comment!");
-                gtk_message_dialog_format_secondary_text(GTK_MESSAGE_DIALOG(message_dialog),"The maximum number of comments has been reached.  Older comments must be deleted before more can be added.");
-                gtk_dialog_run(GTK_DIALOG(message_dialog));
-                gtk_widget_destroy(message_dialog);
-                return;
-              }
               gtk_widget_set_sensitive(GTK_WIDGET(remove_comment_button),FALSE);
               //setup comment data
-              rawdata.chanCommentVal[(int)rawdata.numChComments] = cursorYVal;
-              rawdata.chanCommentCh[(int)rawdata.numChComments] = (int)cursorChan;
+              guiglobals.newCommentVal = cursorYVal;
+              guiglobals.newCommentCh = (int)cursorChan;
               if(drawing.displayedView == -1){
                 //commenting on a raw spectrum, not a view
-                rawdata.chanCommentSp[(int)rawdata.numChComments] = drawing.multiPlots[0];
-                rawdata.chanCommentView[(int)rawdata.numChComments] = 0;
+                guiglobals.newCommentSp = getSpHandle(drawing.multiPlots[0]);
+                guiglobals.newCommentView = 0;
               }else if(drawing.displayedView >= 0){
                 //commenting on a saved view
-                rawdata.chanCommentView[(int)rawdata.numChComments] = 1;
-                rawdata.chanCommentSp[(int)rawdata.numChComments] = (unsigned char)drawing.displayedView;
+                guiglobals.newCommentView = 1;
+                guiglobals.newCommentSp = drawing.displayedView;
                 gtk_button_set_label(comment_ok_button,"Apply");
               }else if (drawing.displayedView == -2){
                 //commenting on a view that hasn't been saved yet
@@ -634,8 +589,8 @@ void on_spectrum_click(GtkWidget *widget, GdkEventButton *event, gpointer data){
                   gtk_widget_destroy (message_dialog);
                   return;
                 }
-                rawdata.chanCommentView[(int)rawdata.numChComments] = 1;
-                rawdata.chanCommentSp[(int)rawdata.numChComments] = rawdata.numViews;
+                guiglobals.newCommentView = 1;
+                guiglobals.newCommentSp = rawdata.numViews;
                 gtk_button_set_label(comment_ok_button,"Save View and Apply");
               }else{
                 printf("WARNING: undefined view state, not displaying edit window.\n");
@@ -673,6 +628,8 @@ void on_spectrum_cursor_motion(GtkWidget *widget, GdkEventMotion *event, gpointe
     return;
   }
 
+  updateDispBuf(); //make sure displayed values are current for the status bar
+
   //printf("Cursor pos: %f %f\n",event->x,event->y);
   if (event->state & GDK_BUTTON1_MASK){
     //left mouse button being pressed
@@ -713,7 +670,7 @@ void on_spectrum_cursor_motion(GtkWidget *widget, GdkEventMotion *event, gpointe
 
   if(cursorChan >= 0){
 
-    signed char commentToHighlight = (signed char)getCommentAtCursor(event->x, event->y, 80.0, 40.0);
+    int commentToHighlight = getCommentAtCursor(event->x, event->y, 80.0, 40.0);
     if(commentToHighlight != drawing.highlightedComment){
       //highlight the comment
       drawing.highlightedComment = commentToHighlight;
@@ -748,9 +705,9 @@ void on_spectrum_cursor_motion(GtkWidget *widget, GdkEventMotion *event, gpointe
     }
 
     //print info on the status bar
-    if(drawing.highlightedComment>=0){
+    if(getComment(drawing.highlightedComment) != NULL){
       //show the comment in the status bar
-      gtk_label_set_text(bottom_info_text,rawdata.chanComment[drawing.highlightedComment]);
+      gtk_label_set_text(bottom_info_text,getComment(drawing.highlightedComment)->text);
     }else{
       //show the default status bar info
       char statusBarLabel[256];
@@ -819,22 +776,22 @@ void on_spectrum_cursor_motion(GtkWidget *widget, GdkEventMotion *event, gpointe
               float calCentrErr = (float)(getCalWidth((double)(fitpar.fitParErr[7+(3*drawing.highlightedPeak)])));
               float calWidthErr = (float)(getCalWidth((double)(fitpar.fitParErr[8+(3*drawing.highlightedPeak)])));
               char fitParStr[3][50];
-              getFormattedValAndUncertainty(evalPeakArea(drawing.highlightedPeak,fitpar.fitType),evalPeakAreaErr(drawing.highlightedPeak,fitpar.fitType),fitParStr[0],50,1,guiglobals.roundErrors);
+              getFormattedValAndUncertainty(evalPeakArea(&fitpar,drawing.highlightedPeak,fitpar.fitType),evalPeakAreaErr(&fitpar,drawing.highlightedPeak,fitpar.fitType),fitParStr[0],50,1,guiglobals.roundErrors);
               getFormattedValAndUncertainty(calCentr,calCentrErr,fitParStr[1],50,1,guiglobals.roundErrors);
               getFormattedValAndUncertainty(2.35482*calWidth,2.35482*calWidthErr,fitParStr[2],50,1,guiglobals.roundErrors);
               snprintf(statusBarLabel,256,"Area: %s, Centroid: %s, FWHM: %s",fitParStr[0],fitParStr[1],fitParStr[2]);
             }else{
-              snprintf(statusBarLabel,256,"Area: %0.3f, Centroid: %0.3f, FWHM: %0.3f",evalPeakArea(drawing.highlightedPeak,fitpar.fitType),calCentr,2.35482*calWidth);
+              snprintf(statusBarLabel,256,"Area: %0.3f, Centroid: %0.3f, FWHM: %0.3f",evalPeakArea(&fitpar,drawing.highlightedPeak,fitpar.fitType),calCentr,2.35482*calWidth);
             }
           }else{
             if(fitpar.errFound){
               char fitParStr[3][50];
-              getFormattedValAndUncertainty(evalPeakArea(drawing.highlightedPeak,fitpar.fitType),evalPeakAreaErr(drawing.highlightedPeak,fitpar.fitType),fitParStr[0],50,1,guiglobals.roundErrors);
+              getFormattedValAndUncertainty(evalPeakArea(&fitpar,drawing.highlightedPeak,fitpar.fitType),evalPeakAreaErr(&fitpar,drawing.highlightedPeak,fitpar.fitType),fitParStr[0],50,1,guiglobals.roundErrors);
               getFormattedValAndUncertainty((double)(fitpar.fitParVal[7+(3*drawing.highlightedPeak)]),(double)(fitpar.fitParErr[7+(3*drawing.highlightedPeak)]),fitParStr[1],50,1,guiglobals.roundErrors);
               getFormattedValAndUncertainty(2.35482*(double)(fitpar.fitParVal[8+(3*drawing.highlightedPeak)]),2.35482*(double)(fitpar.fitParErr[8+(3*drawing.highlightedPeak)]),fitParStr[2],50,1,guiglobals.roundErrors);
               snprintf(statusBarLabel,256,"Area: %s, Centroid: %s, FWHM: %s",fitParStr[0],fitParStr[1],fitParStr[2]);
             }else{
-              snprintf(statusBarLabel,256,"Area: %0.3f, Centroid: %0.3Lf, FWHM: %0.3Lf",evalPeakArea(drawing.highlightedPeak,fitpar.fitType),fitpar.fitParVal[7+(3*drawing.highlightedPeak)],2.35482*fitpar.fitParVal[8+(3*drawing.highlightedPeak)]);
+              snprintf(statusBarLabel,256,"Area: %0.3f, Centroid: %0.3Lf, FWHM: %0.3Lf",evalPeakArea(&fitpar,drawing.highlightedPeak,fitpar.fitType),fitpar.fitParVal[7+(3*drawing.highlightedPeak)],2.35482*fitpar.fitParVal[8+(3*drawing.highlightedPeak)]);
             }
           }
 
@@ -1297,7 +1254,7 @@ void drawSpectrum(cairo_t *cr, const float width, const float height, const floa
     return;
   }
 
-  int i,j,k;
+  int i,j;
 
   //set the origin of the coordinate system in pixels
   float xorigin = 80.0f*scaleFactor;
@@ -1316,6 +1273,7 @@ void drawSpectrum(cairo_t *cr, const float width, const float height, const floa
   cairo_translate(cr, 0.0, height); //so that the origin is at the lower left
 
   setPlotLimits(); //setup the x range to plot over
+  updateDispBuf(); //rebuild cached displayed values if anything changed, see spectrum_data.c
 
   //get the maximum/minimum y values of the displayed region
   float maxVal[MAX_DISP_SP];
@@ -1324,49 +1282,29 @@ void drawSpectrum(cairo_t *cr, const float width, const float height, const floa
     minVal[i] = (float)(BIG_NUMBER);
     maxVal[i] = (float)(SMALL_NUMBER);
   }
-  for(i=0;i<(drawing.upperLimit-drawing.lowerLimit-1);i+=drawing.contractFactor){
-    float currentVal[MAX_DISP_SP];
-    switch(drawing.multiplotMode){
-      case 4:
-        //stacked
-      case 3:
-        //overlay (independent scaling)
-        for(j=0;j<drawing.numMultiplotSp;j++){
-          currentVal[j] = getDispSpBinVal(j, i);
-          if(currentVal[j] > maxVal[j]){
-            maxVal[j] = currentVal[j];
-          }
-          if(currentVal[j] < minVal[j]){
-            minVal[j] = currentVal[j];
-          }
-        }
-        break;
-      case 2:
-        //overlay (common scaling)
-        for(j=0;j<drawing.numMultiplotSp;j++){
-          currentVal[0] = getDispSpBinVal(j, i);
-          if(currentVal[0] > maxVal[0]){
-            maxVal[0] = currentVal[0];
-          }
-          if(currentVal[0] < minVal[0]){
-            minVal[0] = currentVal[0];
-          }
-        }
-        break;
-      case 1:
-        //summed
-      case 0:
-        currentVal[0] = getDispSpBinVal(0, i);
-        if(currentVal[0] > maxVal[0]){
-          maxVal[0] = currentVal[0];
-        }
-        if(currentVal[0] < minVal[0]){
-          minVal[0] = currentVal[0];
-        }
-        break;
-      default:
-        break;
-    }
+  int numDispBins = drawing.upperLimit-drawing.lowerLimit-1;
+  switch(drawing.multiplotMode){
+    case 4:
+      //stacked
+    case 3:
+      //overlay (independent scaling)
+      for(j=0;j<drawing.numMultiplotSp;j++){
+        getDispSpMinMax(j, 0, numDispBins, &minVal[j], &maxVal[j]);
+      }
+      break;
+    case 2:
+      //overlay (common scaling)
+      for(j=0;j<drawing.numMultiplotSp;j++){
+        getDispSpMinMax(j, 0, numDispBins, &minVal[0], &maxVal[0]);
+      }
+      break;
+    case 1:
+      //summed
+    case 0:
+      getDispSpMinMax(0, 0, numDispBins, &minVal[0], &maxVal[0]);
+      break;
+    default:
+      break;
   }
   //setup autoscaling
   if((drawing.autoScale)||(drawing.scaleLevelMax[0] <= drawing.scaleLevelMin[0])){
@@ -1642,17 +1580,15 @@ void drawSpectrum(cairo_t *cr, const float width, const float height, const floa
 
           float currentVal, nextVal;
 
-          //draw high values even if they were going to be interpolated over
+          //draw the full range of values which were going to be interpolated over
           if(binSkipFactor > drawing.contractFactor){
-            for(k=0;k<binSkipFactor;k++){
-              if(getDispSpBinVal(i, j+k) > drawing.scaleLevelMax[i]*0.8){
-                currentVal = getDispSpBinVal(i, j);
-                nextVal = getDispSpBinVal(i, j+k);
-                cairo_move_to(cr, getXPos(j,width,xorigin), getYPos(currentVal,i,height,yorigin));
-                cairo_line_to(cr, getXPos(j+k,width,xorigin), getYPos(currentVal,i,height,yorigin));
-                cairo_line_to(cr, getXPos(j+k,width,xorigin), getYPos(nextVal,i,height,yorigin));
-                break;
-              }
+            float envMin = (float)(BIG_NUMBER);
+            float envMax = (float)(SMALL_NUMBER);
+            getDispSpMinMax(i, j, j+binSkipFactor, &envMin, &envMax);
+            if(envMax > envMin){
+              float envX = (getXPos(j,width,xorigin) + getXPos(j+binSkipFactor,width,xorigin))/2.0f; //centre of the skipped bins
+              cairo_move_to(cr, envX, getYPos(envMin,i,height,yorigin));
+              cairo_line_to(cr, envX, getYPos(envMax,i,height,yorigin));
             }
           }
 
@@ -1674,17 +1610,15 @@ void drawSpectrum(cairo_t *cr, const float width, const float height, const floa
 
           float currentVal, nextVal;
 
-          //draw high values even if they were going to be interpolated over
+          //draw the full range of values which were going to be interpolated over
           if(binSkipFactor > drawing.contractFactor){
-            for(k=0;k<binSkipFactor;k++){
-              if(getDispSpBinVal(i, j+k) > drawing.scaleLevelMax[0]*0.8){
-                currentVal = getDispSpBinVal(i, j);
-                nextVal = getDispSpBinVal(i, j+k);
-                cairo_move_to(cr, getXPos(j,width,xorigin), getYPos(currentVal,0,height,yorigin));
-                cairo_line_to(cr, getXPos(j+k,width,xorigin), getYPos(currentVal,0,height,yorigin));
-                cairo_line_to(cr, getXPos(j+k,width,xorigin), getYPos(nextVal,0,height,yorigin));
-                break;
-              }
+            float envMin = (float)(BIG_NUMBER);
+            float envMax = (float)(SMALL_NUMBER);
+            getDispSpMinMax(i, j, j+binSkipFactor, &envMin, &envMax);
+            if(envMax > envMin){
+              float envX = (getXPos(j,width,xorigin) + getXPos(j+binSkipFactor,width,xorigin))/2.0f; //centre of the skipped bins
+              cairo_move_to(cr, envX, getYPos(envMin,0,height,yorigin));
+              cairo_line_to(cr, envX, getYPos(envMax,0,height,yorigin));
             }
           }
 
@@ -1706,17 +1640,15 @@ void drawSpectrum(cairo_t *cr, const float width, const float height, const floa
 
         float currentVal, nextVal;
 
-        //draw high values even if they were going to be interpolated over
+        //draw the full range of values which were going to be interpolated over
         if(binSkipFactor > drawing.contractFactor){
-          for(k=0;k<binSkipFactor;k++){
-            if(getDispSpBinVal(0, i+k) > drawing.scaleLevelMax[0]*0.8){
-              currentVal = getDispSpBinVal(0, i);
-              nextVal = getDispSpBinVal(0, i+k);
-              cairo_move_to(cr, getXPos(i,width,xorigin), getYPos(currentVal,0,height,yorigin));
-              cairo_line_to(cr, getXPos(i+k,width,xorigin), getYPos(currentVal,0,height,yorigin));
-              cairo_line_to(cr, getXPos(i+k,width,xorigin), getYPos(nextVal,0,height,yorigin));
-              break;
-            }
+          float envMin = (float)(BIG_NUMBER);
+          float envMax = (float)(SMALL_NUMBER);
+          getDispSpMinMax(0, i, i+binSkipFactor, &envMin, &envMax);
+          if(envMax > envMin){
+            float envX = (getXPos(i,width,xorigin) + getXPos(i+binSkipFactor,width,xorigin))/2.0f; //centre of the skipped bins
+            cairo_move_to(cr, envX, getYPos(envMin,0,height,yorigin));
+            cairo_line_to(cr, envX, getYPos(envMax,0,height,yorigin));
           }
         }
 
@@ -1751,8 +1683,8 @@ void drawSpectrum(cairo_t *cr, const float width, const float height, const floa
           xpos = getXPosFromCh(fitDrawX,width,1,xorigin);
           nextXpos = getXPosFromCh(nextFitDrawX,width,1,xorigin);
           if((xpos > 0)&&(nextXpos > 0)){
-            cairo_move_to(cr, xpos, getYPos((float)(evalFitOnePeak(fitDrawX,i,fitpar.fitType)),0,height,yorigin));
-            cairo_line_to(cr, nextXpos, getYPos((float)(evalFitOnePeak(nextFitDrawX,i,fitpar.fitType)),0,height,yorigin));
+            cairo_move_to(cr, xpos, getYPos((float)(evalFitOnePeak(&fitpar,fitDrawX,i,fitpar.fitType)),0,height,yorigin));
+            cairo_line_to(cr, nextXpos, getYPos((float)(evalFitOnePeak(&fitpar,nextFitDrawX,i,fitpar.fitType)),0,height,yorigin));
           }
         }
       }
@@ -1762,8 +1694,8 @@ void drawSpectrum(cairo_t *cr, const float width, const float height, const floa
         xpos = getXPosFromCh(fitDrawX,width,1,xorigin);
         nextXpos = getXPosFromCh(nextFitDrawX,width,1,xorigin);
         if((xpos > 0)&&(nextXpos > 0)){
-          cairo_move_to(cr, xpos, getYPos((float)(evalFitBG(fitDrawX)),0,height,yorigin));
-          cairo_line_to(cr, nextXpos, getYPos((float)(evalFitBG(nextFitDrawX)),0,height,yorigin));
+          cairo_move_to(cr, xpos, getYPos((float)(evalFitBG(&fitpar,fitDrawX)),0,height,yorigin));
+          cairo_line_to(cr, nextXpos, getYPos((float)(evalFitBG(&fitpar,nextFitDrawX)),0,height,yorigin));
         }
       }
       cairo_stroke(cr);
@@ -1775,8 +1707,8 @@ void drawSpectrum(cairo_t *cr, const float width, const float height, const floa
           xpos = getXPosFromCh(fitDrawX,width,1,xorigin);
           nextXpos = getXPosFromCh(nextFitDrawX,width,1,xorigin);
           if((xpos > 0)&&(nextXpos > 0)){
-            cairo_move_to(cr, xpos, getYPos((float)(evalFit(fitDrawX,fitpar.fitType)),0,height,yorigin));
-            cairo_line_to(cr, nextXpos, getYPos((float)(evalFit(nextFitDrawX,fitpar.fitType)),0,height,yorigin));
+            cairo_move_to(cr, xpos, getYPos((float)(evalFit(&fitpar,fitDrawX,fitpar.fitType)),0,height,yorigin));
+            cairo_line_to(cr, nextXpos, getYPos((float)(evalFit(&fitpar,nextFitDrawX,fitpar.fitType)),0,height,yorigin));
           }
         }
         cairo_stroke(cr);
@@ -1789,8 +1721,8 @@ void drawSpectrum(cairo_t *cr, const float width, const float height, const floa
           xpos = getXPosFromCh(fitDrawX,width,1,xorigin);
           nextXpos = getXPosFromCh(nextFitDrawX,width,1,xorigin);
           if((xpos > 0)&&(nextXpos > 0)){
-            cairo_move_to(cr, xpos, getYPos((float)(evalFitOnePeak(fitDrawX,drawing.highlightedPeak,fitpar.fitType)),0,height,yorigin));
-            cairo_line_to(cr, nextXpos, getYPos((float)(evalFitOnePeak(nextFitDrawX,drawing.highlightedPeak,fitpar.fitType)),0,height,yorigin));
+            cairo_move_to(cr, xpos, getYPos((float)(evalFitOnePeak(&fitpar,fitDrawX,drawing.highlightedPeak,fitpar.fitType)),0,height,yorigin));
+            cairo_line_to(cr, nextXpos, getYPos((float)(evalFitOnePeak(&fitpar,nextFitDrawX,drawing.highlightedPeak,fitpar.fitType)),0,height,yorigin));
           }
         }
         cairo_stroke(cr);
@@ -1896,7 +1828,7 @@ void drawSpectrum(cairo_t *cr, const float width, const float height, const floa
       cairo_set_line_width(cr, 2.0*scaleFactor);
       for(i=0;i<fitpar.numFitPeaks;i++){
         if((fitpar.fitParVal[7+(3*i)] > drawing.lowerLimit)&&(fitpar.fitParVal[7+(3*i)] < drawing.upperLimit)){
-          cairo_arc(cr,getXPosFromCh((float)(fitpar.fitParVal[7+(3*i)]),width,1,xorigin),(-0.002*(height)*30.0)-getYPos((float)(evalFit(fitpar.fitParVal[7+(3*i)],fitpar.fitType)),0,height,yorigin),5.,0.,2*G_PI);
+          cairo_arc(cr,getXPosFromCh((float)(fitpar.fitParVal[7+(3*i)]),width,1,xorigin),(-0.002*(height)*30.0)-getYPos((float)(evalFit(&fitpar,fitpar.fitParVal[7+(3*i)],fitpar.fitType)),0,height,yorigin),5.,0.,2*G_PI);
         }
         cairo_stroke_preserve(cr);
         cairo_fill(cr);
@@ -1907,120 +1839,61 @@ void drawSpectrum(cairo_t *cr, const float width, const float height, const floa
   //draw comment indicators
   if(drawComments){
     cairo_set_source_rgb (cr, 0.5, 0.5, 0.5);
+    unsigned char commentView = 0;
+    int commentSp = -1;
     switch (drawing.multiplotMode)
     {
       case 1:
         //sum view
-        for(i=0;i<rawdata.numChComments;i++){
-          if(rawdata.chanCommentView[i]==1){
-            if(rawdata.chanCommentSp[i]==drawing.displayedView){
-              if(rawdata.chanCommentCh[i] > drawing.lowerLimit){
-                if(rawdata.chanCommentCh[i] < drawing.upperLimit){
-                  if((!drawing.logScale)||(rawdata.chanCommentVal[i] > 0)){
-                    if(drawing.highlightedComment == i){
-                      cairo_set_line_width(cr, 8.0*scaleFactor);
-                    }else{
-                      cairo_set_line_width(cr, 4.0*scaleFactor);
-                    }
-                    float chYVal = rawdata.chanCommentVal[i];
-                    if(chYVal < drawing.scaleLevelMin[0]){
-                      chYVal = drawing.scaleLevelMin[0];
-                    }else if(chYVal > drawing.scaleLevelMax[0]){
-                      chYVal = drawing.scaleLevelMax[0];
-                    }
-                    float xc = getXPosFromCh((float)(rawdata.chanCommentCh[i]),width,1,xorigin);
-                    float yc = -1.0f*getYPos(chYVal,0,height,yorigin);
-                    float radius = 14.0;
-                    cairo_arc(cr,xc,yc,radius,0.,2*G_PI);
-                    cairo_set_font_size(cr, plotFontSize*1.5);
-                    cairo_text_extents(cr, "i", &extents);
-                    cairo_move_to(cr,xc-(extents.width),yc+(extents.height/2.));
-                    cairo_show_text(cr, "i");
-                    cairo_stroke(cr);
-                    //cairo_fill(cr);
-                  }
-                }
-              }
-            }
-          }
-        }
+        commentView = 1;
+        commentSp = drawing.displayedView;
         break;
       case 0:
         //single non-summed spectrum
         if(drawing.displayedView == -1){
-          for(i=0;i<rawdata.numChComments;i++){
-            if(rawdata.chanCommentView[i]==0){
-              if(rawdata.chanCommentSp[i]==drawing.multiPlots[0]){
-                if(rawdata.chanCommentCh[i] > drawing.lowerLimit){
-                  if(rawdata.chanCommentCh[i] < drawing.upperLimit){
-                    if((!drawing.logScale)||(rawdata.chanCommentVal[i] > 0)){
-                      if(drawing.highlightedComment == i){
-                        cairo_set_line_width(cr, 8.0*scaleFactor);
-                      }else{
-                        cairo_set_line_width(cr, 4.0*scaleFactor);
-                      }
-                      float chYVal = rawdata.chanCommentVal[i];
-                      if(chYVal < drawing.scaleLevelMin[0]){
-                        chYVal = drawing.scaleLevelMin[0];
-                      }else if(chYVal > drawing.scaleLevelMax[0]){
-                        chYVal = drawing.scaleLevelMax[0];
-                      }
-                      float xc = getXPosFromCh((float)(rawdata.chanCommentCh[i]),width,1,xorigin);
-                      float yc = -1.0f*getYPos(chYVal,0,height,yorigin);
-                      float radius = 14.0;
-                      cairo_arc(cr,xc,yc,radius,0.,2*G_PI);
-                      cairo_set_font_size(cr, plotFontSize*1.5);
-                      cairo_text_extents(cr, "i", &extents);
-                      cairo_move_to(cr,xc-(extents.width),yc+(extents.height/2.));
-                      cairo_show_text(cr, "i");
-                      cairo_stroke(cr);
-                      //cairo_fill(cr);
-                    }
-                  }
-                }
-              }
-            }
-          }
+          commentView = 0;
+          commentSp = getSpHandle(drawing.multiPlots[0]);
         }else{
-          for(i=0;i<rawdata.numChComments;i++){
-            if(rawdata.chanCommentView[i]==1){
-              if(rawdata.chanCommentSp[i]==drawing.displayedView){
-                if(rawdata.chanCommentCh[i] > drawing.lowerLimit){
-                  if(rawdata.chanCommentCh[i] < drawing.upperLimit){
-                    if((!drawing.logScale)||(rawdata.chanCommentVal[i] > 0)){
-                      if(drawing.highlightedComment == i){
-                        cairo_set_line_width(cr, 8.0*scaleFactor);
-                      }else{
-                        cairo_set_line_width(cr, 4.0*scaleFactor);
-                      }
-                      float chYVal = rawdata.chanCommentVal[i];
-                      if(chYVal < drawing.scaleLevelMin[0]){
-                        chYVal = drawing.scaleLevelMin[0];
-                      }else if(chYVal > drawing.scaleLevelMax[0]){
-                        chYVal = drawing.scaleLevelMax[0];
-                      }
-                      float xc = getXPosFromCh((float)(rawdata.chanCommentCh[i]),width,1,xorigin);
-                      float yc = -1.0f*getYPos(chYVal,0,height,yorigin);
-                      float radius = 14.0;
-                      cairo_arc(cr,xc,yc,radius,0.,2*G_PI);
-                      cairo_set_font_size(cr, plotFontSize*1.5);
-                      cairo_text_extents(cr, "i", &extents);
-                      cairo_move_to(cr,xc-(extents.width),yc+(extents.height/2.));
-                      cairo_show_text(cr, "i");
-                      cairo_stroke(cr);
-                      //cairo_fill(cr);
-                    }
-                  }
-                }
-              }
-            }
-          }
+          commentView = 1;
+          commentSp = drawing.displayedView;
         }
         break;
       default:
         //comments not implemented
         break;
     }
+    //only comments in the displayed channel range are looked up
+    int start, end;
+    const comment_list *list = getCommentsInRange(commentView,commentSp,drawing.lowerLimit+1,drawing.upperLimit-1,&start,&end);
+    for(i=start;i<end;i++){
+      const chan_comment *com = getComment(list->ids[i]);
+      if(com == NULL){
+        continue; //deleted comment
+      }
+      if((!drawing.logScale)||(com->val > 0)){
+        if(drawing.highlightedComment == list->ids[i]){
+          cairo_set_line_width(cr, 8.0*scaleFactor);
+        }else{
+          cairo_set_line_width(cr, 4.0*scaleFactor);
+        }
+        float chYVal = com->val;
+        if(chYVal < drawing.scaleLevelMin[0]){
+          chYVal = drawing.scaleLevelMin[0];
+        }else if(chYVal > drawing.scaleLevelMax[0]){
+          chYVal = drawing.scaleLevelMax[0];
+        }
+        float xc = getXPosFromCh((float)(com->ch),width,1,xorigin);
+        float yc = -1.0f*getYPos(chYVal,0,height,yorigin);
+        float radius = 14.0;
+        cairo_arc(cr,xc,yc,radius,0.,2*G_PI);
+        cairo_set_font_size(cr, plotFontSize*1.5);
+        cairo_text_extents(cr, "i", &extents);
+        cairo_move_to(cr,xc-(extents.width),yc+(extents.height/2.));
+        cairo_show_text(cr, "i");
+        cairo_stroke(cr);
+        //cairo_fill(cr);
+      }
+    }
   }
 
   //draw cursor at mouse position
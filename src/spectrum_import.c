@@ -0,0 +1,314 @@
+/* J. Williams, 2020-2021 */
+
+//This file contains routines for holding data read in from a file
+//(spectra, titles, comments, views, and calibration) before it is added
+//to the spectrum store.  File readers (see read_data.c) fill in an
+//import_data structure which is private to the file being read, so that
+//several files can be read at once on worker threads.  Once a file has
+//been read, its data is committed to the spectrum store (and the other
+//global data) on the main thread, with spectrum numbers within the file
+//mapped to the indices at which the spectra are placed.
+
+void initImportData(import_data *imp){
+  memset(imp,0,sizeof(import_data));
+}
+
+void freeImportData(import_data *imp){
+  int i;
+  for(i=0;i<imp->numSpAlloc;i++){
+    freeSpStoreEntry(&imp->sp[i]);
+  }
+  for(i=0;i<imp->numViews;i++){
+    free(imp->view[i].multiPlots);
+    free(imp->view[i].scaleFactor);
+  }
+  free(imp->sp);
+  free(imp->title);
+  free(imp->com);
+  free(imp->view);
+  initImportData(imp);
+}
+
+//allocate space for at least numSp spectra in the imported data, without
+//adding them (eg. when the number of spectra in a file can be estimated
+//before reading it, so that space is only allocated once)
+//returns 1 on success, 0 on failure
+int reserveImportSpectra(import_data *imp, const int numSp){
+  if((numSp < 0)||(numSp > NSPECT)){
+    return 0;
+  }
+  if(numSp > imp->numSpAlloc){
+    int newAlloc = imp->numSpAlloc*2;
+    if(newAlloc < 16){
+      newAlloc = 16;
+    }
+    while(newAlloc < numSp){
+      newAlloc *= 2;
+    }
+    if(newAlloc > NSPECT){
+      newAlloc = NSPECT;
+    }
+    sp_store_entry *newSp = realloc(imp->sp,(size_t)newAlloc*sizeof(sp_store_entry));
+    if(newSp == NULL){
+      printf("ERROR: cannot allocate memory for %i imported spectra.\n",numSp);
+      return 0;
+    }
+    imp->sp = newSp;
+    char (*newTitle)[256] = realloc(imp->title,(size_t)newAlloc*sizeof(imp->title[0]));
+    if(newTitle == NULL){
+      printf("ERROR: cannot allocate memory for %i imported spectra.\n",numSp);
+      return 0;
+    }
+    imp->title = newTitle;
+    memset(&imp->sp[imp->numSpAlloc],0,(size_t)(newAlloc-imp->numSpAlloc)*sizeof(sp_store_entry));
+    memset(&imp->title[imp->numSpAlloc],0,(size_t)(newAlloc-imp->numSpAlloc)*sizeof(imp->title[0]));
+    imp->numSpAlloc = newAlloc;
+  }
+  return 1;
+}
+
+//make sure that at least numSp spectra exist in the imported data,
+//new spectra are empty and have no title
+//returns 1 on success, 0 on failure
+int setImportNumSp(import_data *imp, const int numSp){
+  if(reserveImportSpectra(imp,numSp)==0){
+    return 0;
+  }
+  if(numSp > imp->numSp){
+    imp->numSp = numSp;
+  }
+  return 1;
+}
+
+//get the title buffer (256 characters) of an imported spectrum, or NULL if there is no such spectrum
+char *getImportTitle(import_data *imp, const int spNum){
+  if((spNum < 0)||(spNum >= imp->numSp)){
+    return NULL;
+  }
+  return imp->title[spNum];
+}
+
+//(re)initialize an imported spectrum with numCh empty channels, adding the spectrum if needed
+//returns a pointer to the spectrum data, or NULL on failure
+double *allocImportSpectrum(import_data *imp, const int spNum, const int numCh){
+  if(setImportNumSp(imp,spNum+1)==0){
+    return NULL;
+  }
+  return allocSpStoreEntry(&imp->sp[spNum],numCh);
+}
+
+//empty an imported spectrum, adding the spectrum if needed
+void clearImportSpectrum(import_data *imp, const int spNum){
+  if(setImportNumSp(imp,spNum+1)){
+    imp->sp[spNum].length = 0;
+    imp->sp[spNum].indexValid = 0;
+  }
+}
+
+//set the value of a single channel of an imported spectrum, adding the spectrum if needed
+//returns 1 on success, 0 on failure
+int setImportBinVal(import_data *imp, const int spNum, const int ch, const double val){
+  if(setImportNumSp(imp,spNum+1)==0){
+    return 0;
+  }
+  return setSpStoreEntryBinVal(&imp->sp[spNum],ch,val);
+}
+
+//add a channel comment on an imported spectrum (view=0) or view (view=1)
+//returns 1 on success, 0 on failure
+int addImportComment(import_data *imp, const unsigned char view, const int sp, const int ch, const float val, const char *text){
+  if(imp->numCom >= imp->numComAlloc){
+    int newAlloc = imp->numComAlloc*2;
+    if(newAlloc < 16){
+      newAlloc = 16;
+    }
+    import_comment *newCom = realloc(imp->com,(size_t)newAlloc*sizeof(import_comment));
+    if(newCom == NULL){
+      printf("ERROR: cannot allocate memory for imported comments.\n");
+      return 0;
+    }
+    imp->com = newCom;
+    imp->numComAlloc = newAlloc;
+  }
+  import_comment *com = &imp->com[imp->numCom];
+  memset(com,0,sizeof(import_comment));
+  strncpy(com->text,text,sizeof(com->text)-1);
+  com->view = view;
+  com->sp = sp;
+  com->ch = ch;
+  com->val = val;
+  imp->numCom++;
+  return 1;
+}
+
+//add a view of numMultiplotSp imported spectra (numbered within the file)
+//returns 1 on success, 0 on failure
+int addImportView(import_data *imp, const char *comment, const unsigned char multiplotMode, const int numMultiplotSp, const int *multiPlots, const double *scaleFactor){
+  if((numMultiplotSp < 0)||(numMultiplotSp > NSPECT)){
+    return 0;
+  }
+  if(imp->numViews >= imp->numViewsAlloc){
+    int newAlloc = imp->numViewsAlloc*2;
+    if(newAlloc < 4){
+      newAlloc = 4;
+    }
+    import_view *newView = realloc(imp->view,(size_t)newAlloc*sizeof(import_view));
+    if(newView == NULL){
+      printf("ERROR: cannot allocate memory for imported views.\n");
+      return 0;
+    }
+    imp->view = newView;
+    imp->numViewsAlloc = newAlloc;
+  }
+  import_view *view = &imp->view[imp->numViews];
+  memset(view,0,sizeof(import_view));
+  view->multiPlots = malloc((size_t)(numMultiplotSp+1)*sizeof(int));
+  view->scaleFactor = malloc((size_t)(numMultiplotSp+1)*sizeof(double));
+  if((view->multiPlots == NULL)||(view->scaleFactor == NULL)){
+    printf("ERROR: cannot allocate memory for imported views.\n");
+    free(view->multiPlots);
+    free(view->scaleFactor);
+    return 0;
+  }
+  strncpy(view->comment,comment,sizeof(view->comment)-1);
+  view->multiplotMode = multiplotMode;
+  view->numMultiplotSp = numMultiplotSp;
+  memcpy(view->multiPlots,multiPlots,(size_t)numMultiplotSp*sizeof(int));
+  memcpy(view->scaleFactor,scaleFactor,(size_t)numMultiplotSp*sizeof(double));
+  imp->numViews++;
+  return 1;
+}
+
+//trim the imported spectra to the channels actually containing data and
+//build their indices (see spectrum_store.c), can be done on a worker thread
+void finalizeImportData(import_data *imp){
+  int i;
+  for(i=0;i<imp->numSp;i++){
+    trimSpStoreEntry(&imp->sp[i]);
+  }
+}
+
+//get the handle (see spectrum_store.c) of a spectrum numbered spNum within
+//a file whose numSpec spectra are placed starting at index outHistStartSp
+//returns -1 if the file doesn't contain the spectrum
+int getImportSpHandle(const int spNum, const int numSpec, const int outHistStartSp){
+  if((spNum < 0)||(spNum >= numSpec)){
+    return -1;
+  }
+  return assignSpHandle(spNum+outHistStartSp); //assign to the correct (appended) spectrum
+}
+
+//add data read in from a file to the spectrum store, with the first
+//spectrum placed at index outHistStartSp, and the comments, views, and
+//calibration added to the global data (the imported data is emptied)
+//if spHandle is not NULL, the handle of the spectrum holding each spectrum
+//read is written to it (-1 for dropped spectra)
+//returns the number of spectra added (after dropping empty spectra if
+//dropEmpty is set), or -1 if there are too many spectra
+int commitImportData(import_data *imp, const char *filename, const int outHistStartSp, const int dropEmpty, int *spHandle){
+  int i,j;
+  int numSpec = imp->numSp;
+  int startNumViews = rawdata.numViews;
+
+  if((outHistStartSp+numSpec)>=NSPECT){
+    printf("Cannot open file %s, number of spectra would exceed maximum!\n", filename);
+    return -1; //too many spectra opened
+  }
+  rawdata.metaGeneration++;
+
+  //spectra and titles
+  if(growSpStore(outHistStartSp+numSpec)==0){ //allocate store entries once for all spectra
+    return -1;
+  }
+  for(i=0;i<numSpec;i++){
+    if(imp->sp[i].indexValid == 0){
+      trimSpStoreEntry(&imp->sp[i]);
+    }
+    adoptSpStoreEntry(outHistStartSp+i,&imp->sp[i]); //see spectrum_store.c
+    memcpy(rawdata.histComment[outHistStartSp+i],imp->title[i],sizeof(rawdata.histComment[outHistStartSp+i]));
+    rawdata.histComment[outHistStartSp+i][255] = '\0';
+    if(spHandle != NULL){
+      spHandle[i] = assignSpHandle(outHistStartSp+i); //follows the spectrum if it is moved
+    }
+  }
+
+  //calibration
+  if(imp->hasCalPar){
+    calpar.calMode = imp->cal.calMode;
+    calpar.calpar0 = imp->cal.calpar0;
+    calpar.calpar1 = imp->cal.calpar1;
+    calpar.calpar2 = imp->cal.calpar2;
+  }
+  if(imp->hasCalUnit){
+    memcpy(calpar.calUnit,imp->cal.calUnit,sizeof(calpar.calUnit));
+  }
+  if(imp->hasCalYUnit){
+    memcpy(calpar.calYUnit,imp->cal.calYUnit,sizeof(calpar.calYUnit));
+  }
+
+  //views (refer to spectra by handle)
+  for(i=0;i<imp->numViews;i++){
+    if(rawdata.numViews >= MAXNVIEWS){
+      printf("WARNING: over-imported views.  Truncating.\n");
+      break;
+    }
+    const import_view *view = &imp->view[i];
+    memset(rawdata.viewScaleFactor[rawdata.numViews],0,sizeof(rawdata.viewScaleFactor[rawdata.numViews]));
+    memcpy(rawdata.viewComment[rawdata.numViews],view->comment,sizeof(rawdata.viewComment[rawdata.numViews]));
+    rawdata.viewMultiplotMode[rawdata.numViews] = view->multiplotMode;
+    rawdata.viewNumMultiplotSp[rawdata.numViews] = view->numMultiplotSp;
+    for(j=0;j<view->numMultiplotSp;j++){
+      rawdata.viewMultiPlots[rawdata.numViews][j] = getImportSpHandle(view->multiPlots[j],numSpec,outHistStartSp);
+      rawdata.viewScaleFactor[rawdata.numViews][j] = view->scaleFactor[j];
+    }
+    rawdata.numViews = (unsigned char)(rawdata.numViews+1);
+  }
+
+  //comments (refer to spectra by handle, and views by number)
+  for(i=0;i<imp->numCom;i++){
+    const import_comment *com = &imp->com[i];
+    if(com->view == 1){
+      addComment(1,com->sp+startNumViews,com->ch,com->val,com->text); //assign to the correct (appended) view
+    }else{
+      int handle = getImportSpHandle(com->sp,numSpec,outHistStartSp);
+      if(handle >= 0){
+        addComment(0,handle,com->ch,com->val,com->text);
+      }
+    }
+  }
+
+  freeImportData(imp);
+  printf("Opened file: %s, number of spectra read in: %i\n", filename, numSpec);
+
+  //discard empty spectra
+  if(dropEmpty){
+    int passedSpCount = 0;
+    for(i=0;i<numSpec;i++){
+      if(!isSpectrumEmpty(outHistStartSp+i)){
+        //printf("Passed spectrum %i\n",i);
+        if(passedSpCount != i){
+          //move the spectrum down, overwriting empty ones
+          moveSpectrum(outHistStartSp+passedSpCount,outHistStartSp+i);
+          memcpy(rawdata.histComment[outHistStartSp+passedSpCount],rawdata.histComment[outHistStartSp+i],sizeof(rawdata.histComment[outHistStartSp+i]));
+        }
+        passedSpCount++;
+      }else{
+        deleteCommentsOn(0,getSpHandle(outHistStartSp+i)); //see comment_store.c
+        removeSpFromViews(getSpHandle(outHistStartSp+i)); //before the handle is released, see spectrum_data.c
+        if(spHandle != NULL){
+          spHandle[i] = -1;
+        }
+      }
+    }
+    //release the indices left over at the end
+    for(i=numSpec-1;i>=passedSpCount;i--){
+      removeSpectrumFromStore(outHistStartSp+i,outHistStartSp+i+1);
+    }
+    int dropCount = numSpec-passedSpCount;
+    if(dropCount>0)
+      printf("Dropped %i empty spectra.\n",dropCount);
+    return passedSpCount;
+  }
+
+  return numSpec;
+}
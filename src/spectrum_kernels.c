@@ -0,0 +1,289 @@
+/* J. Williams, 2020-2021 */
+
+//This file contains vectorized kernels for bulk operations on spectrum
+//data (summing, scaling, contraction, fit weight sums, and conversion of
+//imported binary data).  The kernels
+//work on cumulative sums of the data (see spectrum_store.c), so that a
+//contracted bin is a single subtraction.  SSE2 and AVX2 versions are
+//selected at runtime on x86 processors, with a scalar fallback used
+//everywhere else.  All versions give identical results.
+
+int simdLevel = -1; //-1=not checked yet, 0=scalar, 1=SSE2, 2=AVX2
+
+//check which instruction sets are available
+int getSimdLevel(){
+  if(simdLevel < 0){
+    simdLevel = 0;
+#ifdef JF3_SIMD_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")){
+      simdLevel = 2;
+    }else if(__builtin_cpu_supports("sse2")){
+      simdLevel = 1;
+    }
+#endif
+  }
+  return simdLevel;
+}
+
+//window sums: out[i] (+)= sf*(cum[i+windowSize] - cum[i]), for i=0 to numOut-1
+//with windowSize=1 this scales the data, with larger windows it gives the
+//contracted bin starting at each channel
+//cum must contain at least numOut+windowSize values
+void addWindowSumsScalar(float *out, const double *cum, const int numOut, const int windowSize, const double sf, const int accumulate){
+  int i;
+  if(accumulate){
+    for(i=0;i<numOut;i++){
+      out[i] += (float)(sf*(cum[i+windowSize] - cum[i]));
+    }
+  }else{
+    for(i=0;i<numOut;i++){
+      out[i] = (float)(sf*(cum[i+windowSize] - cum[i]));
+    }
+  }
+}
+
+#ifdef JF3_SIMD_X86
+__attribute__((target("sse2")))
+void addWindowSumsSSE2(float *out, const double *cum, const int numOut, const int windowSize, const double sf, const int accumulate){
+  int i;
+  const __m128d sfv = _mm_set1_pd(sf);
+  for(i=0;i<(numOut-1);i+=2){
+    __m128d diff = _mm_sub_pd(_mm_loadu_pd(&cum[i+windowSize]),_mm_loadu_pd(&cum[i]));
+    __m128 vals = _mm_cvtpd_ps(_mm_mul_pd(sfv,diff));
+    if(accumulate){
+      vals = _mm_add_ps(vals,_mm_castpd_ps(_mm_load_sd((const double*)&out[i])));
+    }
+    _mm_store_sd((double*)&out[i],_mm_castps_pd(vals));
+  }
+  addWindowSumsScalar(&out[i],&cum[i],numOut-i,windowSize,sf,accumulate);
+}
+
+__attribute__((target("avx2")))
+void addWindowSumsAVX2(float *out, const double *cum, const int numOut, const int windowSize, const double sf, const int accumulate){
+  int i;
+  const __m256d sfv = _mm256_set1_pd(sf);
+  for(i=0;i<(numOut-7);i+=8){
+    __m256d diffLo = _mm256_sub_pd(_mm256_loadu_pd(&cum[i+windowSize]),_mm256_loadu_pd(&cum[i]));
+    __m256d diffHi = _mm256_sub_pd(_mm256_loadu_pd(&cum[i+4+windowSize]),_mm256_loadu_pd(&cum[i+4]));
+    __m128 valsLo = _mm256_cvtpd_ps(_mm256_mul_pd(sfv,diffLo));
+    __m128 valsHi = _mm256_cvtpd_ps(_mm256_mul_pd(sfv,diffHi));
+    if(accumulate){
+      valsLo = _mm_add_ps(valsLo,_mm_loadu_ps(&out[i]));
+      valsHi = _mm_add_ps(valsHi,_mm_loadu_ps(&out[i+4]));
+    }
+    _mm_storeu_ps(&out[i],valsLo);
+    _mm_storeu_ps(&out[i+4],valsHi);
+  }
+  addWindowSumsScalar(&out[i],&cum[i],numOut-i,windowSize,sf,accumulate);
+}
+#endif
+
+void addWindowSums(float *out, const double *cum, const int numOut, const int windowSize, const double sf, const int accumulate){
+  if(numOut <= 0){
+    return;
+  }
+  switch(getSimdLevel()){
+#ifdef JF3_SIMD_X86
+    case 2:
+      addWindowSumsAVX2(out,cum,numOut,windowSize,sf,accumulate);
+      break;
+    case 1:
+      addWindowSumsSSE2(out,cum,numOut,windowSize,sf,accumulate);
+      break;
+#endif
+    case 0:
+    default:
+      addWindowSumsScalar(out,cum,numOut,windowSize,sf,accumulate);
+      break;
+  }
+}
+
+//block sums: out[i] = sf*(cum[(i+1)*blockSize] - cum[i*blockSize]), for i=0 to numOut-1
+//this gives non-overlapping contracted bins, eg. for export
+//cum must contain at least numOut*blockSize+1 values
+void getBlockSumsScalar(float *out, const double *cum, const int numOut, const int blockSize, const double sf){
+  int i;
+  for(i=0;i<numOut;i++){
+    out[i] = (float)(sf*(cum[(i+1)*blockSize] - cum[i*blockSize]));
+  }
+}
+
+#ifdef JF3_SIMD_X86
+__attribute__((target("sse2")))
+void getBlockSumsSSE2(float *out, const double *cum, const int numOut, const int blockSize, const double sf){
+  int i;
+  const __m128d sfv = _mm_set1_pd(sf);
+  for(i=0;i<(numOut-1);i+=2){
+    __m128d lo = _mm_set_pd(cum[(i+1)*blockSize],cum[i*blockSize]);
+    __m128d hi = _mm_set_pd(cum[(i+2)*blockSize],cum[(i+1)*blockSize]);
+    __m128 vals = _mm_cvtpd_ps(_mm_mul_pd(sfv,_mm_sub_pd(hi,lo)));
+    _mm_store_sd((double*)&out[i],_mm_castps_pd(vals));
+  }
+  getBlockSumsScalar(&out[i],&cum[i*blockSize],numOut-i,blockSize,sf);
+}
+
+__attribute__((target("avx2")))
+void getBlockSumsAVX2(float *out, const double *cum, const int numOut, const int blockSize, const double sf){
+  int i;
+  const __m256d sfv = _mm256_set1_pd(sf);
+  const __m128i offsets = _mm_mullo_epi32(_mm_set_epi32(3,2,1,0),_mm_set1_epi32(blockSize));
+  for(i=0;i<(numOut-3);i+=4){
+    __m256d lo = _mm256_i32gather_pd(&cum[i*blockSize],offsets,8);
+    __m256d hi = _mm256_i32gather_pd(&cum[(i+1)*blockSize],offsets,8);
+    _mm_storeu_ps(&out[i],_mm256_cvtpd_ps(_mm256_mul_pd(sfv,_mm256_sub_pd(hi,lo))));
+  }
+  getBlockSumsScalar(&out[i],&cum[i*blockSize],numOut-i,blockSize,sf);
+}
+#endif
+
+void getBlockSums(float *out, const double *cum, const int numOut, const int blockSize, const double sf){
+  if(numOut <= 0){
+    return;
+  }
+  switch(getSimdLevel()){
+#ifdef JF3_SIMD_X86
+    case 2:
+      getBlockSumsAVX2(out,cum,numOut,blockSize,sf);
+      break;
+    case 1:
+      getBlockSumsSSE2(out,cum,numOut,blockSize,sf);
+      break;
+#endif
+    case 0:
+    default:
+      getBlockSumsScalar(out,cum,numOut,blockSize,sf);
+      break;
+  }
+}
+
+//conversion of imported 32-bit integer or float arrays (eg. from .mca or
+//.fmca files) to spectrum data: out[i] = (double)in[i], for i=0 to num-1
+void convertIntsToDoublesScalar(double *out, const int *in, const int num){
+  int i;
+  for(i=0;i<num;i++){
+    out[i] = (double)in[i];
+  }
+}
+
+void convertFloatsToDoublesScalar(double *out, const float *in, const int num){
+  int i;
+  for(i=0;i<num;i++){
+    out[i] = (double)in[i];
+  }
+}
+
+#ifdef JF3_SIMD_X86
+__attribute__((target("sse2")))
+void convertIntsToDoublesSSE2(double *out, const int *in, const int num){
+  int i;
+  for(i=0;i<(num-3);i+=4){
+    __m128i vals = _mm_loadu_si128((const __m128i*)&in[i]);
+    _mm_storeu_pd(&out[i],_mm_cvtepi32_pd(vals));
+    _mm_storeu_pd(&out[i+2],_mm_cvtepi32_pd(_mm_srli_si128(vals,8)));
+  }
+  convertIntsToDoublesScalar(&out[i],&in[i],num-i);
+}
+
+__attribute__((target("sse2")))
+void convertFloatsToDoublesSSE2(double *out, const float *in, const int num){
+  int i;
+  for(i=0;i<(num-3);i+=4){
+    __m128 vals = _mm_loadu_ps(&in[i]);
+    _mm_storeu_pd(&out[i],_mm_cvtps_pd(vals));
+    _mm_storeu_pd(&out[i+2],_mm_cvtps_pd(_mm_movehl_ps(vals,vals)));
+  }
+  convertFloatsToDoublesScalar(&out[i],&in[i],num-i);
+}
+
+__attribute__((target("avx2")))
+void convertIntsToDoublesAVX2(double *out, const int *in, const int num){
+  int i;
+  for(i=0;i<(num-7);i+=8){
+    _mm256_storeu_pd(&out[i],_mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i*)&in[i])));
+    _mm256_storeu_pd(&out[i+4],_mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i*)&in[i+4])));
+  }
+  convertIntsToDoublesScalar(&out[i],&in[i],num-i);
+}
+
+__attribute__((target("avx2")))
+void convertFloatsToDoublesAVX2(double *out, const float *in, const int num){
+  int i;
+  for(i=0;i<(num-7);i+=8){
+    _mm256_storeu_pd(&out[i],_mm256_cvtps_pd(_mm_loadu_ps(&in[i])));
+    _mm256_storeu_pd(&out[i+4],_mm256_cvtps_pd(_mm_loadu_ps(&in[i+4])));
+  }
+  convertFloatsToDoublesScalar(&out[i],&in[i],num-i);
+}
+#endif
+
+void convertIntsToDoubles(double *out, const int *in, const int num){
+  if(num <= 0){
+    return;
+  }
+  switch(getSimdLevel()){
+#ifdef JF3_SIMD_X86
+    case 2:
+      convertIntsToDoublesAVX2(out,in,num);
+      break;
+    case 1:
+      convertIntsToDoublesSSE2(out,in,num);
+      break;
+#endif
+    case 0:
+    default:
+      convertIntsToDoublesScalar(out,in,num);
+      break;
+  }
+}
+
+void convertFloatsToDoubles(double *out, const float *in, const int num){
+  if(num <= 0){
+    return;
+  }
+  switch(getSimdLevel()){
+#ifdef JF3_SIMD_X86
+    case 2:
+      convertFloatsToDoublesAVX2(out,in,num);
+      break;
+    case 1:
+      convertFloatsToDoublesSSE2(out,in,num);
+      break;
+#endif
+    case 0:
+    default:
+      convertFloatsToDoublesScalar(out,in,num);
+      break;
+  }
+}
+
+//get the number of values in a 32-bit integer (type=0) or float (type=1)
+//array up to and including the last non-zero one
+int getArrayUsedLength(const void *in, const int num, const unsigned char type){
+  int i;
+  if(type == 1){
+    const float *vals = (const float*)in;
+    for(i=num-1;i>=0;i--){
+      if(vals[i] != 0.0f){
+        return i+1;
+      }
+    }
+  }else{
+    const int *vals = (const int*)in;
+    for(i=num-1;i>=0;i--){
+      if(vals[i] != 0){
+        return i+1;
+      }
+    }
+  }
+  return 0;
+}
+
+//convert a 32-bit integer (type=0) or float (type=1) array to spectrum data
+void convertArrayToDoubles(double *out, const void *in, const int num, const unsigned char type){
+  if(type == 1){
+    convertFloatsToDoubles(out,(const float*)in,num);
+  }else{
+    convertIntsToDoubles(out,(const int*)in,num);
+  }
+}
@@ -0,0 +1,771 @@
+/* J. Williams, 2020-2021 */
+
+//This file contains routines for storing spectrum data.
+//Data for each spectrum is allocated separately, sized to the number
+//of channels actually used (up to S32K), and grows on demand when
+//readers write past the end of the allocated region.  Channels beyond
+//the stored length of a spectrum are treated as empty (zero).
+//Cumulative sums are kept for each spectrum so that sums over ranges of
+//channels (eg. for contracted bins) can be taken with a single subtraction,
+//along with a min/max pyramid so that the range of values over any region
+//(eg. for autoscaling or drawing) can be found in O(log n).
+//Spectra are referred to by index (their position in the list of opened
+//spectra), which is mapped to a stable handle identifying the store entry.
+//Deleting or reordering spectra only changes this mapping, the data itself
+//stays in place, and views and comments which refer to spectra by handle
+//don't need to be updated.
+//Routines operating directly on a store entry (sp_store_entry) don't touch
+//any global state, so they may also be used on entries which are not (yet)
+//part of the store, eg. by file readers running on worker threads (see
+//spectrum_import.c).
+//Entries may also be loaded lazily: the reader only records where in a
+//file the data is (see readBinaryArrays and readJF3 in read_data.c), and
+//the data is loaded the first time the entry is accessed through
+//getSpStoreEntry.  The length of such entries is known without loading
+//them, so checking whether spectra are empty doesn't load anything.
+//Entries loaded this way act as a cache of the file: once more than
+//SP_CACHE_CHANNELS channels are loaded, the least recently used entries
+//are unloaded again (and reloaded if they are used later).  Entries are
+//only unloaded when another one is loaded, so a pointer to an entry's
+//data stays valid until a different spectrum is accessed.  Entries which
+//are about to be modified (through getOrAddSpStoreEntry) are detached
+//from their file, and stay in memory.
+
+//free all memory held by a store entry
+void freeSpStoreEntry(sp_store_entry *sp){
+  free(sp->srcFile);
+  free(sp->data);
+  free(sp->cumSum);
+  free(sp->cumAbsSum);
+  freeMinMaxPyramid(&sp->pyr);
+  memset(sp,0,sizeof(sp_store_entry));
+}
+
+//reset the index to handle mapping, must be called before the store is used
+void initSpStore(){
+  int i;
+  for(i=0;i<NSPECT;i++){
+    spstore.spHandle[i] = -1;
+    spstore.spIndex[i] = -1;
+  }
+}
+
+//make sure that store entries exist for at least numSp spectra
+//returns 1 on success, 0 on failure
+int growSpStore(const int numSp){
+  if(numSp <= spstore.numAlloc){
+    return 1;
+  }
+  int newNumAlloc = spstore.numAlloc;
+  if(newNumAlloc < 16){
+    newNumAlloc = 16;
+  }
+  while(newNumAlloc < numSp){
+    newNumAlloc *= 2;
+  }
+  sp_store_entry *newSp = realloc(spstore.sp,(size_t)newNumAlloc*sizeof(sp_store_entry));
+  if(newSp == NULL){
+    printf("ERROR: cannot allocate memory for %i spectra.\n",numSp);
+    return 0;
+  }
+  memset(&newSp[spstore.numAlloc],0,(size_t)(newNumAlloc-spstore.numAlloc)*sizeof(sp_store_entry));
+  spstore.sp = newSp;
+  spstore.numAlloc = newNumAlloc;
+  return 1;
+}
+
+//returns the handle of the spectrum at index spInd, or -1 if there is none
+int getSpHandle(const int spInd){
+  if((spInd < 0)||(spInd >= NSPECT)){
+    return -1;
+  }
+  return spstore.spHandle[spInd];
+}
+
+//returns the index of the spectrum with the given handle, or -1 if the handle is unused
+int getSpIndexFromHandle(const int handle){
+  if((handle < 0)||(handle >= NSPECT)){
+    return -1;
+  }
+  return spstore.spIndex[handle];
+}
+
+//returns the handle of the spectrum at index spInd, assigning
+//an unused handle (with an empty store entry) if there is none
+//returns -1 on failure
+int assignSpHandle(const int spInd){
+  if((spInd < 0)||(spInd >= NSPECT)){
+    return -1;
+  }
+  if(spstore.spHandle[spInd] >= 0){
+    return spstore.spHandle[spInd];
+  }
+  int handle;
+  for(handle=0;handle<NSPECT;handle++){
+    if(spstore.spIndex[handle] < 0){
+      if(growSpStore(handle+1)==0){
+        return -1;
+      }
+      spstore.spHandle[spInd] = handle;
+      spstore.spIndex[handle] = spInd;
+      return handle;
+    }
+  }
+  return -1;
+}
+
+//make sure that at least numCh channels are allocated for a store entry,
+//without changing the stored length
+//returns 1 on success, 0 on failure
+int reserveSpStoreEntryChannels(sp_store_entry *sp, const int numCh){
+  if((numCh < 0)||(numCh > S32K)){
+    return 0;
+  }
+  if(numCh <= sp->allocLength){
+    return 1;
+  }
+  //grow geometrically so that sequential fills don't reallocate on every channel
+  int newAllocLength = sp->allocLength;
+  if(newAllocLength < 1024){
+    newAllocLength = 1024;
+  }
+  while(newAllocLength < numCh){
+    newAllocLength *= 2;
+  }
+  if(newAllocLength > S32K){
+    newAllocLength = S32K;
+  }
+  double *newData = realloc(sp->data,(size_t)newAllocLength*sizeof(double));
+  if(newData == NULL){
+    printf("ERROR: cannot allocate memory for spectrum data (%i channels).\n",newAllocLength);
+    return 0;
+  }
+  sp->data = newData;
+  sp->allocLength = newAllocLength;
+  return 1;
+}
+
+
+//(re)initialize a store entry with numCh empty channels, discarding any data already stored
+//returns a pointer to the data, or NULL on failure
+double *allocSpStoreEntry(sp_store_entry *sp, const int numCh){
+  if(reserveSpStoreEntryChannels(sp,numCh)==0){
+    return NULL;
+  }
+  if(numCh > 0){
+    memset(sp->data,0,(size_t)numCh*sizeof(double));
+  }
+  sp->length = numCh;
+  sp->indexValid = 0; //data pointer is handed to the caller, index is rebuilt later
+  return sp->data;
+}
+
+
+//(re)build the cumulative sums and min/max pyramid for a store entry,
+//should be called once the data has been filled in
+//returns 1 on success, 0 on failure (in which case ranges are taken directly from the data)
+int buildSpStoreEntryIndex(sp_store_entry *sp){
+  sp->indexValid = 0;
+  int i;
+  int hasNegVals = 0;
+  for(i=0;i<sp->length;i++){
+    if(!isfinite(sp->data[i])){
+      //a NaN or infinite value would carry into every later cumulative sum,
+      //so that ranges not containing it would be wrong too
+      return 0;
+    }
+    if(sp->data[i] < 0.){
+      hasNegVals = 1;
+    }
+  }
+  double *newSum = realloc(sp->cumSum,(size_t)(sp->length+1)*sizeof(double));
+  if(newSum == NULL){
+    printf("WARNING: cannot allocate memory for cumulative sums of spectrum data.\n");
+    return 0;
+  }
+  sp->cumSum = newSum;
+  if(hasNegVals){
+    double *newAbsSum = realloc(sp->cumAbsSum,(size_t)(sp->length+1)*sizeof(double));
+    if(newAbsSum == NULL){
+      printf("WARNING: cannot allocate memory for cumulative sums of spectrum data.\n");
+      return 0;
+    }
+    sp->cumAbsSum = newAbsSum;
+    double absSum = 0.; //accumulate in a local, so that each sum doesn't wait on the previous store
+    sp->cumAbsSum[0] = 0.;
+    for(i=0;i<sp->length;i++){
+      absSum += fabs(sp->data[i]);
+      sp->cumAbsSum[i+1] = absSum;
+    }
+  }else{
+    //sums of absolute values are the same as the regular sums
+    free(sp->cumAbsSum);
+    sp->cumAbsSum = NULL;
+  }
+  double sum = 0.;
+  sp->cumSum[0] = 0.;
+  for(i=0;i<sp->length;i++){
+    sum += sp->data[i];
+    sp->cumSum[i+1] = sum;
+  }
+  if(buildMinMaxPyramid(&sp->pyr,sp->data,sp->length)==0){
+    printf("WARNING: cannot allocate memory for min/max pyramid of spectrum data.\n");
+    return 0;
+  }
+  sp->indexValid = 1;
+  return 1;
+}
+
+
+//free the data loaded from the source file of a store entry
+//(the length, and the location of the data in the file are kept, so it can be loaded again)
+void unloadSpStoreEntry(sp_store_entry *sp){
+  free(sp->data);
+  free(sp->cumSum);
+  free(sp->cumAbsSum);
+  freeMinMaxPyramid(&sp->pyr);
+  sp->data = NULL;
+  sp->cumSum = NULL;
+  sp->cumAbsSum = NULL;
+  sp->allocLength = 0;
+  sp->indexValid = 0;
+  sp->srcLoaded = 0;
+}
+
+//stop loading the data of a store entry on demand from its source file,
+//so that the data currently in memory is kept (eg. when it is about to be modified)
+void detachSpStoreEntry(sp_store_entry *sp){
+  free(sp->srcFile);
+  sp->srcFile = NULL;
+  sp->srcLoaded = 0;
+}
+
+//load the data for a lazily loaded store entry from its source file,
+//and build its index
+//returns 1 on success, 0 on failure (in which case the entry is detached from the file and left empty)
+int loadSpStoreEntry(sp_store_entry *sp){
+  int success = 0;
+  if((sp->srcFile == NULL)||(sp->srcLoaded)){
+    return 1; //already loaded
+  }
+  int numCh = sp->length;
+  sp->length = 0;
+  if(numCh > 0){
+    size_t numBytes = (size_t)numCh*4;
+    if(sp->srcType == 2){
+      numBytes = sp->srcLength;
+    }
+    void *buf = malloc(numBytes > 0 ? numBytes : 1);
+    int fd = open(sp->srcFile,O_RDONLY);
+    if((buf != NULL)&&(fd >= 0)){
+      if(pread(fd,buf,numBytes,(off_t)sp->srcOffset) == (ssize_t)numBytes){
+        double *data = allocSpStoreEntry(sp,numCh);
+        if(data != NULL){
+          if(sp->srcType == 2){
+            success = decodeSpectrum(buf,numBytes,sp->srcCodec,data,numCh); //see spectrum_codec.c
+          }else{
+            convertArrayToDoubles(data,buf,numCh,sp->srcType); //see spectrum_kernels.c
+            success = 1;
+          }
+        }
+      }
+    }
+    if(fd >= 0){
+      close(fd);
+    }
+    free(buf);
+  }else{
+    success = 1;
+  }
+  if(success == 0){
+    printf("WARNING: cannot load spectrum data from file %s, the spectrum will be empty.\n",sp->srcFile);
+    sp->length = 0;
+    detachSpStoreEntry(sp);
+  }else{
+    sp->length = numCh;
+    sp->srcLoaded = 1;
+  }
+  buildSpStoreEntryIndex(sp);
+  return success;
+}
+
+//unload the least recently used store entries loaded from files on demand,
+//until numCh more channels can be loaded without exceeding SP_CACHE_CHANNELS
+//(the entry keep is never unloaded)
+void makeSpCacheSpace(const int numCh, const sp_store_entry *keep){
+  while(1){
+    int i;
+    long numLoadedCh = 0;
+    sp_store_entry *lru = NULL;
+    for(i=0;i<spstore.numAlloc;i++){
+      sp_store_entry *sp = &spstore.sp[i];
+      if((sp->srcFile != NULL)&&(sp->srcLoaded)){
+        numLoadedCh += sp->length;
+        if((sp != keep)&&((lru == NULL)||((spstore.useCounter - sp->lastUsed) > (spstore.useCounter - lru->lastUsed)))){
+          lru = sp;
+        }
+      }
+    }
+    if((numLoadedCh + numCh <= SP_CACHE_CHANNELS)||(lru == NULL)){
+      return;
+    }
+    unloadSpStoreEntry(lru);
+  }
+}
+
+//make sure that the data of a store entry in the store is loaded, if it is loaded on demand,
+//and mark it as used
+void useSpStoreEntry(sp_store_entry *sp){
+  if(sp->srcFile == NULL){
+    return;
+  }
+  if(sp->srcLoaded == 0){
+    makeSpCacheSpace(sp->length,sp);
+    loadSpStoreEntry(sp);
+  }
+  sp->lastUsed = ++spstore.useCounter;
+}
+
+//load and detach the data of all store entries loaded on demand from a file,
+//must be called before the file is overwritten
+void detachSpStoreFile(const char *filename){
+  struct stat fileStat, srcStat;
+  int i;
+  if(stat(filename,&fileStat)!=0){
+    return; //file doesn't exist yet
+  }
+  for(i=0;i<spstore.numAlloc;i++){
+    sp_store_entry *sp = &spstore.sp[i];
+    if(sp->srcFile == NULL){
+      continue;
+    }
+    if(stat(sp->srcFile,&srcStat)!=0){
+      continue;
+    }
+    if((srcStat.st_dev == fileStat.st_dev)&&(srcStat.st_ino == fileStat.st_ino)){
+      loadSpStoreEntry(sp);
+      detachSpStoreEntry(sp);
+    }
+  }
+}
+
+//get the store entry for the spectrum at index spInd without loading
+//lazily loaded data (only the length of the entry may be used), or NULL if there is none
+sp_store_entry *peekSpStoreEntry(const int spInd){
+  int handle = getSpHandle(spInd);
+  if((handle < 0)||(handle >= spstore.numAlloc)){
+    return NULL;
+  }
+  return &spstore.sp[handle];
+}
+
+//get the store entry for the spectrum at index spInd for reading, or NULL if there is none
+sp_store_entry *getSpStoreEntry(const int spInd){
+  sp_store_entry *sp = peekSpStoreEntry(spInd);
+  if(sp != NULL){
+    useSpStoreEntry(sp);
+  }
+  return sp;
+}
+
+//get the store entry for the spectrum at index spInd for modification,
+//creating an empty one if needed
+//returns NULL on failure
+sp_store_entry *getOrAddSpStoreEntry(const int spInd){
+  int handle = assignSpHandle(spInd);
+  if(handle < 0){
+    return NULL;
+  }
+  sp_store_entry *sp = &spstore.sp[handle];
+  if(sp->srcFile != NULL){
+    useSpStoreEntry(sp);
+    detachSpStoreEntry(sp); //modified data can't be reloaded from the file
+  }
+  return sp;
+}
+
+//make sure that at least numCh channels are allocated for the spectrum
+//at index spInd, without changing the stored length
+//returns 1 on success, 0 on failure
+int reserveSpectrumChannels(const int spInd, const int numCh){
+  if(spInd < 0){
+    return 0;
+  }
+  sp_store_entry *sp = getOrAddSpStoreEntry(spInd);
+  if(sp == NULL){
+    return 0;
+  }
+  return reserveSpStoreEntryChannels(sp,numCh);
+}
+
+//(re)initialize the spectrum at index spInd with numCh empty channels,
+//discarding any data already stored there
+//returns a pointer to the spectrum data, or NULL on failure
+double *allocSpectrum(const int spInd, const int numCh){
+  sp_store_entry *sp = getOrAddSpStoreEntry(spInd);
+  if(sp == NULL){
+    return NULL;
+  }
+  spstore.generation++;
+  return allocSpStoreEntry(sp,numCh);
+}
+
+//empty the spectrum at index spInd (memory is kept for reuse)
+void clearSpectrum(const int spInd){
+  sp_store_entry *sp = getOrAddSpStoreEntry(spInd);
+  if(sp != NULL){
+    sp->length = 0;
+    sp->indexValid = 0;
+    spstore.generation++;
+  }
+}
+
+//free the memory used by the spectrum at index spInd (its handle is kept)
+void freeSpectrum(const int spInd){
+  sp_store_entry *sp = peekSpStoreEntry(spInd);
+  if(sp != NULL){
+    freeSpStoreEntry(sp);
+    spstore.generation++;
+  }
+}
+
+//free all stored spectrum data
+void freeSpStore(){
+  int i;
+  for(i=0;i<spstore.numAlloc;i++){
+    freeSpStoreEntry(&spstore.sp[i]);
+  }
+  free(spstore.sp);
+  spstore.sp = NULL;
+  spstore.numAlloc = 0;
+  spstore.generation++;
+  initSpStore();
+}
+
+//returns the number of channels stored for a spectrum
+int getSpectrumLength(const int spInd){
+  const sp_store_entry *sp = peekSpStoreEntry(spInd);
+  if(sp == NULL){
+    return 0;
+  }
+  return sp->length;
+}
+
+//returns a pointer to the data for a spectrum (valid up to getSpectrumLength channels),
+//or NULL if there is no data (the data may be unloaded when another spectrum is accessed)
+const double *getSpectrumData(const int spInd){
+  sp_store_entry *sp = getSpStoreEntry(spInd);
+  if(sp == NULL){
+    return NULL;
+  }
+  return sp->data;
+}
+
+//get the value of a single channel, channels outside of the stored data are empty
+double getSpectrumBinVal(const int spInd, const int ch){
+  const sp_store_entry *sp = getSpStoreEntry(spInd);
+  if((sp == NULL)||(ch < 0)||(ch >= sp->length)){
+    return 0.;
+  }
+  return sp->data[ch];
+}
+
+//set the value of a single channel of a store entry, extending the stored data if needed
+//returns 1 on success, 0 on failure (eg. channel out of range)
+int setSpStoreEntryBinVal(sp_store_entry *sp, const int ch, const double val){
+  if((ch < 0)||(ch >= S32K)){
+    return 0;
+  }
+  if(ch >= sp->length){
+    if(val == 0.){
+      return 1; //channels past the end are already empty
+    }
+    if(reserveSpStoreEntryChannels(sp,ch+1)==0){
+      return 0;
+    }
+    memset(&sp->data[sp->length],0,(size_t)(ch+1-sp->length)*sizeof(double));
+    sp->length = ch+1;
+  }
+  sp->data[ch] = val;
+  sp->indexValid = 0;
+  return 1;
+}
+
+//set the value of a single channel, extending the spectrum if needed
+//returns 1 on success, 0 on failure (eg. channel out of range)
+int setSpectrumBinVal(const int spInd, const int ch, const double val){
+  if((ch < 0)||(ch >= S32K)){
+    return 0;
+  }
+  if((ch >= getSpectrumLength(spInd))&&(val == 0.)){
+    return 1; //channels past the end are already empty
+  }
+  sp_store_entry *sp = getOrAddSpStoreEntry(spInd);
+  if(sp == NULL){
+    return 0;
+  }
+  spstore.generation++;
+  return setSpStoreEntryBinVal(sp,ch,val);
+}
+
+//(re)build the cumulative sums and min/max pyramid for the spectrum at index spInd,
+//should be called once the data for a spectrum has been filled in
+//returns 1 on success, 0 on failure (in which case ranges are taken directly from the data)
+int buildSpectrumIndex(const int spInd){
+  sp_store_entry *sp = getSpStoreEntry(spInd);
+  if(sp == NULL){
+    return 0;
+  }
+  spstore.generation++;
+  return buildSpStoreEntryIndex(sp);
+}
+
+//get the sum of channels startCh to endCh-1 (inclusive) of a spectrum,
+//channels outside of the stored data are empty
+//if useAbsVal is set, the sum of the absolute values of the channels is returned
+double getSpectrumRangeSumOrAbsSum(const int spInd, int startCh, int endCh, const int useAbsVal){
+  const sp_store_entry *sp = getSpStoreEntry(spInd);
+  if(sp == NULL){
+    return 0.;
+  }
+  if(startCh < 0){
+    startCh = 0;
+  }
+  if(endCh > sp->length){
+    endCh = sp->length;
+  }
+  if(startCh >= endCh){
+    return 0.;
+  }
+  if(sp->indexValid){
+    if(useAbsVal && (sp->cumAbsSum != NULL)){
+      return sp->cumAbsSum[endCh] - sp->cumAbsSum[startCh];
+    }
+    return sp->cumSum[endCh] - sp->cumSum[startCh];
+  }
+  //sums not available (data is still being filled in), sum directly
+  int i;
+  double sum = 0.;
+  for(i=startCh;i<endCh;i++){
+    if(useAbsVal){
+      sum += fabs(sp->data[i]);
+    }else{
+      sum += sp->data[i];
+    }
+  }
+  return sum;
+}
+double getSpectrumRangeSum(const int spInd, const int startCh, const int endCh){
+  return getSpectrumRangeSumOrAbsSum(spInd,startCh,endCh,0);
+}
+double getSpectrumRangeAbsSum(const int spInd, const int startCh, const int endCh){
+  return getSpectrumRangeSumOrAbsSum(spInd,startCh,endCh,1);
+}
+
+//get (or add to out, if accumulate is set) the scaled sum of windowSize
+//channels starting at each of channels 0 to numOut-1 of a spectrum
+//if useAbsVal is set, absolute values of the channels are summed
+void getSpectrumWindowSums(const int spInd, float *out, const int numOut, const int windowSize, const double sf, const int useAbsVal, const int accumulate){
+  int i;
+  const sp_store_entry *sp = getSpStoreEntry(spInd);
+  int length = (sp != NULL) ? sp->length : 0; //taken after loading, in case the data couldn't be loaded
+  int numFull = 0; //number of windows lying entirely within the stored data
+  if((length > 0)&&(sp->indexValid)){
+    const double *cum = sp->cumSum;
+    if(useAbsVal && (sp->cumAbsSum != NULL)){
+      cum = sp->cumAbsSum;
+    }
+    numFull = length - windowSize + 1;
+    if(numFull > numOut){
+      numFull = numOut;
+    }
+    if(numFull < 0){
+      numFull = 0;
+    }
+    addWindowSums(out,cum,numFull,windowSize,sf,accumulate); //see spectrum_kernels.c
+  }
+  //windows running past the end of the data
+  for(i=numFull;i<numOut;i++){
+    if(i >= length){
+      if(!accumulate){
+        memset(&out[i],0,(size_t)(numOut-i)*sizeof(float));
+      }
+      break;
+    }
+    if(accumulate){
+      out[i] += (float)(sf*getSpectrumRangeSumOrAbsSum(spInd,i,i+windowSize,useAbsVal));
+    }else{
+      out[i] = (float)(sf*getSpectrumRangeSumOrAbsSum(spInd,i,i+windowSize,useAbsVal));
+    }
+  }
+}
+
+//get the scaled sums of consecutive non-overlapping blocks of blockSize
+//channels of a spectrum, starting at channel 0 (ie. contracted bins)
+void getSpectrumBlockSums(const int spInd, float *out, const int numOut, const int blockSize, const double sf){
+  int i;
+  const sp_store_entry *sp = getSpStoreEntry(spInd);
+  int length = (sp != NULL) ? sp->length : 0; //taken after loading, in case the data couldn't be loaded
+  int numFull = 0; //number of blocks lying entirely within the stored data
+  if((length > 0)&&(blockSize > 0)&&(sp->indexValid)){
+    numFull = length/blockSize;
+    if(numFull > numOut){
+      numFull = numOut;
+    }
+    getBlockSums(out,sp->cumSum,numFull,blockSize,sf); //see spectrum_kernels.c
+  }
+  //blocks running past the end of the data
+  for(i=numFull;i<numOut;i++){
+    out[i] = (float)(sf*getSpectrumRangeSum(spInd,i*blockSize,(i+1)*blockSize));
+  }
+}
+
+//get the minimum and maximum values over channels startCh to endCh-1 (inclusive)
+//of a spectrum, channels outside of the stored data are empty
+//minVal and maxVal are only changed if the range contains values beyond them
+void getSpectrumRangeMinMax(const int spInd, const int startCh, const int endCh, float *minVal, float *maxVal){
+  if(startCh >= endCh){
+    return;
+  }
+  int length = getSpectrumLength(spInd);
+  if((startCh < 0)||(endCh > length)){
+    //range includes empty channels
+    if(*minVal > 0.0f) *minVal = 0.0f;
+    if(*maxVal < 0.0f) *maxVal = 0.0f;
+  }
+  if((length == 0)||(startCh >= length)||(endCh <= 0)){
+    return;
+  }
+  const sp_store_entry *sp = getSpStoreEntry(spInd);
+  if(sp->length != length){
+    return; //data couldn't be loaded
+  }
+  if(sp->indexValid){
+    getMinMaxPyramidRange(&sp->pyr,sp->data,startCh,endCh,minVal,maxVal);
+  }else{
+    //pyramid not available (data is still being filled in), scan directly
+    int i;
+    int endInd = (endCh < length) ? endCh : length;
+    for(i=(startCh > 0) ? startCh : 0;i<endInd;i++){
+      if((float)sp->data[i] < *minVal) *minVal = (float)sp->data[i];
+      if((float)sp->data[i] > *maxVal) *maxVal = (float)sp->data[i];
+    }
+  }
+}
+
+//get the number of channels of a store entry up to and including the last non-empty one
+int getSpStoreEntryUsedLength(const sp_store_entry *sp){
+  int i;
+  if(sp->srcFile != NULL){
+    return sp->length; //loaded on demand, length was trimmed when read in
+  }
+  for(i=sp->length-1;i>=0;i--){
+    if(sp->data[i] != 0.){
+      return i+1;
+    }
+  }
+  return 0;
+}
+
+//get the number of channels up to and including the last non-empty one
+int getSpectrumUsedLength(const int spInd){
+  const sp_store_entry *sp = peekSpStoreEntry(spInd);
+  if(sp == NULL){
+    return 0;
+  }
+  return getSpStoreEntryUsedLength(sp);
+}
+
+//returns 1 if the spectrum contains no data, 0 otherwise
+int isSpectrumEmpty(const int spInd){
+  return (getSpectrumUsedLength(spInd) == 0);
+}
+
+//shrink a store entry down to the channels actually containing data, and build its index
+void trimSpStoreEntry(sp_store_entry *sp){
+  if(sp->srcFile != NULL){
+    return; //loaded on demand, already trimmed (index is built when loaded)
+  }
+  sp->length = getSpStoreEntryUsedLength(sp);
+  if(sp->length == 0){
+    free(sp->data);
+    sp->data = NULL;
+    sp->allocLength = 0;
+  }else if(sp->length < sp->allocLength){
+    double *newData = realloc(sp->data,(size_t)sp->length*sizeof(double));
+    if(newData != NULL){
+      sp->data = newData;
+      sp->allocLength = sp->length;
+    }
+  }
+  buildSpStoreEntryIndex(sp);
+}
+
+//shrink the spectrum at index spInd down to the channels actually containing data
+void trimSpectrum(const int spInd){
+  sp_store_entry *sp = getSpStoreEntry(spInd);
+  if(sp == NULL){
+    return;
+  }
+  trimSpStoreEntry(sp);
+  spstore.generation++;
+}
+
+//place the data held by a store entry (eg. one filled in by a file reader)
+//at index spInd, discarding anything previously stored there
+//the source entry is left empty (the data is not copied)
+//returns 1 on success, 0 on failure
+int adoptSpStoreEntry(const int spInd, sp_store_entry *src){
+  sp_store_entry *sp = getOrAddSpStoreEntry(spInd);
+  if(sp == NULL){
+    return 0;
+  }
+  freeSpStoreEntry(sp);
+  memcpy(sp,src,sizeof(sp_store_entry));
+  memset(src,0,sizeof(sp_store_entry));
+  spstore.generation++;
+  return 1;
+}
+
+//move the spectrum at index srcInd to index destInd, freeing anything
+//previously stored at destInd and leaving srcInd empty
+//(only the handle is moved, the data itself is not copied)
+void moveSpectrum(const int destInd, const int srcInd){
+  if((destInd == srcInd)||(destInd < 0)||(destInd >= NSPECT)||(srcInd < 0)||(srcInd >= NSPECT)){
+    return;
+  }
+  int destHandle = spstore.spHandle[destInd];
+  if(destHandle >= 0){
+    freeSpStoreEntry(&spstore.sp[destHandle]);
+    spstore.spIndex[destHandle] = -1;
+  }
+  spstore.spHandle[destInd] = spstore.spHandle[srcInd];
+  spstore.spHandle[srcInd] = -1;
+  if(spstore.spHandle[destInd] >= 0){
+    spstore.spIndex[spstore.spHandle[destInd]] = destInd;
+  }
+  spstore.generation++;
+}
+
+//remove the spectrum at index spInd from the store, shifting the
+//following numSp-spInd-1 spectra down by one index
+//(only the index to handle mapping is shifted, the data itself is not moved)
+void removeSpectrumFromStore(const int spInd, const int numSp){
+  if((spInd < 0)||(spInd >= numSp)||(numSp > NSPECT)){
+    return;
+  }
+  int i;
+  int handle = spstore.spHandle[spInd];
+  if(handle >= 0){
+    freeSpStoreEntry(&spstore.sp[handle]);
+    spstore.spIndex[handle] = -1;
+  }
+  for(i=spInd;i<(numSp-1);i++){
+    spstore.spHandle[i] = spstore.spHandle[i+1];
+    if(spstore.spHandle[i] >= 0){
+      spstore.spIndex[spstore.spHandle[i]] = i;
+    }
+  }
+  spstore.spHandle[numSp-1] = -1;
+  spstore.generation++;
+}
@@ -166,4 +166,267 @@ int getNSigf(const double val, const double oomVal){
   }
 
   return sigf;
-}
\ No newline at end of file
+}
+//parse a floating point number from the start of a string, giving the same
+//result as strtod (which is used as a fallback for anything other than
+//plain decimal numbers of up to 15 significant digits, eg. 'inf', hex, or
+//very large exponents)
+//if end is not NULL, it is set to point to the first character after the number
+double parseDouble(const char *str, char **end){
+  static const double pow10[23] = {1e0,1e1,1e2,1e3,1e4,1e5,1e6,1e7,1e8,1e9,1e10,1e11,1e12,1e13,1e14,1e15,1e16,1e17,1e18,1e19,1e20,1e21,1e22};
+  const char *s = str;
+  long long unsigned int mant = 0;
+  int numSigDigits = 0;
+  int exp10 = 0;
+  int neg = 0;
+
+  while((*s == ' ')||(*s == '\t')){
+    s++;
+  }
+  if(*s == '-'){
+    neg = 1;
+    s++;
+  }else if(*s == '+'){
+    s++;
+  }
+  const char *digitStart = s;
+  while(*s == '0'){
+    s++; //leading zeros aren't significant
+  }
+  while((*s >= '0')&&(*s <= '9')){
+    mant = mant*10 + (long long unsigned int)(*s - '0');
+    numSigDigits++;
+    s++;
+  }
+  if(*s == '.'){
+    s++;
+    if(mant == 0){
+      while(*s == '0'){
+        exp10--;
+        s++;
+      }
+    }
+    while((*s >= '0')&&(*s <= '9')){
+      mant = mant*10 + (long long unsigned int)(*s - '0');
+      numSigDigits++;
+      exp10--;
+      s++;
+    }
+  }
+  if((s == digitStart)||((s == digitStart+1)&&(*digitStart == '.'))||(*s == 'x')||(*s == 'X')){
+    return strtod(str,end); //not a plain decimal number
+  }
+  if(numSigDigits > 15){
+    return strtod(str,end); //mantissa may not be exactly representable
+  }
+  if((*s == 'e')||(*s == 'E')){
+    const char *e = s + 1;
+    int expNeg = 0;
+    int expVal = 0;
+    if(*e == '-'){
+      expNeg = 1;
+      e++;
+    }else if(*e == '+'){
+      e++;
+    }
+    if((*e >= '0')&&(*e <= '9')){
+      while((*e >= '0')&&(*e <= '9')){
+        if(expVal < 10000){
+          expVal = expVal*10 + (*e - '0');
+        }
+        e++;
+      }
+      exp10 += expNeg ? -expVal : expVal;
+      s = e;
+    }
+  }
+  //mantissa is exactly representable, so a single multiplication or
+  //division by an exactly representable power of 10 is correctly rounded
+  if((exp10 < -22)||(exp10 > 22)){
+    return strtod(str,end);
+  }
+  double val = (double)mant;
+  if(exp10 < 0){
+    val /= pow10[-exp10];
+  }else{
+    val *= pow10[exp10];
+  }
+  if(end != NULL){
+    *end = (char*)s;
+  }
+  return neg ? -val : val;
+}
+
+//build a min/max pyramid over an array of values, so that the minimum
+//and maximum over any range of values can be found in O(log n)
+//returns 1 on success, 0 on failure
+int buildMinMaxPyramid(minmax_pyramid *pyr, const double *vals, const int length){
+  int i,l;
+  int numNodes = 0;
+  int levelLength = length;
+  pyr->numLevels = 0;
+  while(levelLength > 1){
+    levelLength = (levelLength+1)/2;
+    pyr->levelStart[pyr->numLevels] = numNodes;
+    numNodes += levelLength;
+    pyr->numLevels++;
+  }
+  pyr->length = 0;
+  if(numNodes > 0){
+    float *newMin = realloc(pyr->min,(size_t)numNodes*sizeof(float));
+    if(newMin == NULL){
+      return 0;
+    }
+    pyr->min = newMin;
+    float *newMax = realloc(pyr->max,(size_t)numNodes*sizeof(float));
+    if(newMax == NULL){
+      return 0;
+    }
+    pyr->max = newMax;
+  }
+  if(pyr->numLevels == 0){
+    //single value (or none), nothing above the values themselves
+    pyr->length = length;
+    return 1;
+  }
+  //first level, from the values themselves
+  levelLength = (length+1)/2;
+  for(i=0;i<levelLength;i++){
+    if((2*i+1) < length){
+      //plain comparisons rather than fmin/fmax, which aren't inlined
+      pyr->min[i] = (float)((vals[2*i+1] < vals[2*i]) ? vals[2*i+1] : vals[2*i]);
+      pyr->max[i] = (float)((vals[2*i+1] > vals[2*i]) ? vals[2*i+1] : vals[2*i]);
+    }else{
+      pyr->min[i] = (float)vals[2*i];
+      pyr->max[i] = (float)vals[2*i];
+    }
+  }
+  //higher levels, from the level below
+  for(l=1;l<pyr->numLevels;l++){
+    int lowerStart = pyr->levelStart[l-1];
+    int lowerLength = pyr->levelStart[l] - lowerStart;
+    int start = pyr->levelStart[l];
+    levelLength = (lowerLength+1)/2;
+    for(i=0;i<levelLength;i++){
+      pyr->min[start+i] = pyr->min[lowerStart+2*i];
+      pyr->max[start+i] = pyr->max[lowerStart+2*i];
+      if((2*i+1) < lowerLength){
+        if(pyr->min[lowerStart+2*i+1] < pyr->min[start+i]){
+          pyr->min[start+i] = pyr->min[lowerStart+2*i+1];
+        }
+        if(pyr->max[lowerStart+2*i+1] > pyr->max[start+i]){
+          pyr->max[start+i] = pyr->max[lowerStart+2*i+1];
+        }
+      }
+    }
+  }
+  pyr->length = length;
+  return 1;
+}
+
+void freeMinMaxPyramid(minmax_pyramid *pyr){
+  free(pyr->min);
+  free(pyr->max);
+  memset(pyr,0,sizeof(minmax_pyramid));
+}
+
+//get the minimum and maximum of values startInd to endInd-1 (inclusive),
+//using a pyramid built from the same values
+//minVal and maxVal are only changed if the range contains values beyond them
+void getMinMaxPyramidRange(const minmax_pyramid *pyr, const double *vals, int startInd, int endInd, float *minVal, float *maxVal){
+  if(startInd < 0){
+    startInd = 0;
+  }
+  if(endInd > pyr->length){
+    endInd = pyr->length;
+  }
+  //level 0 (the values themselves)
+  if(startInd < endInd){
+    if(startInd & 1){
+      if((float)vals[startInd] < *minVal) *minVal = (float)vals[startInd];
+      if((float)vals[startInd] > *maxVal) *maxVal = (float)vals[startInd];
+      startInd++;
+    }
+    if(endInd & 1){
+      endInd--;
+      if((float)vals[endInd] < *minVal) *minVal = (float)vals[endInd];
+      if((float)vals[endInd] > *maxVal) *maxVal = (float)vals[endInd];
+    }
+    startInd /= 2;
+    endInd /= 2;
+  }
+  //higher levels
+  int l = 0;
+  while((startInd < endInd)&&(l < pyr->numLevels)){
+    int start = pyr->levelStart[l];
+    if(startInd & 1){
+      if(pyr->min[start+startInd] < *minVal) *minVal = pyr->min[start+startInd];
+      if(pyr->max[start+startInd] > *maxVal) *maxVal = pyr->max[start+startInd];
+      startInd++;
+    }
+    if(endInd & 1){
+      endInd--;
+      if(pyr->min[start+endInd] < *minVal) *minVal = pyr->min[start+endInd];
+      if(pyr->max[start+endInd] > *maxVal) *maxVal = pyr->max[start+endInd];
+    }
+    startInd /= 2;
+    endInd /= 2;
+    l++;
+  }
+}
+
+//append len bytes to a byte buffer, growing it as needed
+//returns 1 on success, 0 on failure (the error is also recorded in the buffer)
+int appendByteBuffer(byte_buffer *buf, const void *bytes, const size_t len){
+  if(buf->err){
+    return 0;
+  }
+  if(buf->length + len > buf->allocLength){
+    size_t newAllocLength = (buf->allocLength < 4096) ? 4096 : buf->allocLength;
+    while(newAllocLength < buf->length + len){
+      newAllocLength *= 2;
+    }
+    unsigned char *newData = realloc(buf->data,newAllocLength);
+    if(newData == NULL){
+      buf->err = 1;
+      return 0;
+    }
+    buf->data = newData;
+    buf->allocLength = newAllocLength;
+  }
+  if(len > 0){
+    memcpy(&buf->data[buf->length],bytes,len);
+  }
+  buf->length += len;
+  return 1;
+}
+
+//append printf-style formatted text (without the terminating null) to a byte buffer
+//returns 1 on success, 0 on failure
+int appendByteBufferf(byte_buffer *buf, const char *format, ...){
+  char str[1024];
+  va_list args;
+  va_start(args,format);
+  int len = vsnprintf(str,sizeof(str),format,args);
+  va_end(args);
+  if(len < 0){
+    buf->err = 1;
+    return 0;
+  }
+  if((size_t)len >= sizeof(str)){
+    len = (int)sizeof(str) - 1; //truncated
+  }
+  return appendByteBuffer(buf,str,(size_t)len);
+}
+
+//free the memory used by a byte buffer
+void freeByteBuffer(byte_buffer *buf){
+  free(buf->data);
+  memset(buf,0,sizeof(byte_buffer));
+}
+
+//get the position of the name of a file in its path
+const char *getFileBasename(const char *path){
+  const char *slash = strrchr(path,'/');
+  return (slash != NULL) ? slash+1 : path;
+}
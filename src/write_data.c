@@ -1,180 +1,607 @@
 /* J. Williams, 2020-2021 */
 
-//routine to write a .jf3 file
-//header containing: file format version number (unsigned char), number of spectra (unsigned char), label for each spactrum (each 256 element char array),
-//number of comments (unsigned char), individual comments (comment sp (char), ch (int32), y-val (float32), followed by a 256 element char array for the comment itself)
-//spectrum data is compressed using a basic RLE method: packet header (signed char) specifying number of elements to repeat, then the element as a 32-bit float
-//alternatively, the packet header may be a negative number -n, in which case n non-repeating elements follow as 32-bit floats
-//if the packet header is 0, that is the end of the spectrum  
-int writeJF3(const char *filename, double inpHist[NSPECT][S32K])
-{
-  int i, j, k;
-  FILE *out;
-  unsigned char ucharBuf;
-  unsigned int uintBuf;
-
-  if ((out = fopen(filename, "w")) == NULL) //open the file
-  {
-    printf("ERROR: Cannot open the output file: %s\n", filename);
-    printf("The file may not be accesible.\n");
-    return 1;
+//This file contains functions for writing spectra to files.
+//Files are written in two steps: a snapshot of the data to write is taken
+//into a save_job on the main thread (taking care of everything which
+//touches global data, such as loading spectra and encoding them), which is
+//then written out with a few large writes.  That second step can run on a
+//worker thread (see startSaveThread), so that the GUI isn't held up while
+//large sessions are written.  Files are written to a temporary file which
+//replaces the original once it has been fully written, so that a failed
+//save doesn't leave behind a partially written file.
+//Saving a session to the .jf3 file it was opened from or last saved to is
+//incremental: only spectra which changed since (and the metadata, if it
+//changed) are appended to the file, followed by a new directory, after which
+//the superblock at the start of the file is pointed at the new sections.
+//Once most of the file is taken up by data which is no longer used, the
+//whole file is rewritten instead.
+
+#define JF3_COMPACT_MIN_BYTES 1048576 //minimum number of unused bytes in a .jf3 file before it is rewritten when saving
+#define SAVE_CHUNK_BYTES      1048576 //amount of data to build up before writing it to a file
+
+//free all memory held by a save job
+void freeSaveJob(save_job *job){
+  int i;
+  freeByteBuffer(&job->header);
+  freeByteBuffer(&job->trailer);
+  freeByteBuffer(&job->spData);
+  if(job->sp != NULL){
+    for(i=0;i<job->numSp;i++){
+      free(job->sp[i].srcFile);
+    }
+    free(job->sp);
   }
+  free(job->vals);
+  memset(job,0,sizeof(save_job));
+}
 
-  //printf("Number of spectra to write: %i\n",rawdata.numSpOpened);
+//get the name of the temporary file a save job is written to before replacing the original
+void getSaveTmpFilename(const save_job *job, char *tmpFilename, const size_t len){
+  snprintf(tmpFilename,len,"%s.tmp",job->filename);
+}
+
+//write a string as a length (unsigned char) followed by the characters (at most 255)
+void appendJF3String(byte_buffer *buf, const char *str){
+  size_t len = strnlen(str,255);
+  unsigned char ucharBuf = (unsigned char)len;
+  appendByteBuffer(buf,&ucharBuf,sizeof(unsigned char));
+  appendByteBuffer(buf,str,len);
+}
 
-  ucharBuf = 2; //file format version number
-  fwrite(&ucharBuf,sizeof(unsigned char),1,out);
-  ucharBuf = rawdata.numSpOpened; //number of spectra to write
-  fwrite(&ucharBuf,sizeof(unsigned char),1,out);
+//encode the metadata section of a .jf3 file: number of spectra (uint32),
+//calibration parameters (cal_params), label for each spectrum (string),
+//number of comments (uint32), individual comments (view (unsigned char), sp (uint32), ch (int32), y-val (float32), comment (string)),
+//number of views (uint32), individual views (comment (string), multiplot mode (unsigned char), number of spectra (uint32),
+//spectrum indices (uint32 each), scaling factors (double each))
+//strings are stored as a length (unsigned char) followed by the characters
+void encodeJF3Metadata(byte_buffer *buf){
+  int i, j;
+  unsigned int uintBuf;
+
+  uintBuf = (unsigned int)rawdata.numSpOpened; //number of spectra to write
+  appendByteBuffer(buf,&uintBuf,sizeof(unsigned int));
+  //write calibration parameters
+  appendByteBuffer(buf,&calpar,sizeof(calpar));
+  //write labels
   for(i=0;i<rawdata.numSpOpened;i++){
-    fwrite(&rawdata.histComment[i],sizeof(rawdata.histComment[i]),1,out);
+    appendJF3String(buf,rawdata.histComment[i]);
   }
-  //write calibration parameters
-  fwrite(&calpar,sizeof(calpar),1,out);
   //write comments
-  uintBuf = rawdata.numChComments; //number of comments to write
-  fwrite(&uintBuf,sizeof(unsigned int),1,out);
-  for(i=0;i<rawdata.numChComments;i++){
-    fwrite(&rawdata.chanCommentView[i],sizeof(rawdata.chanCommentView[i]),1,out);
-    fwrite(&rawdata.chanCommentSp[i],sizeof(rawdata.chanCommentSp[i]),1,out);
-    fwrite(&rawdata.chanCommentCh[i],sizeof(rawdata.chanCommentCh[i]),1,out);
-    fwrite(&rawdata.chanCommentVal[i],sizeof(rawdata.chanCommentVal[i]),1,out);
-    fwrite(&rawdata.chanComment[i],sizeof(rawdata.chanComment[i]),1,out);
+  uintBuf = (unsigned int)comstore.numComments; //number of comments to write
+  appendByteBuffer(buf,&uintBuf,sizeof(unsigned int));
+  for(i=0;i<comstore.numUsed;i++){
+    const chan_comment *com = getComment(i);
+    if(com == NULL){
+      continue; //deleted comment
+    }
+    appendByteBuffer(buf,&com->view,sizeof(com->view));
+    if(com->view == 1){
+      uintBuf = (unsigned int)com->sp;
+    }else{
+      uintBuf = (unsigned int)getSpIndexFromHandle(com->sp); //comments refer to spectra by handle
+    }
+    appendByteBuffer(buf,&uintBuf,sizeof(unsigned int));
+    appendByteBuffer(buf,&com->ch,sizeof(com->ch));
+    appendByteBuffer(buf,&com->val,sizeof(com->val));
+    appendJF3String(buf,com->text);
   }
   //write views
   uintBuf = rawdata.numViews; //number of views to write
-  fwrite(&uintBuf,sizeof(unsigned int),1,out);
+  appendByteBuffer(buf,&uintBuf,sizeof(unsigned int));
   for(i=0;i<rawdata.numViews;i++){
-    fwrite(&rawdata.viewComment[i],sizeof(rawdata.viewComment[i]),1,out);
-    fwrite(&rawdata.viewMultiplotMode[i],sizeof(unsigned char),1,out);
-    fwrite(&rawdata.viewNumMultiplotSp[i],sizeof(unsigned char),1,out);
+    appendJF3String(buf,rawdata.viewComment[i]);
+    appendByteBuffer(buf,&rawdata.viewMultiplotMode[i],sizeof(unsigned char));
+    uintBuf = (unsigned int)rawdata.viewNumMultiplotSp[i];
+    appendByteBuffer(buf,&uintBuf,sizeof(unsigned int));
     for(j=0;j<rawdata.viewNumMultiplotSp[i];j++){
-      fwrite(&rawdata.viewMultiPlots[i][j],sizeof(unsigned char),1,out);
+      uintBuf = (unsigned int)getSpIndexFromHandle(rawdata.viewMultiPlots[i][j]); //views refer to spectra by handle
+      appendByteBuffer(buf,&uintBuf,sizeof(unsigned int));
     }
-    for(j=0;j<rawdata.viewNumMultiplotSp[i];j++){
-      fwrite(&rawdata.viewScaleFactor[i][rawdata.viewMultiPlots[i][j]],sizeof(double),1,out);
+    appendByteBuffer(buf,rawdata.viewScaleFactor[i],sizeof(double)*(size_t)rawdata.viewNumMultiplotSp[i]);
+  }
+}
+
+//check whether the session can be saved to a file by appending to it, ie. whether
+//it is the session file (see jf3.h), in version 4 format, and unchanged since it was last read or written
+//if so, the file's superblock and the number of spectra in its metadata section are returned in sb and numSp
+int canAppendToSessionFile(const char *filename, jf3_superblock *sb, unsigned int *numSp){
+  struct stat fileStat;
+  unsigned char version;
+  if(sessionfile.filename[0] == '\0'){
+    return 0;
+  }
+  if(stat(filename,&fileStat)!=0){
+    return 0;
+  }
+  if((fileStat.st_dev != sessionfile.dev)||(fileStat.st_ino != sessionfile.ino)){
+    return 0; //not the session file
+  }
+  if((fileStat.st_size != sessionfile.size)||(fileStat.st_mtim.tv_sec != sessionfile.mtime.tv_sec)||(fileStat.st_mtim.tv_nsec != sessionfile.mtime.tv_nsec)){
+    return 0; //changed outside of jf3
+  }
+  int fd = open(filename,O_RDONLY);
+  if(fd < 0){
+    return 0;
+  }
+  int success = 0;
+  if((pread(fd,&version,sizeof(unsigned char),0) == (ssize_t)sizeof(unsigned char))&&(version == 4)){
+    if(pread(fd,sb,sizeof(jf3_superblock),1) == (ssize_t)sizeof(jf3_superblock)){
+      if(pread(fd,numSp,sizeof(unsigned int),(off_t)sb->metaOffset) == (ssize_t)sizeof(unsigned int)){
+        success = 1;
+      }
     }
   }
+  close(fd);
+  return success;
+}
 
-  float lastBin = 0.;
-  float currentBin;
-  float val;
-  signed char packetCounter;
-  for(i=0;i<rawdata.numSpOpened;i++){
-    if(i<NSPECT){
+//take a snapshot of the session, to be written as a .jf3 file (format version 4),
+//all values are in native byte order
+//the file starts with the file format version number (unsigned char), followed by a
+//jf3_superblock (see jf3.h) giving the positions of the metadata section (see encodeJF3Metadata)
+//and of the spectrum directory: number of spectra (uint32) and a jf3_dir_entry for each spectrum,
+//giving the location, length, and codec of each spectrum's data, so that spectra can be found
+//without reading the others
+//spectrum data is stored as one block per spectrum, encoded as described in spectrum_codec.c,
+//and may be anywhere in the file after the superblock
+//(version 2 and 3 files can still be read, see read_data.c)
+//spectra which are already encoded in .jf3 files are copied from there without being decoded,
+//and if the session can be appended to the file (see canAppendToSessionFile), spectra which
+//are already in the file are left in place
+//returns 0 on success, 1 on failure
+int snapshotJF3(save_job *job, const char *filename)
+{
+  int i;
+  jf3_superblock sb;
+  unsigned int fileNumSp = 0;
+
+  memset(job,0,sizeof(save_job));
+  strncpy(job->filename,filename,sizeof(job->filename)-1);
+  job->numSp = rawdata.numSpOpened;
+  job->metaGeneration = rawdata.metaGeneration;
+  job->storeGeneration = spstore.generation;
+  job->type = 0;
+  if(canAppendToSessionFile(filename,&sb,&fileNumSp)){
+    job->type = 2;
+    job->appendOffset = (long long unsigned int)sessionfile.size;
+  }
 
-      //printf("Writing spectrum %i\n",i);
+  job->sp = calloc((size_t)(job->numSp > 0 ? job->numSp : 1),sizeof(save_sp));
+  unsigned char *buf = malloc(getMaxEncodedSpectrumLength(S32K,1));
+  if((job->sp == NULL)||(buf == NULL)){
+    printf("ERROR: Cannot allocate memory to write file: %s\n", filename);
+    free(buf);
+    return 1;
+  }
 
-      //scan for end of spectrum
-      int lastCh = 0;
-      for(j=S32K-1;j>=0;j--){
-        if(inpHist[i][j]!=0){
-          lastCh=j;
-          break;
+  //get the data for each spectrum
+  long long unsigned int keptBytes = 0; //amount of spectrum data which is left in place in the file
+  for(i=0;i<job->numSp;i++){
+    save_sp *out = &job->sp[i];
+    const sp_store_entry *sp = peekSpStoreEntry(i);
+    if((sp != NULL)&&(sp->srcFile != NULL)&&(sp->srcType == 2)&&(sp->srcCodec >= 1)&&(sp->srcCodec <= 3)){
+      //data is already encoded in a .jf3 file
+      out->dir.numCh = (unsigned int)sp->length;
+      out->dir.codec = sp->srcCodec;
+      out->dir.encLength = sp->srcLength;
+      if((job->type == 2)&&(strcmp(sp->srcFile,sessionfile.filename)==0)){
+        out->source = 2; //leave in place
+        out->dir.offset = (long long unsigned int)sp->srcOffset;
+        keptBytes += sp->srcLength;
+      }else{
+        out->source = 1; //copy
+        out->srcOffset = (long long unsigned int)sp->srcOffset;
+        out->srcFile = strdup(sp->srcFile);
+        if(out->srcFile == NULL){
+          free(buf);
+          return 1;
         }
       }
-
-      //encode spectrum
-      packetCounter = 1;
-      for(j=0;j<S32K;j++){
-        
-        //get bin values
-        currentBin = (float)inpHist[i][j];
-        if(j>0)
-          lastBin = (float)inpHist[i][j-1];
-        else
-          lastBin = (float)inpHist[i][j];
-        
-        //printf("bin: %i cuurent val: %f last val: %f packetCounter: %i\n",j,currentBin,lastBin,packetCounter);
-
-        if(j>=lastCh){
-          //end of spectrum reached
-          if(packetCounter > 0){
-            //write last packet
-            fwrite(&packetCounter,sizeof(signed char),1,out);
-            //printf("wrote packet counter %i\n",packetCounter);
-            val = (float)inpHist[i][j-1];
-            fwrite(&val,sizeof(float),1,out);
-          }else{
-            //write last packet
-            fwrite(&packetCounter,sizeof(signed char),1,out);
-            //printf("wrote packet counter %i\n",packetCounter);
-            for(k=0;k<(packetCounter*-1);k++){
-              val = (float)inpHist[i][j+packetCounter+k];
-              fwrite(&val,sizeof(float),1,out);
-            }
-          }
-          //write final packet
-          packetCounter = 0;
-          fwrite(&packetCounter,sizeof(signed char),1,out);
-          //printf("wrote packet counter %i\n",packetCounter);
-          val = (float)inpHist[i][j];
-          fwrite(&val,sizeof(float),1,out);
-          break;
-        }else if(packetCounter > 126){
-          //write last packet
-          fwrite(&packetCounter,sizeof(signed char),1,out);
-          val = (float)inpHist[i][j-1];
-          fwrite(&val,sizeof(float),1,out);
-          //start new packet
-          packetCounter = 1;
-        }else if (packetCounter < -126){
-          //write last packet
-          fwrite(&packetCounter,sizeof(signed char),1,out);
-          //printf("wrote packet counter %i\n",packetCounter);
-          for(k=0;k<(packetCounter*-1);k++){
-            val = (float)inpHist[i][j+packetCounter+k];
-            fwrite(&val,sizeof(float),1,out);
-          }
-          //start new packet
-          packetCounter = 1;
-        }else if((currentBin == lastBin)&&(packetCounter>0)){
-          //continue packet
-          if(j>0) //remember we start off with a value of 1
-            packetCounter++;
-        }else if((currentBin != lastBin)&&(packetCounter>1)){
-          //write last packet
-          fwrite(&packetCounter,sizeof(signed char),1,out);
-          //printf("wrote packet counter %i\n",packetCounter);
-          val = (float)inpHist[i][j-1];
-          fwrite(&val,sizeof(float),1,out);
-          //start new packet
-          packetCounter = 1;
-        }else if((currentBin != lastBin)&&(packetCounter==1)){
-          //change packet type
-          packetCounter = -2;
-        }else if((currentBin == lastBin)&&(packetCounter<0)){
-          //write last packet
-          fwrite(&packetCounter,sizeof(signed char),1,out);
-          //printf("wrote packet counter %i\n",packetCounter);
-          for(k=0;k<(packetCounter*-1);k++){
-            val = (float)inpHist[i][j+packetCounter+k];
-            fwrite(&val,sizeof(float),1,out);
+      continue;
+    }
+    //encode the data
+    int numCh = getSpectrumUsedLength(i);
+    const double *data = getSpectrumData(i);
+    if(data == NULL){
+      numCh = 0;
+    }
+    out->source = 0;
+    out->srcOffset = (long long unsigned int)job->spData.length;
+    out->dir.numCh = (unsigned int)numCh;
+    out->dir.codec = getSpectrumCodec(data,numCh); //see spectrum_codec.c
+    size_t encLength = encodeSpectrum(data,numCh,out->dir.codec,buf);
+    out->dir.encLength = (unsigned int)encLength;
+    appendByteBuffer(&job->spData,buf,encLength);
+  }
+  free(buf);
+
+  if(job->type == 2){
+    long long unsigned int unusedBytes = job->appendOffset - keptBytes;
+    if((unusedBytes > JF3_COMPACT_MIN_BYTES)&&(unusedBytes > keptBytes)){
+      //most of the file is unused, rewrite it (copying the spectra which would have been left in place)
+      job->type = 0;
+      for(i=0;i<job->numSp;i++){
+        if(job->sp[i].source == 2){
+          job->sp[i].source = 1;
+          job->sp[i].srcOffset = job->sp[i].dir.offset;
+          job->sp[i].srcFile = strdup(sessionfile.filename);
+          if(job->sp[i].srcFile == NULL){
+            return 1;
           }
-          //start new packet
-          packetCounter = 1;
-        }else if((currentBin != lastBin)&&(packetCounter<0)){
-          //continue packet
-          packetCounter--;
         }
       }
+    }
+  }
+
+  //get the metadata, unless the metadata already in the file is up to date
+  if((job->type == 2)&&(sessionfile.metaGeneration == rawdata.metaGeneration)&&(fileNumSp == (unsigned int)job->numSp)){
+    job->metaOffset = sb.metaOffset;
+  }else{
+    encodeJF3Metadata(&job->header);
+  }
+
+  if(job->header.err || job->spData.err){
+    printf("ERROR: Cannot allocate memory to write file: %s\n", filename);
+    return 1;
+  }
+  return 0;
+}
+
+//write len bytes to a file descriptor, retrying on partial writes
+//returns 1 on success, 0 on failure
+int writeAllBytes(const int fd, const unsigned char *bytes, size_t len){
+  while(len > 0){
+    ssize_t numWritten = write(fd,bytes,len);
+    if(numWritten < 0){
+      if(errno == EINTR){
+        continue;
+      }
+      return 0;
+    }
+    bytes += numWritten;
+    len -= (size_t)numWritten;
+  }
+  return 1;
+}
 
+//write out the data built up in a chunk, once it is large enough (or if force is set)
+//chunkPos is the position in the file of the start of the chunk, and is advanced past the data written
+//returns 1 on success, 0 on failure
+int flushSaveChunk(const int fd, byte_buffer *chunk, long long unsigned int *chunkPos, const int force){
+  if(chunk->err){
+    return 0;
+  }
+  if((chunk->length < SAVE_CHUNK_BYTES)&&(!force)){
+    return 1;
+  }
+  if(writeAllBytes(fd,chunk->data,chunk->length)==0){
+    return 0;
+  }
+  *chunkPos += chunk->length;
+  chunk->length = 0;
+  return 1;
+}
+
+//write the spectra, metadata, and directory of a .jf3 snapshot, starting at the current
+//position of fd (pos), filling in the positions of the spectra and the superblock
+//returns 1 on success, 0 on failure
+int writeJF3Sections(const int fd, save_job *job, long long unsigned int pos, jf3_superblock *sb){
+  int i;
+  int success = 1;
+  int srcFd = -1;
+  const char *srcFdFile = NULL;
+  byte_buffer chunk;
+  memset(&chunk,0,sizeof(byte_buffer));
+  unsigned char *copyBuf = malloc(getMaxEncodedSpectrumLength(S32K,1));
+  if(copyBuf == NULL){
+    return 0;
+  }
+
+  //spectra
+  for(i=0;(i<job->numSp)&&success;i++){
+    save_sp *sp = &job->sp[i];
+    if(sp->source == 2){
+      continue; //already in the file
+    }
+    sp->dir.offset = pos + chunk.length;
+    if(sp->source == 0){
+      appendByteBuffer(&chunk,&job->spData.data[sp->srcOffset],sp->dir.encLength);
+    }else{
+      if((srcFdFile == NULL)||(strcmp(srcFdFile,sp->srcFile)!=0)){
+        if(srcFd >= 0){
+          close(srcFd);
+        }
+        srcFdFile = sp->srcFile;
+        srcFd = open(sp->srcFile,O_RDONLY);
+      }
+      if((srcFd < 0)||(sp->dir.encLength > getMaxEncodedSpectrumLength(S32K,1))||(pread(srcFd,copyBuf,sp->dir.encLength,(off_t)sp->srcOffset) != (ssize_t)sp->dir.encLength)){
+        printf("ERROR: Cannot copy spectrum data from file: %s\n", sp->srcFile);
+        success = 0;
+        break;
+      }
+      appendByteBuffer(&chunk,copyBuf,sp->dir.encLength);
     }
+    success = flushSaveChunk(fd,&chunk,&pos,0);
+  }
+  if(srcFd >= 0){
+    close(srcFd);
+  }
+  free(copyBuf);
+
+  //metadata
+  if(job->header.length > 0){
+    sb->metaOffset = pos + chunk.length;
+    appendByteBuffer(&chunk,job->header.data,job->header.length);
+  }else{
+    sb->metaOffset = job->metaOffset;
+  }
 
+  //directory
+  sb->dirOffset = pos + chunk.length;
+  unsigned int uintBuf = (unsigned int)job->numSp;
+  appendByteBuffer(&chunk,&uintBuf,sizeof(unsigned int));
+  for(i=0;i<job->numSp;i++){
+    appendByteBuffer(&chunk,&job->sp[i].dir,sizeof(jf3_dir_entry));
+  }
+
+  success = success && flushSaveChunk(fd,&chunk,&pos,1);
+  freeByteBuffer(&chunk);
+  return success;
+}
+
+//write the values of a .txt snapshot as columns of text, in chunks
+//returns 1 on success, 0 on failure
+int writeTXTValues(const int fd, const save_job *job){
+  int i,j;
+  byte_buffer chunk;
+  memset(&chunk,0,sizeof(byte_buffer));
+  long long unsigned int pos = 0;
+  int success = 1;
+  for(j=0;(j<job->numRows)&&success;j++){
+    for(i=0;i<job->numSp;i++){
+      if(job->spaceAfterVals){
+        appendByteBufferf(&chunk,"%f ",job->vals[(size_t)i*(size_t)job->numRows + (size_t)j]);
+      }else{
+        appendByteBufferf(&chunk,"%f",job->vals[(size_t)i*(size_t)job->numRows + (size_t)j]);
+      }
+    }
+    appendByteBuffer(&chunk,"\n",1);
+    success = flushSaveChunk(fd,&chunk,&pos,(j == job->numRows-1));
   }
+  freeByteBuffer(&chunk);
+  return success;
+}
 
-  fclose(out);
-  printf("Wrote data to file: %s\n",filename);
+//write a snapshot taken by snapshotJF3 or snapshotTXT to its file (or to a temporary
+//file, which replaces it in finishSaveJob), filling in the positions of spectra written,
+//doesn't access any global data, so may be called from a worker thread
+//returns 0 on success, 1 if the file can't be written
+int writeSaveJob(save_job *job){
+  char tmpFilename[264];
+  int fd;
+  int success = 1;
+  getSaveTmpFilename(job,tmpFilename,sizeof(tmpFilename));
+  if(job->type == 2){
+    fd = open(job->filename,O_WRONLY);
+  }else{
+    fd = open(tmpFilename,O_WRONLY|O_CREAT|O_TRUNC,0666);
+  }
+  if(fd < 0){
+    printf("ERROR: Cannot open the output file: %s\n", (job->type == 2) ? job->filename : tmpFilename);
+    printf("The file may not be accesible.\n");
+    return 1;
+  }
+  if(job->type == 1){
+    //.txt columns
+    success = writeAllBytes(fd,job->header.data,job->header.length);
+    success = success && writeTXTValues(fd,job);
+    success = success && writeAllBytes(fd,job->trailer.data,job->trailer.length);
+  }else{
+    jf3_superblock sb;
+    if(job->type == 0){
+      //new file, starting with the version number and a superblock which is filled in at the end
+      unsigned char header[1+sizeof(jf3_superblock)];
+      memset(header,0,sizeof(header));
+      header[0] = 4; //file format version number
+      success = writeAllBytes(fd,header,sizeof(header));
+      success = success && writeJF3Sections(fd,job,sizeof(header),&sb);
+    }else{
+      //append to the existing file, the new sections are only used once they are safely
+      //written and the superblock is updated
+      success = (lseek(fd,(off_t)job->appendOffset,SEEK_SET) == (off_t)job->appendOffset);
+      success = success && writeJF3Sections(fd,job,job->appendOffset,&sb);
+      success = success && (fsync(fd)==0);
+    }
+    success = success && (pwrite(fd,&sb,sizeof(jf3_superblock),1) == (ssize_t)sizeof(jf3_superblock));
+    if((!success)&&(job->type == 2)){
+      if(ftruncate(fd,(off_t)job->appendOffset)!=0){ //drop anything partially appended
+        printf("WARNING: cannot remove partially written data from file: %s\n", job->filename);
+      }
+    }
+  }
+  if(fsync(fd)!=0){
+    success = 0;
+  }
+  if(close(fd)!=0){
+    success = 0;
+  }
+  if(!success){
+    printf("ERROR: Cannot write to the output file: %s\n", job->filename);
+    if(job->type != 2){
+      unlink(tmpFilename);
+    }
+    return 1;
+  }
+  return 0;
+}
+
+//set the .jf3 file which the session can be saved to incrementally (see canAppendToSessionFile),
+//metaGeneration is the value of rawdata.metaGeneration matching the metadata in the file
+//returns 1 on success, 0 if the file can't be found (in which case there is no session file)
+int setSessionFile(const char *filename, const unsigned int metaGeneration){
+  struct stat fileStat;
+  if(stat(filename,&fileStat)!=0){
+    sessionfile.filename[0] = '\0';
+    return 0;
+  }
+  strncpy(sessionfile.filename,filename,sizeof(sessionfile.filename)-1);
+  sessionfile.filename[sizeof(sessionfile.filename)-1] = '\0';
+  sessionfile.dev = fileStat.st_dev;
+  sessionfile.ino = fileStat.st_ino;
+  sessionfile.size = fileStat.st_size;
+  sessionfile.mtime = fileStat.st_mtim;
+  sessionfile.metaGeneration = metaGeneration;
+  return 1;
+}
+
+//after a .jf3 file has been written, make it the session file, and load spectra which
+//haven't changed since the snapshot was taken from it on demand (see spectrum_store.c),
+//so that they are left in place when the session is next saved, and can be unloaded when not used
+//files which may be followed for changes are left as they are, as their spectra can't
+//be loaded from them on demand (see watchFollowedFile)
+void updateSessionFile(const save_job *job){
+  int i;
+  if(findFollowedFile(job->filename) >= 0){
+    sessionfile.filename[0] = '\0'; //save the whole session next time
+    return;
+  }
+  if(setSessionFile(job->filename,job->metaGeneration)==0){
+    return;
+  }
+  if(spstore.generation != job->storeGeneration){
+    return; //spectra changed while the file was being written, they will be saved again next time
+  }
+  for(i=0;i<job->numSp;i++){
+    sp_store_entry *sp = peekSpStoreEntry(i);
+    if(sp == NULL){
+      continue;
+    }
+    if(job->sp[i].dir.numCh == 0){
+      //no data to load on demand, but the entry may still point into the
+      //file which has just been written (with a different layout)
+      if(sp->srcFile != NULL){
+        loadSpStoreEntry(sp); //see spectrum_store.c
+        detachSpStoreEntry(sp);
+      }
+      continue;
+    }
+    unsigned char loaded = sp->srcLoaded;
+    if(sp->srcFile == NULL){
+      trimSpStoreEntry(sp); //the data written only covers the channels used
+      loaded = 1;
+    }
+    if(sp->length != (int)job->sp[i].dir.numCh){
+      continue;
+    }
+    char *newSrcFile = strdup(job->filename);
+    if(newSrcFile == NULL){
+      continue;
+    }
+    free(sp->srcFile);
+    sp->srcFile = newSrcFile;
+    sp->srcOffset = (long)job->sp[i].dir.offset;
+    sp->srcType = 2;
+    sp->srcCodec = job->sp[i].dir.codec;
+    sp->srcLength = job->sp[i].dir.encLength;
+    sp->srcLoaded = loaded;
+  }
+}
+
+//finish saving a snapshot after writeSaveJob, must be called on the main thread
+//err is the result of writeSaveJob, and the final result is returned
+int finishSaveJob(save_job *job, int err){
+  if((err == 0)&&(job->type != 2)){
+    //replace the original file
+    char tmpFilename[264];
+    getSaveTmpFilename(job,tmpFilename,sizeof(tmpFilename));
+    if((job->type == 0)&&((spstore.generation != job->storeGeneration)||(findFollowedFile(job->filename) >= 0))){
+      //spectra won't be pointed at the new file (see updateSessionFile), so any
+      //which are loaded from the file being replaced need to be loaded now
+      detachSpStoreFile(job->filename); //see spectrum_store.c
+    }
+    if(rename(tmpFilename,job->filename)!=0){
+      printf("ERROR: Cannot write to the output file: %s\n", job->filename);
+      unlink(tmpFilename);
+      err = 1;
+    }
+  }
+  if(err == 0){
+    if(job->type != 1){
+      updateSessionFile(job);
+    }
+    refreshFollowedFile(job->filename); //see follow.c
+    printf("Wrote data to file: %s\n",job->filename);
+  }
+  return err;
+}
+
+//routine to write a .jf3 file (see snapshotJF3 for the format)
+//returns 0 on success, 1 if the file can't be written
+int writeJF3(const char *filename)
+{
+  save_job job;
+  int err = snapshotJF3(&job,filename);
+  if(err == 0){
+    err = finishSaveJob(&job,writeSaveJob(&job));
+  }
+  freeSaveJob(&job);
+  return err;
+}
+
+//worker thread writing the file for the active save job
+gpointer saveThread(gpointer data){
+  savestate.err = writeSaveJob(&savestate.job);
+  g_idle_add(savestate.doneFunc,NULL); //report back on the main thread
+  return NULL;
+}
+
+//start writing the snapshot in savestate.job on a worker thread,
+//doneFunc is called on the main thread once the file has been written,
+//which should then call endSaveThread
+void startSaveThread(GSourceFunc doneFunc){
+  savestate.active = 1;
+  savestate.doneFunc = doneFunc;
+  savestate.thread = g_thread_try_new("save_thread", saveThread, NULL, NULL);
+  if(savestate.thread == NULL){
+    //write the file on this thread instead
+    savestate.err = writeSaveJob(&savestate.job);
+    g_idle_add(savestate.doneFunc,NULL);
+  }
+}
+
+//start writing a .jf3 file on a worker thread, a snapshot of the data is taken immediately,
+//so the data may be changed while the file is being written
+//returns 0 if the save was started, 1 on failure
+int startSaveJF3(const char *filename, GSourceFunc doneFunc){
+  if(snapshotJF3(&savestate.job,filename)!=0){
+    freeSaveJob(&savestate.job);
+    return 1;
+  }
+  startSaveThread(doneFunc);
   return 0;
 }
 
+//finish writing a file on a worker thread, to be called from the
+//doneFunc passed to startSaveThread
+//returns the result of writing the file (see writeSaveJob)
+int endSaveThread(){
+  if(savestate.thread != NULL){
+    g_thread_join(savestate.thread);
+    savestate.thread = NULL;
+  }
+  int err = finishSaveJob(&savestate.job,savestate.err);
+  freeSaveJob(&savestate.job);
+  savestate.active = 0;
+  return err;
+}
+
 //routine to export a RadWare compatible file
 //exportMode: 0=write displayed spectrum, 1=write all imported spectra
 int exportSPE(const char *filePrefix, const int exportMode, const int rebin)
 {
-  int i,j;
+  int i;
   int spID;
-  float val;
+  float outHist[4096];
   FILE *out;
   char outFileName[256];
 
@@ -212,16 +639,11 @@ int exportSPE(const char *filePrefix, const int exportMode, const int rebin)
         
         //write histogram
         if(rebin){
-          for(j=0;j<(arraySize*drawing.contractFactor);j+=drawing.contractFactor){
-            val = getSpBinValRaw(i,j,drawing.scaleFactor[i],drawing.contractFactor);
-            fwrite(&val,sizeof(float),1,out);
-          }
+          getSpectrumBlockSums(i,outHist,arraySize,drawing.contractFactor,drawing.scaleFactor[i]);
         }else{
-          for(j=0;j<arraySize;j++){
-            val = getSpBinValRaw(i,j,1,1);
-            fwrite(&val,sizeof(float),1,out);
-          }
+          getSpectrumBlockSums(i,outHist,arraySize,1,1.);
         }
+        fwrite(outHist,sizeof(float),(size_t)arraySize,out);
         fwrite(&byteSize,sizeof(int32_t),1,out);
         fclose(out);
         printf("Wrote data to file: %s\n",outFileName);
@@ -257,16 +679,11 @@ int exportSPE(const char *filePrefix, const int exportMode, const int rebin)
 
       //write histogram
       if(rebin){
-        for(i=0;i<(arraySize*drawing.contractFactor);i+=drawing.contractFactor){
-          val = getSpBinValRaw(spID,i,drawing.scaleFactor[spID],drawing.contractFactor);
-          fwrite(&val,sizeof(float),1,out);
-        }
+        getSpectrumBlockSums(spID,outHist,arraySize,drawing.contractFactor,drawing.scaleFactor[spID]);
       }else{
-        for(i=0;i<arraySize;i++){
-          val = getSpBinValRaw(spID,i,1,1);
-          fwrite(&val,sizeof(float),1,out);
-        }
+        getSpectrumBlockSums(spID,outHist,arraySize,1,1.);
       }
+      fwrite(outHist,sizeof(float),(size_t)arraySize,out);
       fwrite(&byteSize,sizeof(int32_t),1,out);
       fclose(out);
       printf("Wrote data to file: %s\n",outFileName);
@@ -276,24 +693,18 @@ int exportSPE(const char *filePrefix, const int exportMode, const int rebin)
   return 0;
 }
 
-//routine to export a plaintext file
-//exportMode: 0=write displayed spectrum, 1=write all imported spectra
-int exportTXT(const char *filePrefix, const int exportMode, const int rebin)
+//take a snapshot of spectrum data, to be written as a plaintext file
+//exportMode: 0=write all imported spectra, otherwise write spectrum exportMode-1
+//returns 0 on success, 1 on failure, 2 if the spectrum to write is invalid
+int snapshotTXT(save_job *job, const char *filePrefix, const int exportMode, const int rebin)
 {
   int i,j;
   int spID;
   int maxArraySize;
-  float val;
-  FILE *out;
-  char outFileName[256];
 
-  snprintf(outFileName,256,"%s.txt",filePrefix);
-  if((out = fopen(outFileName, "w")) == NULL) //open the file
-  {
-    printf("ERROR: Cannot open the output file: %s\n", outFileName);
-    printf("The file may not be accesible.\n");
-    return 1;
-  }
+  memset(job,0,sizeof(save_job));
+  snprintf(job->filename,sizeof(job->filename),"%s.txt",filePrefix);
+  job->type = 1;
   
   switch (exportMode)
   {
@@ -302,52 +713,50 @@ int exportTXT(const char *filePrefix, const int exportMode, const int rebin)
 
       //write header
       for(i=0;i<rawdata.numSpOpened;i++){
-        fprintf(out,"SPECTRUM%i ",i+1);
+        appendByteBufferf(&job->header,"SPECTRUM%i ",i+1);
       }
-      fprintf(out,"\n");
+      appendByteBufferf(&job->header,"\n");
 
       //get max array size
-      maxArraySize = S32K;
-      for(j=S32K-1;j>=0;j--){
-        for(i=0;i<rawdata.numSpOpened;i++){
-          if(rawdata.hist[i][j] != 0.){
-            maxArraySize = j+1;
-            break;
-          }
-        }
-        if(maxArraySize < S32K){
-          break;
+      maxArraySize = 0;
+      for(i=0;i<rawdata.numSpOpened;i++){
+        if(getSpectrumUsedLength(i) > maxArraySize){
+          maxArraySize = getSpectrumUsedLength(i);
         }
       }
       
       //write histogram (not applying rebin or scale factors since the whole session with custom views is saved)
-      for(j=0;j<maxArraySize;j++){
-        for(i=0;i<rawdata.numSpOpened;i++){
-          val = getSpBinValRaw(i,j,drawing.scaleFactor[i],1);
-          fprintf(out,"%f ",val);
+      job->numSp = rawdata.numSpOpened;
+      job->numRows = maxArraySize;
+      job->spaceAfterVals = 1;
+      job->vals = malloc((size_t)job->numSp*(size_t)job->numRows*sizeof(float) + 1);
+      if(job->vals == NULL){
+        printf("ERROR: Cannot allocate memory for export.\n");
+        return 1;
+      }
+      for(i=0;i<rawdata.numSpOpened;i++){
+        for(j=0;j<maxArraySize;j++){
+          job->vals[(size_t)i*(size_t)maxArraySize + (size_t)j] = getSpBinValRaw(i,j,drawing.scaleFactor[i],1);
         }
-        fprintf(out,"\n");
       }
 
       //write histogram titles
       for(i=0;i<rawdata.numSpOpened;i++){
-        fprintf(out,"TITLE %i %s\n",i+1,rawdata.histComment[i]);
+        appendByteBufferf(&job->trailer,"TITLE %i %s\n",i+1,rawdata.histComment[i]);
       }
 
       //write views
       for(i=0;i<rawdata.numViews;i++){
-        fprintf(out,"VIEW %s\nVIEWPAR %u %i\n",rawdata.viewComment[i],rawdata.viewMultiplotMode[i],rawdata.viewNumMultiplotSp[i]);
-        fprintf(out,"VIEWSP ");
+        appendByteBufferf(&job->trailer,"VIEW %s\nVIEWPAR %u %i\n",rawdata.viewComment[i],rawdata.viewMultiplotMode[i],rawdata.viewNumMultiplotSp[i]);
+        appendByteBufferf(&job->trailer,"VIEWSP ");
         for(j=0;j<rawdata.viewNumMultiplotSp[i];j++){
-          fprintf(out," %u", rawdata.viewMultiPlots[i][j]);
+          appendByteBufferf(&job->trailer," %i", getSpIndexFromHandle(rawdata.viewMultiPlots[i][j]));
         }
-        fprintf(out,"\nVIEWSCALE ");
+        appendByteBufferf(&job->trailer,"\nVIEWSCALE ");
         for(j=0;j<rawdata.viewNumMultiplotSp[i];j++){
-          if(rawdata.viewMultiPlots[i][j]<NSPECT){
-            fprintf(out," %0.3f", rawdata.viewScaleFactor[i][rawdata.viewMultiPlots[i][j]]);
-          }
+          appendByteBufferf(&job->trailer," %0.3f", rawdata.viewScaleFactor[i][j]);
         }
-        fprintf(out,"\n");
+        appendByteBufferf(&job->trailer,"\n");
       }
 
       break;
@@ -361,48 +770,84 @@ int exportTXT(const char *filePrefix, const int exportMode, const int rebin)
       }
 
       //write header
-      fprintf(out,"SPECTRUM%i\n",exportMode);
+      appendByteBufferf(&job->header,"SPECTRUM%i\n",exportMode);
 
       //get array size
-      maxArraySize = S32K;
-      for(j=S32K-1;j>=0;j--){
-        if(rawdata.hist[spID][j] != 0.){
-          maxArraySize = j+1;
-          break;
-        }
-      }
+      maxArraySize = getSpectrumUsedLength(spID);
 
       //write histogram
+      job->numSp = 1;
       if(rebin){
-        for(j=0;j<maxArraySize;j+=drawing.contractFactor){
-          val = getSpBinValRaw(spID,j,drawing.scaleFactor[spID],drawing.contractFactor);
-          fprintf(out,"%f\n",val);
-        }
+        job->numRows = (maxArraySize + drawing.contractFactor - 1)/drawing.contractFactor;
+      }else{
+        job->numRows = maxArraySize;
+      }
+      job->vals = malloc((size_t)(job->numRows+1)*sizeof(float));
+      if(job->vals == NULL){
+        printf("ERROR: Cannot allocate memory for export.\n");
+        return 1;
+      }
+      if(rebin){
+        getSpectrumBlockSums(spID,job->vals,job->numRows,drawing.contractFactor,drawing.scaleFactor[spID]);
       }else{
         for(j=0;j<maxArraySize;j++){
-          val = getSpBinValRaw(spID,j,drawing.scaleFactor[spID],1);
-          fprintf(out,"%f\n",val);
+          job->vals[j] = getSpBinValRaw(spID,j,drawing.scaleFactor[spID],1);
         }
       }
 
       //write histogram title
-      fprintf(out,"TITLE 1 %s\n",rawdata.histComment[spID]);
+      appendByteBufferf(&job->trailer,"TITLE 1 %s\n",rawdata.histComment[spID]);
 
       break;
   }
 
   //write comments
-  for(i=0;i<rawdata.numChComments;i++){
-    fprintf(out,"COMMENT %i %i %i %f %s\n", rawdata.chanCommentView[i], rawdata.chanCommentSp[i], rawdata.chanCommentCh[i], rawdata.chanCommentVal[i], rawdata.chanComment[i]);
+  for(i=0;i<comstore.numUsed;i++){
+    const chan_comment *com = getComment(i);
+    if(com == NULL){
+      continue; //deleted comment
+    }
+    if(com->view == 1){
+      appendByteBufferf(&job->trailer,"COMMENT %i %i %i %f %s\n", com->view, com->sp, com->ch, com->val, com->text);
+    }else{
+      appendByteBufferf(&job->trailer,"COMMENT %i %i %i %f %s\n", com->view, getSpIndexFromHandle(com->sp), com->ch, com->val, com->text);
+    }
   }
 
   //write calibration parameters
-  fprintf(out,"CALPAR %f %f %f %i\n", calpar.calpar0, calpar.calpar1, calpar.calpar2, calpar.calMode);
-  fprintf(out,"CALXUNIT %s\n", calpar.calUnit);
-  fprintf(out,"CALYUNIT %s\n", calpar.calYUnit);
+  appendByteBufferf(&job->trailer,"CALPAR %f %f %f %i\n", calpar.calpar0, calpar.calpar1, calpar.calpar2, calpar.calMode);
+  appendByteBufferf(&job->trailer,"CALXUNIT %s\n", calpar.calUnit);
+  appendByteBufferf(&job->trailer,"CALYUNIT %s\n", calpar.calYUnit);
 
-  fclose(out);
-  printf("Wrote data to file: %s\n",outFileName);
+  if(job->header.err || job->trailer.err){
+    printf("ERROR: Cannot allocate memory for export.\n");
+    return 1;
+  }
+  return 0;
+}
 
+//routine to export a plaintext file
+//exportMode: 0=write all imported spectra, otherwise write spectrum exportMode-1
+//returns 0 on success, 1 if the file can't be written, 2 if the spectrum to write is invalid
+int exportTXT(const char *filePrefix, const int exportMode, const int rebin)
+{
+  save_job job;
+  int err = snapshotTXT(&job,filePrefix,exportMode,rebin);
+  if(err == 0){
+    err = finishSaveJob(&job,writeSaveJob(&job));
+  }
+  freeSaveJob(&job);
+  return err;
+}
+
+//start exporting a plaintext file on a worker thread (see exportTXT and startSaveJF3)
+//returns 0 if the export was started, otherwise the error from snapshotTXT
+int startExportTXT(const char *filePrefix, const int exportMode, const int rebin, GSourceFunc doneFunc){
+  int err = snapshotTXT(&savestate.job,filePrefix,exportMode,rebin);
+  if(err != 0){
+    freeSaveJob(&savestate.job);
+    return err;
+  }
+  startSaveThread(doneFunc);
   return 0;
 }